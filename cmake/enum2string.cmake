@@ -33,20 +33,16 @@
 #    NAMESPACE      <namespace to use>
 #    ENUMS          <list of enums to generate>
 #    BLACKLIST      <blacklist for enum constants>
-#    USE_CONSTEXPR  <whether to use constexpr or not (default: off)>
-#    USE_C_STRINGS  <whether to use c strings instead of std::string or not (default: off)>
+#
+# Generates constexpr perfect-hash lookup tables (CLASS_NAME<E>, fromStr<E>() and
+# FUNC_NAME(E)) for each enum; `cadidaq --enum-benchmark` compares them with the
+# boost::bimaps this generator used to emit.
 function( enum2str_generate )
-  set( options        USE_CONSTEXPR USE_C_STRINGS)
+  set( options )
   set( oneValueArgs   PATH CLASS_NAME FUNC_NAME NAMESPACE INDENT_STR )
   set( multiValueArgs INCLUDES ENUMS BLACKLIST )
   cmake_parse_arguments( OPTS "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN} )
 
-  if( OPTS_USE_C_STRINGS )
-    set( STRING_TYPE "const char *" )
-  else( OPTS_USE_C_STRINGS )
-    set( STRING_TYPE "std::string " )
-  endif( OPTS_USE_C_STRINGS )
-
   message( STATUS "Generating enum2str files" )
 
   if( "${OPTS_INDENT_STR}" STREQUAL "" )
@@ -210,41 +206,205 @@ function( enum2str_add )
     endif( LEN GREATER MAX_LENGTH )
   endforeach( I IN LISTS ENUMS_TO_USE )
 
+  file( APPEND "${TRANSL_FILE}" "template<typename Ch, typename Traits, typename Alloc>\n")
+  file( APPEND "${TRANSL_FILE}" "struct translator_between<std::basic_string< Ch, Traits, Alloc >, ${ARGV0}>\n")
+  file( APPEND "${TRANSL_FILE}" "{\n")
+  file( APPEND "${TRANSL_FILE}" "typedef caenEnumTranslator<${ARGV0}> type;\n")
+  file( APPEND "${TRANSL_FILE}" "};\n")
+
+  __enum2str_addConstexpr( "${ARGV0}" )
+endfunction( enum2str_add )
+
+
+# Emits the constexpr lookup tables for one enum (called from enum2str_add with
+# ENUMS_TO_USE, ENUM_NS and MAX_LENGTH in scope):
+#  - name -> value: a perfect hash over the case-folded names with their common
+#    root (e.g. "CAEN_DGTZ_TRGMODE_") removed; the seed of the hash is searched
+#    here at configure time, the hash must match ${OPTS_CLASS_NAME}_detail::hash()
+#  - value -> name: a constexpr function comparing against all constants, which
+#    the compiler folds into a jump/lookup table (the values of the constants are
+#    only known to the compiler)
+function( __enum2str_addConstexpr ENUM )
+  string( REGEX REPLACE "::" "_" ID "${ENUM}" )
+
+  # common root of all constants; keep at least one character of each name
+  list( GET ENUMS_TO_USE 0 ROOT )
+  foreach( I IN LISTS ENUMS_TO_USE )
+    __enum2str_commonPrefix( "${ROOT}" "${I}" ROOT )
+  endforeach( I IN LISTS ENUMS_TO_USE )
+  foreach( I IN LISTS ENUMS_TO_USE )
+    if( "${I}" STREQUAL "${ROOT}" )
+      # e.g. "CAEN_DGTZ_ON" next to "CAEN_DGTZ_ON_DELAYED": fall back to "CAEN_DGTZ_"
+      string( REGEX REPLACE "[^_]+_?$" "" ROOT "${ROOT}" )
+    endif( "${I}" STREQUAL "${ROOT}" )
+  endforeach( I IN LISTS ENUMS_TO_USE )
+  string( LENGTH "${ROOT}" ROOT_LENGTH )
 
-   # add a boost::bimap for bi-directional lookup
-  IF(NOT OPTS_USE_CONSTEXPR )
-    file( APPEND "${HPP_FILE}" "${IND}typedef boost::bimap< ${STRING_TYPE}, ${ARGV0} > bm_${ARGV0}_type;\n" )
-    file( APPEND "${HPP_FILE}" "${IND}bm_${ARGV0}_type bm_${ARGV0};\n" )
-    file( APPEND "${HPP_FILE}" "${IND}bm_${ARGV0}_type* getBimap(${ARGV0}){return &bm_${ARGV0};}\n" )
-
-    file( APPEND "${TRANSL_FILE}" "" )
-
-    file( APPEND "${TRANSL_FILE}" "template<typename Ch, typename Traits, typename Alloc>\n")
-    file( APPEND "${TRANSL_FILE}" "struct translator_between<std::basic_string< Ch, Traits, Alloc >, ${ARGV0}>\n")
-    file( APPEND "${TRANSL_FILE}" "{\n")
-    file( APPEND "${TRANSL_FILE}" "typedef caenEnumTranslator<${ARGV0}> type;\n")
-    file( APPEND "${TRANSL_FILE}" "};\n")
-
-
-    file( APPEND "${CPP_FILE}" "/*!\n * \\brief bimap of ${STRING_TYPE} and enum ${ARGV0}\n */\n" )
-
-    set(IS_FIRST TRUE)
-    foreach( I IN LISTS ENUMS_TO_USE )
-      set( PADDING )
-      string( LENGTH "${I}" LEN )
-      math( EXPR TO_PAD "${MAX_LENGTH} - ${LEN}" )
-      foreach( J RANGE ${TO_PAD} )
-        string( APPEND PADDING " " )
-      endforeach( J RANGE ${TO_PAD} )
-
-      file( APPEND "${CPP_FILE}" "${IND}bm_${ARGV0}.insert( bm_${ARGV0}_type::value_type(\"${I}\",${PADDING} ${ENUM_NS}${I})); \n" )
-    endforeach( I IN LISTS ENUMS_TO_USE )
-    file( APPEND "${CPP_FILE}" "\n\n" )
-   endif( NOT OPTS_USE_CONSTEXPR )
-
+  set( SUFFIXES )
+  foreach( I IN LISTS ENUMS_TO_USE )
+    string( SUBSTRING "${I}" ${ROOT_LENGTH} -1 SUFFIX )
+    string( TOLOWER "${SUFFIX}" SUFFIX )
+    list( APPEND SUFFIXES "${SUFFIX}" )
+  endforeach( I IN LISTS ENUMS_TO_USE )
 
+  __enum2str_perfectHash( "${ENUM}" "${SUFFIXES}" HASH_SEED NSLOTS SLOTS )
+  list( LENGTH ENUMS_TO_USE SIZE )
+  string( REPLACE ";" ", " SLOTS "${SLOTS}" )
+
+  # class specialization with the tables
+  file( APPEND "${HPP_FILE}" "/// lookup tables for ${ENUM} (root '${ROOT}', ${SIZE} constants in ${NSLOTS} slots)\n" )
+  file( APPEND "${HPP_FILE}" "template <> struct ${OPTS_CLASS_NAME}<${ENUM}> {\n" )
+  file( APPEND "${HPP_FILE}" "${IND}typedef ${ENUM} type;\n" )
+  file( APPEND "${HPP_FILE}" "${IND}static constexpr const char*   root       = \"${ROOT}\";\n" )
+  file( APPEND "${HPP_FILE}" "${IND}static constexpr std::size_t   rootLength = ${ROOT_LENGTH};\n" )
+  file( APPEND "${HPP_FILE}" "${IND}static constexpr std::size_t   size       = ${SIZE};\n" )
+  file( APPEND "${HPP_FILE}" "${IND}static constexpr std::uint32_t seed       = ${HASH_SEED};\n" )
+  file( APPEND "${HPP_FILE}" "${IND}static constexpr std::uint32_t nslots     = ${NSLOTS};\n" )
+  file( APPEND "${HPP_FILE}" "${IND}static constexpr std::int16_t  slots[]    = { ${SLOTS} };\n" )
+  file( APPEND "${HPP_FILE}" "${IND}static constexpr ${OPTS_CLASS_NAME}Entry<type> entries[] = {\n" )
+  foreach( I IN LISTS ENUMS_TO_USE )
+    set( PADDING )
+    string( LENGTH "${I}" LEN )
+    math( EXPR TO_PAD "${MAX_LENGTH} - ${LEN}" )
+    foreach( J RANGE ${TO_PAD} )
+      string( APPEND PADDING " " )
+    endforeach( J RANGE ${TO_PAD} )
+    file( APPEND "${HPP_FILE}" "${IND}${IND}{\"${I}\",${PADDING}${ENUM_NS}${I}},\n" )
+  endforeach( I IN LISTS ENUMS_TO_USE )
+  file( APPEND "${HPP_FILE}" "${IND}};\n" )
+  file( APPEND "${HPP_FILE}" "};\n\n" )
 
- endfunction( enum2str_add )
+  # value -> name
+  file( APPEND "${HPP_FILE}" "/// full name of the given ${ENUM} constant or nullptr if unknown\n" )
+  file( APPEND "${HPP_FILE}" "constexpr const char* ${OPTS_FUNC_NAME}(${ENUM} value){\n" )
+  file( APPEND "${HPP_FILE}" "${IND}return\n" )
+  foreach( I IN LISTS ENUMS_TO_USE )
+    set( PADDING )
+    string( LENGTH "${I}" LEN )
+    math( EXPR TO_PAD "${MAX_LENGTH} - ${LEN}" )
+    foreach( J RANGE ${TO_PAD} )
+      string( APPEND PADDING " " )
+    endforeach( J RANGE ${TO_PAD} )
+    file( APPEND "${HPP_FILE}" "${IND}${IND}value == ${ENUM_NS}${I}${PADDING}? \"${I}\" :\n" )
+  endforeach( I IN LISTS ENUMS_TO_USE )
+  file( APPEND "${HPP_FILE}" "${IND}${IND}nullptr;\n}\n\n" )
+
+  # out-of-class definitions of the static members (required for odr-use in C++11)
+  set( SPEC "${OPTS_CLASS_NAME}<${ENUM}>" )
+  file( APPEND "${CPP_FILE}" "constexpr const char*   ${SPEC}::root;\n" )
+  file( APPEND "${CPP_FILE}" "constexpr std::size_t   ${SPEC}::rootLength;\n" )
+  file( APPEND "${CPP_FILE}" "constexpr std::size_t   ${SPEC}::size;\n" )
+  file( APPEND "${CPP_FILE}" "constexpr std::uint32_t ${SPEC}::seed;\n" )
+  file( APPEND "${CPP_FILE}" "constexpr std::uint32_t ${SPEC}::nslots;\n" )
+  file( APPEND "${CPP_FILE}" "constexpr std::int16_t  ${SPEC}::slots[];\n" )
+  file( APPEND "${CPP_FILE}" "constexpr ${OPTS_CLASS_NAME}Entry<${ENUM}> ${SPEC}::entries[];\n\n" )
+endfunction( __enum2str_addConstexpr )
+
+
+# longest common prefix of A and B
+function( __enum2str_commonPrefix A B OUT )
+  string( LENGTH "${A}" LEN )
+  string( LENGTH "${B}" LEN_B )
+  if( LEN_B LESS LEN )
+    set( LEN ${LEN_B} )
+  endif( LEN_B LESS LEN )
+  set( I 0 )
+  while( I LESS LEN )
+    string( SUBSTRING "${A}" ${I} 1 CHAR_A )
+    string( SUBSTRING "${B}" ${I} 1 CHAR_B )
+    if( NOT "${CHAR_A}" STREQUAL "${CHAR_B}" )
+      break()
+    endif( NOT "${CHAR_A}" STREQUAL "${CHAR_B}" )
+    math( EXPR I "${I} + 1" )
+  endwhile( I LESS LEN )
+  string( SUBSTRING "${A}" 0 ${I} PREFIX )
+  set( ${OUT} "${PREFIX}" PARENT_SCOPE )
+endfunction( __enum2str_commonPrefix )
+
+
+# ASCII code of a (lower case) character allowed in identifiers
+function( __enum2str_ord CHAR OUT )
+  string( FIND "0123456789_abcdefghijklmnopqrstuvwxyz" "${CHAR}" IDX )
+  if( IDX LESS 0 )
+    message( FATAL_ERROR "enum2str_generate: unexpected character '${CHAR}' in enum constant" )
+  elseif( IDX LESS 10 )
+    math( EXPR CODE "48 + ${IDX}" )
+  elseif( IDX EQUAL 10 )
+    set( CODE 95 )
+  else()
+    math( EXPR CODE "97 + ${IDX} - 11" )
+  endif()
+  set( ${OUT} ${CODE} PARENT_SCOPE )
+endfunction( __enum2str_ord )
+
+
+# Searches a seed for which
+#   hash(s) = (s[0]*seed^(len-1) + ... + s[len-1]) mod 2147483647 mod nslots
+# is collision-free over the given lower case names, preferring small tables
+# (nslots = N, 2N, 4N, 8N). Returns the parameters and the slot table (index
+# into the list of names, -1 for empty slots).
+function( __enum2str_perfectHash ENUM NAMES OUT_SEED OUT_NSLOTS OUT_SLOTS )
+  list( LENGTH NAMES N )
+  math( EXPR LAST "${N} - 1" )
+
+  # character codes of each name
+  set( K 0 )
+  foreach( S IN LISTS NAMES )
+    set( CODES_${K} )
+    string( LENGTH "${S}" L )
+    math( EXPR L "${L} - 1" )
+    foreach( IDX RANGE ${L} )
+      string( SUBSTRING "${S}" ${IDX} 1 CHAR )
+      __enum2str_ord( "${CHAR}" CODE )
+      list( APPEND CODES_${K} ${CODE} )
+    endforeach( IDX RANGE ${L} )
+    math( EXPR K "${K} + 1" )
+  endforeach( S IN LISTS NAMES )
+
+  foreach( FACTOR 1 2 4 8 )
+    math( EXPR M "${N} * ${FACTOR}" )
+    foreach( SEED RANGE 31 286 )
+      if( NOT DEFINED HASHES_${SEED} )
+        # full hash values for this seed (computed once and reused for all table sizes)
+        set( HASHES_${SEED} )
+        foreach( K RANGE ${LAST} )
+          set( X 0 )
+          foreach( CODE IN LISTS CODES_${K} )
+            set( X "(${X} * ${SEED} + ${CODE}) % 2147483647" )
+          endforeach( CODE IN LISTS CODES_${K} )
+          math( EXPR X "${X}" )
+          list( APPEND HASHES_${SEED} ${X} )
+        endforeach( K RANGE ${LAST} )
+      endif( NOT DEFINED HASHES_${SEED} )
+
+      set( HASHES )
+      set( PERFECT TRUE )
+      foreach( X IN LISTS HASHES_${SEED} )
+        math( EXPR H "${X} % ${M}" )
+        if( H IN_LIST HASHES )
+          set( PERFECT FALSE )
+          break()
+        endif( H IN_LIST HASHES )
+        list( APPEND HASHES ${H} )
+      endforeach( X IN LISTS HASHES_${SEED} )
+
+      if( PERFECT )
+        set( SLOTS )
+        math( EXPR LAST_SLOT "${M} - 1" )
+        foreach( SLOT RANGE ${LAST_SLOT} )
+          list( FIND HASHES ${SLOT} IDX )
+          list( APPEND SLOTS ${IDX} )
+        endforeach( SLOT RANGE ${LAST_SLOT} )
+        set( ${OUT_SEED}   ${SEED}    PARENT_SCOPE )
+        set( ${OUT_NSLOTS} ${M}       PARENT_SCOPE )
+        set( ${OUT_SLOTS}  "${SLOTS}" PARENT_SCOPE )
+        return()
+      endif( PERFECT )
+    endforeach( SEED RANGE 31 286 )
+  endforeach( FACTOR 1 2 4 8 )
+
+  message( FATAL_ERROR "enum2str_generate: no perfect hash found for '${ENUM}' (add the offending constants to BLACKLIST)" )
+endfunction( __enum2str_perfectHash )
 
 
 function( enum2str_init )
@@ -255,30 +415,55 @@ function( enum2str_init )
   file( APPEND "${HPP_FILE}" "  * \\warning This is an automatically generated file!\n" )
   file( APPEND "${HPP_FILE}" "  */\n\n" )
   file( APPEND "${HPP_FILE}" "#pragma once\n\n// clang-format off\n\n" )
-  file( APPEND "${HPP_FILE}" "#include <string>\n" )
-  file( APPEND "${HPP_FILE}" "#include <boost/bimap.hpp>\n" )
+  file( APPEND "${HPP_FILE}" "#include <cstddef>\n" )
+  file( APPEND "${HPP_FILE}" "#include <cstdint>\n" )
 
   foreach( I IN LISTS OPTS_INCLUDES )
     file( APPEND "${HPP_FILE}" "#include <${I}>\n" )
   endforeach( I IN LISTS OPTS_INCLUDES )
 
   file( APPEND "${HPP_FILE}" "\nnamespace ${OPTS_NAMESPACE} {\n\n" )
-  file( APPEND "${HPP_FILE}" "class ${OPTS_CLASS_NAME} {\n" )
-  file( APPEND "${HPP_FILE}" " public:\n" )
-  file( APPEND "${HPP_FILE}" " ${OPTS_CLASS_NAME}();\n" )
-
-  if( NOT OPTS_USE_CONSTEXPR )
-    file( WRITE  "${CPP_FILE}" "/*!\n" )
-    file( APPEND "${CPP_FILE}" "  * \\file ${OPTS_CLASS_NAME}.cpp\n" )
-    file( APPEND "${CPP_FILE}" "  * \\warning This is an automatically generated file!\n" )
-    file( APPEND "${CPP_FILE}" "  */\n\n" )
-    file( APPEND "${CPP_FILE}" "#pragma clang diagnostic push\n" )
-    file( APPEND "${CPP_FILE}" "#pragma clang diagnostic ignored \"-Wcovered-switch-default\"\n\n" )
-    file( APPEND "${CPP_FILE}" "#include \"${OPTS_CLASS_NAME}.hpp\"\n\n// clang-format off\n\n" )
-    file( APPEND "${CPP_FILE}" "namespace ${OPTS_NAMESPACE} {\n\n" )
-    file( APPEND "${CPP_FILE}" "${OPTS_CLASS_NAME}::${OPTS_CLASS_NAME}(){\n" )
-
-  endif( NOT OPTS_USE_CONSTEXPR )
+  set( C "${OPTS_CLASS_NAME}" )
+  file( APPEND "${HPP_FILE}" "/// entry of a lookup table: full name and value of an enum constant\n" )
+  file( APPEND "${HPP_FILE}" "template <typename E> struct ${C}Entry {\n" )
+  file( APPEND "${HPP_FILE}" "${IND}const char* name;\n" )
+  file( APPEND "${HPP_FILE}" "${IND}E           value;\n" )
+  file( APPEND "${HPP_FILE}" "};\n\n" )
+  file( APPEND "${HPP_FILE}" "/// lookup tables for enum E, specialized below for each generated enum\n" )
+  file( APPEND "${HPP_FILE}" "template <typename E> struct ${C};\n\n" )
+  file( APPEND "${HPP_FILE}" "namespace ${C}_detail {\n" )
+  file( APPEND "${HPP_FILE}" "${IND}constexpr char fold(char c){ return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; }\n" )
+  file( APPEND "${HPP_FILE}" "${IND}/// case-insensitive comparison of two zero-terminated strings\n" )
+  file( APPEND "${HPP_FILE}" "${IND}constexpr bool iequals(const char* a, const char* b){ return fold(*a) != fold(*b) ? false : (*a == '\\0' ? true : iequals(a + 1, b + 1)); }\n" )
+  file( APPEND "${HPP_FILE}" "${IND}constexpr std::size_t length(const char* s){ return *s == '\\0' ? 0 : 1 + length(s + 1); }\n" )
+  file( APPEND "${HPP_FILE}" "${IND}/// case-insensitive polynomial hash of the name without its root; the seed is chosen by the generator\n" )
+  file( APPEND "${HPP_FILE}" "${IND}constexpr std::uint64_t hashStep(const char* s, std::size_t len, std::uint64_t seed, std::uint64_t x){\n" )
+  file( APPEND "${HPP_FILE}" "${IND}${IND}return len == 0 ? x : hashStep(s + 1, len - 1, seed, (x * seed + static_cast<unsigned char>(fold(*s))) % 2147483647);\n" )
+  file( APPEND "${HPP_FILE}" "${IND}}\n" )
+  file( APPEND "${HPP_FILE}" "${IND}constexpr std::uint32_t hash(const char* s, std::size_t len, std::uint32_t seed, std::uint32_t nslots){\n" )
+  file( APPEND "${HPP_FILE}" "${IND}${IND}return static_cast<std::uint32_t>(hashStep(s, len, seed, 0) % nslots);\n" )
+  file( APPEND "${HPP_FILE}" "${IND}}\n" )
+  file( APPEND "${HPP_FILE}" "${IND}template <typename E> constexpr const ${C}Entry<E>* match(const char* s, std::int16_t slot){\n" )
+  file( APPEND "${HPP_FILE}" "${IND}${IND}return slot < 0 ? nullptr : (iequals(${C}<E>::entries[slot].name + ${C}<E>::rootLength, s) ? &${C}<E>::entries[slot] : nullptr);\n" )
+  file( APPEND "${HPP_FILE}" "${IND}}\n" )
+  file( APPEND "${HPP_FILE}" "}\n\n" )
+  file( APPEND "${HPP_FILE}" "/** looks up the constant of enum E by its name without the common root, ignoring case\n" )
+  file( APPEND "${HPP_FILE}" "    (s must be zero-terminated after len characters); returns nullptr if unknown */\n" )
+  file( APPEND "${HPP_FILE}" "template <typename E> constexpr const ${C}Entry<E>* fromStr(const char* s, std::size_t len){\n" )
+  file( APPEND "${HPP_FILE}" "${IND}return ${C}_detail::match<E>(s, ${C}<E>::slots[${C}_detail::hash(s, len, ${C}<E>::seed, ${C}<E>::nslots)]);\n" )
+  file( APPEND "${HPP_FILE}" "}\n" )
+  file( APPEND "${HPP_FILE}" "template <typename E> constexpr const ${C}Entry<E>* fromStr(const char* s){\n" )
+  file( APPEND "${HPP_FILE}" "${IND}return fromStr<E>(s, ${C}_detail::length(s));\n" )
+  file( APPEND "${HPP_FILE}" "}\n\n" )
+
+  file( WRITE  "${CPP_FILE}" "/*!\n" )
+  file( APPEND "${CPP_FILE}" "  * \\file ${OPTS_CLASS_NAME}.cpp\n" )
+  file( APPEND "${CPP_FILE}" "  * \\warning This is an automatically generated file!\n" )
+  file( APPEND "${CPP_FILE}" "  */\n\n" )
+  file( APPEND "${CPP_FILE}" "#pragma clang diagnostic push\n" )
+  file( APPEND "${CPP_FILE}" "#pragma clang diagnostic ignored \"-Wcovered-switch-default\"\n\n" )
+  file( APPEND "${CPP_FILE}" "#include \"${OPTS_CLASS_NAME}.hpp\"\n\n// clang-format off\n\n" )
+  file( APPEND "${CPP_FILE}" "namespace ${OPTS_NAMESPACE} {\n\n" )
 
   file( WRITE  "${TRANSL_FILE}" "/*!\n" )
   file( APPEND "${TRANSL_FILE}" "  * \\file ${OPTS_CLASS_NAME}Translator.hpp\n" )
@@ -304,10 +489,8 @@ function( enum2str_end )
 
   file( APPEND "${TRANSL_FILE}" "}\n}\n")
 
-  file( APPEND "${HPP_FILE}" "};\n\n}\n\n// clang-format on\n" )
-  if( NOT OPTS_USE_CONSTEXPR )
-    file( APPEND "${CPP_FILE}" "\n}\n}\n" )
-    file( APPEND "${CPP_FILE}" "// clang-format on\n\n#pragma clang diagnostic pop\n" )
-  endif( NOT OPTS_USE_CONSTEXPR )
+  file( APPEND "${HPP_FILE}" "}\n\n// clang-format on\n" )
+  file( APPEND "${CPP_FILE}" "}\n" )
+  file( APPEND "${CPP_FILE}" "// clang-format on\n\n#pragma clang diagnostic pop\n" )
 
 endfunction( enum2str_end )
@@ -0,0 +1,38 @@
+// affinity.hpp
+#ifndef CADIDAQ_AFFINITY_H
+#define CADIDAQ_AFFINITY_H
+
+#include <string>
+#include <vector>
+
+namespace cadidaq {
+
+  /** CPU and NUMA placement of threads and their memory (Linux).
+      A set of CPUs is given as a list of CPUs and ranges (e.g. "0-3, 8") or of NUMA nodes prefixed
+      with 'node' (e.g. "node1"), meaning all CPUs of those nodes. Memory is placed by first touch:
+      pages are allocated on the node of the CPU that writes them first, so buffers pre-faulted by a
+      thread pinned to a node are local to that node without any NUMA library.
+  */
+  namespace affinity {
+    typedef std::vector<int> cpuList;
+
+    /// parses a CPU set; throws std::invalid_argument if it is malformed or names CPUs or nodes not present
+    cpuList     parse(const std::string& spec);
+    /// restricts the calling thread to the given CPUs (nothing to do for an empty list); returns false if that failed
+    bool        pin(const cpuList& cpus);
+    /// the CPUs the calling thread may run on
+    cpuList     current();
+    /// number of NUMA nodes (1 on systems without NUMA)
+    int         nodes();
+    /// the CPUs of a NUMA node (empty if there is no such node)
+    cpuList     cpusOf(int node);
+    /// the NUMA node of a CPU (0 if unknown)
+    int         nodeOf(int cpu);
+    /// renders a list of CPUs compactly together with their NUMA node(s), e.g. "2-3 (node 0)"
+    std::string describe(const cpuList& cpus);
+    /// the NUMA nodes holding the pages of the mapping starting at 'address' as listed in /proc/self/numa_maps, e.g. "N0=512" (empty if unknown)
+    std::string memoryNodes(const void* address);
+  }
+}
+
+#endif
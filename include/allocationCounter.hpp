@@ -0,0 +1,21 @@
+// allocationCounter.hpp
+#ifndef CADIDAQ_ALLOCATIONCOUNTER_H
+#define CADIDAQ_ALLOCATIONCOUNTER_H
+
+#include <cstdint>
+
+namespace cadidaq {
+
+  /** Heap allocation accounting, used to verify that the readout loop does not allocate in steady state.
+      Only active when built with -DCOUNT_ALLOCATIONS=ON, which replaces the global operator new/delete
+      by versions counting the allocations of each thread; otherwise nothing is counted.
+  */
+  namespace allocations {
+    /// tests whether allocations are being counted (i.e. the accounting build is used)
+    bool     counting();
+    /// number of allocations made by the calling thread so far
+    uint64_t thisThread();
+  }
+}
+
+#endif
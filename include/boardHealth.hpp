@@ -0,0 +1,80 @@
+// boardHealth.hpp
+#ifndef CADIDAQ_BOARDHEALTH_H
+#define CADIDAQ_BOARDHEALTH_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>  // memcpy
+
+namespace cadidaq {
+
+  /** /struct boardHealth
+      The health registers of a digitizer as last read (see digitizer::readHealth and healthPoller).
+  */
+  struct boardHealth {
+    static const uint32_t maxChannels = 16;
+
+    uint64_t time;                      ///< of the latest register read (latencyMetrics::now()), 0 before the first
+    uint32_t acquisitionStatus;         ///< register 0x8104
+    uint32_t failureStatus;             ///< register 0x8178 (x725, x730)
+    uint8_t  temperature[maxChannels];  ///< ADC temperature of each channel in degrees Celsius (x725, x730)
+    uint32_t channels;                  ///< number of temperatures read
+
+    bool     running() const {return acquisitionStatus & (1u << 2);}
+    /// the event memory is full: triggers are lost until it is read out
+    bool     memoryFull() const {return acquisitionStatus & (1u << 4);}
+    /// the PLL has not lost its lock to the (internal or external) reference clock
+    bool     pllLocked() const {return acquisitionStatus & (1u << 7);}
+    bool     temperatureFailure() const {return failureStatus & (1u << 5);}
+    bool     adcPowerDown() const {return failureStatus & (1u << 6);}
+    uint32_t maxTemperature() const {
+      uint32_t t = 0;
+      for (uint32_t c = 0; c < channels && c < maxChannels; c++)
+        t = temperature[c] > t ? temperature[c] : t;
+      return t;
+    }
+  };
+
+  /** /class healthSnapshot
+      The latest boardHealth of a board, published by the thread polling it and read by any other thread without
+      locks: a sequence lock whose writer never waits and whose readers retry while it is being updated.
+  */
+  class healthSnapshot {
+  public:
+    healthSnapshot() : sequence(0) {
+      for (auto& w : data)
+        w.store(0, std::memory_order_relaxed);
+    }
+    /// replaces the snapshot (by a single thread)
+    void publish(const boardHealth& health){
+      uint64_t words[size] = {};
+      std::memcpy(words, &health, sizeof(health));
+      uint32_t s = sequence.load(std::memory_order_relaxed);
+      sequence.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (uint32_t i = 0; i < size; i++)
+        data[i].store(words[i], std::memory_order_relaxed);
+      sequence.store(s + 2, std::memory_order_release);
+    }
+    boardHealth read() const {
+      uint64_t words[size];
+      uint32_t before, after;
+      do {
+        before = sequence.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < size; i++)
+          words[i] = data[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence.load(std::memory_order_relaxed);
+      } while ((before & 1) || before != after);
+      boardHealth health;
+      std::memcpy(&health, words, sizeof(health));
+      return health;
+    }
+  private:
+    static const uint32_t size = (sizeof(boardHealth) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::atomic<uint64_t> data[size];
+    std::atomic<uint32_t> sequence;  ///< odd while being updated
+  };
+}
+
+#endif
@@ -0,0 +1,70 @@
+// bufferPool.hpp
+#ifndef CADIDAQ_BUFFERPOOL_H
+#define CADIDAQ_BUFFERPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+#include <caen.hpp>
+
+namespace cadidaq {
+
+  /** /class bufferPool
+      Readout buffers allocated once when the boards are configured and reused for all runs.
+      A buffer is acquired by handle before reading out a board, handed on to the processing
+      stages and released by the last of them. The memory is backed by huge pages where available,
+      pre-faulted and locked so that the readout causes neither allocations nor page faults.
+  */
+  class bufferPool {
+  public:
+    typedef uint32_t handle;
+    static const handle none = UINT32_MAX;
+
+    /// allocates 'count' buffers of (at least) 'bufferSize' bytes each; throws std::runtime_error if the memory cannot be mapped
+    bufferPool(uint32_t bufferSize, uint32_t count);
+    ~bufferPool();
+    bufferPool(const bufferPool&) = delete;
+    bufferPool& operator=(const bufferPool&) = delete;
+
+    /// hands out a free buffer (with no data) or 'none' if all buffers are in use; never blocks on I/O or allocates
+    handle               acquire();
+    /// as acquire(), but waits up to 'timeout' for a buffer to be released if all are in use
+    handle               acquire(std::chrono::microseconds timeout);
+    void                 release(handle h);
+    caen::ReadoutBuffer& get(handle h){return buffers[h];}
+
+    uint32_t getBufferSize() const {return bufferSize;}
+    uint32_t getCount() const {return buffers.size();}
+    /// number of buffers currently acquired and not yet released
+    uint32_t getInUse() const {return inUse.load(std::memory_order_relaxed);}
+    size_t   getMappedSize() const {return mappedSize;}
+    /// start of the memory mapping holding all buffers
+    const void* getMemory() const {return memory;}
+    bool     usesHugePages() const {return hugePages;}
+    bool     isLocked() const {return locked;}
+    /// number of times a buffer has been handed out (each one a reuse of memory allocated at configure time)
+    uint64_t getAcquired() const {return acquired;}
+  private:
+    uint32_t             bufferSize;
+    char*                memory;
+    size_t               mappedSize;
+    bool                 hugePages;
+    bool                 locked;
+    std::vector<caen::ReadoutBuffer> buffers;
+    std::vector<handle>  freeList;
+    std::mutex           mutex;
+    std::condition_variable released;
+    uint64_t             acquired;
+    std::atomic<uint32_t> inUse;
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+  };
+}
+
+#endif
@@ -19,25 +19,24 @@ struct caenEnumTranslator
 {
   typedef std::string internal_type;
   typedef T           external_type;
+  typedef cadidaq::CaenEnum2str<T> table; // constexpr lookup tables for this CAEN enum type
 
     // Converts a (hex)string to int
   boost::optional<external_type> get_value(const internal_type& str){
         if (!str.empty()){
           external_type value;
-          // get a converter for this CAEN enum type
-          cadidaq::CaenEnum2str enumConverter;
-          auto* map = enumConverter.getBimap(value);
-          // add the leading part of the CAEN enum ("CAEN_DGTZ_"...)
-          std::string searchstr = findEnumRoot(*map) + str;
-
-          // case-insensitive search for string in bimap matching search string
-          typedef typename boost::bimap< std::string, external_type >::left_const_iterator const_iterator;
-          for( const_iterator i = map->left.begin(), iend = map->left.end(); i != iend; ++i ){
-            if(boost::iequals(boost::algorithm::to_lower_copy(i->first), searchstr)){
-              return boost::optional<external_type>(i->second);
-            }
+          const char* name = str.c_str();
+          size_t length = str.size();
+          // the leading part of the CAEN enum ("CAEN_DGTZ_"...) is optional
+          if (length > table::rootLength && boost::istarts_with(str, table::root)){
+            name += table::rootLength;
+            length -= table::rootLength;
           }
-          // could not find value in bimap, could be integer value instead
+          // case-insensitive perfect-hash lookup of the name
+          auto* entry = cadidaq::fromStr<external_type>(name, length);
+          if (entry)
+            return boost::optional<external_type>(entry->value);
+          // could not find value in table, could be integer value instead
           try{
             value = static_cast<external_type>( boost::lexical_cast<int>(str) );
           }
@@ -54,21 +53,12 @@ struct caenEnumTranslator
 
   // Converts a CAEN enum to string
   boost::optional<internal_type> put_value(const external_type& value){
-    // get a converter for this CAEN enum type
-    cadidaq::CaenEnum2str enumConverter;
-    auto* map = enumConverter.getBimap(value);
-    std::string str;
-    // find the string corresponding to the setting's enum value in the bimap
-    try{
-      str = map->right.at(value);
-      // remove the first part originating from CAEN's enum naming convention ("CAEN_DGTZ_".....)
-      str.erase(0,findEnumRoot(*map).length());
-    }
-    catch (std::out_of_range & e){
-      // return just the integer should the conversion have failed
+    const char* name = cadidaq::toStr(value);
+    // return just the integer should the conversion have failed
+    if (!name)
       return boost::optional<internal_type>(std::to_string(value));
-    }
-    return boost::optional<internal_type>(str);
+    // remove the first part originating from CAEN's enum naming convention ("CAEN_DGTZ_".....)
+    return boost::optional<internal_type>(std::string(name + table::rootLength));
   }
 };
 
@@ -0,0 +1,104 @@
+// channelScan.hpp
+#ifndef CADIDAQ_CHANNELSCAN_H
+#define CADIDAQ_CHANNELSCAN_H
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <cstdint>
+
+#include <digitizer.hpp>
+#include <event.hpp>
+#include <dppEvents.hpp>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+namespace cadidaq {
+
+  /** /struct channelMeasurement
+      What a short acquisition found on a channel.
+  */
+  struct channelMeasurement {
+    uint64_t events = 0;           ///< records of the channel (DPP firmware: its events)
+    uint64_t crossings = 0;        ///< records whose samples cross the channel's trigger threshold (DPP firmware: its events)
+    uint64_t baselineSamples = 0;  ///< samples at the start of the records (standard firmware)
+    double   baselineSum = 0;
+    double   baselineSquares = 0;
+
+    double   baseline() const {return baselineSamples ? baselineSum / baselineSamples : 0;}
+    double   baselineRMS() const;
+  };
+
+  /** /class channelScan
+      Short acquisitions on all boards at once, for commissioning: steps the channels' trigger thresholds and DC
+      offsets through a grid, measuring the rates and baselines at each point. The boards stay configured between
+      points and only the values that change are written. Boards read out by the same thread (i.e. sharing a link)
+      are started together and read in turn by one thread, the threads of the links run in parallel, so that a point
+      takes about as long as its acquisition time whatever the number of boards.
+      The baseline of a channel is taken from the first samples of its records (before the trigger, for the usual
+      post-trigger settings) of the standard firmware of the x720, x724, x725, x730, x740, x742 and x751; the rates are those of
+      the records of each channel and of the records crossing its trigger threshold (standard firmware) or of the
+      channel's events (DPP firmware of the x725 and x730).
+      The DC offsets can also be calibrated so that the baselines land at a target level, see calibrateBaselines.
+  */
+  class channelScan {
+  public:
+    explicit channelScan(const std::vector<digitizer*>& boards);
+    ~channelScan();
+    channelScan(const channelScan&) = delete;
+    channelScan& operator=(const channelScan&) = delete;
+
+    /// runs f(i) for each board i: the boards of a readout thread one after the other, the threads in parallel
+    void forEachBoard(const std::function<void(size_t)>& f);
+    /// acquires on all boards for 'time', sending a software trigger to each board every 'triggerInterval' (0: none)
+    void measure(std::chrono::milliseconds time, std::chrono::microseconds triggerInterval = std::chrono::microseconds(0));
+    /// measurements of board 'i' in the latest acquisition, one per channel
+    const std::vector<channelMeasurement>& getResult(size_t i) const {return boards[i].result;}
+    /// time board 'i' acquired for in the latest acquisition in seconds
+    double           getSeconds(size_t i) const {return boards[i].seconds;}
+    /** measures for 'time' at each point of the grid of trigger thresholds and DC offsets (applied to all channels;
+        an empty list keeps the setting as configured) and writes a line per board, point and channel to 'table'.
+        returns false, scanning nothing, if thresholds are given and a board runs DPP firmware (whose thresholds
+        digitizer::reprogram does not program) */
+    bool scan(const std::vector<uint32_t>& thresholds, const std::vector<uint32_t>& dcOffsets, std::chrono::milliseconds time, std::ostream& table);
+    /** calibrates the DC offsets so that the baselines of all channels (or the mean baselines of the groups of channels
+        sharing a DC offset, on the x740 and x742) come within 'tolerance' ADC counts of 'target' (in ADC counts, or as
+        a fraction of the ADC range if at most 1): all boards are measured at once with software triggers for 'time'
+        per iteration, and each offset follows the secant through its last two measurements, bisecting the range the
+        target is known to lie in where the secant leaves it. The offsets found (for those not converging, the one
+        measured closest to the target) are written to 'ini' (a section per board, .ini format, one value per group).
+        Boards whose baselines are not decoded are skipped. */
+    void calibrateBaselines(double target, double tolerance, std::chrono::milliseconds time, std::ostream& ini);
+  private:
+    struct board {
+      digitizer*                      dg;
+      caen::ReadoutBuffer             buffer;
+      samplePacking                   packing;
+      dppFormat                       format;
+      std::vector<bool>               falling;     ///< channels triggering on the falling edge
+      channelValues<uint32_t>         thresholds;  ///< as programmed during the acquisition
+      std::vector<channelMeasurement> result;
+      double                          seconds;
+      // triggers as programmed, restored after the calibration
+      CAEN_DGTZ_TriggerMode_t         swTrigger;
+      CAEN_DGTZ_TriggerMode_t         externalTrigger;
+      std::vector<CAEN_DGTZ_TriggerMode_t> selfTrigger;
+    };
+    /// acquires on the boards of a readout thread
+    void acquire(const std::vector<size_t>& group, std::chrono::milliseconds time, std::chrono::microseconds triggerInterval);
+    /// adds the 'bytes' read into the board's buffer to its measurements
+    void accumulate(board& b, uint32_t bytes);
+    /// programs 'value' for all channels of each board; returns the number of writes
+    uint32_t reprogramAll(channelSetting setting, uint32_t value);
+    /// disables all triggers of the board but the software trigger, or restores them; returns false on errors
+    bool     triggerBySoftware(board& b, bool only);
+
+    std::vector<board>               boards;
+    std::vector<std::vector<size_t>> groups;  ///< boards read out by the same thread
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+  };
+}
+
+#endif
@@ -0,0 +1,188 @@
+// channelValues.hpp
+#ifndef CADIDAQ_CHANNELVALUES_H
+#define CADIDAQ_CHANNELVALUES_H
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <boost/optional.hpp>
+
+namespace cadidaq {
+
+  /// maximum number of channels of a digitizer (x740 boards have 64)
+  const unsigned maxChannels = 64;
+
+  /** /class channelBits
+      Bookkeeping shared by the channelValues containers: the number of channels and
+      one bit per channel recording whether the channel's value is defined.
+      Range arguments (start, stop) select the channels start <= ch < stop.
+  */
+  class channelBits {
+  public:
+    static const unsigned all = std::numeric_limits<unsigned>::max();
+
+    explicit channelBits(unsigned nchannels) : nchannels(nchannels), defined(0) {
+      if (nchannels > maxChannels)
+        throw std::invalid_argument("Cannot handle " + std::to_string(nchannels) + " channels, at most " + std::to_string(maxChannels) + " are supported");
+    }
+    unsigned size() const {return nchannels;}
+    bool     isSet(unsigned ch) const {return ch < nchannels && (defined >> ch & 1);}
+    /// bit mask of the channels in the range (limited to the existing channels)
+    uint64_t rangeMask(unsigned start = 0, unsigned stop = all) const {
+      if (stop > nchannels) stop = nchannels;
+      if (start >= stop) return 0;
+      uint64_t width = stop - start;
+      return (width == 64 ? ~uint64_t(0) : ((uint64_t(1) << width) - 1)) << start;
+    }
+    /// bit mask of the channels with defined values
+    uint64_t setMask(unsigned start = 0, unsigned stop = all) const {return defined & rangeMask(start, stop);}
+    unsigned countSet(unsigned start = 0, unsigned stop = all) const {return __builtin_popcountll(setMask(start, stop));}
+    bool     allSet(unsigned start = 0, unsigned stop = all) const {return setMask(start, stop) == rangeMask(start, stop);}
+    bool     noneSet(unsigned start = 0, unsigned stop = all) const {return setMask(start, stop) == 0;}
+    /// first channel with a defined value in the range or size() if there is none
+    unsigned firstSet(unsigned start = 0, unsigned stop = all) const {
+      uint64_t m = setMask(start, stop);
+      return m ? __builtin_ctzll(m) : nchannels;
+    }
+    void     unset(unsigned ch){if (ch < nchannels) defined &= ~(uint64_t(1) << ch);}
+  protected:
+    void     markSet(unsigned ch){defined |= uint64_t(1) << ch;}
+    void     markRange(uint64_t range, bool set){defined = set ? (defined | range) : (defined & ~range);}
+
+    unsigned nchannels;
+    uint64_t defined;
+  };
+
+  /** /class channelValues
+      Fixed-capacity container of optional per-channel setting values (e.g. a threshold for each channel).
+      Replaces std::vector<boost::optional<T>>: whether a value is defined is kept as a bit mask
+      so that counting and comparing channels and channel ranges needs no walk over the elements.
+  */
+  template <typename T>
+  class channelValues : public channelBits {
+  public:
+    explicit channelValues(unsigned nchannels = 0) : channelBits(nchannels), values() {}
+
+    boost::optional<T> get(unsigned ch) const {
+      return isSet(ch) ? boost::optional<T>(values[ch]) : boost::optional<T>(boost::none);
+    }
+    /// sets the channel's value, or unsets it when given boost::none; channels out of range are ignored
+    void set(unsigned ch, const boost::optional<T>& value){
+      if (ch >= nchannels) return;
+      if (!value){unset(ch); return;}
+      values[ch] = *value;
+      markSet(ch);
+    }
+    /// sets (or unsets) all channels in the range
+    void fill(const boost::optional<T>& value, unsigned start = 0, unsigned stop = all){
+      uint64_t range = rangeMask(start, stop);
+      if (value)
+        for (uint64_t m = range; m; m &= m - 1)
+          values[__builtin_ctzll(m)] = *value;
+      markRange(range, static_cast<bool>(value));
+    }
+    /// value of the first channel with a defined value in the range or boost::none
+    boost::optional<T> firstValue(unsigned start = 0, unsigned stop = all) const {
+      return get(firstSet(start, stop));
+    }
+    /// tests if all defined values in the range are identical (true as well if none is defined)
+    bool allSame(unsigned start = 0, unsigned stop = all) const {
+      uint64_t m = setMask(start, stop);
+      if (!m) return true;
+      const T& first = values[__builtin_ctzll(m)];
+      for (m &= m - 1; m; m &= m - 1)
+        if (!(values[__builtin_ctzll(m)] == first))
+          return false;
+      return true;
+    }
+  private:
+    T values[maxChannels];
+  };
+
+  /** /class channelValues<bool>
+      Channel set: the values are kept as a second bit mask next to the mask of defined channels,
+      so that all operations including the conversion from/to the digitizer's channel and group
+      masks are done on whole words.
+  */
+  template <>
+  class channelValues<bool> : public channelBits {
+  public:
+    explicit channelValues(unsigned nchannels = 0) : channelBits(nchannels), bits(0) {}
+
+    boost::optional<bool> get(unsigned ch) const {
+      return isSet(ch) ? boost::optional<bool>((bits >> ch & 1) != 0) : boost::optional<bool>(boost::none);
+    }
+    void set(unsigned ch, const boost::optional<bool>& value){
+      if (ch >= nchannels) return;
+      if (!value){unset(ch); return;}
+      uint64_t bit = uint64_t(1) << ch;
+      bits = *value ? (bits | bit) : (bits & ~bit);
+      markSet(ch);
+    }
+    void fill(const boost::optional<bool>& value, unsigned start = 0, unsigned stop = all){
+      uint64_t range = rangeMask(start, stop);
+      if (value)
+        bits = *value ? (bits | range) : (bits & ~range);
+      markRange(range, static_cast<bool>(value));
+    }
+    boost::optional<bool> firstValue(unsigned start = 0, unsigned stop = all) const {
+      return get(firstSet(start, stop));
+    }
+    bool allSame(unsigned start = 0, unsigned stop = all) const {
+      uint64_t m = setMask(start, stop);
+      return (bits & m) == 0 || (bits & m) == m;
+    }
+    /// bit mask of the channels set to 'true' (undefined channels count as 'false')
+    uint64_t trueMask(unsigned start = 0, unsigned stop = all) const {return bits & setMask(start, stop);}
+    unsigned countTrue(unsigned start = 0, unsigned stop = all) const {return __builtin_popcountll(trueMask(start, stop));}
+
+    /** folds the channels into a mask with one bit per group of 'perGroup' (a power of two) channels,
+        the group's bit being set if any of its channels is 'true' */
+    uint64_t groupMask(unsigned perGroup) const {
+      uint64_t m = trueMask();
+      if (perGroup <= 1) return m;
+      // OR all bits of a group down into its lowest bit, then gather these bits
+      for (unsigned shift = 1; shift < perGroup; shift <<= 1)
+        m |= m >> shift;
+      uint64_t mask = 0;
+      for (unsigned g = 0; g * perGroup < nchannels; g++)
+        mask |= (m >> (g * perGroup) & 1) << g;
+      return mask;
+    }
+    /// sets all channels from a mask with one bit per group of 'perGroup' channels, or unsets all if the mask is undefined
+    void fromGroupMask(boost::optional<uint64_t> mask, unsigned perGroup = 1){
+      if (!mask){
+        markRange(rangeMask(), false);
+        return;
+      }
+      if (perGroup <= 1){
+        bits = *mask & rangeMask();
+      } else {
+        uint64_t block = perGroup >= 64 ? ~uint64_t(0) : (uint64_t(1) << perGroup) - 1;
+        bits = 0;
+        for (uint64_t m = *mask; m; m &= m - 1){
+          unsigned g = __builtin_ctzll(m);
+          if (g * perGroup >= nchannels) break;
+          bits |= block << (g * perGroup);
+        }
+        bits &= rangeMask();
+      }
+      markRange(rangeMask(), true);
+    }
+    /// tests if the channels set to 'true' can be expressed exactly by a group mask, i.e. all channels of a group agree
+    bool groupsConsistent(unsigned perGroup) const {
+      channelValues<bool> expanded(nchannels);
+      expanded.fromGroupMask(groupMask(perGroup), perGroup);
+      return expanded.trueMask() == trueMask();
+    }
+  private:
+    uint64_t bits;
+  };
+
+  /// set of channels, e.g. the enabled channels of a board
+  typedef channelValues<bool> channelSet;
+}
+
+#endif
@@ -0,0 +1,116 @@
+// dataFileLayout.hpp
+// layout of the data files written by cadidaq (see fileWriter), shared by the writer and readers
+#ifndef CADIDAQ_DATAFILELAYOUT_H
+#define CADIDAQ_DATAFILELAYOUT_H
+
+#include <cstdint>
+
+namespace cadidaq {
+  namespace dataFileLayout {
+
+    const uint32_t magic        = 0xCAD1F11E;
+    const uint32_t trailerMagic = 0xCAD11DE7;
+    const uint32_t version      = 3;
+    const uint32_t maxBoards    = 64;
+    const uint32_t nameLength   = 32;
+
+    /** /struct fileHeader
+        At the beginning of each file, followed by 'configurationSize' bytes of the configuration read back from
+        the boards (in .ini format, one section per board) padded to 8 bytes, then by the records and, in a file
+        that was closed properly, by the index of the records and the fileTrailer.
+    */
+    struct fileHeader {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t fileNumber;         ///< position of the file among the files of the run, from 0
+      uint32_t nboards;
+      uint64_t runStart;           ///< wall-clock time the run started, in nanoseconds since the epoch
+      uint64_t fileStart;          ///< wall-clock time the file was opened, in nanoseconds since the epoch
+      uint32_t configurationSize;
+      uint32_t reserved;
+      char     boardNames[maxBoards][nameLength];
+      uint8_t  dppFormats[maxBoards]; ///< list-mode format of each board's DPP firmware (dppFormat), to decode replayed data
+    };
+
+    /// type of a record
+    enum recordType : uint16_t {
+      EVENTS     = 1, ///< raw events of a readout buffer, as read from the board
+      DPP_EVENTS = 2  ///< decoded DPP list-mode events (dppEventBatch)
+    };
+
+    /// flags of a record
+    enum recordFlags : uint32_t { NONE = 0, FEATURES_ONLY = 1, PRESCALED = 2 };
+
+    /** /struct recordHeader
+        Header of each record, followed by 'payloadSize' bytes:
+         - EVENTS:     the events kept by the overflow prescaler (every 'prescale'th one counted from 'firstEvent'),
+                       with only their header words (and the event size patched accordingly) if FEATURES_ONLY
+         - DPP_EVENTS: the columns of the event batch one after the other: timestamp (uint64_t), channel, energy,
+                       chargeShort and flags (uint16_t), 'nevents' values each
+        The time stamps are in the boards' clock ticks: the trigger time tags (31 bits) of the raw events, extended by
+        counting their roll-overs per board, or the DPP events' extended time stamps.
+        Records are aligned to 8 bytes.
+    */
+    struct recordHeader {
+      uint32_t size;               ///< total size of the record in bytes including this header and alignment
+      uint16_t board;              ///< index of the board in fileHeader::boardNames
+      uint16_t type;
+      uint64_t sequence;           ///< number of the readout buffer among the board's buffers
+      uint64_t firstEvent;         ///< index of the buffer's first event (DPP: aggregate) among the board's events
+      uint32_t nevents;            ///< events in the payload
+      uint32_t prescale;
+      uint32_t flags;
+      uint32_t payloadSize;
+      uint64_t minTimestamp;       ///< earliest time stamp of the events in the payload
+      uint64_t maxTimestamp;       ///< latest time stamp of the events in the payload
+      uint64_t writeTime;          ///< nanoseconds from the start of the run until the record was written (the pace of the run when replaying it)
+    };
+
+    /** /struct indexEntry
+        Entry of the index at the end of a file, one per record in file order.
+    */
+    struct indexEntry {
+      uint64_t offset;             ///< position of the record from the beginning of the file
+      uint64_t minTimestamp;
+      uint64_t maxTimestamp;
+      uint64_t firstEvent;
+      uint32_t nevents;
+      uint16_t board;
+      uint16_t type;
+    };
+
+    /** /struct fileTrailer
+        The last bytes of a file closed properly, following the 'entries' index entries starting at 'indexOffset'.
+    */
+    struct fileTrailer {
+      uint32_t magic;              ///< trailerMagic
+      uint32_t entries;
+      uint64_t indexOffset;
+    };
+
+    /// bits of the trigger time tag of the raw events before it rolls over
+    const uint32_t timeTagBits = 31;
+
+    /// extends the time tag of the next event of a board, given the extended time stamp of its previous one
+    inline uint64_t extendTimeTag(uint64_t previous, uint32_t triggerTimeTag){
+      const uint64_t mask = (static_cast<uint64_t>(1) << timeTagBits) - 1;
+      uint64_t tag = triggerTimeTag & mask;
+      uint64_t extended = (previous & ~mask) | tag;
+      // rolled over since the previous event
+      return tag < (previous & mask) ? extended + mask + 1 : extended;
+    }
+
+    /// rounds up a size to the alignment of records in the file
+    inline uint64_t align(uint64_t size){
+      return (size + 7) & ~static_cast<uint64_t>(7);
+    }
+
+    /// whether a record header found at 'pos' of a file of 'size' bytes is consistent (when walking the records of a file without index)
+    inline bool validRecord(const recordHeader& r, uint64_t pos, uint64_t size){
+      return (r.type == EVENTS || r.type == DPP_EVENTS) && r.size == sizeof(recordHeader) + align(r.payloadSize) && pos + r.size <= size;
+    }
+
+  }
+}
+
+#endif
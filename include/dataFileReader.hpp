@@ -0,0 +1,179 @@
+// dataFileReader.hpp
+// library for offline analysis reading the data files written by cadidaq
+#ifndef CADIDAQ_DATAFILEREADER_H
+#define CADIDAQ_DATAFILEREADER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include <event.hpp>
+#include <dppEvents.hpp>
+#include <dataFileLayout.hpp>
+
+namespace cadidaq {
+
+  /** /class dataFileReader
+      Memory-maps a data file and finds the events of a board within a time range through the file's index:
+      only the records of the board overlapping the range are touched, and they can be decoded by several
+      threads at once. Files without an index (not closed properly), or whose index points outside of their
+      records, are indexed by walking their records when opened.
+      Throws std::runtime_error if the file cannot be mapped or is not a data file of a compatible version.
+  */
+  class dataFileReader {
+  public:
+    typedef dataFileLayout::indexEntry entry;
+
+    dataFileReader(const std::string& path);
+    ~dataFileReader();
+    dataFileReader(const dataFileReader&) = delete;
+    dataFileReader& operator=(const dataFileReader&) = delete;
+
+    const dataFileLayout::fileHeader& getHeader() const {return *header;}
+    uint32_t    getNBoards() const {return header->nboards;}
+    std::string getBoardName(uint16_t board) const;
+    /// list-mode format of the board's DPP firmware (NONE for other firmwares)
+    dppFormat   getDPPFormat(uint16_t board) const;
+    /// index of the board with the given name, or -1
+    int         findBoard(const std::string& name) const;
+    /// configuration read back from the boards at the start of the run (.ini format)
+    std::string getConfiguration() const;
+    /// whether the file ends with an index (otherwise its records were walked when opening it)
+    bool        hasIndex() const {return indexed;}
+    const std::vector<entry>& getIndex() const {return index;}
+    const dataFileLayout::recordHeader& getRecord(const entry& e) const {
+      return *reinterpret_cast<const dataFileLayout::recordHeader*>(data + e.offset);
+    }
+
+    /// collects the records of 'board' with events from time stamp 'from' to 'to' (inclusive), in file order
+    void        select(uint16_t board, uint64_t from, uint64_t to, std::vector<const entry*>& records) const;
+
+    /** calls f(thread, const eventHeader&, timestamp) for each raw event of 'board' with a time stamp from 'from' to 'to',
+        decoding the selected records on 'threads' threads (f is called concurrently with different thread numbers).
+        returns the number of events */
+    template <typename F>
+    uint64_t    forEachEvent(uint16_t board, uint64_t from, uint64_t to, F f, uint32_t threads = 1) const {
+      return parallel(board, from, to, threads, [&](uint32_t thread, const entry& e){
+          return decodeRecord(getRecord(e), from, to, [&](const eventHeader& event, uint64_t timestamp){f(thread, event, timestamp);});
+        });
+    }
+    /// calls f(thread, const dppEvent&) for each decoded DPP event of 'board' with a time stamp from 'from' to 'to'; see forEachEvent
+    template <typename F>
+    uint64_t    forEachDPPEvent(uint16_t board, uint64_t from, uint64_t to, F f, uint32_t threads = 1) const {
+      return parallel(board, from, to, threads, [&](uint32_t thread, const entry& e){
+          return decodeDPPRecord(getRecord(e), from, to, [&](const dppEvent& event){f(thread, event);});
+        });
+    }
+    /** the same as forEachEvent without the index or the records' time ranges, decoding all events of the board
+        in the whole file sequentially (to compare) */
+    template <typename F>
+    uint64_t    scanEvents(uint16_t board, uint64_t from, uint64_t to, F f) const {
+      uint64_t nevents = 0;
+      for (uint64_t pos = firstRecord; pos + sizeof(dataFileLayout::recordHeader) <= recordsEnd; ){
+        const dataFileLayout::recordHeader& r = *reinterpret_cast<const dataFileLayout::recordHeader*>(data + pos);
+        if (!dataFileLayout::validRecord(r, pos, recordsEnd))
+          break;
+        if (r.board == board)
+          nevents += decodeRecord(r, from, to, [&](const eventHeader& event, uint64_t timestamp){f(0, event, timestamp);}, false);
+        pos += r.size;
+      }
+      return nevents;
+    }
+
+  private:
+    /// calls g(thread, entry) for the selected records on 'threads' threads and adds up the events counted
+    template <typename G>
+    uint64_t    parallel(uint16_t board, uint64_t from, uint64_t to, uint32_t threads, G g) const {
+      std::vector<const entry*> records;
+      select(board, from, to, records);
+      if (threads <= 1 || records.size() <= 1){
+        uint64_t nevents = 0;
+        for (auto e : records)
+          nevents += g(0, *e);
+        return nevents;
+      }
+      // the records are handed out one at a time, as they differ in size
+      std::atomic<size_t>   next(0);
+      std::atomic<uint64_t> nevents(0);
+      std::vector<std::thread> pool;
+      for (uint32_t t = 0; t < threads && t < records.size(); t++)
+        pool.emplace_back([&, t]{
+            uint64_t n = 0;
+            for (size_t i; (i = next.fetch_add(1)) < records.size(); )
+              n += g(t, *records[i]);
+            nevents += n;
+          });
+      for (auto& t : pool)
+        t.join();
+      return nevents;
+    }
+
+    /// calls f(const eventHeader&, timestamp) for the events of an EVENTS record within the time range
+    template <typename F>
+    static uint64_t decodeRecord(const dataFileLayout::recordHeader& r, uint64_t from, uint64_t to, F f, bool useRange = true){
+      if (r.type != dataFileLayout::EVENTS || (useRange && (r.maxTimestamp < from || r.minTimestamp > to)))
+        return 0;
+      // the time stamps of a board increase, so the record's first event has the earliest one
+      uint64_t timestamp = r.minTimestamp;
+      uint64_t nevents = 0;
+      cadidaq::forEachEvent(reinterpret_cast<const char*>(&r + 1), r.payloadSize, [&](const eventHeader& event){
+          timestamp = dataFileLayout::extendTimeTag(timestamp, event.triggerTimeTag);
+          if (timestamp >= from && timestamp <= to){
+            f(event, timestamp);
+            nevents++;
+          }
+        });
+      return nevents;
+    }
+
+    /// calls f(const dppEvent&) for the events of a DPP_EVENTS record within the time range
+    template <typename F>
+    static uint64_t decodeDPPRecord(const dataFileLayout::recordHeader& r, uint64_t from, uint64_t to, F f){
+      if (r.type != dataFileLayout::DPP_EVENTS || r.maxTimestamp < from || r.minTimestamp > to)
+        return 0;
+      uint32_t n = r.nevents;
+      const uint64_t* timestamp   = reinterpret_cast<const uint64_t*>(&r + 1);
+      const uint16_t* channel     = reinterpret_cast<const uint16_t*>(timestamp + n);
+      const uint16_t* energy      = channel + n;
+      const uint16_t* chargeShort = energy + n;
+      const uint16_t* flags       = chargeShort + n;
+      uint64_t nevents = 0;
+      for (uint32_t i = 0; i < n; i++){
+        if (timestamp[i] < from || timestamp[i] > to)
+          continue;
+        dppEvent event = {timestamp[i], channel[i], energy[i], chargeShort[i], flags[i]};
+        f(event);
+        nevents++;
+      }
+      return nevents;
+    }
+
+    /// walks the records to build the index of a file without one
+    void        scanRecords();
+    /// whether the entries of the index read from the file all point to valid records before 'recordsEnd'
+    bool        validIndex() const;
+    void        indexBoards();
+
+    std::string                       path;
+    int                               fd;
+    size_t                            size;
+    const char*                       data;
+    const dataFileLayout::fileHeader* header;
+    uint64_t                          firstRecord;
+    uint64_t                          recordsEnd;
+    bool                              indexed;
+    std::vector<entry>                index;
+    /** per board: its entries in file order, the latest time stamp up to each of them and the earliest from each
+        of them on (both monotonic, so that the records overlapping a time range are found by bisection) */
+    struct boardIndex {
+      std::vector<uint32_t> entries;
+      std::vector<uint64_t> maxUpTo;
+      std::vector<uint64_t> minFrom;
+    };
+    std::vector<boardIndex>           boards;
+  };
+}
+
+#endif
@@ -11,6 +11,11 @@
 #include <boost/optional.hpp>
 
 #include <settings.hpp>
+#include <metrics.hpp>
+#include <affinity.hpp>
+#include <dppEvents.hpp>
+#include <eventFilter.hpp>
+#include <boardHealth.hpp>
 #include <helper.hpp>       // helper functions
 #include <caen.hpp>
 
@@ -30,17 +35,87 @@ namespace std {
 }
 namespace cadidaq {
 
+    /// how the readout of a board is scheduled (see readoutScheduler)
+    enum class readoutMode {ADAPTIVE, POLL, IRQ};
+    const char* toString(readoutMode mode);
+    /// what happens to a board's data while the readout buffers are filled beyond the high watermark (see overflowControl)
+    enum class overflowPolicy {BLOCK, DROP_OLDEST, PRESCALE, FEATURES_ONLY};
+    const char* toString(overflowPolicy policy);
+    /// the policy named by a (verified) 'OverflowPolicy' setting
+    overflowPolicy toOverflowPolicy(const std::string& name);
+    /// per-channel settings reprogrammed while the board stays configured (see digitizer::reprogram)
+    enum class channelSetting {TRIGGER_THRESHOLD, DC_OFFSET};
+
     class digitizer {
     public:
         digitizer(std::string name);
         ~digitizer();
-        void             configure(pt::iptree *node);
-        pt::iptree*      retrieveConfig();
+        void             configure(settingsIndex &index);
+        /// configures the board from a snapshot instead; throws std::runtime_error if it does not match the board found
+        void             configure(snapshotReader &snapshot);
+        /// reads the settings back from the device and adds them to the given ptree
+        void             retrieveConfig(pt::iptree &node);
+        /// appends the board's verified configuration to a snapshot
+        void             storeConfig(snapshotWriter &snapshot);
+        /// decodes a board's configuration from a snapshot into a ptree (without connecting to the board)
+        static pt::iptree* describeSnapshot(std::string name, snapshotReader &snapshot);
+        void             startAcquisition();
+        void             stopAcquisition();
+        /// size of the readout buffer needed for the programmed settings (record length, enabled channels, events per block transfer)
+        uint32_t         readoutBufferSize();
+        /// reads the data stored on the board into the given buffer; returns the number of bytes read
+        uint32_t         readData(caen::ReadoutBuffer &buffer);
+        /// waits up to 'timeout' milliseconds for the board's interrupt (IRQ mode only); returns true if it was raised
+        bool             waitForInterrupt(uint32_t timeout);
+        readoutMode      getReadoutMode(){return mode;}
+        /// longest time between two reads of the board in microseconds
+        uint32_t         getReadoutMaxInterval(){return *reg->readoutMaxInterval.first;}
+        overflowPolicy   getOverflowPolicy(){return overflow;}
+        /// events kept (one in N) by the prescale overflow policy
+        uint32_t         getOverflowPrescale(){return *reg->overflowPrescale.first;}
+        /// selection of the board's decoded DPP events handed on (nullptr: all events)
+        const eventFilter* getEventFilter(){return filter;}
+        /// name of the thread reading out the board: as configured or derived from the link shared with other boards
+        std::string      getReadoutThread();
+        /// CPUs the board's readout thread is to run on as configured for the board (empty if not set)
+        affinity::cpuList getReadoutCPUs();
+        /** fraction of the board's event memory holding events, queried from the board (one register access).
+            Returns 0 if the board holds no data and a negative value if the fill level is unknown. */
+        double           occupancy();
+        /// time between two polls of the board's health registers in milliseconds (0: not polled)
+        uint32_t         getHealthInterval(){return *reg->healthInterval.first;}
+        /// number of health registers: the acquisition status, and for the x725 and x730 the board failure status and the channels' temperatures
+        uint32_t         healthRegisters();
+        /// reads the health register 'index' (see healthRegisters) into 'health' (one register access); returns false if it cannot be read
+        bool             readHealth(uint32_t index, boardHealth& health);
+        /// list-mode format of the board's DPP firmware decoded into event batches (NONE for other firmwares and families)
+        dppFormat        getDPPFormat();
+        /// packing of the samples in the events of the standard firmware (NONE for DPP firmware and families not decoded)
+        samplePacking    getSamplePacking();
+        /// values of a per-channel setting as programmed (channels without a value keep the board's default)
+        const channelValues<uint32_t>& getChannelValues(channelSetting setting);
+        /// name of a per-channel setting in the configuration
+        std::string      getSettingName(channelSetting setting);
+        /** programs the values of a per-channel setting, writing only the channels (or groups of channels sharing the
+            setting, whose first defined value applies) that differ from the values programmed; returns the number of
+            writes. Trigger thresholds are not programmed with DPP firmware (logged as a warning, no writes). */
+        uint32_t         reprogram(channelSetting setting, const channelValues<uint32_t>& values);
+        /// whether channel 'ch' triggers when its signal falls below the threshold (rather than rising above it)
+        bool             fallingTrigger(unsigned ch);
+        /// sets the counters to account the board's readout in
+        void             setMetrics(boardMetrics* m){stats = m;}
         caen::Digitizer* getDevice(){return dg;}
         std::string      getName(){return name;}
         enum class comDirection {READING, WRITING};
     private:
+        void connect();
         void verifySettings();
+        /// chooses the events per block transfer or per aggregate if ReadoutSizing is Auto or Calibrate
+        void sizeReadout();
+        /// estimated size of an event in bytes for the programmed record length and enabled channels
+        uint32_t estimateEventSize();
+        /// transfer rate (bytes per second spent transferring) measured with blocks of 'events' software triggers
+        double measureTransferRate(uint32_t events);
 
         template <typename T>
         void programWrapper(void (caen::Digitizer::*write)(T), T (caen::Digitizer::*read)(), boost::optional<T> &value, comDirection direction){
@@ -94,39 +169,29 @@ namespace cadidaq {
         
         template <typename T, typename C>
         void programLoopWrapper(void (caen::Digitizer::*write)(C, T), T (caen::Digitizer::*read)(C), cadidaq::settingsBase::optionVector<T> &vec, comDirection direction, bool ignoreGroups = false){
-            int ngroups = dg->groups();
-            // if groups are to be ignored
-            if (ignoreGroups)
-                ngroups = 1;
+            cadidaq::channelValues<T>& values = vec.first;
+            // number of channels sharing a setting (one if groups are to be ignored)
+            unsigned perGroup = ignoreGroups ? 1 : dg->channelsPerGroup();
+            if (perGroup < 1)
+                perGroup = 1;
+            unsigned ngroups = (values.size() + perGroup - 1) / perGroup;
             // verify that the vector can be put into group structure of the device (if channels are grouped)
-            if (ngroups>1){
-                for (int i = 0; i<ngroups; i++){
-                    if (!allValuesSame(vec.first,i*dg->channelsPerGroup(), (i+1)*dg->channelsPerGroup()))
-                        DG_LOG_WARN << "The channels in the range " << i*dg->channelsPerGroup() << " and " << (i+1)*dg->channelsPerGroup() << " for '" << vec.second << "' are set to different values -> cannot consistently convert to groups supported by the device!";
+            if (perGroup > 1 && direction == comDirection::WRITING){
+                for (unsigned g = 0; g < ngroups; g++){
+                    if (!values.allSame(g*perGroup, (g+1)*perGroup))
+                        DG_LOG_WARN << "The channels in the range " << g*perGroup << " and " << (g+1)*perGroup << " for '" << vec.second << "' are set to different values -> cannot consistently convert to groups supported by the device!";
                 }
             }
-            // loop over vector's entries and READ/WRITE values from/to digitzer
-            for (auto it = vec.first.begin(); it != vec.first.end(); ++it) {
-                auto channel = std::distance(vec.first.begin(), it);
-                if (direction == comDirection::WRITING){
-                    if (!*it)
-                        continue; // skip and leave default
-                }
-                // map channel number to group index (or set to one if NGroups==1)
-                C group = channel/ngroups;
-                if (direction == comDirection::READING && channel%ngroups != 0)
-                    continue; // only read once per group
-                
+            // loop over the channels/groups and READ/WRITE values from/to digitzer
+            for (unsigned g = 0; g < ngroups; g++){
+                // value of the group's first defined channel when writing
+                boost::optional<T> value = values.firstValue(g*perGroup, (g+1)*perGroup);
+                if (direction == comDirection::WRITING && !value)
+                    continue; // skip and leave default
                 // perform the call to the digitizer
-                programWrapper(write, read, group, *it, direction);
-                if (direction == comDirection::READING){
-                    if (ngroups > 1){
-                        // set the other values in the group
-                        for (int i = group*dg->channelsPerGroup(); i<(group+1)*dg->channelsPerGroup(); i++){
-                            vec.first.at(i) = *it;
-                        }
-                    }
-                }
+                programWrapper(write, read, static_cast<C>(g), value, direction);
+                if (direction == comDirection::READING)
+                    values.fill(value, g*perGroup, (g+1)*perGroup); // set all channels of the group
             }
         }
         
@@ -135,6 +200,11 @@ namespace cadidaq {
         caen::Digitizer*    dg;
         connectionSettings* lnk;
         registerSettings*   reg;
+        readoutMode         mode;
+        overflowPolicy      overflow;
+        eventFilter*        filter;
+        uint32_t            eventCapacity;  ///< number of events the board's memory is organized into (0 if unknown)
+        boardMetrics*       stats;
         std::string         name;
         boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
     };
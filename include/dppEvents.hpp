@@ -0,0 +1,163 @@
+// dppEvents.hpp
+#ifndef CADIDAQ_DPPEVENTS_H
+#define CADIDAQ_DPPEVENTS_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <event.hpp>
+
+namespace cadidaq {
+
+  /// list-mode data formats of the DPP firmwares decoded into event batches
+  enum class dppFormat {NONE, PSD, PHA};
+  const char* toString(dppFormat format);
+
+  /// bits of dppEvent::flags and dppEventBatch::flags
+  enum dppFlags : uint16_t { DPP_PILEUP = 1 };
+
+  /** /struct dppEvent
+      A decoded list-mode event of the DPP-PSD or DPP-PHA firmware, one structure per event (array-of-structures).
+  */
+  struct dppEvent {
+    uint64_t timestamp;    ///< trigger time tag extended by the upper bits of the extras word, in samples
+    uint16_t channel;
+    uint16_t energy;       ///< energy (PHA) or long gate charge (PSD)
+    uint16_t chargeShort;  ///< short gate charge (PSD only)
+    uint16_t flags;        ///< DPP_PILEUP, and the firmware's event flags shifted up by one
+  };
+
+  /** /struct dppEventBatch
+      Decoded list-mode events of one board in structure-of-arrays layout: one contiguous array per field,
+      so that selections and histograms can loop over a field of all events at once.
+      Batches are handed on by moving or swapping them, never copied; clear() keeps the arrays' storage, so a
+      batch that is reused does not allocate once it has grown to the size of the data.
+  */
+  struct dppEventBatch {
+    dppEventBatch() = default;
+    dppEventBatch(dppEventBatch&&) = default;
+    dppEventBatch& operator=(dppEventBatch&&) = default;
+    dppEventBatch(const dppEventBatch&) = delete;
+    dppEventBatch& operator=(const dppEventBatch&) = delete;
+
+    size_t size() const {return timestamp.size();}
+    void   clear(){
+      timestamp.clear(); channel.clear(); energy.clear(); chargeShort.clear(); flags.clear();
+    }
+    void   reserve(size_t n){
+      timestamp.reserve(n); channel.reserve(n); energy.reserve(n); chargeShort.reserve(n); flags.reserve(n);
+    }
+    void   resize(size_t n){
+      timestamp.resize(n); channel.resize(n); energy.resize(n); chargeShort.resize(n); flags.resize(n);
+    }
+    void   push_back(const dppEvent& e){
+      timestamp.push_back(e.timestamp); channel.push_back(e.channel); energy.push_back(e.energy);
+      chargeShort.push_back(e.chargeShort); flags.push_back(e.flags);
+    }
+
+    uint32_t              board = 0;
+    uint64_t              sequence = 0;  ///< sequence number of the readout buffer the events were decoded from
+    std::vector<uint64_t> timestamp;
+    std::vector<uint16_t> channel;
+    std::vector<uint16_t> energy;
+    std::vector<uint16_t> chargeShort;
+    std::vector<uint16_t> flags;
+  };
+
+  /// number of words of each event in a channel aggregate with the given format word
+  inline uint32_t dppEventWords(uint32_t info){
+    // trigger time tag, samples (two per word), extras, energy or charges
+    return 1 + ((info & (1u << 27)) ? (info & 0xFFFF) * 4 : 0) + ((info >> 28) & 1) + ((info >> 30) & 1);
+  }
+
+  /** loops over the events of a board aggregate (the 'event' found by forEachEvent in DPP list-mode data) of a
+      x725/x730 board and calls f(const dppEvent&) for each of them. Waveforms are skipped.
+      returns the number of events found; decoding stops at the first channel aggregate not matching its format. */
+  template <typename F>
+  inline uint32_t forEachDPPEvent(const eventHeader& aggregate, dppFormat format, F f){
+    if (format == dppFormat::NONE)
+      return 0;
+    const uint32_t* words = aggregate.data;
+    uint32_t pos = eventHeaderWords;
+    uint32_t nevents = 0;
+    // one channel aggregate per channel pair in the (dual channel) mask
+    for (uint32_t pair = 0; pair < 8 && pos + 2 <= aggregate.size; pair++){
+      if (!(aggregate.channelMask & (1u << pair)))
+        continue;
+      uint32_t size = words[pos] & 0x3FFFFF;
+      uint32_t info = words[pos + 1];
+      // the format word must be present
+      if (!(words[pos] >> 31) || size < 2 || size > aggregate.size - pos)
+        return nevents;
+      uint32_t samples = (info & (1u << 27)) ? (info & 0xFFFF) * 4 : 0;
+      bool     extras  = info & (1u << 28);
+      bool     energy  = info & (1u << 30);
+      uint32_t eventWords = dppEventWords(info);
+      for (uint32_t e = pos + 2; e + eventWords <= pos + size; e += eventWords){
+        dppEvent event;
+        uint32_t tag = words[e];
+        uint32_t extra = extras ? words[e + 1 + samples] : 0;
+        uint32_t last = energy ? words[e + eventWords - 1] : 0;
+        event.channel   = 2 * pair + (tag >> 31);
+        event.timestamp = (static_cast<uint64_t>(extra >> 16) << 31) | (tag & 0x7FFFFFFF);
+        event.flags     = (last >> 15) & DPP_PILEUP;
+        if (format == dppFormat::PSD){
+          event.energy      = last >> 16;
+          event.chargeShort = last & 0x7FFF;
+          event.flags      |= ((extra >> 10) & 0x3F) << 1;
+        } else {
+          event.energy      = last & 0x7FFF;
+          event.chargeShort = 0;
+          event.flags      |= ((last >> 16) & 0x7FFF) << 1;
+        }
+        f(event);
+        nevents++;
+      }
+      pos += size;
+    }
+    return nevents;
+  }
+
+  /** number of events the channel aggregates of a board aggregate announce by their sizes (without decoding them);
+      counting stops, like the decoding, at the first channel aggregate not fitting in the board aggregate */
+  inline uint32_t countDPPEvents(const eventHeader& aggregate){
+    uint32_t announced = 0;
+    for (uint32_t pair = 0, pos = eventHeaderWords; pair < 8 && pos + 2 <= aggregate.size; pair++){
+      if (!(aggregate.channelMask & (1u << pair)))
+        continue;
+      uint32_t size = aggregate.data[pos] & 0x3FFFFF;
+      if (size < 2 || size > aggregate.size - pos)
+        break;
+      announced += (size - 2) / dppEventWords(aggregate.data[pos + 1]);
+      pos += size;
+    }
+    return announced;
+  }
+
+  /// appends the events of a board aggregate to the batch; returns the number of events added
+  inline uint32_t decodeDPPEvents(const eventHeader& aggregate, dppFormat format, dppEventBatch& batch){
+    // the columns are grown once per aggregate, by the number of events the channel aggregates announce, and filled by index
+    uint32_t announced = countDPPEvents(aggregate);
+    size_t first = batch.size();
+    batch.resize(first + announced);
+    uint64_t* timestamp   = batch.timestamp.data() + first;
+    uint16_t* channel     = batch.channel.data() + first;
+    uint16_t* energy      = batch.energy.data() + first;
+    uint16_t* chargeShort = batch.chargeShort.data() + first;
+    uint16_t* flags       = batch.flags.data() + first;
+    uint32_t n = 0;
+    forEachDPPEvent(aggregate, format, [&](const dppEvent& e){
+        if (n == announced)
+          return;
+        timestamp[n] = e.timestamp; channel[n] = e.channel; energy[n] = e.energy; chargeShort[n] = e.chargeShort; flags[n] = e.flags;
+        n++;
+      });
+    // (fewer if decoding stopped early)
+    batch.resize(first + n);
+    return n;
+  }
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+// event.hpp
+#ifndef CADIDAQ_EVENT_H
+#define CADIDAQ_EVENT_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace cadidaq {
+
+  /** /struct eventHeader
+      Decoded header of an event in the standard (non-DPP) firmware data format.
+      The event's raw data (header and samples) is referenced, not copied.
+  */
+  struct eventHeader {
+    uint32_t        size;           ///< event size in 32-bit words (including the header)
+    uint32_t        boardId;
+    uint32_t        pattern;
+    uint32_t        channelMask;    ///< channel (or group) mask
+    uint32_t        eventCounter;
+    uint32_t        triggerTimeTag;
+    const uint32_t* data;           ///< pointer to the first header word in the readout buffer
+  };
+
+  /// number of 32-bit words in the event header of the standard firmware
+  const uint32_t eventHeaderWords = 4;
+
+  /** decodes the four header words at the given position into an eventHeader.
+      returns false if the words do not start a valid event or if the event would exceed the given number of remaining words. */
+  inline bool decodeEventHeader(const uint32_t* words, uint32_t remaining, eventHeader& header){
+    if (remaining < eventHeaderWords)
+      return false;
+    // header tag in the upper nibble of the first word is always 0xA
+    if ((words[0] >> 28) != 0xA)
+      return false;
+    header.size           = words[0] & 0x0FFFFFFF;
+    if (header.size < eventHeaderWords || header.size > remaining)
+      return false;
+    header.boardId        = words[1] >> 27;
+    header.pattern        = (words[1] >> 8) & 0xFFFF;
+    // lower 8 bits of the mask in word 1, upper 8 bits (16-channel boards) in word 2
+    header.channelMask    = (words[1] & 0xFF) | ((words[2] >> 16) & 0xFF00);
+    header.eventCounter   = words[2] & 0x00FFFFFF;
+    header.triggerTimeTag = words[3];
+    header.data           = words;
+    return true;
+  }
+
+  /** loops over all events in a block-transfer readout buffer and calls f(const eventHeader&) for each of them.
+      returns the number of events found; decoding stops at the first word not starting a valid event. */
+  template <typename F>
+  inline uint32_t forEachEvent(const char* buffer, uint32_t bytes, F f){
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(buffer);
+    uint32_t nwords = bytes / sizeof(uint32_t);
+    uint32_t pos = 0;
+    uint32_t nevents = 0;
+    eventHeader header;
+    while (pos < nwords && decodeEventHeader(words + pos, nwords - pos, header)){
+      f(header);
+      pos += header.size;
+      nevents++;
+    }
+    return nevents;
+  }
+
+  /// how the samples of a channel are packed into the 32-bit words of an event (depends on the board family)
+  enum class samplePacking {
+    NONE,            ///< not decoded
+    TWO_PER_WORD,    ///< two samples in the lower 14 bits of each half word (x720, x724, x725, x730)
+    THREE_PER_WORD,  ///< three 10-bit samples (x751)
+    GROUP_OF_THREE,  ///< 12-bit samples of the channels of a group, three of each channel in turn per 9 words (x740)
+    GROUP_OF_ONE     ///< 12-bit samples of the channels of a group, one of each channel in turn per 3 words, after a group header (x742)
+  };
+
+  /// channels in a group of the boards with grouped channels (x740, x742; without the fast trigger of the x742)
+  const uint32_t groupChannels = 8;
+
+  /** /struct channelRecord
+      The samples of a channel in an event: its own words, or those of its group which it shares with the group's
+      other channels (interleaved as 12-bit values, the first channel's in the lowest bits).
+  */
+  struct channelRecord {
+    samplePacking   packing;
+    const uint32_t* words;
+    uint32_t        nwords;
+    uint32_t        index;          ///< of the channel in its group
+
+    /// number of samples
+    uint32_t samples() const {
+      switch (packing){
+      case samplePacking::TWO_PER_WORD:   return 2 * nwords;
+      case samplePacking::THREE_PER_WORD: return 3 * nwords;
+      case samplePacking::GROUP_OF_THREE: return nwords / (3 * groupChannels * 12 / 32) * 3;
+      case samplePacking::GROUP_OF_ONE:   return nwords / (groupChannels * 12 / 32);
+      default:                            return 0;
+      }
+    }
+    /// sample 'i'
+    uint16_t sample(uint32_t i) const {
+      if (packing == samplePacking::TWO_PER_WORD)
+        return (words[i / 2] >> (16 * (i % 2))) & 0x3FFF;
+      if (packing == samplePacking::THREE_PER_WORD)
+        return (words[i / 3] >> (10 * (i % 3))) & 0x3FF;
+      // position of the 12-bit value among those of the group (possibly spanning two words)
+      uint32_t value = packing == samplePacking::GROUP_OF_THREE ? (i / 3) * 3 * groupChannels + 3 * index + i % 3
+                                                                : i * groupChannels + index;
+      uint32_t bit = 12 * value;
+      uint32_t shift = bit % 32;
+      uint64_t bits = words[bit / 32];
+      if (shift > 32 - 12)
+        bits |= static_cast<uint64_t>(words[bit / 32 + 1]) << 32;
+      return (bits >> shift) & 0xFFF;
+    }
+  };
+
+  /** loops over the channels stored in an event and calls f(uint32_t channel, const channelRecord& record) for each of
+      them: one record per channel in the event's mask, all of the same size, or for grouped packings one per group in
+      the mask (all of the same size on the x740, each with a header giving its size on the x742) shared by its
+      channels; returns the number of channels */
+  template <typename F>
+  inline uint32_t forEachChannelRecord(const eventHeader& header, samplePacking packing, F f){
+    uint32_t nrecords = __builtin_popcount(header.channelMask);
+    if (nrecords == 0)
+      return 0;
+    const uint32_t* words = header.data + eventHeaderWords;
+    const uint32_t* end = header.data + header.size;
+    uint32_t nwords = (header.size - eventHeaderWords) / nrecords;
+    if (packing != samplePacking::GROUP_OF_THREE && packing != samplePacking::GROUP_OF_ONE){
+      for (uint32_t m = header.channelMask; m; m &= m - 1, words += nwords)
+        f(static_cast<uint32_t>(__builtin_ctz(m)), channelRecord{packing, words, nwords, 0});
+      return nrecords;
+    }
+    uint32_t nchannels = 0;
+    for (uint32_t m = header.channelMask; m; m &= m - 1){
+      uint32_t group = __builtin_ctz(m);
+      const uint32_t* samples = words;
+      if (packing == samplePacking::GROUP_OF_ONE){
+        // group header: size of the samples in words (bits 0-11), samples of the fast trigger following them (bit 12),
+        // and after all of them a word with the group's trigger time tag
+        if (words >= end)
+          break;
+        nwords = words[0] & 0xFFF;
+        uint32_t triggerWords = (words[0] >> 12) & 1 ? nwords / groupChannels : 0;
+        samples = words + 1;
+        words += 1 + nwords + triggerWords + 1;
+        if (words > end)
+          break;
+      } else
+        words += nwords;
+      for (uint32_t c = 0; c < groupChannels; c++)
+        f(group * groupChannels + c, channelRecord{packing, samples, nwords, c});
+      nchannels += groupChannels;
+    }
+    return nchannels;
+  }
+
+}
+
+#endif
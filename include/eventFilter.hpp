@@ -0,0 +1,73 @@
+// eventFilter.hpp
+#ifndef CADIDAQ_EVENTFILTER_H
+#define CADIDAQ_EVENTFILTER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <dppEvents.hpp>
+
+namespace cadidaq {
+
+  /** /class eventFilter
+      Selection of decoded DPP events given as an expression, e.g. "energy > 200 && channel in [0-15] && !pileup":
+       - comparisons of a field with a number (==, !=, <, <=, >, >=; decimal or 0x hex, up to 64 bit)
+       - 'field in [RANGE]' with a list of values and ranges as in the channel ranges of the settings ("0-3,8,12-15"), whose
+         bounds must fit the field (16 bit, 64 bit for the time stamps)
+       - 'pileup' for events flagged as pile-up
+       - combined with &&, || and ! and grouped by parentheses
+      The fields are the columns of dppEventBatch: timestamp, channel, energy, chargeShort and flags (case-insensitive).
+      The expression is parsed once into a tree whose negations are pushed down to its comparisons, so that only
+      conjunctions and disjunctions of comparisons remain. A batch is evaluated one comparison at a time over a whole
+      column into a mask of selected events, in loops without branches the compiler vectorizes; the conjunctions and
+      disjunctions combine the masks in place.
+      Throws std::runtime_error (with the position of the error) if the expression cannot be parsed.
+  */
+  class eventFilter {
+  public:
+    /// scratch memory of the evaluation, one per thread; grows to the largest batch evaluated and is then reused
+    typedef std::vector<uint8_t> workspace;
+
+    eventFilter(const std::string& expression);
+
+    /// sets mask[i] to 1 for the events of the batch selected, 0 for the others
+    void     evaluate(const dppEventBatch& batch, uint8_t* mask, workspace& ws) const;
+    /// removes the events not selected from the batch (keeping their order); returns the number removed
+    uint32_t select(dppEventBatch& batch, workspace& ws) const;
+    /// whether a single event is selected, interpreting the expression tree event by event (for comparison with evaluate)
+    bool     matches(const dppEvent& event) const;
+    /// makes room in the workspace for batches of up to 'events' events, so that evaluating them does not allocate
+    void     reserve(workspace& ws, size_t events) const;
+    /// the expression as compiled (negations resolved, fully parenthesized)
+    std::string describe() const;
+
+  private:
+    enum class field : uint8_t {TIMESTAMP, CHANNEL, ENERGY, CHARGE_SHORT, FLAGS};
+    enum class kind : uint8_t {AND, OR, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL, EQUAL, NOT_EQUAL, IN, NOT_IN, PILEUP, NOT_PILEUP};
+    /// how a node's result is merged into the mask
+    enum class combine : uint8_t {SET, AND, OR};
+    struct node {
+      kind                  type;
+      field                 column;
+      uint64_t              value;
+      std::vector<std::pair<uint64_t, uint64_t>> ranges;  ///< inclusive, sorted and disjoint (IN, NOT_IN)
+      std::vector<uint32_t> children;                     ///< (AND, OR)
+    };
+    class parser;
+
+    /// negates the subtree, pushing the negation down to its comparisons
+    void     negate(uint32_t n);
+    void     evaluate(uint32_t n, const dppEventBatch& batch, uint8_t* mask, combine how, uint8_t* scratch) const;
+    bool     matches(uint32_t n, const dppEvent& event) const;
+    uint32_t depth(uint32_t n) const;
+    std::string describe(uint32_t n) const;
+
+    std::vector<node> nodes;
+    uint32_t          root;
+    uint32_t          levels;  ///< masks needed for nested conjunctions and disjunctions
+  };
+}
+
+#endif
@@ -0,0 +1,167 @@
+// fileWriter.hpp
+#ifndef CADIDAQ_FILEWRITER_H
+#define CADIDAQ_FILEWRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+#include <dppEvents.hpp>
+#include <metrics.hpp>
+#include <traceRecorder.hpp>
+#include <dataFileLayout.hpp>
+#include <affinity.hpp>
+
+namespace cadidaq {
+
+  /** /class fileWriter
+      Writes the acquired data into a sequence of files (see dataFileLayout) named <base>_<run start>_<number>.cdaq,
+      starting a new file once the current one would exceed the configured size, number of events or wall time.
+      Each file starts with the configuration read back from the boards and ends with an index of its records
+      (board, time stamp range, events, position), so that readers (see dataFileReader) find the events of a board in
+      a time range without scanning the file.
+      The records are copied into a ring of large chunks which a writer thread writes out; closing a finished
+      file, flushing it to disk (fsync), computing its CRC-32 (of the uncompressed file, written next to it as
+      <file>.crc32) and optionally compressing it happens on a separate finalisation thread, so that neither the
+      acquisition nor the writer thread waits for it. The acquisition only waits if all chunks are waiting to be written (the disk is too slow).
+      The writer thread allocates and pre-faults the chunks once it is pinned, so that they are on its NUMA node.
+      The write functions are to be called from one thread at a time; they never allocate.
+  */
+  class fileWriter {
+  public:
+    /// limits of a file, zero for none
+    struct rotation {
+      uint64_t bytes;
+      uint64_t events;
+      uint32_t seconds;
+    };
+
+    /** opens the first file for boards with the given names and DPP formats; records of up to 'maxRecordBytes' bytes (payload) can be written.
+        'compressCommand' (a program and its arguments, split at white space and run without a shell) is run with the path
+        of each finished file appended, if not empty. The writer and finalisation threads run on 'cpus' (any CPU if empty).
+        throws std::runtime_error if the file cannot be created or the chunks cannot be allocated */
+    fileWriter(const std::string& base, const rotation& rotate, const std::vector<std::string>& boardNames, const std::vector<dppFormat>& formats,
+               const std::string& configuration, uint32_t maxRecordBytes, const std::string& compressCommand, stageMetrics& writeStats, stageMetrics& finaliseStats,
+               const affinity::cpuList& cpus = affinity::cpuList());
+    ~fileWriter();
+    fileWriter(const fileWriter&) = delete;
+    fileWriter& operator=(const fileWriter&) = delete;
+
+    /** appends the events of a readout buffer kept by the prescaler (every 'prescale'th event, counted from 'firstEvent'),
+        or only their headers if 'featuresOnly'; 'readTime' is when the buffer was read (latencyMetrics::now(), 0 if not known) */
+    void     writeEvents(uint16_t board, uint64_t sequence, uint64_t firstEvent, const char* buffer, uint32_t nbytes, uint32_t prescale, bool featuresOnly,
+                         uint64_t readTime = 0);
+    /// appends a batch of decoded DPP events
+    void     writeDPP(const dppEventBatch& batch, uint64_t firstEvent, uint32_t prescale, uint64_t readTime = 0);
+    /** measures per chunk written how long its first record waited to be written ('complete') and how long ago its oldest
+        record was read ('endToEnd'), recording the writes as spans of 'traceThread' in 'trace' (if not nullptr); to be
+        called before writing. (Written is handed to the kernel: the files are flushed to disk once finished.) */
+    void     traceLatency(latencyMetrics& complete, latencyMetrics& endToEnd, traceRecorder* trace, uint32_t traceThread);
+    /// writes out everything, closes the last file and waits until all files are finalised (called from the thread that constructed the writer)
+    void     close();
+
+    /// path of the files up to their number
+    std::string getPrefix() const {return prefix;}
+    uint32_t getFiles() const {return fileNumber;}
+    uint64_t getBytes() const {return bytesWritten;}
+    uint64_t getRecords() const {return records;}
+    /// time the acquisition waited for chunks to be written
+    uint64_t getBlockedNanoseconds() const {return blockedNanoseconds;}
+  private:
+    typedef std::chrono::steady_clock clock;
+    struct chunk {
+      char*                   data = nullptr;    ///< in 'ring'
+      size_t                  used = 0;
+      bool                    endsFile = false;  ///< the file is complete after this chunk
+      uint64_t                firstCommit = 0;   ///< when its first record was added (latencyMetrics::now())
+      uint64_t                oldestRead = 0;    ///< earliest read time of its records (0 if none known)
+    };
+    struct finishedFile {
+      int         fd;
+      std::string path;
+    };
+
+    /// returns room for a record of at most 'size' bytes in the current chunk, starting a new chunk or file as needed
+    char* reserve(std::unique_lock<std::mutex>& lock, uint64_t size, uint64_t nevents);
+    void  commit(uint64_t size, uint64_t nevents, uint64_t readTime);
+    /// queues the current chunk for writing and takes a free one (waiting for it if there is none)
+    void  handOver(std::unique_lock<std::mutex>& lock, bool endsFile);
+    /// opens the next file and writes its header (writer thread)
+    int   openFile();
+    /// appends the index to the current file and hands it on for finalisation (writer thread)
+    void  finishFile();
+    void  runWriter();
+    void  runFinaliser();
+    void  finalise(const finishedFile& f);
+
+    std::string              prefix;       ///< path of the files up to their number
+    rotation                 rotate;
+    std::vector<std::string> boardNames;
+    std::vector<dppFormat>   formats;
+    std::string              configuration;
+    std::string              compressCommand;
+    uint64_t                 runStart;     ///< nanoseconds since the epoch
+    clock::time_point        started;      ///< the same on the clock of the records' write times
+    size_t                   chunkBytes;
+    affinity::cpuList        cpus;
+    char*                    ring;         ///< memory of all chunks, mapped by the writer thread
+    size_t                   ringBytes;
+    stageMetrics&            writeStats;   ///< (its errors are counted by the acquisition and the writer thread)
+    stageMetrics&            finaliseStats;
+
+    // chunks: the one being filled, those queued for writing (in order) and free ones, protected by 'mutex'
+    std::mutex               mutex;
+    std::condition_variable  chunkQueued;
+    std::condition_variable  chunkFree;
+    std::vector<chunk>       chunks;
+    uint32_t                 current;
+    std::vector<uint32_t>    queue;        ///< ring of chunks to write
+    size_t                   queueHead;
+    size_t                   queueCount;
+    std::vector<uint32_t>    freeChunks;
+    bool                     mapped;       ///< the writer thread is placed and has tried to map the chunks
+    bool                     pinned;
+    affinity::cpuList        writerCPUs;   ///< where the writer thread runs
+    bool                     closing;
+    uint64_t                 fileBytes;    ///< data of the current file so far (filling side)
+    uint64_t                 fileEvents;
+    clock::time_point        fileStart;    ///< time of the current file's first record
+    uint64_t                 records;
+    uint64_t                 blockedNanoseconds;
+    std::vector<uint64_t>    lastTimestamp; ///< extended time stamp of each board's latest event
+    latencyMetrics*          completeLatency;
+    latencyMetrics*          endToEndLatency;
+    traceRecorder*           trace;
+    uint32_t                 traceThread;
+
+    // writer thread
+    int                      fd;
+    std::string              path;
+    uint64_t                 fileSize;
+    std::vector<dataFileLayout::indexEntry> index; ///< of the records in the current file
+    uint32_t                 fileNumber;
+    uint64_t                 bytesWritten;
+    std::thread              writer;
+
+    // finished files waiting for finalisation, protected by 'finaliseMutex'
+    std::mutex               finaliseMutex;
+    std::condition_variable  fileFinished;
+    std::deque<finishedFile> finished;
+    bool                     finaliseDone;
+    std::thread              finaliser;
+
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+    /// (loggers are not shared between threads)
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > finaliseLg;
+  };
+}
+
+#endif
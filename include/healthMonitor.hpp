@@ -0,0 +1,99 @@
+// healthMonitor.hpp
+#ifndef CADIDAQ_HEALTHMONITOR_H
+#define CADIDAQ_HEALTHMONITOR_H
+
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include <boardHealth.hpp>
+#include <digitizer.hpp>
+#include <metrics.hpp>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+namespace cadidaq {
+
+  /** /class healthPoller
+      Reads the health registers of the boards of a readout thread in the thread's idle time, so that the register
+      accesses never compete with the block transfers on the link: the readoutScheduler offers each gap before the
+      next board is due, and a single register is read if the gap is at least twice as long as a register read has
+      been taking (a moving average, measured). The registers of a board are read one at a time, a full set every
+      HealthIntervalMs, and its snapshot is updated after each read. A board kept busy without gaps (e.g. polled
+      continuously) is read anyway, one register per round of the scheduler, once its health is overdue by a whole
+      interval. Used by the readout thread only; never allocates after construction.
+  */
+  class healthPoller {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    healthPoller(const std::vector<digitizer*>& boards, const std::vector<healthSnapshot*>& snapshots, const std::vector<boardMetrics*>& stats);
+    /// reads a health register of a board that is due if there is time for it before 'until'; returns whether one was read
+    bool poll(clock::time_point now, clock::time_point until);
+    /// reads a health register of a board overdue by a whole interval; returns whether one was read
+    bool pollOverdue(clock::time_point now);
+  private:
+    struct boardState {
+      uint32_t                 registers;  ///< health registers of the board (0: not polled)
+      uint32_t                 next;       ///< next register to read
+      std::chrono::nanoseconds interval;
+      clock::time_point        due;        ///< of the next set of registers
+      boardHealth              health;
+    };
+    /// reads the next register of board 'i'
+    void read(size_t i, clock::time_point now);
+    /// updates 'overdue'
+    void plan();
+
+    std::vector<digitizer*>      boards;
+    std::vector<healthSnapshot*> snapshots;
+    std::vector<boardMetrics*>   stats;
+    std::vector<boardState>      state;
+    size_t                       cursor;   ///< board to consider first (round robin)
+    std::chrono::nanoseconds     cost;     ///< of a register read (moving average)
+    clock::time_point            overdue;  ///< earliest time a board is overdue by its interval
+  };
+
+  /** /class healthMonitor
+      Holds the latest health of each board (lock-free snapshots published by the healthPoller of its readout
+      thread) and checks it in a thread of its own: updates the temperature, memory full and PLL lock gauges of the
+      board's metrics and raises an alarm (logged and counted) when the event memory of a board fills up (triggers are
+      lost), its PLL loses the lock on the clock reference, an ADC overheats or powers down; their recovery is logged.
+  */
+  class healthMonitor {
+  public:
+    healthMonitor(const std::vector<digitizer*>& boards, const std::vector<boardMetrics*>& stats);
+    ~healthMonitor();
+    healthMonitor(const healthMonitor&) = delete;
+    healthMonitor& operator=(const healthMonitor&) = delete;
+
+    /// snapshot of board 'i' to be published by its poller
+    healthSnapshot*  getSnapshot(size_t i){return &snapshots[i];}
+    /// latest health of board 'i' (time 0 if not read yet)
+    boardHealth      get(size_t i) const {return snapshots[i].read();}
+  private:
+    struct alarms {
+      bool memoryFull = false;
+      bool pllUnlocked = false;
+      bool overheated = false;
+      bool powerDown = false;
+    };
+    void run();
+    /// checks the health of board 'i' and logs the alarms raised or cleared since the previous check
+    void check(size_t i);
+
+    std::vector<std::string>          names;
+    std::vector<boardMetrics*>        stats;
+    std::unique_ptr<healthSnapshot[]> snapshots;
+    std::vector<alarms>               raised;
+    std::atomic<bool>                 stop;
+    std::thread                       thread;
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+  };
+}
+
+#endif
@@ -1,8 +1,14 @@
 #ifndef CADIDAQ_HELPER_H
 #define CADIDAQ_HELPER_H
 
-#include <bitset>
-#include <iterator>  // distance
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cctype>    // isdigit
+#include <iterator>  // next
+#include <limits>
+#include <utility>   // pair
+#include <stdexcept> // invalid_argument
 
 #include <boost/optional.hpp>
 #include <boost/lexical_cast.hpp>
@@ -10,158 +16,60 @@
 #include <boost/algorithm/string/predicate.hpp> // boost::starts_with
 
 
-/** converts a vector of optional<bool> into a uint32 bit mask.
-    defaults to bit=0 if corresponding optional not set.
-    groups parameter allows to group the bits with any bit in the group being 1 leading to the resulting group's bit being 1
-    blocksize parameter allows to switch bits in blocks of the given number of bits.
-*/
-inline uint32_t vec2Mask(std::vector<boost::optional<bool>>& vec, uint ngroups, uint blocksize = 1){
-  std::bitset<32> mask(0);
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    // set value if set and 'true' (else it stays 0)
-    if (*it && **it) {
-      // create a bit pattern for the channel/group the channel belongs to with size of blocksize
-      uint32_t shift = (((uint32_t)1 << blocksize) - 1) << index/(ngroups*blocksize);
-      // set that pattern (applied multiple times if groupsize>1 and remains 'true' if one of the group's members was)
-      mask |= shift;
-    }
-  }
-  return mask.to_ulong();
-}
-
-/// fills the given bit mask into a vector of boost::optional<bool>
-inline  void mask2Vec(boost::optional<uint32_t> mask, std::vector<boost::optional<bool>>& vec, uint ngroups = 1){
-  if (!mask){
-    // invalid argument -> set vector elements to boost::none
-    for (auto it = vec.begin(); it != vec.end(); ++it)
-      *it = boost::none;
-    return;
-  }
-  std::bitset<32> bits(*mask);
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    uint group = index/ngroups;
-    // set vector entry
-    *it = bits[group];
-  }
-}
-
-/// counts the number of 'true' values in a vector of boost::optional<bool> (optionally limited to an index range startidx--stopidx)
-inline int countTrue(std::vector<boost::optional<bool>>& vec, size_t startidx = 0, size_t stopidx = std::numeric_limits<std::size_t>::max()){
-  int nTrue = 0;
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    if (index >= startidx && index < stopidx && *it && **it) {
-      nTrue++;
-    }
-  }
-  return nTrue;
-}
-
-/// counts the number of set values in a vector of boost::optional<bool> (optionally limited to an index range startidx--stopidx)
+/** splits a comma-separated list of values and ranges (e.g. "1, 3-5") into its
+    ranges [low, high] (a single value v giving [v, v]); spaces are ignored.
+    throws std::invalid_argument if the list or one of its elements is empty,
+    if it contains anything else, if a range is inverted or if a value does
+    not fit into T */
 template <typename T>
-inline int countSet(std::vector<boost::optional<T>>& vec, size_t startidx = 0, size_t stopidx = std::numeric_limits<std::size_t>::max()){
-  int nSet = 0;
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    if (index >= startidx && index < stopidx && *it) {
-      nSet++;
+std::vector<std::pair<T, T>> parseRanges(const std::string& range){
+  std::vector<std::pair<T, T>> ranges;
+  size_t i = 0;
+  const size_t n = range.length();
+  auto fail = [&](const std::string& what){
+    throw std::invalid_argument("Invalid range '" + range + "': " + what);
+  };
+  // reads a non-negative number at the current position
+  auto number = [&](){
+    while (i < n && range[i] == ' ') i++;
+    if (i >= n || !std::isdigit(static_cast<unsigned char>(range[i])))
+      fail(i >= n || range[i] == ',' ? "empty element" : "number expected at '" + range.substr(i) + "'");
+    T value = 0;
+    while (i < n && std::isdigit(static_cast<unsigned char>(range[i]))){
+      T digit = range[i++] - '0';
+      if (value > (std::numeric_limits<T>::max() - digit) / 10)
+        fail("value too large (at most " + std::to_string(std::numeric_limits<T>::max()) + ")");
+      value = value*10 + digit;
     }
-  }
-  return nSet;
-}
-
-/// returns the first set value in a range of indexes in a vector of boost::optional _or_ returns a boost::optional set to boost::none if no element is set
-template <typename T>
-inline boost::optional<T> getFirstSetValue(std::vector<boost::optional<T>>& vec, size_t startidx = 0, size_t stopidx = std::numeric_limits<std::size_t>::max()){
-  // find first defined value in the idx range
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    if (index >= startidx && index < stopidx && (*it)){
-      return *it;
+    while (i < n && range[i] == ' ') i++;
+    return value;
+  };
+  do {
+    T low = number();
+    T high = low;
+    if (i < n && range[i] == '-'){
+      i++;
+      high = number();
+      if (high < low)
+        fail("inverted range " + std::to_string(low) + "-" + std::to_string(high));
     }
-  }
-  return boost::optional<T>(boost::none);
+    if (i < n && range[i] != ',')
+      fail("',' expected at '" + range.substr(i) + "'");
+    ranges.push_back(std::make_pair(low, high));
+  } while (i++ < n); // skips the comma, another element must follow
+  return ranges;
 }
 
-/// tests if all values in a vector of boost::optional are set to some identical value _or_ all are undefined (optionally limited to an index range startidx--stopidx)
-template <typename T>
-inline bool allValuesSame(std::vector<boost::optional<T>>& vec, size_t startidx = 0, size_t stopidx = std::numeric_limits<std::size_t>::max()){
-  // get value of first defined element
-  boost::optional<T> value = getFirstSetValue(vec, startidx, stopidx);
-  // compare against all values
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    if (index >= startidx && index < stopidx && *it && (*it != value))
-      return false;
-  }
-  return true;
-}
-
-/// tests if all values in a vector of boost::optional are set to any defined value (optionally limited to an index range startidx--stopidx)
-template <typename T>
-inline bool allValuesSet(std::vector<boost::optional<T>>& vec, size_t startidx = 0, size_t stopidx = std::numeric_limits<std::size_t>::max()){
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    if (!*it && index >= startidx && index < stopidx)
-      return false;
-  }
-  return true;
-}
-
-/// tests if all values in a vector of boost::optional are unset/undefined (optionally limited to an index range startidx--stopidx)
-template <typename T>
-inline bool noValuesSet(std::vector<boost::optional<T>>& vec, size_t startidx = 0, size_t stopidx = std::numeric_limits<std::size_t>::max()){
-  for (auto it = vec.begin(); it != vec.end(); ++it) {
-    auto index = std::distance(vec.begin(), it);
-    if (*it && index >= startidx && index < stopidx)
-      return false;
-  }
-  return true;
-}
-
-/// finds the common root-prefix for the enums in the given boost::bimap (e.g. "CAEN_DGTZ_")
-template <class CAEN_ENUM>
-inline std::string findEnumRoot(boost::bimap< std::string, CAEN_ENUM >& map){
-  std::string root = map.left.begin()->first;
-  for(const auto& item : map.left){
-    if (root.length() > item.first.length()){
-      root.erase(item.first.length(), std::string::npos);
-    }
-    for(int i = 0; i < root.length(); ++i){
-      if (root[i] != item.first[i]){
-        root.erase(i, std::string::npos);
+/** splits a comma-separated list of values and ranges (e.g. "1, 3-5") into
+    individual values appended to the given vector; spaces are ignored.
+    throws std::invalid_argument on malformed lists, see parseRanges */
+inline void expandRange(const std::string& range, std::vector<int>& v){
+  for (auto& r : parseRanges<int>(range))
+    for (int x = r.first; ; ++x){
+      v.push_back(x);
+      if (x == r.second)
         break;
-      }
     }
-  }
-  return root;
-}
-
-/** splits a comma-separated list of values and ranges into
-    individual values, returns these as vector */
-inline std::vector<int> expandRange(std::string range){
-  // clean input of spaces
-  boost::erase_all(range," ");
-  // helper vars
-  std::vector<std::string> strs,r;
-  std::vector<int> v;
-  int low,high,i;
-  // split string
-  boost::split(strs,range,boost::is_any_of(","));
-  // expand values
-  for (auto it:strs){
-    boost::split(r,it,boost::is_any_of("-"));
-    auto x = r.begin();
-    low = high =boost::lexical_cast<int>(r[0]);
-    x++;
-    if(x!=r.end())
-      high = boost::lexical_cast<int>(r[1]);
-    for(i=low;i<=high;++i)
-      v.push_back(i);
-  }
-  return v;
 }
 
 /// converts a string to a hex value
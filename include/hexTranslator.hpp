@@ -9,6 +9,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp> // boost::starts_with
 #include <boost/lexical_cast.hpp>
+#include <limits>
 
 
 // Custom translator for hex (only supports std::string)
@@ -26,10 +27,13 @@ struct hexTranslator
           external_type i;
           if (boost::istarts_with(str, "0x")){
             // treat as hex
-            std::size_t* pos;
+            std::size_t pos = 0;
             std::size_t length = str.length();
             try{
-              i = std::stoi(str, pos, 16);
+              unsigned long long v = std::stoull(str, &pos, 16);
+              if (v > static_cast<unsigned long long>(std::numeric_limits<external_type>::max()))
+                return boost::optional<external_type>(boost::none);
+              i = static_cast<external_type>(v);
               }
             catch (std::invalid_argument& e){
               // no conversion performed
@@ -41,7 +45,7 @@ struct hexTranslator
               // to ERANGE.
               return boost::optional<external_type>(boost::none);
             }
-            if (*pos != length){
+            if (pos != length){
               // not all characters have been converted
               return boost::optional<external_type>(boost::none);
             }
@@ -0,0 +1,45 @@
+// liveTap.hpp
+#ifndef CADIDAQ_LIVETAP_H
+#define CADIDAQ_LIVETAP_H
+
+#include <string>
+#include <cstdint>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+#include <event.hpp>
+#include <liveTapLayout.hpp>
+
+namespace cadidaq {
+
+  /** /class liveTap
+      Publishes (a prescaled fraction of) the decoded events into a POSIX shared-memory ring
+      from which online monitors can sample without ever blocking the acquisition.
+      Monitors attach read-only using the liveTapReader client library.
+  */
+  class liveTap {
+  public:
+    liveTap(std::string name, uint64_t capacity, uint32_t prescale = 1);
+    ~liveTap();
+    /// registers a board under the given name and returns the index to use when publishing its events
+    uint16_t addBoard(std::string boardName);
+    /// copies an event (or only its header) into the ring (if selected by the prescaler); never blocks
+    void     publish(uint16_t board, const eventHeader& event, bool headerOnly = false);
+    uint64_t getPublished(){return sequence;}
+    std::string getName(){return name;}
+  private:
+    std::string                  name;
+    int                          fd;
+    size_t                       segmentSize;
+    liveTapLayout::ringHeader*   header;
+    char*                        ring;
+    uint64_t                     capacity;
+    uint32_t                     prescale;
+    uint64_t                     nevents;
+    uint64_t                     sequence;
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+  };
+}
+
+#endif
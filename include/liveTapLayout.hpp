@@ -0,0 +1,65 @@
+// liveTapLayout.hpp
+// memory layout of the shared-memory live data tap, shared by the writer (cadidaq) and the client library
+#ifndef CADIDAQ_LIVETAPLAYOUT_H
+#define CADIDAQ_LIVETAPLAYOUT_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace cadidaq {
+  namespace liveTapLayout {
+
+    const uint32_t magic      = 0xCAD1DA0;
+    const uint32_t version    = 1;
+    const uint32_t maxBoards  = 64;
+    const uint32_t nameLength = 32;
+
+    /** /struct ringHeader
+        Sits at the beginning of the shared-memory segment and is followed by the ring of 'capacity' bytes.
+
+        The writer advances 'head' before overwriting any part of the ring and 'committed' once a record is
+        complete. Readers copy a record and then check 'head' again: if the writer has moved more than
+        'capacity' bytes past the record's start in the meantime, the copy is discarded as overwritten.
+        Readers therefore never block the writer and only lose data when falling behind.
+    */
+    struct ringHeader {
+      uint32_t              magic;
+      uint32_t              version;
+      uint64_t              capacity;      ///< size of the ring in bytes
+      uint32_t              prescale;      ///< only every prescale'th event is published
+      uint32_t              nboards;
+      char                  boardNames[maxBoards][nameLength];
+      alignas(64) std::atomic<uint64_t> head;      ///< position up to which the ring might be (over)written
+      alignas(64) std::atomic<uint64_t> committed; ///< position up to which complete records are available
+      std::atomic<uint64_t> published;     ///< number of published records
+      std::atomic<uint64_t> skipped;       ///< number of events not published as they exceeded the ring size
+    };
+
+    /// flags of a record
+    enum recordFlags : uint16_t { NONE = 0, PADDING = 1 };
+
+    /** /struct recordHeader
+        Header of each record in the ring, followed by 'payloadSize' bytes of raw event data (header and samples,
+        or only the header for events whose waveforms were discarded by the overflow policy).
+        Records are aligned to 8 bytes; a record never wraps around the end of the ring.
+    */
+    struct recordHeader {
+      uint32_t size;           ///< total size of the record in bytes including this header and alignment
+      uint16_t board;          ///< index of the board in ringHeader::boardNames
+      uint16_t flags;
+      uint64_t sequence;       ///< running number of published records, gaps indicate lost records
+      uint32_t eventCounter;
+      uint32_t triggerTimeTag;
+      uint32_t channelMask;
+      uint32_t payloadSize;    ///< size of the raw event data in bytes
+    };
+
+    /// rounds up a record size to the alignment of records in the ring
+    inline uint64_t align(uint64_t size){
+      return (size + 7) & ~static_cast<uint64_t>(7);
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,58 @@
+// liveTapReader.hpp
+// client library for online monitors sampling events from cadidaq's shared-memory live data tap
+#ifndef CADIDAQ_LIVETAPREADER_H
+#define CADIDAQ_LIVETAPREADER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <liveTapLayout.hpp>
+
+namespace cadidaq {
+
+  /** /struct liveTapEvent
+      An event copied out of the live data tap.
+  */
+  struct liveTapEvent {
+    uint16_t              board;
+    uint64_t              sequence;
+    uint32_t              eventCounter;
+    uint32_t              triggerTimeTag;
+    uint32_t              channelMask;
+    std::vector<uint32_t> data;  ///< raw event data (header and samples) as read from the board
+  };
+
+  /** /class liveTapReader
+      Attaches read-only to the live data tap published by a running cadidaq instance.
+      Readers never block the acquisition: a reader falling behind by more than the ring size
+      skips ahead to the most recent data and counts the events it missed.
+      Throws std::runtime_error if the tap cannot be attached to.
+  */
+  class liveTapReader {
+  public:
+    liveTapReader(std::string name);
+    ~liveTapReader();
+    /// copies the next event into 'event' and returns true, or returns false if no new event is available (never blocks)
+    bool        next(liveTapEvent& event);
+    /// number of events missed since attaching because the reader fell behind
+    uint64_t    getLost(){return lost;}
+    uint32_t    getPrescale(){return header->prescale;}
+    uint32_t    getNBoards(){return header->nboards;}
+    std::string getBoardName(uint16_t board);
+  private:
+    void        resync();
+
+    std::string                        name;
+    int                                fd;
+    size_t                             segmentSize;
+    const liveTapLayout::ringHeader*   header;
+    const char*                        ring;
+    uint64_t                           capacity;
+    uint64_t                           readPos;
+    uint64_t                           expectedSequence;
+    uint64_t                           lost;
+  };
+}
+
+#endif
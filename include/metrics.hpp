@@ -0,0 +1,205 @@
+// metrics.hpp
+#ifndef CADIDAQ_METRICS_H
+#define CADIDAQ_METRICS_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+namespace cadidaq {
+
+  /** /class counter
+      Run-time counter updated by a single thread on the hot path and read concurrently by the exporter.
+      Updates use relaxed loads/stores instead of read-modify-write operations so that no locked
+      instructions are needed; only one thread may ever update a given counter, unless all of its updates
+      use addShared (a locked instruction, for rare events like errors counted by several threads).
+  */
+  class counter {
+  public:
+    counter() : value(0) {}
+    void     add(uint64_t n = 1){value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);}
+    void     addShared(uint64_t n = 1){value.fetch_add(n, std::memory_order_relaxed);}
+    void     set(uint64_t n){value.store(n, std::memory_order_relaxed);}
+    void     max(uint64_t n){if (n > value.load(std::memory_order_relaxed)) value.store(n, std::memory_order_relaxed);}
+    uint64_t get() const {return value.load(std::memory_order_relaxed);}
+  private:
+    std::atomic<uint64_t> value;
+  };
+
+  /** /struct boardMetrics
+      Counters for a single digitizer, updated by the thread reading out the board.
+  */
+  struct boardMetrics {
+    boardMetrics(std::string name) : name(name) {}
+    /// accounts for a single read call between 'start' and 'end' returning 'nbytes' into a buffer of 'bufferSize' bytes
+    void recordRead(uint32_t nbytes, uint32_t bufferSize, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+    std::string name;
+    counter     events;
+    counter     bytes;
+    counter     readCalls;
+    counter     emptyReads;
+    counter     skippedReads;        ///< reads saved because the board reported no stored events when queried by the scheduler
+    counter     readNanoseconds;
+    counter     maxReadNanoseconds;
+    counter     saturatedReads;      ///< reads filling the readout buffer, i.e. the board was likely holding more data
+    counter     deadNanoseconds;     ///< estimated dead time: time following saturated reads until the next read
+    counter     bufferOccupancy;     ///< occupancy of the readout buffer in the last non-empty read in per mille
+    counter     latencyNanoseconds;  ///< time since the previous read summed over the reads returning data (bound on how long data waited)
+    counter     maxLatencyNanoseconds;
+    counter     errors;
+    counter     pileups;             ///< decoded DPP events flagged as pile-up
+    counter     filteredEvents;      ///< decoded DPP events not selected by the board's event filter
+    // data discarded by the overflow policy (see overflowControl)
+    counter     overflowBuffers;     ///< buffers dispatched while the readout buffers were filled beyond the high watermark
+    counter     droppedEvents;       ///< events in buffers discarded whole (DropOldest)
+    counter     droppedBytes;
+    counter     prescaledEvents;     ///< events discarded by the prescaler (Prescale)
+    counter     strippedBytes;       ///< waveform data discarded keeping the events' features (FeaturesOnly)
+    counter     blockedNanoseconds;  ///< time the readout waited for a free buffer before reading the board
+    // health registers (see healthPoller, the gauges and alarms are updated by the healthMonitor)
+    counter     healthReads;
+    counter     healthForcedReads;   ///< health registers read while the board was due to be read out (as no gap came up in time)
+    counter     healthNanoseconds;
+    counter     healthAlarms;
+    counter     temperature;         ///< highest ADC temperature in degrees Celsius
+    counter     memoryFull;
+    counter     pllLocked;
+    // bookkeeping for the dead-time estimate (only touched by the updating thread)
+    std::chrono::steady_clock::time_point lastRead;
+    bool        lastReadSaturated = false;
+  };
+
+  /** /struct stageMetrics
+      Counters for a processing stage of the acquisition pipeline, updated by the thread running the stage.
+  */
+  struct stageMetrics {
+    stageMetrics(std::string name) : name(name) {}
+    std::string name;
+    counter     items;
+    counter     busyNanoseconds;
+    counter     cpuNanoseconds;      ///< CPU time used by the stage's thread(s), including waiting for work by polling
+    counter     stolen;              ///< items taken over from the queues of other threads (work stealing)
+    counter     errors;
+  };
+
+  /** /struct latencyMetrics
+      Distribution of the latencies of a pipeline stage measured by a single thread (per buffer or batch), in buckets of
+      powers of two from 1 us up to about a minute (the last bucket holds everything beyond). Several threads measuring
+      the same stage (e.g. the readout threads) each register their own, which are exported together.
+      The latencies are differences of now(): CLOCK_MONOTONIC in nanoseconds, read from the time stamp counter through
+      the vDSO in about 20 ns.
+  */
+  struct latencyMetrics {
+    static const uint32_t buckets = 28;
+    latencyMetrics(std::string stage) : stage(stage) {}
+    static uint64_t now(){return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();}
+    /// upper bound of a bucket in nanoseconds (none for the last one)
+    static uint64_t bound(uint32_t bucket){return 1024ull << bucket;}
+    void record(uint64_t nanoseconds){
+      uint64_t us = nanoseconds >> 10;
+      uint32_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+      counts[bucket < buckets ? bucket : buckets - 1].add();
+      total.add();
+      sum.add(nanoseconds);
+    }
+
+    std::string stage;
+    counter     counts[buckets];
+    counter     total;
+    counter     sum;                 ///< of the latencies in nanoseconds
+  };
+
+  /** /struct latencyDistribution
+      The latencies of a stage summed over the threads measuring it, as taken at one point in time.
+  */
+  struct latencyDistribution {
+    void     add(const latencyMetrics& m);
+    /// upper bound (in nanoseconds) of the bucket holding the quantile 'q', i.e. the fraction 'q' of the latencies are shorter
+    uint64_t quantile(double q) const;
+    double   mean() const {return total ? static_cast<double>(sum) / total : 0;}
+
+    uint64_t counts[latencyMetrics::buckets] = {};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+  };
+
+  class traceRecorder;
+
+  /** /class metrics
+      Registry of all run-time counters. Boards and stages are registered before the acquisition
+      starts; the returned references stay valid for the lifetime of the registry.
+  */
+  class metrics {
+  public:
+    boardMetrics& addBoard(std::string name);
+    stageMetrics& addStage(std::string name);
+    latencyMetrics& addLatency(std::string stage);
+    /// the stages with latencies in the order they were registered first
+    std::vector<std::string> getLatencyStages() const;
+    latencyDistribution getLatency(const std::string& stage) const;
+    /// takes a snapshot of all counters to derive rates since the previous snapshot
+    void          sample();
+    /// renders all counters and rates in the Prometheus text exposition format
+    std::string   prometheus();
+    /// measures the cost of the bookkeeping done per read call (in nanoseconds)
+    static double measureOverhead();
+    void          setOverhead(double nanoseconds){overhead = nanoseconds;}
+  private:
+    struct rates {
+      double events = 0;
+      double bytes = 0;
+      double emptyReads = 0;
+      double deadFraction = 0;
+      uint64_t lastEvents = 0;
+      uint64_t lastBytes = 0;
+      uint64_t lastEmpty = 0;
+      uint64_t lastDead = 0;
+    };
+    std::deque<boardMetrics> boards;
+    std::deque<stageMetrics> stages;
+    std::deque<latencyMetrics> latencies;
+    std::deque<rates>        boardRates;
+    std::chrono::steady_clock::time_point lastSample;
+    double                   overhead = 0;
+  };
+
+  /** /class metricsExporter
+      Background thread exporting the metrics registry, either by serving the Prometheus text format
+      via HTTP on localhost or by periodically (re-)writing a file (e.g. for node_exporter's textfile collector).
+      With a trace recorder, 'GET /trace?seconds=N' records the pipeline for the next N seconds (default 1, at most
+      60) and answers with the trace, one at a time; the metrics are served meanwhile.
+  */
+  class metricsExporter {
+  public:
+    metricsExporter(metrics& registry, uint16_t port, std::string file, uint32_t interval, traceRecorder* trace = nullptr);
+    ~metricsExporter();
+  private:
+    void run();
+    void serve(int connection);
+    /// sends the trace recorded to the connection waiting for it
+    void finishTrace();
+    void writeFile();
+
+    metrics&          registry;
+    uint16_t          port;
+    std::string       file;
+    uint32_t          interval;
+    int               listenSocket;
+    traceRecorder*    trace;
+    int               traceConnection;  ///< waiting for the trace being recorded (or -1)
+    std::chrono::steady_clock::time_point traceEnd;
+    std::atomic<bool> stop;
+    std::thread       thread;
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+  };
+}
+
+#endif
@@ -0,0 +1,59 @@
+// overflowControl.hpp
+#ifndef CADIDAQ_OVERFLOWCONTROL_H
+#define CADIDAQ_OVERFLOWCONTROL_H
+
+#include <vector>
+#include <cstdint>
+
+#include <digitizer.hpp>
+#include <metrics.hpp>
+#include <dppEvents.hpp>
+#include <readoutQueue.hpp>
+
+namespace cadidaq {
+
+  /** /class overflowControl
+      Applies the boards' overflow policies to the buffers handed to the processing while more than the high
+      watermark of a readout thread's buffers are in use (queued, being processed or handed on), until the
+      fill level has fallen back to the low watermark:
+       - Block:        nothing is discarded; once all buffers are in use the readout waits for one to be released
+                       and the board fills up and eventually goes busy (dead time)
+       - DropOldest:   the buffers waiting longest to be processed are discarded whole, so that the readout goes on
+       - Prescale:     only every N-th event is processed and handed on
+       - FeaturesOnly: the events are processed, but only their features (header, decoded DPP values) are handed on
+      Everything discarded is counted exactly per board (boardMetrics) to correct losses offline.
+      Used by the thread dispatching the buffers only; never allocates after construction.
+  */
+  class overflowControl {
+  public:
+    /// what to do with a buffer
+    struct decision {
+      bool     drop;
+      uint32_t prescale;
+      bool     featuresOnly;
+    };
+
+    /** for boards with the given policies, prescale factors and DPP formats; the watermarks are fractions of the buffers
+        of the pool a buffer comes from */
+    overflowControl(const std::vector<overflowPolicy>& policies, const std::vector<uint32_t>& prescales, const std::vector<dppFormat>& formats,
+                    const std::vector<boardMetrics*>& stats, double highWatermark, double lowWatermark);
+    /// decides on a buffer about to be processed
+    decision decide(const readoutQueue::item& item);
+    /// discards a buffer whole: counts its events and releases it
+    void     drop(const readoutQueue::item& item);
+  private:
+    struct poolState {
+      const bufferPool* pool;
+      bool              overflowing;
+    };
+    std::vector<overflowPolicy> policies;
+    std::vector<uint32_t>       prescales;
+    std::vector<dppFormat>      formats;
+    std::vector<boardMetrics*>  stats;
+    std::vector<poolState>      pools;
+    double                      highWatermark;
+    double                      lowWatermark;
+  };
+}
+
+#endif
@@ -0,0 +1,178 @@
+// processingPool.hpp
+#ifndef CADIDAQ_PROCESSINGPOOL_H
+#define CADIDAQ_PROCESSINGPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <cstdint>
+
+#include <event.hpp>
+#include <dppEvents.hpp>
+#include <eventFilter.hpp>
+#include <metrics.hpp>
+#include <traceRecorder.hpp>
+#include <affinity.hpp>
+#include <readoutQueue.hpp>
+
+namespace cadidaq {
+
+  /** /class processingPool
+      Worker threads decoding and processing the readout buffers in parallel. Each buffer is split into
+      batches of whole events which are spread over the workers' task queues; a worker takes the oldest
+      task of its own queue and, once that is empty, steals the newest one of another worker, so that
+      uneven loads from the boards are balanced. The buffers of each board are numbered in the order
+      they are submitted and delivered in that order once all their batches are done, one buffer at a
+      time, so that everything downstream sees each board's events in the order they were read. The
+      deliveries (and onBatch) run outside the pool's lock and by one thread at a time: the thread that
+      finds buffers done while no other is delivering delivers them, and those of all boards finished
+      meanwhile, while the other workers carry on with their batches; a slow consumer thus holds up
+      only the delivering thread.
+      The list-mode events of boards with DPP firmware can be decoded by the workers into one dppEventBatch
+      per batch, which are handed on with their buffer in the same order, reduced to the events selected by
+      the board's eventFilter if it has one.
+      Under back-pressure a buffer can be submitted prescaled (only every N-th event of the board, counted
+      over its buffers, is processed and handed on) or for its events' features only (see overflowControl).
+      All memory is allocated on construction (and by decodeDPP); submitting and processing never allocate,
+      unless the DPP events of a batch need more room than its shortest events would.
+  */
+  class processingPool {
+  public:
+    /// called by the workers for each event of their batches (concurrently for different batches)
+    typedef std::function<void(const eventHeader&)> eventFunction;
+    /// outcome of processing a buffer
+    struct result {
+      uint64_t sequence;       ///< number of the buffer among the board's buffers
+      uint32_t nevents;        ///< events processed (and to be handed on)
+      uint32_t discarded;      ///< events discarded by the prescaler
+      uint32_t filtered;       ///< decoded events not selected by the board's event filter
+      uint64_t strippedBytes;  ///< waveform data of the processed events not to be handed on (features only)
+      uint64_t firstEvent;     ///< index of the buffer's first event (DPP: aggregate) among the board's events
+      uint32_t prescale;       ///< events with index % prescale == 0 were kept
+      bool     featuresOnly;
+      // times along the pipeline (latencyMetrics::now())
+      uint64_t readTime;       ///< the buffer was read (see readoutQueue::item)
+      uint64_t submitted;
+      uint64_t processed;      ///< its last batch was done
+      uint64_t delivering;     ///< its delivery began (with the first call of onBatch)
+    };
+    /// called for each finished buffer
+    typedef std::function<void(const readoutQueue::item&, const result&)> deliverFunction;
+    /** called for each decoded event batch of a finished buffer (before its delivery, with its result), in order; the batch
+        can be taken over by swapping it with a spare one, whose storage the pool then decodes into */
+    typedef std::function<void(dppEventBatch& batch, const result&)> batchFunction;
+
+    /** starts 'workers' threads on the given CPUs (any if empty) for up to 'maxBuffers' buffers of at most
+        'maxBufferSize' bytes in flight, split into batches of about 'batchBytes' bytes */
+    processingPool(uint32_t workers, uint32_t nboards, uint32_t maxBuffers, uint32_t maxBufferSize, uint32_t batchBytes,
+                   const affinity::cpuList& cpus, const std::vector<stageMetrics*>& workerStats,
+                   deliverFunction deliver, eventFunction process = nullptr);
+    ~processingPool();
+    processingPool(const processingPool&) = delete;
+    processingPool& operator=(const processingPool&) = delete;
+
+    /** splits the buffer into batches and queues them for the workers, keeping only every 'prescale'-th event
+        and (if 'featuresOnly') marking the waveforms to be discarded; never blocks */
+    void     submit(const readoutQueue::item& item, uint32_t prescale = 1, bool featuresOnly = false);
+    /** decodes the list-mode events of the boards with the given formats (indexed by board) into event batches
+        passed to 'onBatch' (instead of counting the board aggregates as events); to be called before submitting */
+    void     decodeDPP(const std::vector<dppFormat>& formats, batchFunction onBatch);
+    /** removes the decoded events not selected by the boards' filters (indexed by board, nullptr for none) from their
+        batches; to be called after decodeDPP and before submitting, the filters have to outlive the pool */
+    void     filterDPP(const std::vector<const eventFilter*>& filters);
+    /** measures the time each worker takes for a batch into its 'latency' (indexed by worker) and records the batches as
+        spans of the worker's 'traceThreads' in 'trace' (if not nullptr); to be called before submitting */
+    void     traceLatency(const std::vector<latencyMetrics*>& latency, traceRecorder* trace, const std::vector<uint32_t>& traceThreads);
+    /// waits until all submitted buffers have been delivered
+    void     drain();
+    /// stops the workers (after draining)
+    void     stop();
+    uint32_t getWorkers() const {return workers.size();}
+    /// heap allocations of a worker after its first batch (only counted in the allocation accounting build), available after stop()
+    uint64_t getSteadyAllocations(uint32_t worker) const {return workers[worker].steadyAllocations;}
+    uint64_t getSteadyIterations(uint32_t worker) const {return workers[worker].steadyIterations;}
+  private:
+    struct task {
+      uint32_t job;
+      uint32_t part;   ///< index of the batch in the buffer
+      uint64_t firstEvent;
+      uint32_t offset;
+      uint32_t nbytes;
+    };
+    /// ring of tasks, only accessed with the worker's mutex held
+    struct worker {
+      std::vector<task> tasks;
+      size_t            head = 0;
+      size_t            count = 0;
+      std::mutex        mutex;
+      stageMetrics*     stats = nullptr;
+      latencyMetrics*   latency = nullptr;
+      uint32_t          traceThread = 0;
+      eventFilter::workspace filterSpace;
+      std::thread       thread;
+      bool              steady = false;
+      uint64_t          steadyAllocations = 0;
+      uint64_t          steadyIterations = 0;
+    };
+    /// a submitted buffer
+    struct job {
+      readoutQueue::item    item;
+      uint64_t              sequence;
+      std::atomic<uint32_t> remaining;  ///< batches not yet processed (plus one while being submitted)
+      std::atomic<uint32_t> nevents;
+      std::atomic<uint32_t> discarded;
+      std::atomic<uint32_t> filtered;
+      std::atomic<uint64_t> strippedBytes;
+      uint64_t              firstEvent;
+      uint32_t              prescale;
+      bool                  featuresOnly;
+      uint32_t              nparts;     ///< number of batches (set once all are queued)
+      uint64_t              submitted;
+      std::atomic<uint64_t> processed;  ///< latest end of its batches
+      std::vector<dppEventBatch> batches; ///< decoded events of each batch (DPP boards only)
+    };
+
+    void run(uint32_t w);
+    bool take(uint32_t w, task& t);
+    /// delivers the jobs that are done, in order per board (called whenever a job is done)
+    void finish();
+
+    std::vector<worker>     workers;
+    std::vector<job>        jobs;
+    std::vector<uint32_t>   freeJobs;     ///< protected by deliverMutex
+    /// per board ring of its jobs in submission order, protected by deliverMutex
+    std::vector<uint32_t>   order;
+    std::vector<uint32_t>   orderHead;
+    std::vector<uint32_t>   orderCount;
+    std::vector<uint32_t>   readyHead;    ///< per board, buffers taken from its ring for delivery (delivering thread only)
+    std::vector<uint32_t>   readyCount;
+    std::vector<uint64_t>   nextSequence; ///< next sequence number to assign per board (submitting thread only)
+    std::vector<uint64_t>   nextEvent;    ///< index of the next event submitted per board (submitting thread only)
+    uint32_t                maxBuffers;
+    uint32_t                maxParts;     ///< largest number of batches a buffer is split into
+    uint32_t                batchBytes;
+    uint32_t                nextWorker;   ///< worker to queue the next batch on (submitting thread only)
+    affinity::cpuList       cpus;
+    deliverFunction         deliver;
+    eventFunction           process;
+    std::vector<dppFormat>  formats;      ///< per board, empty if none is decoded
+    std::vector<const eventFilter*> filters; ///< per board, empty if none is filtered
+    batchFunction           onBatch;
+    traceRecorder*          trace;
+    // sleeping workers wait for tasks, drain() for deliveries
+    std::mutex              idleMutex;
+    std::condition_variable workAvailable;
+    std::atomic<uint64_t>   queued;
+    bool                    stopping;
+    std::mutex              deliverMutex;
+    std::condition_variable delivered;
+    uint32_t                inFlight;     ///< jobs submitted but not delivered, protected by deliverMutex
+    bool                    delivering;   ///< a thread is delivering, protected by deliverMutex
+    bool                    redeliver;    ///< buffers may have been done meanwhile, protected by deliverMutex
+  };
+}
+
+#endif
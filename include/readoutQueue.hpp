@@ -0,0 +1,44 @@
+// readoutQueue.hpp
+#ifndef CADIDAQ_READOUTQUEUE_H
+#define CADIDAQ_READOUTQUEUE_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+#include <bufferPool.hpp>
+
+namespace cadidaq {
+
+  /** /class readoutQueue
+      Hands the buffers filled by the readout threads on to the processing stage, in the order they were
+      read (and thereby in order for each board, as every board is read by a single thread). The queue
+      never holds more entries than there are buffers in the pool, so it is allocated once and pushing
+      neither blocks nor fails.
+  */
+  class readoutQueue {
+  public:
+    struct item {
+      uint32_t           board;   ///< index of the board the data was read from
+      bufferPool*        pool;    ///< pool of the thread that read the board, to release the buffer to
+      bufferPool::handle buffer;
+      uint32_t           nbytes;
+      uint64_t           readTime; ///< when the read call returned (latencyMetrics::now(), 0 if not known)
+    };
+
+    readoutQueue(uint32_t capacity);
+    void   push(const item& i);
+    /// takes the oldest item, waiting up to 'timeout' for one to arrive; returns false if there is none
+    bool   pop(item& i, std::chrono::microseconds timeout);
+  private:
+    std::vector<item>       ring;
+    size_t                  head;
+    size_t                  count;
+    std::mutex              mutex;
+    std::condition_variable pushed;
+  };
+}
+
+#endif
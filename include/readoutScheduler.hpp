@@ -0,0 +1,68 @@
+// readoutScheduler.hpp
+#ifndef CADIDAQ_READOUTSCHEDULER_H
+#define CADIDAQ_READOUTSCHEDULER_H
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include <digitizer.hpp>
+#include <metrics.hpp>
+#include <healthMonitor.hpp>
+
+namespace cadidaq {
+
+  /** /class readoutScheduler
+      Decides which of the boards read out by a thread is read next and how the thread waits in between,
+      following each board's readout mode:
+       - Poll:     the board is read again immediately (busy polling, lowest latency, burns a core)
+       - IRQ:      the board is read until it has no data left, then the thread waits for its interrupt
+       - Adaptive: the time until the next read follows the observed data rate so that the readout
+                   buffer is filled to about a quarter, it is shortened as soon as the occupancy grows
+                   and backs off exponentially while the board has no data
+      No board is left unread for longer than its ReadoutMaxIntervalUs.
+      When several boards are due at once (e.g. all boards daisy-chained on one link), their event memory
+      occupancy is queried and they are served in a round, fullest first; boards reporting no stored events
+      are skipped without a block transfer. Every board due at the start of a round is served before any
+      board is considered again, and ties are broken by how long the boards have been overdue.
+      The gaps between reads are offered to a healthPoller, whose register reads thus share the link with the
+      block transfers without competing with them.
+  */
+  class readoutScheduler {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    readoutScheduler(const std::vector<digitizer*>& boards, const std::vector<boardMetrics*>& stats, healthPoller* health = nullptr);
+    /// waits until a board is due to be read (but not beyond 'deadline') and returns its index, or -1 if none is due yet
+    int  next(clock::time_point deadline);
+    /// accounts for a read of board 'i' returning 'nbytes' into a buffer of 'bufferSize' bytes and plans its next read
+    void record(int i, uint32_t nbytes, uint32_t bufferSize);
+    /** accounts for a read of board 'i' that could not take place for want of a readout buffer: the board keeps
+        filling up meanwhile, so it is read as soon as a buffer is released (the adaptive interval is reset) */
+    void stalled(int i);
+    /// CPU time used by the calling thread in nanoseconds
+    static uint64_t threadCpuTime();
+  private:
+    struct boardState {
+      readoutMode              mode;
+      std::chrono::nanoseconds maxInterval;
+      std::chrono::nanoseconds interval;  ///< current interval of the adaptive mode
+      clock::time_point        due;
+      clock::time_point        lastRead;
+      double                   rate;      ///< bytes per nanosecond (moving average) for the adaptive mode
+    };
+    std::vector<digitizer*>    boards;
+    std::vector<boardMetrics*> stats;
+    healthPoller*              health;
+    /// orders the boards of a new round by priority and drops those without data; returns false if none is left
+    bool prioritise(clock::time_point now);
+
+    std::vector<boardState>    state;
+    std::vector<int>           round;     ///< boards to serve in the current round, in order
+    std::vector<double>        priority;
+    size_t                     position;  ///< next board of the round to serve
+    bool                       anyIRQ;
+  };
+}
+
+#endif
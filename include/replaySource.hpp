@@ -0,0 +1,87 @@
+// replaySource.hpp
+#ifndef CADIDAQ_REPLAYSOURCE_H
+#define CADIDAQ_REPLAYSOURCE_H
+
+#include <string>
+#include <vector>
+#include <memory>    // unique_ptr
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+#include <dataFileReader.hpp>
+#include <dppEvents.hpp>
+#include <bufferPool.hpp>
+#include <readoutQueue.hpp>
+#include <metrics.hpp>
+
+namespace cadidaq {
+
+  /** /class replaySource
+      Replays the raw events recorded in data files (see fileWriter) as if they were read from the boards: each record
+      is copied into a readout buffer and queued like the buffers of a readout thread, so that the data passes through
+      the same dispatching, overflow control, processing and delivery as during a run. This reprocesses old runs with
+      new settings and gives a reproducible benchmark of the throughput of the whole pipeline.
+      The records are replayed in the order they were written, either as fast as the pipeline takes them or at the pace
+      they were written (scaled by a speed factor). The boards are those of the files, told apart by name, so that the
+      files of several runs can be replayed together. Records of decoded DPP events (FeaturesOnly) cannot be fed back
+      and are skipped.
+      Throws std::runtime_error if a file cannot be read or the files hold no raw events.
+  */
+  class replaySource {
+  public:
+    /// for the given files (replayed by run and file number); 'speed' is the pace relative to the recording, 0 for as fast as possible
+    replaySource(const std::vector<std::string>& paths, double speed);
+    replaySource(const replaySource&) = delete;
+    replaySource& operator=(const replaySource&) = delete;
+
+    const std::vector<std::string>& getBoardNames() const {return boardNames;}
+    const std::vector<dppFormat>&   getDPPFormats() const {return formats;}
+    /// configuration of the boards recorded in the first file (.ini format)
+    std::string getConfiguration() const;
+    /// payload of the largest record, i.e. the size of the readout buffers needed
+    uint32_t    getMaxRecordBytes() const {return maxRecordBytes;}
+
+    /** queues the next record in a buffer of 'pool', waiting for its time and for a free buffer, and accounts it as a
+        read of its board. returns false once all records are replayed or when 'stop' is set; never allocates */
+    bool        next(bufferPool& pool, readoutQueue& queue, const std::vector<boardMetrics*>& stats, const std::atomic<bool>& stop);
+    /// whether all records have been replayed (asked by the thread dispatching the buffers)
+    bool        isFinished() const {return finished.load(std::memory_order_acquire);}
+    uint64_t    getRecords() const {return records;}
+    uint64_t    getBytes() const {return bytes;}
+    /// records skipped as they hold decoded DPP events
+    uint64_t    getSkipped() const {return skipped;}
+    /// records dropped as their board is not one of their file's (beyond the boards it names)
+    uint64_t    getDroppedBoards() const {return droppedBoards;}
+  private:
+    typedef std::chrono::steady_clock clock;
+    struct replayFile {
+      std::unique_ptr<dataFileReader> reader;
+      std::vector<uint32_t>           boards;  ///< index of each of the file's boards among all replayed
+    };
+
+    std::vector<replayFile>  files;
+    std::vector<std::string> boardNames;
+    std::vector<dppFormat>   formats;
+    double                   speed;
+    uint32_t                 maxRecordBytes;
+
+    // position of the replay (replaying thread)
+    size_t                   currentFile;
+    size_t                   currentEntry;
+    bool                     paced;        ///< whether 'start' has been set for the run of the current file
+    clock::time_point        start;        ///< time the run being replayed would have started at
+    uint64_t                 records;
+    uint64_t                 bytes;
+    uint64_t                 skipped;
+    uint64_t                 droppedBoards;
+    std::atomic<bool>        finished;
+
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+  };
+}
+
+#endif
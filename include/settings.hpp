@@ -2,11 +2,15 @@
 #ifndef CADIDAQ_SETTINGS_H
 #define CADIDAQ_SETTINGS_H
 
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>    // shared_ptr
+
 #include <boost/property_tree/ptree.hpp>
 #include <boost/optional.hpp>
 
-#include <boost/bimap.hpp>
-
 #include <boost/log/trivial.hpp>
 #include <boost/log/sources/severity_channel_logger.hpp>
 
@@ -14,14 +18,76 @@
 #include <CAENDigitizerType.h>
 #include <caen.hpp>
 
+#include <channelValues.hpp>
+#include <snapshot.hpp>
+
 namespace pt = boost::property_tree;
 
 namespace cadidaq {
+  class settingsSection;
+  class settingsIndex;
   class settingsBase;
+  class daqSettings;
   class connectionSettings;
   class registerSettings;
 }
 
+/** /class settingsSection
+   Keys of one config section, each tokenized once into its normalized (lower-case) setting name and
+   the optional channel/address range given in brackets. Sections are immutable once indexed, so that
+   the general section and templates can be shared by the indices of all boards inheriting from them.
+   Keys given more than once in the section keep the last value.
+ */
+class cadidaq::settingsSection {
+public:
+  struct entry {
+    std::string key;      ///< key as given in the config file
+    std::string normKey;  ///< lower-case key without whitespace, identifies duplicates
+    std::string range;    ///< content of the brackets following the setting name
+    bool        hasRange;
+    std::string value;
+  };
+  /// indexes the keys of the section, which inherits all keys it does not give itself from 'parent'
+  settingsSection(const pt::iptree& node, std::shared_ptr<const settingsSection> parent = nullptr);
+  /// returns the section's own entries for the normalized setting name, or nullptr if there are none
+  const std::vector<entry>* find(const std::string& normName) const;
+  const std::vector<std::string>& getNames() const {return names;}
+  std::shared_ptr<const settingsSection> getParent() const {return parent;}
+private:
+  std::unordered_map<std::string, std::vector<entry>> entries;
+  std::vector<std::string> names; ///< setting names in the order of their first appearance
+  std::shared_ptr<const settingsSection> parent;
+};
+
+/** /class settingsIndex
+   Index of the keys of one or several layered config sections (e.g. general section, template(s) and
+   the board's own section), so that settings can look up their keys directly instead of scanning the
+   sections. Keys of later layers override those of earlier ones; the (shared) sections are never
+   copied or modified, only the keys used by any setting are recorded here and the others can be
+   reported as unknown afterwards.
+ */
+class cadidaq::settingsIndex {
+public:
+  typedef settingsSection::entry entry;
+  settingsIndex(){}
+  settingsIndex(const pt::iptree& node){add(node);}
+  /// adds all keys of a section on top of those already present (e.g. from the general section)
+  void add(const pt::iptree& node);
+  /// adds the keys of a shared section (including those it inherits) on top of those already present
+  void add(std::shared_ptr<const settingsSection> section);
+  /// returns all effective entries for the given setting name in the order they were added
+  std::vector<const entry*> find(const std::string& settingName) const;
+  void markUsed(const entry* e){used.insert(e);}
+  /// returns the effective entries that have not been used by any setting
+  std::vector<const entry*> unused() const;
+  size_t size() const;
+private:
+  /// merges the entries for the normalized setting name from all layers
+  std::vector<const entry*> lookup(const std::string& normName) const;
+  std::vector<std::shared_ptr<const settingsSection>> layers; ///< from the least to the most specific
+  std::unordered_set<const entry*> used;
+};
+
 /** /class settingsBase
    Base class to hold settings values and provide methods to parse (and output again) boost's property trees for values and verify them for consistency.
  */
@@ -29,7 +95,11 @@ class cadidaq::settingsBase {
 public:
   settingsBase(std::string name);
   ~settingsBase(){;}
-  void parse(pt::iptree *node);
+  /// reads the settings from the indexed config section(s), marking the keys used
+  void parse(settingsIndex& index);
+  /// writes the (verified) settings to / reads them back from a binary configuration snapshot
+  void store(snapshotWriter& out);
+  void load(snapshotReader& in);
   pt::iptree* createPTree();
   void fillPTree(pt::iptree *node);
   virtual void verify(){};
@@ -41,29 +111,97 @@ public:
   using option = std::pair< boost::optional<T>, std::string >;
 
   template<class T>
-  using Vec = std::vector< boost::optional<T> >;
+  using Vec = channelValues<T>;
 
   template<class T>
   using optionVector = std::pair< Vec<T>, std::string >;
 
 protected:
   std::string name;
+  /// index of the config keys while parsing (when READING, settings are looked up here rather than in the node)
+  settingsIndex* index;
+  /// snapshot written/read while STORING/LOADING
+  snapshotWriter* snapshotOut;
+  snapshotReader* snapshotIn;
   boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
-  enum class parseDirection {READING, WRITING};
+  enum class parseDirection {READING, WRITING, STORING, LOADING};
   enum class parseFormat {DEFAULT, HEX, CAENEnum};
   template <class VALUE> void parseSetting(std::string settingName, pt::iptree *node, boost::optional<VALUE>& settingValue, parseDirection direction, parseFormat format = parseFormat::DEFAULT);
-  template <typename VALUE> void parseSetting(std::string settingName, pt::iptree *node, std::vector<boost::optional<VALUE>>& settingValue, parseDirection direction, parseFormat format = parseFormat::DEFAULT);
+  template <typename VALUE> void parseSetting(std::string settingName, pt::iptree *node, channelValues<VALUE>& settingValue, parseDirection direction, parseFormat format = parseFormat::DEFAULT);
   /// overloaded methods using combined settings/setting's name nomenclature
   template <class VALUE> void parseSetting(option<VALUE>& setting, pt::iptree *node, parseDirection direction, parseFormat format = parseFormat::DEFAULT);
   template <typename VALUE> void parseSetting(optionVector<VALUE>& setting, pt::iptree *node, parseDirection direction, parseFormat format = parseFormat::DEFAULT);
   /// method to parse arbitrary register address-value pairs
   void parseRegisters(pt::iptree *node, std::vector< std::pair< uint32_t, uint32_t >>& registers, parseDirection direction);
+  /// encode/decode a setting in the binary snapshot (STORING/LOADING)
+  template <class VALUE> void snapshotSetting(const std::string& settingName, boost::optional<VALUE>& settingValue, parseDirection direction);
+  template <class VALUE> void snapshotSetting(const std::string& settingName, channelValues<VALUE>& settingValue, parseDirection direction);
+  /// checks a set of CPUs (see affinity::parse), unsetting it if invalid
+  void verifyCPUs(option<std::string>& setting);
 
 private:
   virtual void processPTree(pt::iptree *node, parseDirection direction){};
 };
 
 
+/** /class daqSettings
+    Class to hold settings of the DAQ application itself (from the [CADIDAQ] section)
+*/
+class cadidaq::daqSettings : public settingsBase {
+public:
+  daqSettings(std::string name);
+  ~daqSettings(){;}
+
+  void verify();
+
+  /// run control
+  option<uint32_t>                          runDuration;
+
+  /// shared-memory live data tap for online monitors
+  option<std::string>                       liveTapName;
+  option<uint32_t>                          liveTapSize;
+  option<uint32_t>                          liveTapPrescale;
+
+  /// readout buffers (per board) in the buffer pool
+  option<uint32_t>                          readoutBuffers;
+  /// largest number of readout threads (0: one per link or 'ReadoutThread' name)
+  option<uint32_t>                          readoutThreads;
+
+  /// CPUs (or NUMA nodes) of the readout threads (unless set for their boards), of the processing stage and of the
+  /// threads writing the data files and streaming
+  option<std::string>                       readoutCPUs;
+  option<std::string>                       processingCPUs;
+  option<std::string>                       writerCPUs;
+
+  /// parallel processing: number of worker threads and size of the batches of events the readout buffers are split into
+  option<uint32_t>                          processingThreads;
+  option<uint32_t>                          processingBatchSize;
+
+  /// overflow control: fill levels (percent of a readout thread's buffers in use) at which the boards' overflow policies start and stop applying
+  option<uint32_t>                          overflowHighWatermark;
+  option<uint32_t>                          overflowLowWatermark;
+
+  /// data files: path and name prefix, limits of a file (size in MB, events, seconds) and command compressing the finished files
+  option<std::string>                       outputFile;
+  option<uint32_t>                          outputRotateSize;
+  option<uint32_t>                          outputRotateEvents;
+  option<uint32_t>                          outputRotateTime;
+  option<std::string>                       outputCompress;
+
+  /// streaming to an event builder: receiver ("host:port" or "unix:/path"), size of the batches sent (kB) and longest time data waits for a batch to fill up (ms)
+  option<std::string>                       streamTarget;
+  option<uint32_t>                          streamBatchSize;
+  option<uint32_t>                          streamMaxDelay;
+
+  /// run-time metrics export
+  option<uint32_t>                          metricsPort;
+  option<std::string>                       metricsFile;
+  option<uint32_t>                          metricsInterval;
+
+private:
+  virtual void processPTree(pt::iptree *node, parseDirection direction);
+};
+
 /** /class connectionSettings
     Class to hold settings specifically needed for establishing a link to a digitizer
 */
@@ -98,6 +236,16 @@ public:
 
   /// data readout settings
   option<uint32_t>                          maxNumEventsBLT;
+  option<std::string>                       readoutSizing;       ///< "Manual", "Auto" or "Calibrate": how the events per block transfer/aggregate are chosen
+  option<std::string>                       readoutMode;         ///< "Adaptive", "Poll" or "IRQ"
+  option<uint32_t>                          readoutMaxInterval;  ///< longest time between reads (adaptive backoff, IRQ wait) in microseconds
+  option<uint32_t>                          readoutIRQEvents;    ///< number of events stored on the board raising an interrupt
+  option<std::string>                       readoutThread;       ///< name of the thread reading out the board (default: one thread per link)
+  option<std::string>                       readoutCPUs;         ///< CPUs (or NUMA nodes) the board's readout thread runs on
+  option<std::string>                       overflowPolicy;      ///< "Block", "DropOldest", "Prescale" or "FeaturesOnly"
+  option<uint32_t>                          overflowPrescale;    ///< events kept (one in N) by the "Prescale" policy
+  option<std::string>                       eventFilter;         ///< expression selecting the decoded DPP events handed on (see eventFilter)
+  option<uint32_t>                          healthInterval;      ///< time between two polls of the board's health registers in milliseconds (0: none)
 
   /// trigger settings
   option<CAEN_DGTZ_TriggerMode_t>           swTriggerMode;
@@ -122,6 +270,7 @@ public:
   optionVector<CAEN_DGTZ_PulsePolarity_t>   dppChPulsePolarity;
   option<caen::DPPAcquisitionMode>           dppAcqMode;
   option<CAEN_DGTZ_DPP_TriggerMode_t>       dppTriggermode;
+  option<uint32_t>                          dppEventAggregation; ///< events per aggregate (0: chosen by the library)
 
 private:
   virtual void processPTree(pt::iptree *node, parseDirection direction);
@@ -0,0 +1,99 @@
+// snapshot.hpp
+// binary snapshots of a validated configuration for starting without re-parsing the ini file
+#ifndef CADIDAQ_SNAPSHOT_H
+#define CADIDAQ_SNAPSHOT_H
+
+#include <string>
+#include <cstring>     // memcpy
+#include <cstdint>
+#include <stdexcept>   // exceptions
+#include <type_traits>
+
+namespace cadidaq {
+
+  namespace snapshotLayout {
+    const char     magic[8] = {'C', 'A', 'D', 'I', 'S', 'N', 'A', 'P'};
+    /// to be increased whenever the encoding or the order of the settings changes
+    const uint32_t version  = 12;
+
+    /// file header, followed by 'payloadSize' bytes of encoded settings
+    struct fileHeader {
+      char     magic[8];
+      uint32_t version;
+      uint32_t payloadChecksum;  ///< CRC-32 of the payload
+      uint64_t payloadSize;
+      uint64_t sourceSize;       ///< size of the ini file the snapshot was compiled from
+      uint32_t sourceChecksum;   ///< CRC-32 of that ini file
+      uint32_t reserved;
+      int64_t  created;          ///< time of creation (seconds since the epoch)
+    };
+  }
+
+  /// CRC-32 of the given bytes (used to validate snapshots and to identify their source)
+  uint32_t checksum(const char* data, size_t size);
+
+  /** /class snapshotWriter
+      Collects the encoded settings of a configuration and writes them to a snapshot file.
+  */
+  class snapshotWriter {
+  public:
+    template <typename T>
+    void put(const T& value){
+      static_assert(std::is_trivially_copyable<T>::value, "only plain values can be stored in a snapshot");
+      data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    void put(const std::string& str){
+      put(static_cast<uint32_t>(str.size()));
+      data.append(str);
+    }
+    /// writes the snapshot (atomically replacing an existing file); throws std::runtime_error on failure
+    void save(const std::string& file, uint64_t sourceSize, uint32_t sourceChecksum);
+    size_t size(){return data.size();}
+  private:
+    std::string data;
+  };
+
+  /** /class snapshotReader
+      Memory-maps a snapshot file and decodes its settings in the order they were written.
+      Throws std::runtime_error if the file cannot be read, is damaged, was written by an
+      incompatible version or if decoding runs past its end.
+  */
+  class snapshotReader {
+  public:
+    snapshotReader(const std::string& file);
+    ~snapshotReader();
+    /// tests whether the snapshot was compiled from an ini file with the given size and checksum
+    bool    matchesSource(uint64_t size, uint32_t checksum) const;
+    int64_t getCreated() const {return header->created;}
+    template <typename T>
+    void get(T& value){
+      static_assert(std::is_trivially_copyable<T>::value, "only plain values can be read from a snapshot");
+      need(sizeof(T));
+      std::memcpy(&value, pos, sizeof(T));
+      pos += sizeof(T);
+    }
+    void get(std::string& str){
+      uint32_t size;
+      get(size);
+      need(size);
+      str.assign(pos, size);
+      pos += size;
+    }
+    /// reads a setting's name and throws if it differs from the expected one
+    void expect(const std::string& name);
+  private:
+    void need(size_t n){
+      if (static_cast<size_t>(end - pos) < n)
+        throw std::runtime_error("Snapshot '" + file + "' is truncated");
+    }
+
+    std::string                         file;
+    void*                               mapping;
+    size_t                              mappingSize;
+    const snapshotLayout::fileHeader*   header;
+    const char*                         pos;
+    const char*                         end;
+  };
+}
+
+#endif
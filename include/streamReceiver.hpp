@@ -0,0 +1,66 @@
+// streamReceiver.hpp
+// receiving end of the data streams sent by cadidaq (see streamSink), for event builders and monitors
+#ifndef CADIDAQ_STREAMRECEIVER_H
+#define CADIDAQ_STREAMRECEIVER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include <dataFileLayout.hpp>
+
+namespace cadidaq {
+
+  /** /class streamReceiver
+      Listens for the data stream of cadidaq (over TCP or a Unix domain socket) and hands out its records. A stream
+      has the layout of a data file without the index (see dataFileLayout): the file header with the configuration
+      of the boards, then the records, each raw events read from a board or a batch of decoded DPP events.
+      The records' write times tell when they were sent, in nanoseconds from the header's run start.
+      Throws std::runtime_error if it cannot listen at the address.
+  */
+  class streamReceiver {
+  public:
+    /// listens at "host:port" (port 0: any free one) or "unix:/path"
+    streamReceiver(const std::string& address);
+    ~streamReceiver();
+    streamReceiver(const streamReceiver&) = delete;
+    streamReceiver& operator=(const streamReceiver&) = delete;
+
+    /// address listened at (with the port chosen)
+    std::string getAddress() const {return address;}
+    /** waits up to 'timeout' for a sender to connect (replacing the current one) and reads the header of its stream.
+        returns false if none connected or its stream does not start with a header of a compatible version */
+    bool        accept(std::chrono::milliseconds timeout);
+    const dataFileLayout::fileHeader& getHeader() const {return header;}
+    std::string getBoardName(uint16_t board) const;
+    /// configuration of the boards (.ini format)
+    std::string getConfiguration() const {return configuration;}
+    /** the next record, with its payload following the header, valid until the next call; nullptr if none arrived
+        within 'timeout' or the sender has disconnected (or sent something else than a record) */
+    const dataFileLayout::recordHeader* next(std::chrono::milliseconds timeout);
+    /// whether a sender is connected (false once next() found it disconnected)
+    bool        isConnected() const {return fd >= 0;}
+    /// bytes received from the current sender
+    uint64_t    getBytes() const {return bytes;}
+  private:
+    typedef std::chrono::steady_clock clock;
+    /** reads until at least 'size' bytes from 'begin' on are buffered; false if they did not arrive before 'deadline'
+        or the sender disconnected (disconnecting it) */
+    bool        fill(size_t size, clock::time_point deadline);
+    void        disconnect();
+
+    std::string                address;
+    int                        listener;
+    int                        fd;
+    std::vector<char>          buffer;
+    size_t                     begin;    ///< start of the data not yet handed out
+    size_t                     end;      ///< end of the data received
+    size_t                     pending;  ///< size of the record handed out last
+    dataFileLayout::fileHeader header;
+    std::string                configuration;
+    uint64_t                   bytes;
+  };
+}
+
+#endif
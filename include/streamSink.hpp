@@ -0,0 +1,126 @@
+// streamSink.hpp
+#ifndef CADIDAQ_STREAMSINK_H
+#define CADIDAQ_STREAMSINK_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#include <sys/uio.h> // iovec
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/sources/severity_channel_logger.hpp>
+
+#include <dppEvents.hpp>
+#include <metrics.hpp>
+#include <bufferPool.hpp>
+#include <readoutQueue.hpp>
+#include <dataFileLayout.hpp>
+#include <affinity.hpp>
+
+namespace cadidaq {
+
+  /** /class streamSink
+      Streams the delivered events to a receiver (e.g. an event builder, see streamReceiver) over TCP or a Unix domain
+      socket, in the layout of a data file without the index: the file header with the configuration of the boards
+      whenever a connection is made, then one record per readout buffer or DPP event batch.
+      Nothing is copied: the sink takes over the readout buffers (reducing their events in place under the overflow
+      policies) and the DPP event batches (swapping them for spare ones), and a sender thread writes the records
+      straight from them with scatter-gather I/O, releasing them once sent. The records are sent in batches, once
+      'batchBytes' are waiting or the oldest record has waited 'maxDelay'.
+      While there is no receiver, the sender tries to connect once a second and discards (and counts) the records
+      meanwhile, so that the readout is not held up. The buffers held until sent count towards the fill level the
+      overflow policies act on, so a slow receiver causes back-pressure like a slow processing.
+      The send functions are to be called from one thread at a time; they never allocate.
+  */
+  class streamSink {
+  public:
+    /** streams to "host:port" or "unix:/path" the data of boards with the given names and DPP formats; up to
+        'maxBuffers' readout buffers and, for event batches, 'spareBatches' spares with room for 'batchEvents' events
+        are held until sent; the sender thread runs on 'cpus' (any CPU if empty) */
+    streamSink(const std::string& address, const std::vector<std::string>& boardNames, const std::vector<dppFormat>& formats,
+               const std::string& configuration, uint32_t batchBytes, std::chrono::milliseconds maxDelay,
+               uint32_t maxBuffers, uint32_t spareBatches, size_t batchEvents, stageMetrics& stats,
+               const affinity::cpuList& cpus = affinity::cpuList());
+    ~streamSink();
+    streamSink(const streamSink&) = delete;
+    streamSink& operator=(const streamSink&) = delete;
+
+    /** takes over a delivered readout buffer, releasing it to its pool once sent: the events kept by the prescaler
+        (every 'prescale'th one counted from 'firstEvent'), or only their headers if 'featuresOnly' */
+    void     sendEvents(const readoutQueue::item& item, uint64_t sequence, uint64_t firstEvent, uint32_t prescale, bool featuresOnly);
+    /// takes over a batch of decoded DPP events, leaving an empty spare batch in its place (waits for one if all are in use)
+    void     sendDPP(dppEventBatch& batch, uint64_t firstEvent, uint32_t prescale);
+    /// sends what is queued (if connected), releases all buffers and closes the connection (called from the thread that constructed the sink)
+    void     close();
+
+    std::string getAddress() const {return address;}
+    uint64_t getSentBytes() const {return sentBytes;}
+    uint64_t getSentRecords() const {return sentRecords;}
+    uint64_t getDroppedBytes() const {return droppedBytes;}
+    uint64_t getDroppedRecords() const {return droppedRecords;}
+    uint32_t getConnections() const {return connections;}
+  private:
+    typedef std::chrono::steady_clock clock;
+    static const uint32_t noBatch = ~0u;
+    struct record {
+      dataFileLayout::recordHeader header;
+      const char*                  payload;  ///< raw events (or nullptr for an event batch)
+      bufferPool*                  pool;     ///< to release the buffer to once sent
+      bufferPool::handle           buffer;
+      uint32_t                     batch;    ///< spare batch holding the events (or noBatch)
+      clock::time_point            queued;
+    };
+
+    /// appends a record to the queue (the header and source filled in); 'lock' must hold 'mutex'
+    void     queue(std::unique_lock<std::mutex>& lock, record& r);
+    /// writes the records from 'first' on (up to 'count') to the receiver; returns false if the connection failed
+    bool     sendRecords(size_t first, size_t count);
+    bool     connect();
+    void     runSender();
+
+    std::string              address;
+    std::vector<char>        preamble;     ///< file header and configuration sent first on every connection
+    uint32_t                 batchBytes;
+    clock::duration          maxDelay;
+    clock::time_point        started;      ///< run start on the clock of the records' write times
+    stageMetrics&            stats;
+    affinity::cpuList        cpus;
+    std::vector<uint64_t>    lastTimestamp; ///< extended time stamp of each board's latest event (delivering thread)
+
+    // records waiting to be sent (a ring) and spare event batches, protected by 'mutex'
+    std::mutex               mutex;
+    std::condition_variable  queued;
+    std::condition_variable  batchFree;
+    std::vector<record>      records;
+    size_t                   head;
+    size_t                   count;
+    uint64_t                 queuedBytes;
+    std::vector<dppEventBatch> batches;
+    std::vector<uint32_t>    freeBatches;
+    bool                     closing;
+
+    // sender thread
+    int                      fd;
+    clock::time_point        nextAttempt;
+    std::vector<struct iovec> iov;         ///< (allocated by the sender thread once placed)
+    uint64_t                 sentBytes;
+    uint64_t                 sentRecords;
+    uint64_t                 droppedBytes;
+    uint64_t                 droppedRecords;
+    uint64_t                 droppedSinceConnected;
+    uint32_t                 connections;
+    bool                     unreachableReported;
+    std::thread              sender;
+
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > lg;
+    /// (loggers are not shared between threads)
+    boost::log::sources::severity_channel_logger< boost::log::trivial::severity_level, std::string > senderLg;
+  };
+}
+
+#endif
@@ -0,0 +1,23 @@
+// streamSocket.hpp
+// sockets of the data streams sent by cadidaq (see streamSink and streamReceiver)
+#ifndef CADIDAQ_STREAMSOCKET_H
+#define CADIDAQ_STREAMSOCKET_H
+
+#include <string>
+
+namespace cadidaq {
+  namespace streamSocket {
+
+    /** connects to a receiver at "host:port" (TCP) or "unix:/path" (Unix domain socket).
+        returns the connected socket, or -1 with 'error' describing why not */
+    int connect(const std::string& address, std::string& error);
+    /** listens at "host:port" (TCP; port 0 for any free port) or "unix:/path" (replacing a stale socket file).
+        returns the listening socket, or -1 with 'error' describing why not */
+    int listen(const std::string& address, std::string& error);
+    /// address a socket listens at, in the form given to listen() (with the port chosen if it was 0)
+    std::string localAddress(int socket);
+
+  }
+}
+
+#endif
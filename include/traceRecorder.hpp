@@ -0,0 +1,74 @@
+// traceRecorder.hpp
+#ifndef CADIDAQ_TRACERECORDER_H
+#define CADIDAQ_TRACERECORDER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+namespace cadidaq {
+
+  /** /class traceRecorder
+      Records what happens to the buffers along the pipeline during a time window and renders it in the trace-event
+      format of Chrome (to be loaded into chrome://tracing or https://ui.perfetto.dev): the work of each thread (read
+      calls, batches decoded, deliveries and data handed to the files, chunks written) as spans on the thread's track,
+      and the phases of each buffer (waiting for a worker, being processed, waiting for the board's earlier buffers)
+      as spans of their own.
+      The spans are kept in memory allocated on construction. Recording one takes a slot with an atomic increment and
+      never blocks or allocates; outside the window it costs a load. Spans beyond the capacity are dropped (and counted).
+      The times are those of latencyMetrics::now().
+  */
+  class traceRecorder {
+  public:
+    enum class span : uint8_t {READ, DECODE, DELIVER, WRITE_SUBMIT, WRITE, QUEUE, PROCESS, MERGE};
+    /// board of the spans not belonging to a board (e.g. chunks written)
+    static const uint16_t noBoard = 0xFFFF;
+
+    traceRecorder(const std::vector<std::string>& boardNames, uint32_t capacity);
+    traceRecorder(const traceRecorder&) = delete;
+    traceRecorder& operator=(const traceRecorder&) = delete;
+
+    /// registers a thread (or a track of work serialised otherwise) recording spans, before recording; returns its number
+    uint32_t addThread(const std::string& name);
+    /// starts recording; returns false if already recording
+    bool     start();
+    /// stops recording and returns the trace of the spans recorded (JSON)
+    std::string stop();
+
+    /** records a span of a buffer of 'board' (its 'sequence' number, if known) from 'begin' to 'end', 'amount' being its
+        bytes (READ, WRITE_SUBMIT, WRITE) or events (DECODE, DELIVER); safe to call from any thread */
+    void     record(span what, uint32_t thread, uint16_t board, uint64_t sequence, uint64_t begin, uint64_t end, uint32_t amount = 0){
+      if (next.load(std::memory_order_relaxed) >= closed)
+        return;
+      // (acquiring the reset of 'written' by start())
+      uint64_t i = next.fetch_add(1, std::memory_order_acquire);
+      if (i >= spans.size())
+        return;
+      spans[i] = {begin, end, sequence, amount, static_cast<uint16_t>(thread), board, what};
+      written.fetch_add(1, std::memory_order_release);
+    }
+
+  private:
+    struct entry {
+      uint64_t begin;
+      uint64_t end;
+      uint64_t sequence;
+      uint32_t amount;
+      uint16_t thread;
+      uint16_t board;
+      span     what;
+    };
+    /// value of 'next' while not recording (increments of threads finding it open just before still count as closed)
+    static const uint64_t closed = 1ull << 63;
+
+    std::vector<std::string> boardNames;
+    std::vector<std::string> threadNames;
+    std::vector<entry>       spans;
+    std::atomic<uint64_t>    next;      ///< next slot to fill (beyond the capacity: spans dropped)
+    std::atomic<uint64_t>    written;   ///< slots filled
+    uint64_t                 started;   ///< start of the recording
+  };
+}
+
+#endif
@@ -0,0 +1,154 @@
+#include <affinity.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <stdexcept> // exceptions
+#include <cstdint>   // uintptr_t
+#include <cctype>    // isdigit
+
+#include <sched.h>   // sched_setaffinity, CPU_SET
+#include <unistd.h>  // sysconf
+
+#include <boost/algorithm/string.hpp>
+
+#include <helper.hpp> // expandRange
+
+namespace {
+  const std::string nodeDirectory = "/sys/devices/system/node/node";
+
+  int configuredCpus(){
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    return n > 0 ? n : 1;
+  }
+}
+
+cadidaq::affinity::cpuList cadidaq::affinity::parse(const std::string& spec){
+  std::string list = boost::algorithm::trim_copy(spec);
+  bool byNode = boost::istarts_with(list, "node");
+  std::vector<int> values;
+  try{
+    expandRange(byNode ? list.substr(4) : list, values);
+  }
+  catch (std::invalid_argument&){
+    throw std::invalid_argument("Invalid CPU list '" + spec + "': expected e.g. '0-3,8' or 'node1'");
+  }
+  std::set<int> cpus;
+  for (int v : values){
+    if (byNode){
+      cpuList nodeCpus = cpusOf(v);
+      if (nodeCpus.empty())
+        throw std::invalid_argument("Invalid CPU list '" + spec + "': there is no NUMA node " + std::to_string(v));
+      cpus.insert(nodeCpus.begin(), nodeCpus.end());
+    } else {
+      if (v >= configuredCpus() || v >= CPU_SETSIZE)
+        throw std::invalid_argument("Invalid CPU list '" + spec + "': there is no CPU " + std::to_string(v));
+      cpus.insert(v);
+    }
+  }
+  return cpuList(cpus.begin(), cpus.end());
+}
+
+bool cadidaq::affinity::pin(const cpuList& cpus){
+  if (cpus.empty())
+    return true;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus)
+    CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+cadidaq::affinity::cpuList cadidaq::affinity::current(){
+  cpuList cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &set))
+      cpus.push_back(cpu);
+  return cpus;
+}
+
+int cadidaq::affinity::nodes(){
+  int n = 0;
+  while (std::ifstream(nodeDirectory + std::to_string(n) + "/cpulist").good())
+    n++;
+  return n > 0 ? n : 1;
+}
+
+cadidaq::affinity::cpuList cadidaq::affinity::cpusOf(int node){
+  cpuList cpus;
+  std::ifstream file(nodeDirectory + std::to_string(node) + "/cpulist");
+  std::string list;
+  if (!std::getline(file, list)){
+    // no NUMA information: all CPUs are on node 0
+    if (node == 0)
+      for (int cpu = 0; cpu < configuredCpus(); cpu++)
+        cpus.push_back(cpu);
+    return cpus;
+  }
+  boost::algorithm::trim(list);
+  try{
+    if (!list.empty())
+      expandRange(list, cpus);
+  }
+  catch (std::invalid_argument&){
+    cpus.clear();
+  }
+  return cpus;
+}
+
+int cadidaq::affinity::nodeOf(int cpu){
+  for (int node = 0, n = nodes(); node < n; node++){
+    cpuList cpus = cpusOf(node);
+    for (int c : cpus)
+      if (c == cpu)
+        return node;
+  }
+  return 0;
+}
+
+std::string cadidaq::affinity::describe(const cpuList& cpus){
+  if (cpus.empty())
+    return "any CPU";
+  std::ostringstream out;
+  std::set<int> nodeSet;
+  for (size_t i = 0; i < cpus.size(); i++){
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+      j++;
+    out << (i ? "," : "") << cpus[i];
+    if (j > i)
+      out << "-" << cpus[j];
+    for (size_t k = i; k <= j; k++)
+      nodeSet.insert(nodeOf(cpus[k]));
+    i = j;
+  }
+  out << (nodeSet.size() > 1 ? " (nodes " : " (node ");
+  for (auto it = nodeSet.begin(); it != nodeSet.end(); ++it)
+    out << (it == nodeSet.begin() ? "" : ",") << *it;
+  out << ")";
+  return out.str();
+}
+
+std::string cadidaq::affinity::memoryNodes(const void* address){
+  std::ifstream maps("/proc/self/numa_maps");
+  std::ostringstream start;
+  start << std::hex << reinterpret_cast<uintptr_t>(address) << " ";
+  std::string line;
+  while (std::getline(maps, line)){
+    if (!boost::starts_with(line, start.str()))
+      continue;
+    // e.g. "7f0e2c000000 default anon=16384 dirty=16384 N0=16384 kernelpagesize_kB=4"
+    std::vector<std::string> fields;
+    boost::split(fields, line, boost::is_any_of(" "));
+    std::string result;
+    for (auto& f : fields)
+      if (f.size() > 1 && f[0] == 'N' && std::isdigit(static_cast<unsigned char>(f[1])))
+        result += (result.empty() ? "" : " ") + f;
+    return result;
+  }
+  return std::string();
+}
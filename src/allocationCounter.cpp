@@ -0,0 +1,80 @@
+#include <allocationCounter.hpp>
+
+#ifdef CADIDAQ_COUNT_ALLOCATIONS
+
+#include <cstdlib>   // malloc, free
+#include <new>       // bad_alloc, new_handler, nothrow_t
+
+namespace {
+  // trivially initialized, so it can be used by allocations made during the thread's start-up
+  thread_local uint64_t allocated = 0;
+}
+
+bool cadidaq::allocations::counting(){
+  return true;
+}
+
+uint64_t cadidaq::allocations::thisThread(){
+  return allocated;
+}
+
+// replacements of the global allocation functions (affecting the whole program including libraries)
+
+void* operator new(std::size_t size){
+  allocated++;
+  if (size == 0)
+    size = 1;
+  void* p;
+  while ((p = std::malloc(size)) == nullptr){
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+  return p;
+}
+
+void* operator new[](std::size_t size){
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept{
+  try {
+    return operator new(size);
+  }
+  catch (...){
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept{
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept{
+  std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept{
+  std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept{
+  std::free(p);
+}
+
+#else
+
+bool cadidaq::allocations::counting(){
+  return false;
+}
+
+uint64_t cadidaq::allocations::thisThread(){
+  return 0;
+}
+
+#endif
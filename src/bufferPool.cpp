@@ -0,0 +1,111 @@
+#include <bufferPool.hpp>
+
+#include <cstring>   // memset, strerror
+#include <cerrno>
+#include <stdexcept> // exceptions
+
+// memory mapping
+#include <sys/mman.h>
+#include <unistd.h>
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define POOL_LOG_DEBUG BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::debug)
+#define POOL_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define POOL_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+
+namespace {
+  const size_t hugePageSize = 2*1024*1024;
+
+  size_t roundUp(size_t size, size_t multiple){
+    return ((size + multiple - 1) / multiple) * multiple;
+  }
+}
+
+cadidaq::bufferPool::bufferPool(uint32_t bufferSize, uint32_t count)
+  : bufferSize(bufferSize), memory(nullptr), mappedSize(0), hugePages(false), locked(false), acquired(0), inUse(0) {
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("pool"));
+  if (count == 0)
+    count = 1;
+  // buffers start on cache line boundaries (the readout uses 64-bit block transfers)
+  size_t stride = roundUp(bufferSize, 64);
+  size_t total = stride * count;
+
+  // try explicit huge pages first, then regular pages with transparent huge pages requested
+  mappedSize = roundUp(total, hugePageSize);
+  void* mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mapping != MAP_FAILED){
+    hugePages = true;
+  } else {
+    POOL_LOG_DEBUG << "No huge pages available for the readout buffers (" << strerror(errno) << "), using regular pages.";
+    mappedSize = roundUp(total, sysconf(_SC_PAGESIZE));
+    mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+      throw std::runtime_error("Could not allocate " + std::to_string(mappedSize) + " bytes of readout buffers: " + strerror(errno));
+#ifdef MADV_HUGEPAGE
+    madvise(mapping, mappedSize, MADV_HUGEPAGE);
+#endif
+  }
+  memory = static_cast<char*>(mapping);
+  // touch all pages now rather than during the first run, then keep them resident
+  std::memset(memory, 0, mappedSize);
+  if (mlock(memory, mappedSize) == 0)
+    locked = true;
+  else
+    POOL_LOG_WARN << "Could not lock the readout buffers in memory (" << strerror(errno) << "); consider raising the memlock limit (ulimit -l).";
+
+  buffers.resize(count);
+  freeList.reserve(count);
+  for (uint32_t i = 0; i < count; i++){
+    buffers[i].data = memory + i * stride;
+    buffers[i].size = bufferSize;
+    buffers[i].dataSize = 0;
+    // hand out the lowest buffers first
+    freeList.push_back(count - 1 - i);
+  }
+  POOL_LOG_INFO << "Allocated " << count << " readout buffers of " << bufferSize << " bytes ("
+                << mappedSize/(1024*1024) << " MB, huge pages: " << (hugePages ? "yes" : "no")
+                << ", locked: " << (locked ? "yes" : "no") << ")";
+}
+
+cadidaq::bufferPool::~bufferPool(){
+  if (memory){
+    if (locked)
+      munlock(memory, mappedSize);
+    munmap(memory, mappedSize);
+  }
+}
+
+cadidaq::bufferPool::handle cadidaq::bufferPool::acquire(){
+  std::lock_guard<std::mutex> lock(mutex);
+  if (freeList.empty())
+    return none;
+  handle h = freeList.back();
+  freeList.pop_back();
+  buffers[h].dataSize = 0;
+  acquired++;
+  inUse++;
+  return h;
+}
+
+cadidaq::bufferPool::handle cadidaq::bufferPool::acquire(std::chrono::microseconds timeout){
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!released.wait_for(lock, timeout, [this]{return !freeList.empty();}))
+    return none;
+  handle h = freeList.back();
+  freeList.pop_back();
+  buffers[h].dataSize = 0;
+  acquired++;
+  inUse++;
+  return h;
+}
+
+void cadidaq::bufferPool::release(handle h){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    freeList.push_back(h);
+    inUse--;
+  }
+  released.notify_one();
+}
@@ -0,0 +1,514 @@
+#include <channelScan.hpp>
+
+#include <map>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <cmath>     // sqrt, fabs, round
+#include <algorithm> // min, max
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define SCAN_LOG_DEBUG BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::debug)
+#define SCAN_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define SCAN_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+#define SCAN_LOG_ERROR BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::error)
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+
+namespace {
+  /// samples at the start of each record the baseline is taken from
+  const uint32_t baselineWindow = 32;
+  /// time the DC offsets take to settle after being changed
+  const milliseconds dcOffsetSettling = milliseconds(50);
+  /// pause between two rounds of reads that found no data
+  const microseconds idleWait = microseconds(500);
+
+  /// iterations after which the calibration of a DC offset is given up
+  const uint32_t maxIterations = 10;
+  /// time between the software triggers of the baseline calibration
+  const microseconds calibrationTriggerInterval = microseconds(1000);
+  /// largest DC offset (16-bit DAC)
+  const uint32_t maxDCOffset = 0xFFFF;
+  /// change of the DC offset probing the slope of the baseline after the first measurement
+  const uint32_t probeStep = 0x2000;
+
+  /** /struct offsetSearch
+      Search for the DC offset bringing the baseline of a channel (or of a group of channels sharing the offset) to
+      the target.
+  */
+  struct offsetSearch {
+    size_t   board;
+    unsigned first;                 ///< channels [first, last) sharing the offset
+    unsigned last;
+    double   target;
+    uint32_t offset;                ///< programmed for the next measurement (or found, once done)
+    double   baseline = 0;          ///< measured at 'offset'
+    uint32_t bestOffset = 0;        ///< giving the baseline closest to the target so far
+    double   bestBaseline = 0;
+    bool     havePrevious = false;
+    uint32_t previousOffset = 0;
+    double   previousBaseline = 0;
+    bool     haveBelow = false;     ///< an offset giving a baseline below the target is known
+    bool     haveAbove = false;
+    uint32_t below = 0;
+    uint32_t above = 0;
+    uint32_t iterations = 0;
+    bool     done = false;
+    bool     converged = false;
+    bool     noData = false;        ///< no samples were recorded (e.g. the channels are disabled)
+    double   seconds = 0;           ///< time until done
+
+    /// takes the baseline measured at 'offset' and chooses the next offset (or finishes)
+    void step(double measured, double tolerance){
+      iterations++;
+      baseline = measured;
+      if (iterations == 1 || std::fabs(measured - target) < std::fabs(bestBaseline - target)){
+        bestOffset = offset;
+        bestBaseline = measured;
+      }
+      if (std::fabs(measured - target) <= tolerance){
+        done = converged = true;
+        return;
+      }
+      if (measured < target){
+        haveBelow = true;
+        below = offset;
+      } else {
+        haveAbove = true;
+        above = offset;
+      }
+      // secant through the last two measurements, or a first step to find out the slope
+      double next;
+      if (havePrevious && measured != previousBaseline)
+        next = offset + (target - measured) * (static_cast<double>(offset) - previousOffset) / (measured - previousBaseline);
+      else
+        next = offset < maxDCOffset / 2 ? static_cast<double>(offset) + probeStep : static_cast<double>(offset) - probeStep;
+      // within the offsets known to bracket the target: bisect where the secant leaves them (e.g. near saturation)
+      if (haveBelow && haveAbove){
+        double lo = std::min(below, above), hi = std::max(below, above);
+        if (hi - lo <= 1){
+          giveUp();
+          return;
+        }
+        if (!(next > lo && next < hi))
+          next = (lo + hi) / 2;
+      }
+      next = std::max(0., std::min(std::round(next), static_cast<double>(maxDCOffset)));
+      if (static_cast<uint32_t>(next) == offset || iterations >= maxIterations){
+        giveUp();
+        return;
+      }
+      havePrevious = true;
+      previousOffset = offset;
+      previousBaseline = measured;
+      offset = static_cast<uint32_t>(next);
+    }
+
+    /// finishes without converging, at the offset measured closest to the target (e.g. the better end of the bracket)
+    void giveUp(){
+      done = true;
+      offset = bestOffset;
+      baseline = bestBaseline;
+    }
+  };
+}
+
+double cadidaq::channelMeasurement::baselineRMS() const {
+  if (baselineSamples == 0)
+    return 0;
+  double mean = baseline();
+  double variance = baselineSquares / baselineSamples - mean * mean;
+  return variance > 0 ? std::sqrt(variance) : 0;
+}
+
+cadidaq::channelScan::channelScan(const std::vector<digitizer*>& digitizers){
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("scan"));
+  std::map<std::string, size_t> groupIndex;
+  for (auto dg : digitizers){
+    board b;
+    b.dg      = dg;
+    b.packing = dg->getSamplePacking();
+    b.format  = dg->getDPPFormat();
+    b.seconds = 0;
+    b.swTrigger = CAEN_DGTZ_TRGMODE_DISABLED;
+    b.externalTrigger = CAEN_DGTZ_TRGMODE_DISABLED;
+    b.buffer.data = nullptr;
+    b.buffer.size = 0;
+    b.buffer.dataSize = 0;
+    caen::Digitizer* device = dg->getDevice();
+    uint32_t channels = device ? device->channels() : 0;
+    b.result.resize(channels);
+    for (uint32_t ch = 0; ch < channels; ch++)
+      b.falling.push_back(dg->fallingTrigger(ch));
+    try{
+      if (device)
+        b.buffer = device->mallocReadoutBuffer();
+    }
+    catch (caen::Error& e){
+      SCAN_LOG_ERROR << "Could not allocate a readout buffer for digitizer '" << dg->getName() << "' (" << e.what() << "), it is not scanned.";
+      b.buffer.data = nullptr;
+    }
+    if (b.packing == samplePacking::NONE && b.format == dppFormat::NONE)
+      SCAN_LOG_INFO << "The samples of digitizer '" << dg->getName() << "' are not decoded: only its records are counted.";
+    // the boards sharing a readout thread (link) are acquired by one thread
+    auto g = groupIndex.insert(std::make_pair(dg->getReadoutThread(), groups.size()));
+    if (g.second)
+      groups.emplace_back();
+    groups[g.first->second].push_back(boards.size());
+    boards.push_back(b);
+  }
+}
+
+cadidaq::channelScan::~channelScan(){
+  for (auto& b : boards)
+    if (b.buffer.data)
+      b.dg->getDevice()->freeReadoutBuffer(b.buffer);
+}
+
+void cadidaq::channelScan::forEachBoard(const std::function<void(size_t)>& f){
+  std::vector<std::thread> threads;
+  for (auto& group : groups)
+    threads.emplace_back([&f, &group](){
+        for (size_t i : group)
+          f(i);
+      });
+  for (auto& t : threads)
+    t.join();
+}
+
+void cadidaq::channelScan::measure(milliseconds time, microseconds triggerInterval){
+  for (auto& b : boards){
+    for (auto& m : b.result)
+      m = channelMeasurement();
+    b.thresholds = b.dg->getChannelValues(channelSetting::TRIGGER_THRESHOLD);
+    b.seconds = 0;
+  }
+  std::vector<std::thread> threads;
+  for (auto& group : groups)
+    threads.emplace_back(&channelScan::acquire, this, std::cref(group), time, triggerInterval);
+  for (auto& t : threads)
+    t.join();
+}
+
+void cadidaq::channelScan::acquire(const std::vector<size_t>& group, milliseconds time, microseconds triggerInterval){
+  std::vector<size_t> running;
+  for (size_t i : group){
+    caen::Digitizer* device = boards[i].dg->getDevice();
+    if (device == nullptr || boards[i].buffer.data == nullptr)
+      continue;
+    try{
+      device->clearData();
+      device->startAcquisition();
+      running.push_back(i);
+    }
+    catch (caen::Error& e){
+      SCAN_LOG_ERROR << "Could not start the acquisition of digitizer '" << boards[i].dg->getName() << "': " << e.what();
+    }
+  }
+  auto start = steady_clock::now();
+  auto end = start + time;
+  auto nextTrigger = start;
+  while (true){
+    auto now = steady_clock::now();
+    bool last = now >= end;
+    if (last){
+      // what the boards stored until they are stopped is read below
+      for (size_t i : running){
+        try{
+          boards[i].dg->getDevice()->stopAcquisition();
+        }
+        catch (caen::Error& e){
+          SCAN_LOG_ERROR << "Could not stop the acquisition of digitizer '" << boards[i].dg->getName() << "': " << e.what();
+        }
+        boards[i].seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+      }
+    } else if (triggerInterval.count() && now >= nextTrigger){
+      for (size_t i : running){
+        try{
+          boards[i].dg->getDevice()->sendSWtrigger();
+        }
+        catch (caen::Error& e){
+          SCAN_LOG_DEBUG << "Could not send a software trigger to digitizer '" << boards[i].dg->getName() << "': " << e.what();
+        }
+      }
+      nextTrigger += triggerInterval;
+    }
+    bool any = false;
+    for (size_t i : running){
+      uint32_t bytes = boards[i].dg->readData(boards[i].buffer);
+      if (bytes){
+        accumulate(boards[i], bytes);
+        any = true;
+      }
+    }
+    if (last)
+      break;
+    if (!any)
+      std::this_thread::sleep_until(std::min(steady_clock::now() + idleWait, triggerInterval.count() ? std::min(nextTrigger, end) : end));
+  }
+}
+
+void cadidaq::channelScan::accumulate(board& b, uint32_t bytes){
+  forEachEvent(b.buffer.data, bytes, [&b](const eventHeader& event){
+      if (b.format != dppFormat::NONE){
+        forEachDPPEvent(event, b.format, [&b](const dppEvent& e){
+            if (e.channel < b.result.size()){
+              b.result[e.channel].events++;
+              b.result[e.channel].crossings++;
+            }
+          });
+        return;
+      }
+      forEachChannelRecord(event, b.packing, [&b](uint32_t ch, const channelRecord& record){
+          if (ch >= b.result.size())
+            return;
+          channelMeasurement& m = b.result[ch];
+          m.events++;
+          uint32_t n = record.samples();
+          for (uint32_t i = 0; i < n && i < baselineWindow; i++){
+            double s = record.sample(i);
+            m.baselineSum += s;
+            m.baselineSquares += s * s;
+            m.baselineSamples++;
+          }
+          boost::optional<uint32_t> threshold = b.thresholds.get(ch);
+          if (!threshold)
+            return;
+          bool falling = b.falling[ch];
+          for (uint32_t i = 0; i < n; i++){
+            uint16_t s = record.sample(i);
+            if (falling ? s <= *threshold : s >= *threshold){
+              m.crossings++;
+              break;
+            }
+          }
+        });
+    });
+}
+
+uint32_t cadidaq::channelScan::reprogramAll(channelSetting setting, uint32_t value){
+  std::atomic<uint32_t> writes(0);
+  forEachBoard([&](size_t i){
+      channelValues<uint32_t> values(boards[i].result.size());
+      values.fill(value);
+      writes += boards[i].dg->reprogram(setting, values);
+    });
+  return writes;
+}
+
+bool cadidaq::channelScan::scan(const std::vector<uint32_t>& thresholds, const std::vector<uint32_t>& dcOffsets, milliseconds time, std::ostream& table){
+  // (the rates would all be those of the configured thresholds)
+  if (!thresholds.empty())
+    for (auto& b : boards)
+      if (b.dg->getDevice() && b.dg->getDevice()->hasDppFw()){
+        SCAN_LOG_ERROR << "The trigger thresholds of digitizer '" << b.dg->getName() << "' (DPP firmware) cannot be scanned; scan its DC offsets only.";
+        return false;
+      }
+  // the DC offsets, which take time to settle, change least often
+  size_t nthresholds = std::max<size_t>(thresholds.size(), 1);
+  size_t ndcOffsets = std::max<size_t>(dcOffsets.size(), 1);
+  size_t points = nthresholds * ndcOffsets;
+  SCAN_LOG_INFO << "Scanning " << points << " point(s) of " << time.count() << " ms on " << boards.size() << " digitizer(s) read by "
+                << groups.size() << " thread(s)" << (thresholds.empty() ? ", thresholds as configured" : "")
+                << (dcOffsets.empty() ? ", DC offsets as configured" : "");
+  table << "# board\tchannel\tthreshold\tdc_offset\tseconds\tevents\trate_hz\tthreshold_rate_hz\tbaseline\tbaseline_rms\n";
+  auto start = steady_clock::now();
+  uint64_t totalWrites = 0;
+  for (size_t d = 0; d < ndcOffsets; d++){
+    if (!dcOffsets.empty()){
+      uint32_t writes = reprogramAll(channelSetting::DC_OFFSET, dcOffsets[d]);
+      totalWrites += writes;
+      if (writes)
+        std::this_thread::sleep_for(dcOffsetSettling);
+    }
+    for (size_t t = 0; t < nthresholds; t++){
+      if (!thresholds.empty())
+        totalWrites += reprogramAll(channelSetting::TRIGGER_THRESHOLD, thresholds[t]);
+      measure(time);
+      size_t point = d * nthresholds + t + 1;
+      SCAN_LOG_INFO << "Scan point " << point << "/" << points
+                    << (thresholds.empty() ? "" : ", threshold " + std::to_string(thresholds[t]))
+                    << (dcOffsets.empty() ? "" : ", DC offset " + std::to_string(dcOffsets[d]));
+      for (auto& b : boards){
+        const channelValues<uint32_t>& threshold = b.dg->getChannelValues(channelSetting::TRIGGER_THRESHOLD);
+        const channelValues<uint32_t>& dcOffset = b.dg->getChannelValues(channelSetting::DC_OFFSET);
+        for (uint32_t ch = 0; ch < b.result.size(); ch++){
+          const channelMeasurement& m = b.result[ch];
+          table << b.dg->getName() << "\t" << ch << "\t"
+                << (threshold.get(ch) ? std::to_string(*threshold.get(ch)) : "-") << "\t"
+                << (dcOffset.get(ch) ? std::to_string(*dcOffset.get(ch)) : "-") << "\t"
+                << b.seconds << "\t" << m.events << "\t"
+                << (b.seconds > 0 ? m.events / b.seconds : 0) << "\t"
+                << (b.seconds > 0 ? m.crossings / b.seconds : 0) << "\t";
+          if (m.baselineSamples)
+            table << m.baseline() << "\t" << m.baselineRMS() << "\n";
+          else
+            table << "-\t-\n";
+        }
+      }
+    }
+  }
+  double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+  SCAN_LOG_INFO << "Scanned " << points << " point(s) in " << seconds << " s (" << (seconds - points * time.count() * 1e-3) / points * 1e3
+                << " ms per point besides the acquisition), " << totalWrites << " setting(s) written.";
+  return true;
+}
+
+bool cadidaq::channelScan::triggerBySoftware(board& b, bool only){
+  caen::Digitizer* device = b.dg->getDevice();
+  if (device == nullptr)
+    return false;
+  bool grouped = device->groups() > 1;
+  uint32_t n = grouped ? device->groups() : device->channels();
+  try{
+    if (only){
+      b.swTrigger = device->getSWTriggerMode();
+      b.externalTrigger = device->getExternalTriggerMode();
+      b.selfTrigger.clear();
+      for (uint32_t u = 0; u < n; u++)
+        b.selfTrigger.push_back(grouped ? device->getGroupSelfTrigger(u) : device->getChannelSelfTrigger(u));
+      device->setSWTriggerMode(CAEN_DGTZ_TRGMODE_ACQ_ONLY);
+      device->setExternalTriggerMode(CAEN_DGTZ_TRGMODE_DISABLED);
+      for (uint32_t u = 0; u < n; u++)
+        if (grouped)
+          device->setGroupSelfTrigger(u, CAEN_DGTZ_TRGMODE_DISABLED);
+        else
+          device->setChannelSelfTrigger(u, CAEN_DGTZ_TRGMODE_DISABLED);
+    } else {
+      device->setSWTriggerMode(b.swTrigger);
+      device->setExternalTriggerMode(b.externalTrigger);
+      for (uint32_t u = 0; u < b.selfTrigger.size(); u++)
+        if (grouped)
+          device->setGroupSelfTrigger(u, b.selfTrigger[u]);
+        else
+          device->setChannelSelfTrigger(u, b.selfTrigger[u]);
+    }
+  }
+  catch (caen::Error& e){
+    SCAN_LOG_ERROR << "Could not " << (only ? "switch to software triggers on" : "restore the triggers of") << " digitizer '" << b.dg->getName() << "': " << e.what();
+    return false;
+  }
+  return true;
+}
+
+void cadidaq::channelScan::calibrateBaselines(double target, double tolerance, milliseconds time, std::ostream& ini){
+  auto start = steady_clock::now();
+  // one search per channel, or per group of channels sharing a DC offset
+  std::vector<offsetSearch> searches;
+  std::vector<std::vector<size_t>> boardSearches(boards.size());
+  std::vector<bool> switched(boards.size(), false);
+  for (size_t i = 0; i < boards.size(); i++){
+    board& b = boards[i];
+    caen::Digitizer* device = b.dg->getDevice();
+    if (device == nullptr || b.buffer.data == nullptr || b.packing == samplePacking::NONE){
+      SCAN_LOG_WARN << "The baselines of digitizer '" << b.dg->getName() << "' are not decoded, its DC offsets are not calibrated.";
+      continue;
+    }
+    double counts = target <= 1 ? target * ((1u << device->ADCbits()) - 1) : target;
+    unsigned perGroup = device->groups() > 1 ? std::max(device->channelsPerGroup(), 1u) : 1;
+    const channelValues<uint32_t>& configured = b.dg->getChannelValues(channelSetting::DC_OFFSET);
+    unsigned channels = b.result.size();
+    for (unsigned first = 0; first < channels; first += perGroup){
+      offsetSearch s;
+      s.board  = i;
+      s.first  = first;
+      s.last   = std::min(first + perGroup, channels);
+      s.target = counts;
+      boost::optional<uint32_t> offset = configured.firstValue(s.first, s.last);
+      s.offset = offset ? std::min(*offset, maxDCOffset) : maxDCOffset / 2 + 1;
+      boardSearches[i].push_back(searches.size());
+      searches.push_back(s);
+    }
+    switched[i] = triggerBySoftware(b, true);
+  }
+  std::ostringstream goal;
+  goal << "baselines within " << tolerance << " ADC counts of ";
+  if (target <= 1)
+    goal << target * 100 << " % of the ADC range";
+  else
+    goal << target << " ADC counts";
+  SCAN_LOG_INFO << "Calibrating " << searches.size() << " DC offset(s) on " << boards.size() << " digitizer(s) read by " << groups.size()
+                << " thread(s) for " << goal.str();
+
+  uint32_t iteration = 0;
+  while (std::any_of(searches.begin(), searches.end(), [](const offsetSearch& s){return !s.done;})){
+    iteration++;
+    // program the offsets to measure next, measure all boards at once
+    std::atomic<uint32_t> writes(0);
+    forEachBoard([&](size_t i){
+        if (boardSearches[i].empty())
+          return;
+        channelValues<uint32_t> values(boards[i].result.size());
+        for (size_t k : boardSearches[i])
+          values.fill(searches[k].offset, searches[k].first, searches[k].last);
+        writes += boards[i].dg->reprogram(channelSetting::DC_OFFSET, values);
+      });
+    if (writes)
+      std::this_thread::sleep_for(dcOffsetSettling);
+    measure(time, calibrationTriggerInterval);
+    double elapsed = std::chrono::duration<double>(steady_clock::now() - start).count();
+    uint32_t pending = 0;
+    for (auto& s : searches){
+      if (s.done)
+        continue;
+      // the mean baseline of the channels sharing the offset
+      double sum = 0;
+      uint64_t samples = 0;
+      for (unsigned ch = s.first; ch < s.last; ch++){
+        sum += boards[s.board].result[ch].baselineSum;
+        samples += boards[s.board].result[ch].baselineSamples;
+      }
+      if (samples == 0)
+        s.done = s.noData = true;
+      else
+        s.step(sum / samples, tolerance);
+      if (s.done)
+        s.seconds = elapsed;
+      else
+        pending++;
+    }
+    SCAN_LOG_DEBUG << "Baseline calibration iteration " << iteration << ": " << writes << " DC offset(s) written, " << pending << " still to calibrate.";
+  }
+  for (size_t i = 0; i < boards.size(); i++)
+    if (switched[i])
+      triggerBySoftware(boards[i], false);
+
+  // report per board, and the offsets found as settings
+  ini << "# DC offsets calibrated for " << goal.str() << "\n";
+  for (size_t i = 0; i < boards.size(); i++){
+    if (boardSearches[i].empty())
+      continue;
+    uint32_t converged = 0, noData = 0, iterations = 0;
+    double seconds = 0;
+    std::ostringstream failed;
+    ini << "\n[" << boards[i].dg->getName() << "]\n";
+    for (size_t k : boardSearches[i]){
+      const offsetSearch& s = searches[k];
+      iterations = std::max(iterations, s.iterations);
+      seconds = std::max(seconds, s.seconds);
+      if (s.noData){
+        noData++;
+        continue;
+      }
+      std::string channels = s.last - s.first > 1 ? std::to_string(s.first) + "-" + std::to_string(s.last - 1) : std::to_string(s.first);
+      if (s.converged)
+        converged++;
+      else {
+        failed << (failed.tellp() ? ", " : "") << channels << " (" << s.baseline << " at " << s.offset << ")";
+        ini << "# not converged: baseline " << s.baseline << "\n";
+      }
+      ini << boards[i].dg->getSettingName(channelSetting::DC_OFFSET) << "[" << channels << "] = " << s.offset << "\n";
+    }
+    size_t calibrated = boardSearches[i].size() - noData;
+    SCAN_LOG_INFO << "'" << boards[i].dg->getName() << "': " << converged << " of " << calibrated << " DC offset(s) calibrated in "
+                  << iterations << " iteration(s) at most, " << seconds << " s" << (noData ? ", " + std::to_string(noData) + " without data" : "");
+    if (failed.tellp())
+      SCAN_LOG_WARN << "'" << boards[i].dg->getName() << "': baselines not within " << tolerance << " ADC counts of the target (baseline at offset): " << failed.str();
+  }
+  SCAN_LOG_INFO << "Baseline calibration took " << iteration << " iteration(s) in "
+                << std::chrono::duration<double>(steady_clock::now() - start).count() << " s.";
+}
@@ -0,0 +1,142 @@
+#include <dataFileReader.hpp>
+
+#include <cstring>   // strerror, strnlen
+#include <cerrno>
+#include <algorithm> // lower_bound, min, max
+#include <stdexcept> // exceptions
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace layout = cadidaq::dataFileLayout;
+
+cadidaq::dataFileReader::dataFileReader(const std::string& path)
+  : path(path), fd(-1), size(0), data(nullptr), header(nullptr), firstRecord(0), recordsEnd(0), indexed(false) {
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Could not open data file '" + path + "': " + strerror(errno));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(layout::fileHeader)){
+    close(fd);
+    throw std::runtime_error("Data file '" + path + "' is too short");
+  }
+  size = st.st_size;
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED){
+    close(fd);
+    throw std::runtime_error("Could not map data file '" + path + "': " + strerror(errno));
+  }
+  data = static_cast<const char*>(mapping);
+  header = reinterpret_cast<const layout::fileHeader*>(data);
+  firstRecord = sizeof(layout::fileHeader) + layout::align(header->configurationSize);
+  if (header->magic != layout::magic || header->version != layout::version || firstRecord > size){
+    munmap(mapping, size);
+    close(fd);
+    throw std::runtime_error("'" + path + "' is not a data file or has an incompatible version");
+  }
+
+  // the index at the end of the file, if it was closed properly
+  const layout::fileTrailer* trailer = reinterpret_cast<const layout::fileTrailer*>(data + size - sizeof(layout::fileTrailer));
+  if (size >= firstRecord + sizeof(layout::fileTrailer) && trailer->magic == layout::trailerMagic && trailer->indexOffset >= firstRecord
+      && trailer->indexOffset + static_cast<uint64_t>(trailer->entries) * sizeof(entry) + sizeof(layout::fileTrailer) == size){
+    const entry* entries = reinterpret_cast<const entry*>(data + trailer->indexOffset);
+    index.assign(entries, entries + trailer->entries);
+    recordsEnd = trailer->indexOffset;
+    indexed = true;
+  }
+  // a corrupt index (e.g. of a damaged file) is not trusted: the records are walked instead, up to the first bad one
+  if (indexed && !validIndex()){
+    index.clear();
+    indexed = false;
+  }
+  if (!indexed)
+    scanRecords();
+  indexBoards();
+}
+
+cadidaq::dataFileReader::~dataFileReader(){
+  munmap(const_cast<char*>(data), size);
+  close(fd);
+}
+
+void cadidaq::dataFileReader::scanRecords(){
+  // up to the first incomplete record (e.g. of a file still being written)
+  uint64_t pos = firstRecord;
+  while (pos + sizeof(layout::recordHeader) <= size){
+    const layout::recordHeader& r = *reinterpret_cast<const layout::recordHeader*>(data + pos);
+    if (!layout::validRecord(r, pos, size))
+      break;
+    index.push_back({pos, r.minTimestamp, r.maxTimestamp, r.firstEvent, r.nevents, r.board, r.type});
+    pos += r.size;
+  }
+  recordsEnd = pos;
+}
+
+bool cadidaq::dataFileReader::validIndex() const {
+  for (const entry& e : index){
+    // (compared without overflowing, whatever the offset)
+    if (e.offset < firstRecord || recordsEnd - firstRecord < sizeof(layout::recordHeader) || e.offset > recordsEnd - sizeof(layout::recordHeader)
+        || e.offset % 8 != 0)
+      return false;
+    const layout::recordHeader& r = *reinterpret_cast<const layout::recordHeader*>(data + e.offset);
+    if (!layout::validRecord(r, e.offset, recordsEnd) || r.type != e.type)
+      return false;
+  }
+  return true;
+}
+
+void cadidaq::dataFileReader::indexBoards(){
+  for (uint32_t i = 0; i < index.size(); i++){
+    if (index[i].board >= boards.size())
+      boards.resize(index[i].board + 1);
+    boards[index[i].board].entries.push_back(i);
+  }
+  for (auto& b : boards){
+    size_t n = b.entries.size();
+    b.maxUpTo.resize(n);
+    b.minFrom.resize(n);
+    for (size_t k = 0; k < n; k++)
+      b.maxUpTo[k] = std::max(index[b.entries[k]].maxTimestamp, k ? b.maxUpTo[k - 1] : 0);
+    for (size_t k = n; k-- > 0; )
+      b.minFrom[k] = std::min(index[b.entries[k]].minTimestamp, k + 1 < n ? b.minFrom[k + 1] : ~static_cast<uint64_t>(0));
+  }
+}
+
+void cadidaq::dataFileReader::select(uint16_t board, uint64_t from, uint64_t to, std::vector<const entry*>& records) const {
+  records.clear();
+  if (board >= boards.size())
+    return;
+  const boardIndex& b = boards[board];
+  // the first record that might reach 'from', up to the last that might start before 'to'
+  size_t k = std::lower_bound(b.maxUpTo.begin(), b.maxUpTo.end(), from) - b.maxUpTo.begin();
+  for (; k < b.entries.size() && b.minFrom[k] <= to; k++){
+    const entry& e = index[b.entries[k]];
+    if (e.maxTimestamp >= from && e.minTimestamp <= to)
+      records.push_back(&e);
+  }
+}
+
+std::string cadidaq::dataFileReader::getBoardName(uint16_t board) const {
+  if (board >= header->nboards || board >= layout::maxBoards)
+    return std::string();
+  return std::string(header->boardNames[board], strnlen(header->boardNames[board], layout::nameLength));
+}
+
+cadidaq::dppFormat cadidaq::dataFileReader::getDPPFormat(uint16_t board) const {
+  if (board >= header->nboards || board >= layout::maxBoards || header->dppFormats[board] > static_cast<uint8_t>(dppFormat::PHA))
+    return dppFormat::NONE;
+  return static_cast<dppFormat>(header->dppFormats[board]);
+}
+
+int cadidaq::dataFileReader::findBoard(const std::string& name) const {
+  for (uint16_t b = 0; b < header->nboards && b < layout::maxBoards; b++)
+    if (getBoardName(b) == name)
+      return b;
+  return -1;
+}
+
+std::string cadidaq::dataFileReader::getConfiguration() const {
+  return std::string(data + sizeof(layout::fileHeader), header->configurationSize);
+}
@@ -9,10 +9,70 @@
 #include <boost/log/attributes/constant.hpp>
 
 #include <iomanip>   // std::hex
+#include <algorithm> // min, max
+#include <chrono>
+
+#include <event.hpp>    // eventHeaderWords
 
 namespace pt = boost::property_tree;
 
-cadidaq::digitizer::digitizer(std::string name) : name(name), lnk(nullptr), dg(nullptr), reg(nullptr){
+namespace {
+  // registers common to the x7xx digitizers (see the boards' register descriptions)
+  const uint32_t readoutControlRegister = 0xEF00; ///< bits [2:0]: VME interrupt level, bit 3: optical link interrupt enable
+  const uint32_t irqEventNumberRegister = 0xEF18; ///< number of events stored on the board raising an interrupt
+  const uint32_t bufferOrganizationRegister = 0x800C; ///< event memory divided into 2^N buffers (standard firmware)
+  const uint32_t acquisitionStatusRegister  = 0x8104; ///< bit 2: running, bit 3: at least one event ready for readout, bit 4: memory full, bit 7: PLL locked
+  const uint32_t eventStoredRegister        = 0x812C; ///< number of events currently stored (standard firmware)
+  const uint32_t failureStatusRegister      = 0x8178; ///< bit 4: PLL lock lost, bit 5: temperature failure, bit 6: ADC power down (x725, x730)
+
+  /// largest number of events per block transfer (standard firmware) or per aggregate (DPP) the library accepts
+  const uint32_t maxEventsPerTransfer = 1023;
+  /// block transfer size beyond which the fixed cost of a transfer (some 10 us) is below a few percent at the link's bandwidth
+  const uint32_t targetBlockBytes     = 1024*1024;
+  /// size of the DPP aggregates aimed at by the automatic sizing
+  const uint32_t targetAggregateBytes = 16*1024;
+  /// time spent measuring each candidate block size
+  const std::chrono::milliseconds calibrationTime(100);
+  /// fraction of the best transfer rate accepted for a smaller block
+  const double   calibrationTolerance = 0.05;
+}
+
+const char* cadidaq::toString(readoutMode mode){
+  switch (mode){
+  case readoutMode::POLL: return "Poll";
+  case readoutMode::IRQ:  return "IRQ";
+  default:                return "Adaptive";
+  }
+}
+
+const char* cadidaq::toString(overflowPolicy policy){
+  switch (policy){
+  case overflowPolicy::DROP_OLDEST:   return "DropOldest";
+  case overflowPolicy::PRESCALE:      return "Prescale";
+  case overflowPolicy::FEATURES_ONLY: return "FeaturesOnly";
+  default:                            return "Block";
+  }
+}
+
+cadidaq::overflowPolicy cadidaq::toOverflowPolicy(const std::string& name){
+  if (boost::iequals(name, "DropOldest"))
+    return overflowPolicy::DROP_OLDEST;
+  if (boost::iequals(name, "Prescale"))
+    return overflowPolicy::PRESCALE;
+  if (boost::iequals(name, "FeaturesOnly"))
+    return overflowPolicy::FEATURES_ONLY;
+  return overflowPolicy::BLOCK;
+}
+
+const char* cadidaq::toString(dppFormat format){
+  switch (format){
+  case dppFormat::PSD: return "DPP-PSD";
+  case dppFormat::PHA: return "DPP-PHA";
+  default:             return "none";
+  }
+}
+
+cadidaq::digitizer::digitizer(std::string name) : name(name), lnk(nullptr), dg(nullptr), reg(nullptr), mode(readoutMode::ADAPTIVE), overflow(overflowPolicy::BLOCK), filter(nullptr), eventCapacity(0), stats(nullptr){
   // Register a constant attribute that identifies our digitizer in the logs
   lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>(name));
 }
@@ -23,18 +83,93 @@ cadidaq::digitizer::~digitizer(){
   if (lnk)
     delete lnk;
   if (reg)
-    delete lnk;
+    delete reg;
+  if (filter)
+    delete filter;
 }
 
-void cadidaq::digitizer::configure(pt::iptree *node){
+void cadidaq::digitizer::configure(settingsIndex &index){
   if (dg != nullptr){
     DG_LOG_FATAL << "Digitizer '" << name << "' already configured!";
     return;
   }
   lnk = new cadidaq::connectionSettings(name);
   // parse and store the link settings
-  lnk->parse(node);
+  lnk->parse(index);
   lnk->verify();
+  connect();
+
+  reg = new cadidaq::registerSettings(name, dg->channels());
+  reg->parse(index);
+  reg->verify();
+  // call our own verification routine to check model-dependent options
+  verifySettings();
+  // now program the settings
+  programSettings(comDirection::WRITING);
+  // choose the events per block transfer (the snapshot keeps the values chosen)
+  sizeReadout();
+  /* Loop over all keys that have not been used by any setting */
+  for (auto key : index.unused()){
+    DG_LOG_WARN << "Unknown setting in section " << name << " ignored: \t" << key->key << " = " << key->value;
+  }
+
+}
+
+void cadidaq::digitizer::configure(snapshotReader &snapshot){
+  if (dg != nullptr){
+    DG_LOG_FATAL << "Digitizer '" << name << "' already configured!";
+    return;
+  }
+  // the board the configuration was compiled for
+  uint32_t serialNumber, nchannels;
+  std::string model;
+  snapshot.get(serialNumber);
+  snapshot.get(nchannels);
+  snapshot.get(model);
+  lnk = new cadidaq::connectionSettings(name);
+  lnk->load(snapshot);
+  connect();
+  if (dg->serialNumber() != serialNumber || dg->channels() != nchannels)
+    throw std::runtime_error("Snapshot for '" + name + "' was compiled for " + model + " serial " + std::to_string(serialNumber)
+                             + " but found " + dg->modelName() + " serial " + std::to_string(dg->serialNumber()));
+  // the settings have been verified before they were stored
+  reg = new cadidaq::registerSettings(name, nchannels);
+  reg->load(snapshot);
+  verifySettings();
+  programSettings(comDirection::WRITING);
+}
+
+void cadidaq::digitizer::storeConfig(snapshotWriter &snapshot){
+  if (dg == nullptr){
+    DG_LOG_FATAL << "Digitizer '" << name << "' not yet (properly) configured!";
+    return;
+  }
+  // NOTE: the order has to match configure(snapshotReader&) and describeSnapshot()
+  snapshot.put(static_cast<uint32_t>(dg->serialNumber()));
+  snapshot.put(static_cast<uint32_t>(dg->channels()));
+  snapshot.put(dg->modelName());
+  lnk->store(snapshot);
+  reg->store(snapshot);
+}
+
+pt::iptree* cadidaq::digitizer::describeSnapshot(std::string name, snapshotReader &snapshot){
+  uint32_t serialNumber, nchannels;
+  std::string model;
+  snapshot.get(serialNumber);
+  snapshot.get(nchannels);
+  snapshot.get(model);
+  cadidaq::connectionSettings link(name);
+  link.load(snapshot);
+  cadidaq::registerSettings settings(name, nchannels);
+  settings.load(snapshot);
+  pt::iptree *node = link.createPTree();
+  settings.fillPTree(node);
+  node->put("Snapshot_Model", model);
+  node->put("Snapshot_SerialNumber", serialNumber);
+  return node;
+}
+
+void cadidaq::digitizer::connect(){
   // establish connection
   DG_LOG_INFO << "Establishing connection to digitizer '" << name << "': "
                 << "' (linkType=" << *lnk->linkType
@@ -65,32 +200,389 @@ void cadidaq::digitizer::configure(pt::iptree *node){
                  << "\t ROC FW rel.:\t"       << dg->ROCfirmwareRel() << std::endl
                  << "\t AMC FW rel.:\t"       << dg->AMCfirmwareRel() << ", uses DPP FW: " << (dg->hasDppFw() ? "yes" : "no") << std::endl
                  << "\t PCB rev.:\t"          << dg->PCBrevision() << std::endl;
-
-  reg = new cadidaq::registerSettings(name, dg->channels());
-  reg->parse(node);
-  reg->verify();
-  // call our own verification routine to check model-dependent options
-  verifySettings();
-  // now program the settings
-  programSettings(comDirection::WRITING);
-  /* Loop over all sub sections and keys that remained after parsing */
-  for (auto& key : *node){
-    DG_LOG_WARN << "Unknown setting in section " << name << " ignored: \t" << key.first << " = " << key.second.get_value<std::string>();
-  }
-
 }
 
-pt::iptree* cadidaq::digitizer::retrieveConfig(){
+void cadidaq::digitizer::retrieveConfig(pt::iptree &node){
   if (dg == nullptr){
     DG_LOG_FATAL << "Digitizer '" << name << "' not yet (properly) configured!";
-    return nullptr;
+    return;
   }
   // read the settings back from the device
   programSettings(comDirection::READING);
-  // dump settings into a ptree
-  pt::iptree *node = lnk->createPTree();
-  reg->fillPTree(node);
-  return node;
+  // dump settings into the ptree
+  lnk->fillPTree(&node);
+  reg->fillPTree(&node);
+}
+
+//
+// data acquisition
+//
+
+void cadidaq::digitizer::startAcquisition(){
+  if (dg == nullptr){
+    DG_LOG_FATAL << "Digitizer '" << name << "' not yet (properly) configured!";
+    return;
+  }
+  // the capacity of the event memory, to tell how full the board is during the run
+  eventCapacity = 0;
+  if (dg->getDPPFirmwareType() == CAEN_DGTZ_NotDPPFirmware){
+    try{
+      uint32_t code = dg->readRegister(bufferOrganizationRegister) & 0xF;
+      eventCapacity = 1u << code;
+    }
+    catch (caen::Error& e){
+      DG_LOG_DEBUG << "Could not read the buffer organization of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+    }
+  }
+  try{
+    dg->startAcquisition();
+    DG_LOG_INFO << "Acquisition started";
+  }
+  catch (caen::Error& e){
+    DG_LOG_ERROR << "Caught exception when starting acquisition on digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+  }
+}
+
+void cadidaq::digitizer::stopAcquisition(){
+  if (dg == nullptr)
+    return;
+  try{
+    dg->stopAcquisition();
+    DG_LOG_INFO << "Acquisition stopped";
+  }
+  catch (caen::Error& e){
+    DG_LOG_ERROR << "Caught exception when stopping acquisition on digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+  }
+}
+
+uint32_t cadidaq::digitizer::readoutBufferSize(){
+  if (dg == nullptr)
+    return 0;
+  // the size the CAEN library requires for the programmed settings
+  uint32_t required = 0;
+  try{
+    caen::ReadoutBuffer probe = dg->mallocReadoutBuffer();
+    required = probe.size;
+    dg->freeReadoutBuffer(probe);
+  }
+  catch (caen::Error& e){
+    DG_LOG_ERROR << "Caught exception when determining the readout buffer size of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+  }
+  // estimate from the settings: events per block transfer x (header + enabled channels x samples x at most 2 bytes)
+  if (reg->recordLength.first && reg->maxNumEventsBLT.first){
+    uint64_t nchannels = reg->chEnable.first.noneSet() ? dg->channels() : reg->chEnable.first.countTrue();
+    uint64_t estimate = static_cast<uint64_t>(*reg->maxNumEventsBLT.first) * (eventHeaderWords*sizeof(uint32_t) + nchannels * *reg->recordLength.first * 2);
+    if (estimate > UINT32_MAX)
+      estimate = UINT32_MAX;
+    if (estimate > required)
+      required = estimate;
+  }
+  return required;
+}
+
+std::string cadidaq::digitizer::getReadoutThread(){
+  if (reg && reg->readoutThread.first)
+    return *reg->readoutThread.first;
+  if (lnk == nullptr)
+    return name;
+  // boards sharing a link (daisy-chained on an optical link or in a VME crate behind a bridge) cannot be read concurrently
+  switch (*lnk->linkType){
+  case CAEN_DGTZ_OpticalLink: return "optical link " + std::to_string(*lnk->linkNum);
+  case CAEN_DGTZ_USB:         return "USB link " + std::to_string(*lnk->linkNum);
+  default:                    return "link " + std::to_string(*lnk->linkType) + "/" + std::to_string(*lnk->linkNum);
+  }
+}
+
+cadidaq::affinity::cpuList cadidaq::digitizer::getReadoutCPUs(){
+  if (reg == nullptr || !reg->readoutCPUs.first)
+    return affinity::cpuList();
+  return affinity::parse(*reg->readoutCPUs.first);
+}
+
+cadidaq::dppFormat cadidaq::digitizer::getDPPFormat(){
+  if (dg == nullptr)
+    return dppFormat::NONE;
+  // the list-mode format decoded is that of the x725 and x730 families
+  uint32_t family = dg->familyCode();
+  if (family != CAEN_DGTZ_XX725_FAMILY_CODE && family != CAEN_DGTZ_XX730_FAMILY_CODE)
+    return dppFormat::NONE;
+  switch (dg->getDPPFirmwareType()){
+  case CAEN_DGTZ_DPPFirmware_PSD: return dppFormat::PSD;
+  case CAEN_DGTZ_DPPFirmware_PHA: return dppFormat::PHA;
+  default:                        return dppFormat::NONE;
+  }
+}
+
+double cadidaq::digitizer::occupancy(){
+  if (dg == nullptr)
+    return -1;
+  try{
+    if (eventCapacity)
+      return std::min(1., static_cast<double>(dg->readRegister(eventStoredRegister)) / eventCapacity);
+    // DPP firmware: only tells whether there is data at all
+    return (dg->readRegister(acquisitionStatusRegister) & 0x8) ? -1 : 0;
+  }
+  catch (caen::Error& e){
+    return -1;
+  }
+}
+
+uint32_t cadidaq::digitizer::healthRegisters(){
+  if (dg == nullptr)
+    return 0;
+  uint32_t family = dg->familyCode();
+  if (family != CAEN_DGTZ_XX725_FAMILY_CODE && family != CAEN_DGTZ_XX730_FAMILY_CODE)
+    return 1;
+  uint32_t channels = dg->channels();
+  return 2 + (channels < boardHealth::maxChannels ? channels : boardHealth::maxChannels);
+}
+
+bool cadidaq::digitizer::readHealth(uint32_t index, boardHealth& health){
+  if (dg == nullptr)
+    return false;
+  try{
+    if (index == 0)
+      health.acquisitionStatus = dg->readRegister(acquisitionStatusRegister);
+    else if (index == 1)
+      health.failureStatus = dg->readRegister(failureStatusRegister);
+    else if (index - 2 < boardHealth::maxChannels){
+      health.temperature[index - 2] = std::min<uint32_t>(dg->readTemperature(index - 2), 0xFF);
+      health.channels = std::max(health.channels, index - 1);
+    }
+  }
+  catch (caen::Error& e){
+    if (stats)
+      stats->errors.add();
+    return false;
+  }
+  return true;
+}
+
+cadidaq::samplePacking cadidaq::digitizer::getSamplePacking(){
+  if (dg == nullptr || dg->hasDppFw())
+    return samplePacking::NONE;
+  switch (dg->familyCode()){
+  case CAEN_DGTZ_XX720_FAMILY_CODE:
+  case CAEN_DGTZ_XX724_FAMILY_CODE:
+  case CAEN_DGTZ_XX725_FAMILY_CODE:
+  case CAEN_DGTZ_XX730_FAMILY_CODE: return samplePacking::TWO_PER_WORD;
+  case CAEN_DGTZ_XX751_FAMILY_CODE: return samplePacking::THREE_PER_WORD;
+  case CAEN_DGTZ_XX740_FAMILY_CODE: return samplePacking::GROUP_OF_THREE;
+  case CAEN_DGTZ_XX742_FAMILY_CODE: return samplePacking::GROUP_OF_ONE;
+  default:                          return samplePacking::NONE;
+  }
+}
+
+const cadidaq::channelValues<uint32_t>& cadidaq::digitizer::getChannelValues(channelSetting setting){
+  return setting == channelSetting::TRIGGER_THRESHOLD ? reg->chTriggerThreshold.first : reg->chDCOffset.first;
+}
+
+std::string cadidaq::digitizer::getSettingName(channelSetting setting){
+  return setting == channelSetting::TRIGGER_THRESHOLD ? reg->chTriggerThreshold.second : reg->chDCOffset.second;
+}
+
+uint32_t cadidaq::digitizer::reprogram(channelSetting setting, const channelValues<uint32_t>& values){
+  if (dg == nullptr)
+    return 0;
+  if (setting == channelSetting::TRIGGER_THRESHOLD && dg->hasDppFw()){
+    DG_LOG_WARN << "'" << getSettingName(setting) << "' not reprogrammed on digitizer " << dg->modelName() << ", serial " << dg->serialNumber()
+                << ": the thresholds of the DPP firmware are not supported.";
+    return 0;
+  }
+  bool threshold = setting == channelSetting::TRIGGER_THRESHOLD;
+  channelValues<uint32_t>& programmed = threshold ? reg->chTriggerThreshold.first : reg->chDCOffset.first;
+  // the setting is shared by the channels of a group on boards with grouped channels
+  bool grouped = dg->groups() > 1;
+  unsigned perGroup = grouped ? std::max(dg->channelsPerGroup(), 1u) : 1;
+  uint32_t writes = 0;
+  for (unsigned g = 0; g * perGroup < values.size(); g++){
+    boost::optional<uint32_t> value = values.firstValue(g*perGroup, (g+1)*perGroup);
+    if (!value || programmed.firstValue(g*perGroup, (g+1)*perGroup) == value)
+      continue;
+    try{
+      if (threshold && grouped)
+        dg->setGroupTriggerThreshold(g, *value);
+      else if (threshold)
+        dg->setChannelTriggerThreshold(g, *value);
+      else if (grouped)
+        dg->setGroupDCOffset(g, *value);
+      else
+        dg->setChannelDCOffset(g, *value);
+    }
+    catch (caen::Error& e){
+      DG_LOG_ERROR << "Caught exception when setting '" << getSettingName(setting) << "' of " << (grouped ? "group " : "channel ") << g << " to " << *value
+                   << " on digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+      continue;
+    }
+    programmed.fill(value, g*perGroup, (g+1)*perGroup);
+    writes++;
+  }
+  return writes;
+}
+
+bool cadidaq::digitizer::fallingTrigger(unsigned ch){
+  return reg->chTriggerPolarity.first.get(ch) == CAEN_DGTZ_TriggerOnFallingEdge;
+}
+
+bool cadidaq::digitizer::waitForInterrupt(uint32_t timeout){
+  try{
+    dg->doIRQWait(timeout);
+  }
+  catch (caen::Error& e){
+    // also thrown when timing out
+    return false;
+  }
+  return true;
+}
+
+uint32_t cadidaq::digitizer::readData(caen::ReadoutBuffer &buffer){
+  if (dg == nullptr || buffer.data == nullptr)
+    return 0;
+  auto start = std::chrono::steady_clock::now();
+  try{
+    dg->readData(buffer, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT);
+  }
+  catch (caen::Error& e){
+    DG_LOG_ERROR << "Caught exception when reading data from digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+    if (stats)
+      stats->errors.add();
+    return 0;
+  }
+  if (stats)
+    stats->recordRead(buffer.dataSize, buffer.size, start, std::chrono::steady_clock::now());
+  return buffer.dataSize;
+}
+
+//
+// readout sizing
+//
+
+uint32_t cadidaq::digitizer::estimateEventSize(){
+  uint32_t recordLength = 0;
+  if (reg->recordLength.first)
+    recordLength = *reg->recordLength.first;
+  else {
+    try{
+      recordLength = dg->getRecordLength();
+    }
+    catch (caen::Error& e){
+      DG_LOG_DEBUG << "Could not read the record length of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+    }
+  }
+  if (dg->hasDppFw()){
+    // time tag, extras and energy/charges, plus the waveform (two samples per word) unless in list mode
+    bool waveforms = !reg->dppAcqMode.first || reg->dppAcqMode.first->mode != CAEN_DGTZ_DPP_ACQ_MODE_List;
+    return (3 + (waveforms ? (recordLength + 1) / 2 : 0)) * sizeof(uint32_t);
+  }
+  uint32_t nchannels = reg->chEnable.first.noneSet() ? dg->channels() : reg->chEnable.first.countTrue();
+  return eventHeaderWords * sizeof(uint32_t) + nchannels * recordLength * (dg->ADCbits() > 8 ? 2 : 1);
+}
+
+void cadidaq::digitizer::sizeReadout(){
+  bool calibrate = boost::iequals(*reg->readoutSizing.first, "Calibrate");
+  if (!calibrate && !boost::iequals(*reg->readoutSizing.first, "Auto"))
+    return;
+  uint32_t eventSize = std::max<uint32_t>(estimateEventSize(), 1);
+
+  if (dg->hasDppFw()){
+    // aggregates of about 'targetAggregateBytes' per channel; the library sizes the block transfers to them
+    uint32_t events = std::max<uint32_t>(1, std::min<uint32_t>(maxEventsPerTransfer, targetAggregateBytes / eventSize));
+    if (reg->dppEventAggregation.first && *reg->dppEventAggregation.first != events)
+      DG_LOG_WARN << "'" << reg->dppEventAggregation.second << " = " << *reg->dppEventAggregation.first << "' replaced as '" << reg->readoutSizing.second << " = " << *reg->readoutSizing.first << "'.";
+    if (calibrate)
+      DG_LOG_INFO << "No calibration run for DPP firmware, sizing the aggregates from the event size.";
+    reg->dppEventAggregation.first = events;
+    try{
+      dg->setDPPEventAggregation(events, 0);
+    }
+    catch (caen::Error& e){
+      DG_LOG_ERROR << "Caught exception when setting the event aggregation of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+      reg->dppEventAggregation.first = boost::none;
+      return;
+    }
+    DG_LOG_INFO << "Readout sizing: " << events << " events of about " << eventSize << " bytes per aggregate (" << events * eventSize / 1024. << " kB).";
+    return;
+  }
+
+  // largest useful block: within the library's limit, half of the board's event buffers (the other half takes new
+  // events during a transfer) and the size beyond which the fixed cost of a transfer hardly matters
+  uint32_t capacity = 0;
+  try{
+    capacity = 1u << (dg->readRegister(bufferOrganizationRegister) & 0xF);
+  }
+  catch (caen::Error& e){
+    DG_LOG_DEBUG << "Could not read the buffer organization of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+  }
+  uint32_t largest = std::min(maxEventsPerTransfer, std::max<uint32_t>(targetBlockBytes / eventSize, 1));
+  if (capacity)
+    largest = std::min(largest, std::max<uint32_t>(capacity / 2, 1));
+  if (reg->maxNumEventsBLT.first && *reg->maxNumEventsBLT.first != largest)
+    DG_LOG_WARN << "'" << reg->maxNumEventsBLT.second << " = " << *reg->maxNumEventsBLT.first << "' replaced as '" << reg->readoutSizing.second << " = " << *reg->readoutSizing.first << "'.";
+  uint32_t chosen = largest;
+  if (calibrate){
+    // the smallest block within a few percent of the best transfer rate (less memory and latency at the same efficiency)
+    std::vector<std::pair<uint32_t, double>> rates;
+    double best = 0;
+    for (uint32_t events = 1; ; events = std::min(events * 4, largest)){
+      double rate = measureTransferRate(events);
+      rates.push_back(std::make_pair(events, rate));
+      best = std::max(best, rate);
+      DG_LOG_INFO << "Readout sizing calibration: " << events << " event(s) (" << events * eventSize / 1024. << " kB) per block transfer: " << rate / (1024*1024) << " MB/s";
+      if (events == largest)
+        break;
+    }
+    if (best > 0)
+      for (auto& r : rates)
+        if (r.second >= (1 - calibrationTolerance) * best){
+          chosen = r.first;
+          break;
+        }
+  }
+  reg->maxNumEventsBLT.first = chosen;
+  programWrapper(&caen::Digitizer::setMaxNumEventsBLT, &caen::Digitizer::getMaxNumEventsBLT, reg->maxNumEventsBLT.first, comDirection::WRITING);
+  DG_LOG_INFO << "Readout sizing: " << chosen << " event(s) of " << eventSize << " bytes per block transfer (" << chosen * eventSize / 1024. << " kB"
+              << (capacity ? ", board memory organized in " + std::to_string(capacity) + " buffers" : "") << ").";
+}
+
+double cadidaq::digitizer::measureTransferRate(uint32_t events){
+  // blocks of 'events' software triggers, read as soon as they are stored; only the time spent transferring counts
+  uint64_t bytes = 0;
+  std::chrono::nanoseconds transferring(0);
+  caen::ReadoutBuffer buffer;
+  buffer.data = nullptr;
+  CAEN_DGTZ_TriggerMode_t swTrigger = CAEN_DGTZ_TRGMODE_DISABLED;
+  try{
+    swTrigger = dg->getSWTriggerMode();
+    dg->setSWTriggerMode(CAEN_DGTZ_TRGMODE_ACQ_ONLY);
+    dg->setMaxNumEventsBLT(events);
+    buffer = dg->mallocReadoutBuffer();
+    dg->clearData();
+    dg->startAcquisition();
+    auto end = std::chrono::steady_clock::now() + calibrationTime;
+    while (std::chrono::steady_clock::now() < end){
+      for (uint32_t i = 0; i < events; i++)
+        dg->sendSWtrigger();
+      auto start = std::chrono::steady_clock::now();
+      dg->readData(buffer, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT);
+      transferring += std::chrono::steady_clock::now() - start;
+      bytes += buffer.dataSize;
+    }
+  }
+  catch (caen::Error& e){
+    DG_LOG_ERROR << "Caught exception during the readout sizing calibration of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+    bytes = 0;
+  }
+  try{
+    dg->stopAcquisition();
+    dg->clearData();
+    dg->setSWTriggerMode(swTrigger);
+  }
+  catch (caen::Error& e){
+    DG_LOG_ERROR << "Caught exception when ending the readout sizing calibration of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+  }
+  if (buffer.data)
+    dg->freeReadoutBuffer(buffer);
+  return transferring.count() ? bytes / (transferring.count() * 1e-9) : 0;
 }
 
 //
@@ -102,21 +594,22 @@ pt::iptree* cadidaq::digitizer::retrieveConfig(){
 
 void cadidaq::digitizer::programMaskWrapper(void (caen::Digitizer::*write)(uint32_t), uint32_t (caen::Digitizer::*read)(), cadidaq::settingsBase::optionVector<bool> &vec, comDirection direction){
   boost::optional<uint32_t> mask = 0;
+  unsigned perGroup = dg->channelsPerGroup();
   // derive the mask in case we are writing it
   if (direction == comDirection::WRITING){
     // check if the setting has been configured at all
-    if (countSet(vec.first) == 0)
+    if (vec.first.noneSet())
       return; // keep the default
-    mask = vec2Mask(vec.first, dg->groups());
-    // verify that channel vector -> group mask conversion is consistent and the same as channel -> channel mask, else warn about misconfiguration
-    if (vec2Mask(vec.first, 1, dg->channelsPerGroup()) != vec2Mask(vec.first, 1, 1)){
-      DG_LOG_WARN << "Channel mask cannot be exactly mapped to groups of the device '"<< dg->modelName() << "' for setting '" << vec.second << "'. Using instead group mask of " << mask;
+    mask = static_cast<uint32_t>(vec.first.groupMask(perGroup));
+    // verify that channel -> group mask conversion is consistent, else warn about misconfiguration
+    if (!vec.first.groupsConsistent(perGroup)){
+      DG_LOG_WARN << "Channel mask cannot be exactly mapped to groups of the device '"<< dg->modelName() << "' for setting '" << vec.second << "'. Using instead group mask of " << *mask;
     }
   }
   programWrapper(write, read, mask, direction);
   // if reading: now store the retrieved mask it in the vector
   if (direction == comDirection::READING)
-    mask2Vec(mask, vec.first, dg->groups());
+    vec.first.fromGroupMask(mask ? boost::optional<uint64_t>(*mask) : boost::optional<uint64_t>(boost::none), perGroup);
 }
 
 
@@ -127,8 +620,45 @@ void cadidaq::digitizer::verifySettings(){
   // TODO: Trigger Polarity: channel parameter is unused (i.e. the setting is common to all channels) for those digitizers that do not support the individual trigger polarity setting. Please refer to the Registers Description document of the relevant board for check
   // TODO: Trigger Polarity: not for DPP FW
   // TODO: ChannelTriggerThreshold not for DPP FW (inform about alternative setting)
-  // TODO: MaxNumEventsBLT: if using DPP-PHA, DPP-PSD or DPP-CI firmware, you have to refer to the SetDPPEventAggregation function.
+  if (dg->hasDppFw() && reg->maxNumEventsBLT.first)
+    DG_LOG_WARN << "'" << reg->maxNumEventsBLT.second << "' is not supported by DPP firmware, use '" << reg->dppEventAggregation.second << "' instead.";
   // TOOD: options specific to one model should not be set if we are using one without that function
+
+  // readout scheduling: interrupts are only delivered via the optical link
+  if (boost::iequals(*reg->readoutMode.first, "Poll"))
+    mode = readoutMode::POLL;
+  else if (boost::iequals(*reg->readoutMode.first, "IRQ")){
+    if (*lnk->linkType == CAEN_DGTZ_OpticalLink)
+      mode = readoutMode::IRQ;
+    else {
+      DG_LOG_WARN << "Interrupts are only supported via the optical link, using adaptive polling instead of '" << reg->readoutMode.second << " = " << *reg->readoutMode.first << "'.";
+      mode = readoutMode::ADAPTIVE;
+    }
+  } else
+    mode = readoutMode::ADAPTIVE;
+  DG_LOG_DEBUG << "Readout mode: " << toString(mode) << " (reading at least every " << *reg->readoutMaxInterval.first << " us)";
+
+  // overflow control
+  overflow = toOverflowPolicy(*reg->overflowPolicy.first);
+  DG_LOG_DEBUG << "Overflow policy: " << toString(overflow);
+
+  // event filter: compiled once, applied by the processing to the decoded DPP events
+  if (filter)
+    delete filter;
+  filter = nullptr;
+  if (reg->eventFilter.first && !reg->eventFilter.first->empty()){
+    if (getDPPFormat() == dppFormat::NONE)
+      DG_LOG_WARN << "'" << reg->eventFilter.second << "' only applies to the decoded events of DPP-PSD and DPP-PHA firmware, all events are kept.";
+    else {
+      try {
+        filter = new eventFilter(*reg->eventFilter.first);
+        DG_LOG_INFO << "Keeping the events selected by " << filter->describe();
+      }
+      catch (const std::runtime_error& e){
+        DG_LOG_ERROR << e.what() << " -- all events are kept.";
+      }
+    }
+  }
 }
 
 /** Implements model/FW-specific settings verification and the calls mapping read/write methods from/to the digitizer and the corresponding the settings.
@@ -164,7 +694,17 @@ void cadidaq::digitizer::programSettings(comDirection direction){
     }
   } else {
     // DPP FW only
-    
+    // (there is no call reading the event aggregation back: the value programmed is kept)
+    if (direction == comDirection::WRITING && reg->dppEventAggregation.first){
+      try{
+        dg->setDPPEventAggregation(*reg->dppEventAggregation.first, 0);
+      }
+      catch (caen::Error& e){
+        DG_LOG_ERROR << "Caught exception when communicating with digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ":";
+        DG_LOG_ERROR << "\t Setting the event aggregation to '" << *reg->dppEventAggregation.first << "' caused exception: " << e.what();
+        reg->dppEventAggregation.first = boost::none;
+      }
+    }
   } // hasDPP
   // Standard FW and DPP, either grouped or non-grouped channels:
   if (dg->groups() == 1){
@@ -204,12 +744,13 @@ void cadidaq::digitizer::programSettings(comDirection direction){
     // NOTE: loop wrapper is called with ignoreGroups = true as the DPP options are set channel-by-channel in contrast to the non-DPP channel options
     if (fw == CAEN_DGTZ_DPPFirmware_CI){
       // DPP-CI only supports ch= -1 (different channels must have the same pre-trigger)
-      if (!allValuesSame(reg->dppPreTriggerSize.first)){
+      if (!reg->dppPreTriggerSize.first.allSame()){
         DG_LOG_WARN << "Firmware only supports same pre-trigger for all channels but " << reg->dppPreTriggerSize.second << " not set to same value for all channels. Will apply value given for first channel to all.";
       }
-      programWrapper(&caen::Digitizer::setDPPPreTriggerSize, &caen::Digitizer::getDPPPreTriggerSize, -1, reg->dppPreTriggerSize.first.at(0), direction);
+      boost::optional<uint32_t> preTrigger = reg->dppPreTriggerSize.first.get(0);
+      programWrapper(&caen::Digitizer::setDPPPreTriggerSize, &caen::Digitizer::getDPPPreTriggerSize, -1, preTrigger, direction);
       // set other elements in the vector to same value for consistency
-      std::fill(reg->dppPreTriggerSize.first.begin(), reg->dppPreTriggerSize.first.end(), reg->dppPreTriggerSize.first.at(0));
+      reg->dppPreTriggerSize.first.fill(preTrigger);
     } else {
       programLoopWrapper(&caen::Digitizer::setDPPPreTriggerSize, &caen::Digitizer::getDPPPreTriggerSize, reg->dppPreTriggerSize, direction, true);
     }
@@ -218,6 +759,19 @@ void cadidaq::digitizer::programSettings(comDirection direction){
     programWrapper(&caen::Digitizer::setDPPTriggerMode, &caen::Digitizer::getDPPTriggerMode, reg->dppTriggermode.first, direction);
   }
 
+  /* interrupts for the IRQ readout mode (optical link interrupt, raised once the given number of events is stored) */
+  if (direction == comDirection::WRITING && mode == readoutMode::IRQ){
+    try{
+      dg->writeRegister(irqEventNumberRegister, *reg->readoutIRQEvents.first);
+      dg->writeRegister(readoutControlRegister, dg->readRegister(readoutControlRegister) | 0x8);
+    }
+    catch (caen::Error& e){
+      DG_LOG_ERROR << "Caught exception when configuring interrupts of digitizer " << dg->modelName() << ", serial " << dg->serialNumber() << ": " << e.what();
+      DG_LOG_WARN << "Using adaptive polling instead of interrupts.";
+      mode = readoutMode::ADAPTIVE;
+    }
+  }
+
   /* program address-value pairs configured individually */
   for (auto r:reg->registerValues){
     try{
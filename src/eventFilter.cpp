@@ -0,0 +1,480 @@
+#include <eventFilter.hpp>
+
+#include <stdexcept> // exceptions
+#include <sstream>
+#include <algorithm> // sort, max
+#include <limits>
+#include <cctype>    // isspace, isalnum, isdigit
+
+#include <boost/algorithm/string.hpp>
+
+#include <helper.hpp> // parseRanges
+
+namespace {
+  /// merges the operation's result 'selected' into the mask entry
+  template <typename T, typename P>
+  inline void apply(const T* column, size_t n, uint8_t* mask, uint8_t how, P selected){
+    // (one loop per way of merging, each without branches so that it is vectorized)
+    switch (how){
+    case 0:
+      for (size_t i = 0; i < n; i++)
+        mask[i] = selected(column[i]);
+      break;
+    case 1:
+      for (size_t i = 0; i < n; i++)
+        mask[i] &= selected(column[i]);
+      break;
+    default:
+      for (size_t i = 0; i < n; i++)
+        mask[i] |= selected(column[i]);
+    }
+  }
+
+  inline void fill(uint8_t* mask, size_t n, uint8_t how, bool value){
+    if (how == 0 || (how == 1 && !value) || (how == 2 && value))
+      std::fill(mask, mask + n, value ? 1 : 0);
+  }
+}
+
+/** /class eventFilter::parser
+    Recursive descent parser of filter expressions building the nodes of the filter.
+*/
+class cadidaq::eventFilter::parser {
+public:
+  parser(const std::string& text, eventFilter& filter) : text(text), pos(0), filter(filter) {}
+
+  uint32_t parse(){
+    uint32_t n = disjunction();
+    skipSpace();
+    if (pos < text.size())
+      fail("unexpected '" + text.substr(pos, 1) + "'");
+    return n;
+  }
+
+private:
+  uint32_t disjunction(){
+    std::vector<uint32_t> terms(1, conjunction());
+    while (accept("||"))
+      terms.push_back(conjunction());
+    return join(kind::OR, terms);
+  }
+
+  uint32_t conjunction(){
+    std::vector<uint32_t> terms(1, unary());
+    while (accept("&&"))
+      terms.push_back(unary());
+    return join(kind::AND, terms);
+  }
+
+  uint32_t unary(){
+    if (accept("!")){
+      uint32_t n = unary();
+      filter.negate(n);
+      return n;
+    }
+    if (accept("(")){
+      uint32_t n = disjunction();
+      if (!accept(")"))
+        fail("')' expected");
+      return n;
+    }
+    return predicate();
+  }
+
+  uint32_t predicate(){
+    size_t start = pos;
+    std::string name = word();
+    node n;
+    n.column = field::FLAGS;
+    n.value = 0;
+    if (boost::iequals(name, "pileup")){
+      n.type = kind::PILEUP;
+      return add(n);
+    }
+    if (boost::iequals(name, "timestamp"))
+      n.column = field::TIMESTAMP;
+    else if (boost::iequals(name, "channel"))
+      n.column = field::CHANNEL;
+    else if (boost::iequals(name, "energy"))
+      n.column = field::ENERGY;
+    else if (boost::iequals(name, "chargeShort"))
+      n.column = field::CHARGE_SHORT;
+    else if (boost::iequals(name, "flags"))
+      n.column = field::FLAGS;
+    else {
+      pos = start;
+      fail(name.empty() ? "field name expected" : "unknown field '" + name + "' (timestamp, channel, energy, chargeShort, flags or pileup)");
+    }
+    // 'field in [RANGE]', with the range syntax of the channel settings
+    size_t before = pos;
+    if (boost::iequals(word(), "in")){
+      if (!accept("["))
+        fail("'[' expected");
+      size_t close = text.find(']', pos);
+      if (close == std::string::npos)
+        fail("list of values and ranges (e.g. 0-3,8) followed by ']' expected");
+      // compared as intervals, the bounds fitting the column (all but the time stamps are 16 bit)
+      std::vector<std::pair<uint64_t, uint64_t>> ranges;
+      try{
+        std::string list = text.substr(pos, close - pos);
+        if (n.column == field::TIMESTAMP)
+          ranges = parseRanges<uint64_t>(list);
+        else
+          for (auto& r : parseRanges<uint16_t>(list))
+            ranges.push_back(std::make_pair(r.first, r.second));
+      }
+      catch (std::invalid_argument& err){
+        fail(err.what());
+      }
+      pos = close + 1;
+      std::sort(ranges.begin(), ranges.end());
+      for (auto& r : ranges)
+        if (!n.ranges.empty() && (r.first <= n.ranges.back().second || r.first - n.ranges.back().second == 1))
+          n.ranges.back().second = std::max(n.ranges.back().second, r.second);
+        else
+          n.ranges.push_back(r);
+      n.type = kind::IN;
+      return add(n);
+    }
+    pos = before;
+    if (accept("<="))
+      n.type = kind::LESS_EQUAL;
+    else if (accept(">="))
+      n.type = kind::GREATER_EQUAL;
+    else if (accept("=="))
+      n.type = kind::EQUAL;
+    else if (accept("!="))
+      n.type = kind::NOT_EQUAL;
+    else if (accept("<"))
+      n.type = kind::LESS;
+    else if (accept(">"))
+      n.type = kind::GREATER;
+    else
+      fail("comparison (<, <=, >, >=, ==, !=) or 'in' expected after '" + name + "'");
+    n.value = number();
+    return add(n);
+  }
+
+  /// a conjunction or disjunction of the terms, merging those of the same kind (e.g. from parentheses or negations)
+  uint32_t join(kind type, const std::vector<uint32_t>& terms){
+    if (terms.size() == 1)
+      return terms[0];
+    node n;
+    n.type = type;
+    n.column = field::FLAGS;
+    n.value = 0;
+    for (uint32_t t : terms)
+      if (filter.nodes[t].type == type)
+        n.children.insert(n.children.end(), filter.nodes[t].children.begin(), filter.nodes[t].children.end());
+      else
+        n.children.push_back(t);
+    return add(n);
+  }
+
+  uint32_t add(const node& n){
+    filter.nodes.push_back(n);
+    return filter.nodes.size() - 1;
+  }
+
+  uint64_t number(){
+    skipSpace();
+    size_t start = pos;
+    int base = 10;
+    if (text.compare(pos, 2, "0x") == 0 || text.compare(pos, 2, "0X") == 0){
+      base = 16;
+      pos += 2;
+    }
+    uint64_t value = 0;
+    size_t digits = 0;
+    for (; pos < text.size() && std::isxdigit(static_cast<unsigned char>(text[pos])); pos++, digits++){
+      int d = std::isdigit(static_cast<unsigned char>(text[pos])) ? text[pos] - '0' : std::tolower(text[pos]) - 'a' + 10;
+      if (d >= base)
+        break;
+      if (value > (std::numeric_limits<uint64_t>::max() - d) / base){
+        pos = start;
+        fail("number out of range (at most " + std::to_string(std::numeric_limits<uint64_t>::max()) + ")");
+      }
+      value = value * base + d;
+    }
+    if (digits == 0){
+      pos = start;
+      fail("number expected");
+    }
+    return value;
+  }
+
+  std::string word(){
+    skipSpace();
+    size_t start = pos;
+    while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+      pos++;
+    return text.substr(start, pos - start);
+  }
+
+  bool accept(const std::string& token){
+    skipSpace();
+    if (text.compare(pos, token.size(), token) != 0)
+      return false;
+    // '!' is not the start of '!='
+    if (token == "!" && text.compare(pos, 2, "!=") == 0)
+      return false;
+    pos += token.size();
+    return true;
+  }
+
+  void skipSpace(){
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+      pos++;
+  }
+
+  void fail(const std::string& message){
+    throw std::runtime_error("Invalid event filter '" + text + "' at position " + std::to_string(pos + 1) + ": " + message);
+  }
+
+  const std::string& text;
+  size_t             pos;
+  eventFilter&       filter;
+};
+
+cadidaq::eventFilter::eventFilter(const std::string& expression){
+  parser p(expression, *this);
+  root = p.parse();
+  // each level of nested conjunctions and disjunctions (and a range list) may need a mask of its own
+  levels = depth(root);
+}
+
+void cadidaq::eventFilter::negate(uint32_t n){
+  node& nd = nodes[n];
+  switch (nd.type){
+  case kind::AND:           nd.type = kind::OR; break;
+  case kind::OR:            nd.type = kind::AND; break;
+  case kind::LESS:          nd.type = kind::GREATER_EQUAL; break;
+  case kind::LESS_EQUAL:    nd.type = kind::GREATER; break;
+  case kind::GREATER:       nd.type = kind::LESS_EQUAL; break;
+  case kind::GREATER_EQUAL: nd.type = kind::LESS; break;
+  case kind::EQUAL:         nd.type = kind::NOT_EQUAL; break;
+  case kind::NOT_EQUAL:     nd.type = kind::EQUAL; break;
+  case kind::IN:            nd.type = kind::NOT_IN; break;
+  case kind::NOT_IN:        nd.type = kind::IN; break;
+  case kind::PILEUP:        nd.type = kind::NOT_PILEUP; break;
+  case kind::NOT_PILEUP:    nd.type = kind::PILEUP; break;
+  }
+  for (uint32_t c : nd.children)
+    negate(c);
+}
+
+uint32_t cadidaq::eventFilter::depth(uint32_t n) const {
+  const node& nd = nodes[n];
+  uint32_t d = 0;
+  for (uint32_t c : nd.children)
+    d = std::max(d, depth(c));
+  return d + 1;
+}
+
+void cadidaq::eventFilter::reserve(workspace& ws, size_t events) const {
+  ws.reserve((levels + 1) * events);
+}
+
+void cadidaq::eventFilter::evaluate(const dppEventBatch& batch, uint8_t* mask, workspace& ws) const {
+  size_t n = batch.size();
+  if (ws.size() < levels * n)
+    ws.resize(levels * n);
+  evaluate(root, batch, mask, combine::SET, ws.data());
+}
+
+void cadidaq::eventFilter::evaluate(uint32_t n, const dppEventBatch& batch, uint8_t* mask, combine how, uint8_t* scratch) const {
+  const node& nd = nodes[n];
+  size_t size = batch.size();
+  uint8_t h = static_cast<uint8_t>(how);
+
+  if (nd.type == kind::AND || nd.type == kind::OR){
+    // the children merge straight into the mask, but a conjunction within a disjunction (or vice versa) is
+    // evaluated into a mask of its own first
+    combine own = nd.type == kind::AND ? combine::AND : combine::OR;
+    bool direct = how == combine::SET || how == own;
+    uint8_t* target = direct ? mask : scratch;
+    for (size_t c = 0; c < nd.children.size(); c++)
+      evaluate(nd.children[c], batch, target, c == 0 && (how == combine::SET || !direct) ? combine::SET : own, scratch + size);
+    if (!direct)
+      apply(scratch, size, mask, h, [](uint8_t s){return s;});
+    return;
+  }
+
+  if (nd.type == kind::PILEUP || nd.type == kind::NOT_PILEUP){
+    uint16_t expected = nd.type == kind::PILEUP ? DPP_PILEUP : 0;
+    apply(batch.flags.data(), size, mask, h, [expected](uint16_t f){return static_cast<uint8_t>((f & DPP_PILEUP) == expected);});
+    return;
+  }
+
+  if (nd.type == kind::IN || nd.type == kind::NOT_IN){
+    // the ranges are merged into a mask of their own, unless they can go straight into the result
+    bool direct = nd.type == kind::IN && (how != combine::AND || nd.ranges.size() == 1);
+    uint8_t* target = direct ? mask : scratch;
+    for (size_t r = 0; r < nd.ranges.size(); r++){
+      uint64_t low = nd.ranges[r].first;
+      uint64_t span = nd.ranges[r].second - low;
+      uint8_t rh = direct ? (r == 0 ? h : static_cast<uint8_t>(combine::OR)) : (r == 0 ? 0 : static_cast<uint8_t>(combine::OR));
+      // one unsigned comparison per value tests low <= x <= high
+      if (nd.column == field::TIMESTAMP)
+        apply(batch.timestamp.data(), size, target, rh, [low, span](uint64_t x){return static_cast<uint8_t>(x - low <= span);});
+      else {
+        const uint16_t* column = nd.column == field::CHANNEL ? batch.channel.data() : nd.column == field::ENERGY ? batch.energy.data()
+                               : nd.column == field::CHARGE_SHORT ? batch.chargeShort.data() : batch.flags.data();
+        // (the bounds fit the column, the parser rejects others)
+        uint16_t l = low;
+        uint16_t s = span;
+        apply(column, size, target, rh, [l, s](uint16_t x){return static_cast<uint8_t>(static_cast<uint16_t>(x - l) <= s);});
+      }
+    }
+    if (!direct){
+      if (nd.type == kind::IN)
+        apply(scratch, size, mask, h, [](uint8_t s){return s;});
+      else
+        apply(scratch, size, mask, h, [](uint8_t s){return static_cast<uint8_t>(s ^ 1);});
+    }
+    return;
+  }
+
+  // comparisons, in the width of the column
+  if (nd.column == field::TIMESTAMP){
+    uint64_t v = nd.value;
+    const uint64_t* column = batch.timestamp.data();
+    switch (nd.type){
+    case kind::LESS:          apply(column, size, mask, h, [v](uint64_t x){return static_cast<uint8_t>(x <  v);}); break;
+    case kind::LESS_EQUAL:    apply(column, size, mask, h, [v](uint64_t x){return static_cast<uint8_t>(x <= v);}); break;
+    case kind::GREATER:       apply(column, size, mask, h, [v](uint64_t x){return static_cast<uint8_t>(x >  v);}); break;
+    case kind::GREATER_EQUAL: apply(column, size, mask, h, [v](uint64_t x){return static_cast<uint8_t>(x >= v);}); break;
+    case kind::EQUAL:         apply(column, size, mask, h, [v](uint64_t x){return static_cast<uint8_t>(x == v);}); break;
+    default:                  apply(column, size, mask, h, [v](uint64_t x){return static_cast<uint8_t>(x != v);}); break;
+    }
+    return;
+  }
+  const uint16_t* column = nd.column == field::CHANNEL ? batch.channel.data() : nd.column == field::ENERGY ? batch.energy.data()
+                         : nd.column == field::CHARGE_SHORT ? batch.chargeShort.data() : batch.flags.data();
+  if (nd.value > std::numeric_limits<uint16_t>::max()){
+    // beyond the column's values: the same outcome for all events
+    fill(mask, size, h, nd.type == kind::LESS || nd.type == kind::LESS_EQUAL || nd.type == kind::NOT_EQUAL);
+    return;
+  }
+  uint16_t v = nd.value;
+  switch (nd.type){
+  case kind::LESS:          apply(column, size, mask, h, [v](uint16_t x){return static_cast<uint8_t>(x <  v);}); break;
+  case kind::LESS_EQUAL:    apply(column, size, mask, h, [v](uint16_t x){return static_cast<uint8_t>(x <= v);}); break;
+  case kind::GREATER:       apply(column, size, mask, h, [v](uint16_t x){return static_cast<uint8_t>(x >  v);}); break;
+  case kind::GREATER_EQUAL: apply(column, size, mask, h, [v](uint16_t x){return static_cast<uint8_t>(x >= v);}); break;
+  case kind::EQUAL:         apply(column, size, mask, h, [v](uint16_t x){return static_cast<uint8_t>(x == v);}); break;
+  default:                  apply(column, size, mask, h, [v](uint16_t x){return static_cast<uint8_t>(x != v);}); break;
+  }
+}
+
+uint32_t cadidaq::eventFilter::select(dppEventBatch& batch, workspace& ws) const {
+  size_t n = batch.size();
+  if (ws.size() < (levels + 1) * n)
+    ws.resize((levels + 1) * n);
+  uint8_t* mask = ws.data() + levels * n;
+  evaluate(root, batch, mask, combine::SET, ws.data());
+  // move the selected events to the front, writing every event and advancing past the selected ones only
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++){
+    batch.timestamp[k]   = batch.timestamp[i];
+    batch.channel[k]     = batch.channel[i];
+    batch.energy[k]      = batch.energy[i];
+    batch.chargeShort[k] = batch.chargeShort[i];
+    batch.flags[k]       = batch.flags[i];
+    k += mask[i];
+  }
+  // (shrinking keeps the storage)
+  batch.resize(k);
+  return n - k;
+}
+
+bool cadidaq::eventFilter::matches(const dppEvent& event) const {
+  return matches(root, event);
+}
+
+bool cadidaq::eventFilter::matches(uint32_t n, const dppEvent& event) const {
+  const node& nd = nodes[n];
+  switch (nd.type){
+  case kind::AND:
+    for (uint32_t c : nd.children)
+      if (!matches(c, event))
+        return false;
+    return true;
+  case kind::OR:
+    for (uint32_t c : nd.children)
+      if (matches(c, event))
+        return true;
+    return false;
+  case kind::PILEUP:
+    return event.flags & DPP_PILEUP;
+  case kind::NOT_PILEUP:
+    return !(event.flags & DPP_PILEUP);
+  default:
+    break;
+  }
+  uint64_t x = 0;
+  switch (nd.column){
+  case field::TIMESTAMP:    x = event.timestamp; break;
+  case field::CHANNEL:      x = event.channel; break;
+  case field::ENERGY:       x = event.energy; break;
+  case field::CHARGE_SHORT: x = event.chargeShort; break;
+  case field::FLAGS:        x = event.flags; break;
+  }
+  switch (nd.type){
+  case kind::LESS:          return x <  nd.value;
+  case kind::LESS_EQUAL:    return x <= nd.value;
+  case kind::GREATER:       return x >  nd.value;
+  case kind::GREATER_EQUAL: return x >= nd.value;
+  case kind::EQUAL:         return x == nd.value;
+  case kind::NOT_EQUAL:     return x != nd.value;
+  case kind::IN:
+  case kind::NOT_IN: {
+    bool in = false;
+    for (auto& r : nd.ranges)
+      in = in || (x >= r.first && x <= r.second);
+    return in == (nd.type == kind::IN);
+  }
+  default:
+    return false;
+  }
+}
+
+std::string cadidaq::eventFilter::describe() const {
+  return describe(root);
+}
+
+std::string cadidaq::eventFilter::describe(uint32_t n) const {
+  static const char* fields[] = {"timestamp", "channel", "energy", "chargeShort", "flags"};
+  const node& nd = nodes[n];
+  std::ostringstream s;
+  switch (nd.type){
+  case kind::AND:
+  case kind::OR:
+    s << "(";
+    for (size_t c = 0; c < nd.children.size(); c++)
+      s << (c ? (nd.type == kind::AND ? " && " : " || ") : "") << describe(nd.children[c]);
+    s << ")";
+    break;
+  case kind::PILEUP:
+    s << "pileup";
+    break;
+  case kind::NOT_PILEUP:
+    s << "!pileup";
+    break;
+  case kind::IN:
+  case kind::NOT_IN:
+    s << (nd.type == kind::NOT_IN ? "!(" : "") << fields[static_cast<int>(nd.column)] << " in [";
+    for (size_t r = 0; r < nd.ranges.size(); r++){
+      s << (r ? "," : "") << nd.ranges[r].first;
+      if (nd.ranges[r].second != nd.ranges[r].first)
+        s << "-" << nd.ranges[r].second;
+    }
+    s << "]" << (nd.type == kind::NOT_IN ? ")" : "");
+    break;
+  default: {
+    static const char* ops[] = {"", "", "<", "<=", ">", ">=", "==", "!="};
+    s << fields[static_cast<int>(nd.column)] << " " << ops[static_cast<int>(nd.type)] << " " << nd.value;
+  }
+  }
+  return s.str();
+}
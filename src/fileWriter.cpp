@@ -0,0 +1,513 @@
+#include <fileWriter.hpp>
+#include <readoutScheduler.hpp> // threadCpuTime
+
+#include <fstream>
+#include <iomanip>   // setw, setfill
+#include <cstring>   // memcpy, memset, strncpy, strerror
+#include <sstream>
+#include <ctime>     // localtime_r, strftime
+#include <cerrno>
+#include <algorithm> // max, min
+#include <stdexcept> // exceptions
+#include <memory>    // unique_ptr
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <boost/crc.hpp>
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define WRT_LOG_DEBUG BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::debug)
+#define WRT_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define WRT_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+#define WRT_LOG_ERROR BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::error)
+
+namespace layout = cadidaq::dataFileLayout;
+
+namespace {
+  /// size and number of the chunks the records are collected in before being written
+  const size_t   chunkSize  = 4*1024*1024;
+  const uint32_t chunkCount = 8;
+  const uint32_t noChunk = ~0u;
+  /// longest time data is kept in a chunk before it is written (unless more arrives)
+  const std::chrono::milliseconds flushInterval(1000);
+
+  /// writes all of 'size' bytes, returns false on error
+  bool writeAll(int fd, const char* data, size_t size){
+    while (size){
+      ssize_t n = write(fd, data, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  /** runs 'command' (a program and its arguments separated by white space, not interpreted by a shell) with 'path' as its
+      last argument and waits for it; returns its exit status (127 if it could not be run, 128 + the signal if killed) */
+  int runCommand(const std::string& command, const std::string& path){
+    std::vector<std::string> words;
+    std::istringstream in(command);
+    for (std::string word; in >> word; )
+      words.push_back(word);
+    words.push_back(path);
+    // (built before forking: the child of a multi-threaded process may only call async-signal-safe functions)
+    std::vector<char*> argv;
+    for (auto& word : words)
+      argv.push_back(&word[0]);
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid < 0)
+      return 127;
+    if (pid == 0){
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+      if (errno != EINTR)
+        return 127;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  }
+}
+
+cadidaq::fileWriter::fileWriter(const std::string& base, const rotation& rotate, const std::vector<std::string>& boardNames, const std::vector<dppFormat>& formats,
+                                const std::string& configuration, uint32_t maxRecordBytes, const std::string& compressCommand,
+                                stageMetrics& writeStats, stageMetrics& finaliseStats, const affinity::cpuList& cpus)
+  : rotate(rotate), boardNames(boardNames), formats(formats), configuration(configuration), compressCommand(compressCommand),
+    chunkBytes(std::max<size_t>(chunkSize, sizeof(layout::recordHeader) + layout::align(maxRecordBytes))), cpus(cpus), ring(nullptr), ringBytes(0),
+    writeStats(writeStats), finaliseStats(finaliseStats), current(noChunk), queueHead(0), queueCount(0), mapped(false), pinned(false), closing(false),
+    fileBytes(0), fileEvents(0), records(0), blockedNanoseconds(0), completeLatency(nullptr), endToEndLatency(nullptr), trace(nullptr), traceThread(0), fd(-1), fileSize(0), fileNumber(0), bytesWritten(0), finaliseDone(false) {
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("writer"));
+  finaliseLg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("writer"));
+  // the files of a run are named after its start
+  auto now = std::chrono::system_clock::now();
+  runStart = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+  started = clock::now();
+  std::time_t t = std::chrono::system_clock::to_time_t(now);
+  struct tm local;
+  localtime_r(&t, &local);
+  char stamp[32];
+  std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+  prefix = base + "_" + stamp + "_";
+
+  // all memory is allocated up front (the chunks by the writer thread, once placed)
+  chunks.resize(chunkCount);
+  for (uint32_t c = 0; c < chunkCount; c++)
+    freeChunks.push_back(c);
+  queue.resize(chunkCount);
+  lastTimestamp.resize(boardNames.size(), 0);
+  current = freeChunks.back();
+  freeChunks.pop_back();
+
+  fd = openFile();
+  if (fd < 0)
+    throw std::runtime_error("Could not create data file '" + path + "': " + strerror(errno));
+  writer = std::thread(&fileWriter::runWriter, this);
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    chunkFree.wait(lock, [this]{return mapped;});
+  }
+  if (ring == nullptr){
+    writer.join();
+    ::close(fd);
+    unlink(path.c_str());
+    throw std::runtime_error("Could not allocate " + std::to_string(ringBytes / (1024*1024)) + " MB for the chunks of data file '" + path + "'");
+  }
+  if (!cpus.empty() && !pinned)
+    WRT_LOG_ERROR << "Could not pin the writer to CPUs " << affinity::describe(cpus) << ", running it on any CPU.";
+  std::string memory = affinity::memoryNodes(ring);
+  WRT_LOG_INFO << "Writer on CPUs " << affinity::describe(writerCPUs) << ", its " << chunkCount << " chunks of "
+               << chunkBytes / (1024*1024) << " MB on " << (memory.empty() ? "unknown NUMA node(s)" : "NUMA node(s) " + memory + " (pages per node)");
+  WRT_LOG_INFO << "Writing data to " << prefix << "*.cdaq" << (rotate.bytes || rotate.events || rotate.seconds ? ", starting a new file every " : "")
+               << (rotate.bytes ? std::to_string(rotate.bytes/(1024*1024)) + " MB " : "")
+               << (rotate.events ? std::to_string(rotate.events) + " events " : "")
+               << (rotate.seconds ? std::to_string(rotate.seconds) + " s" : "")
+               << (compressCommand.empty() ? "" : ", compressed by '" + compressCommand + "'");
+  finaliser = std::thread(&fileWriter::runFinaliser, this);
+}
+
+cadidaq::fileWriter::~fileWriter(){
+  close();
+  if (ring)
+    munmap(ring, ringBytes);
+}
+
+int cadidaq::fileWriter::openFile(){
+  char number[16];
+  snprintf(number, sizeof(number), "%04u", fileNumber);
+  path = prefix + number + ".cdaq";
+  int f = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (f < 0)
+    return -1;
+  layout::fileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic             = layout::magic;
+  header.version           = layout::version;
+  header.fileNumber        = fileNumber;
+  header.nboards           = std::min<size_t>(boardNames.size(), layout::maxBoards);
+  header.runStart          = runStart;
+  header.fileStart         = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  header.configurationSize = configuration.size();
+  for (uint32_t b = 0; b < header.nboards; b++){
+    std::strncpy(header.boardNames[b], boardNames[b].c_str(), layout::nameLength - 1);
+    header.dppFormats[b] = b < formats.size() ? static_cast<uint8_t>(formats[b]) : 0;
+  }
+  const char padding[8] = {};
+  size_t padded = layout::align(configuration.size()) - configuration.size();
+  if (!writeAll(f, reinterpret_cast<const char*>(&header), sizeof(header)) || !writeAll(f, configuration.data(), configuration.size())
+      || !writeAll(f, padding, padded)){
+    int error = errno;
+    ::close(f);
+    errno = error;
+    return -1;
+  }
+  fileNumber++;
+  fileSize = sizeof(header) + configuration.size() + padded;
+  bytesWritten += fileSize;
+  index.clear();
+  return f;
+}
+
+void cadidaq::fileWriter::finishFile(){
+  layout::fileTrailer trailer = {layout::trailerMagic, static_cast<uint32_t>(index.size()), fileSize};
+  if (!writeAll(fd, reinterpret_cast<const char*>(index.data()), index.size() * sizeof(layout::indexEntry))
+      || !writeAll(fd, reinterpret_cast<const char*>(&trailer), sizeof(trailer)))
+    writeStats.errors.addShared();
+  else
+    bytesWritten += index.size() * sizeof(layout::indexEntry) + sizeof(trailer);
+  std::lock_guard<std::mutex> finishedLock(finaliseMutex);
+  finished.push_back({fd, path});
+  fd = -1;
+  fileFinished.notify_one();
+}
+
+char* cadidaq::fileWriter::reserve(std::unique_lock<std::mutex>& lock, uint64_t size, uint64_t nevents){
+  if (size > chunkBytes)
+    return nullptr;
+  clock::time_point now = clock::now();
+  if (fileBytes && ((rotate.bytes && fileBytes + size > rotate.bytes) || (rotate.events && fileEvents + nevents > rotate.events)
+                    || (rotate.seconds && now - fileStart >= std::chrono::seconds(rotate.seconds))))
+    handOver(lock, true);
+  if (chunks[current].used + size > chunkBytes)
+    handOver(lock, false);
+  if (fileBytes == 0)
+    fileStart = now;
+  return chunks[current].data + chunks[current].used;
+}
+
+void cadidaq::fileWriter::traceLatency(latencyMetrics& complete, latencyMetrics& endToEnd, traceRecorder* trace, uint32_t traceThread){
+  std::lock_guard<std::mutex> lock(mutex);
+  completeLatency = &complete;
+  endToEndLatency = &endToEnd;
+  this->trace = trace;
+  this->traceThread = traceThread;
+}
+
+void cadidaq::fileWriter::commit(uint64_t size, uint64_t nevents, uint64_t readTime){
+  chunk& ch = chunks[current];
+  if (ch.used == 0)
+    ch.firstCommit = latencyMetrics::now();
+  if (readTime && (ch.oldestRead == 0 || readTime < ch.oldestRead))
+    ch.oldestRead = readTime;
+  ch.used += size;
+  fileBytes += size;
+  fileEvents += nevents;
+  records++;
+}
+
+void cadidaq::fileWriter::handOver(std::unique_lock<std::mutex>& lock, bool endsFile){
+  chunks[current].endsFile = endsFile;
+  queue[(queueHead + queueCount++) % queue.size()] = current;
+  current = noChunk;
+  chunkQueued.notify_one();
+  if (endsFile){
+    fileBytes = 0;
+    fileEvents = 0;
+  }
+  if (freeChunks.empty()){
+    // the writer falls behind
+    clock::time_point start = clock::now();
+    chunkFree.wait(lock, [this]{return !freeChunks.empty();});
+    blockedNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+  }
+  current = freeChunks.back();
+  freeChunks.pop_back();
+  chunks[current].used = 0;
+  chunks[current].endsFile = false;
+  chunks[current].oldestRead = 0;
+}
+
+void cadidaq::fileWriter::writeEvents(uint16_t board, uint64_t sequence, uint64_t firstEvent, const char* buffer, uint32_t nbytes, uint32_t prescale, bool featuresOnly,
+                                      uint64_t readTime){
+  if (nbytes == 0)
+    return;
+  if (prescale == 0)
+    prescale = 1;
+  std::unique_lock<std::mutex> lock(mutex);
+  // room for all of the buffer; its events are only counted while copying them (at least one), so that a file can end up
+  // with more than the limit on events by the events of a buffer
+  char* record = reserve(lock, sizeof(layout::recordHeader) + layout::align(nbytes), 1);
+  if (!record){
+    writeStats.errors.addShared();
+    return;
+  }
+  char* payload = record + sizeof(layout::recordHeader);
+  uint32_t payloadSize = 0;
+  uint32_t nevents = 0;
+  uint64_t index = firstEvent;
+  uint64_t& timestamp = lastTimestamp[board];
+  uint64_t minTimestamp = ~static_cast<uint64_t>(0);
+  uint64_t maxTimestamp = 0;
+  forEachEvent(buffer, nbytes, [&](const eventHeader& event){
+      // (the roll-overs are counted over all events of the board)
+      timestamp = layout::extendTimeTag(timestamp, event.triggerTimeTag);
+      if (index++ % prescale != 0)
+        return;
+      minTimestamp = std::min(minTimestamp, timestamp);
+      maxTimestamp = std::max(maxTimestamp, timestamp);
+      uint32_t words = featuresOnly ? eventHeaderWords : event.size;
+      uint32_t* out = reinterpret_cast<uint32_t*>(payload + payloadSize);
+      std::memcpy(out, event.data, words * sizeof(uint32_t));
+      // the header alone is a complete event
+      if (featuresOnly)
+        out[0] = (out[0] & 0xF0000000) | eventHeaderWords;
+      payloadSize += words * sizeof(uint32_t);
+      nevents++;
+    });
+  if (nevents == 0)
+    return;
+  layout::recordHeader* header = reinterpret_cast<layout::recordHeader*>(record);
+  header->size        = sizeof(layout::recordHeader) + layout::align(payloadSize);
+  header->board       = board;
+  header->type        = layout::EVENTS;
+  header->sequence    = sequence;
+  header->firstEvent  = firstEvent;
+  header->nevents     = nevents;
+  header->prescale    = prescale;
+  header->flags       = (featuresOnly ? layout::FEATURES_ONLY : layout::NONE) | (prescale > 1 ? layout::PRESCALED : layout::NONE);
+  header->payloadSize = payloadSize;
+  header->minTimestamp = minTimestamp;
+  header->maxTimestamp = maxTimestamp;
+  header->writeTime   = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count();
+  std::memset(payload + payloadSize, 0, header->size - sizeof(layout::recordHeader) - payloadSize);
+  commit(header->size, nevents, readTime);
+}
+
+void cadidaq::fileWriter::writeDPP(const dppEventBatch& batch, uint64_t firstEvent, uint32_t prescale, uint64_t readTime){
+  size_t n = batch.size();
+  if (n == 0)
+    return;
+  uint32_t payloadSize = n * (sizeof(uint64_t) + 4 * sizeof(uint16_t));
+  std::unique_lock<std::mutex> lock(mutex);
+  char* record = reserve(lock, sizeof(layout::recordHeader) + payloadSize, n);
+  if (!record){
+    writeStats.errors.addShared();
+    return;
+  }
+  layout::recordHeader* header = reinterpret_cast<layout::recordHeader*>(record);
+  header->size        = sizeof(layout::recordHeader) + payloadSize;
+  header->board       = batch.board;
+  header->type        = layout::DPP_EVENTS;
+  header->sequence    = batch.sequence;
+  header->firstEvent  = firstEvent;
+  header->nevents     = n;
+  header->prescale    = prescale ? prescale : 1;
+  header->flags       = layout::FEATURES_ONLY | (prescale > 1 ? layout::PRESCALED : layout::NONE);
+  header->payloadSize = payloadSize;
+  // (the events of the channels are not in time order)
+  const uint64_t* timestamps = batch.timestamp.data();
+  header->minTimestamp = *std::min_element(timestamps, timestamps + n);
+  header->maxTimestamp = *std::max_element(timestamps, timestamps + n);
+  header->writeTime   = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count();
+  // one column after the other (a multiple of 8 bytes in total)
+  char* out = record + sizeof(layout::recordHeader);
+  std::memcpy(out, batch.timestamp.data(), n * sizeof(uint64_t));
+  out += n * sizeof(uint64_t);
+  for (const std::vector<uint16_t>* column : {&batch.channel, &batch.energy, &batch.chargeShort, &batch.flags}){
+    std::memcpy(out, column->data(), n * sizeof(uint16_t));
+    out += n * sizeof(uint16_t);
+  }
+  commit(header->size, n, readTime);
+}
+
+void cadidaq::fileWriter::runWriter(){
+  // the chunks are mapped and pre-faulted once pinned, so that their pages are on the writer's NUMA node
+  bool placed = affinity::pin(cpus);
+  size_t bytes = chunkCount * chunkBytes;
+  void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory != MAP_FAILED){
+    std::memset(memory, 0, bytes);
+    for (uint32_t c = 0; c < chunkCount; c++)
+      chunks[c].data = static_cast<char*>(memory) + c * chunkBytes;
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  ring = memory != MAP_FAILED ? static_cast<char*>(memory) : nullptr;
+  ringBytes = bytes;
+  pinned = placed;
+  writerCPUs = affinity::current();
+  mapped = true;
+  chunkFree.notify_all();
+  if (ring == nullptr)
+    return;
+  uint64_t cpuStart = readoutScheduler::threadCpuTime();
+  while (true){
+    if (queueCount == 0 && !closing){
+      chunkQueued.wait_for(lock, flushInterval);
+      // no chunk filled for a while: write out what has been collected, and end the file if its time is up
+      // (there is a free chunk to continue with, as none is queued or being written)
+      if (queueCount == 0 && !closing && current != noChunk && fileBytes){
+        bool expired = rotate.seconds && clock::now() - fileStart >= std::chrono::seconds(rotate.seconds);
+        if (expired || chunks[current].used)
+          handOver(lock, expired);
+      }
+    }
+    if (queueCount == 0){
+      if (closing)
+        break;
+      continue;
+    }
+    uint32_t c = queue[queueHead];
+    queueHead = (queueHead + 1) % queue.size();
+    queueCount--;
+    latencyMetrics* complete = completeLatency;
+    latencyMetrics* endToEnd = endToEndLatency;
+    traceRecorder* tracer = trace;
+    uint32_t thread = traceThread;
+    lock.unlock();
+
+    uint64_t start = latencyMetrics::now();
+    chunk& ch = chunks[c];
+    if (ch.used){
+      if (fd < 0)
+        fd = openFile();
+      if (fd < 0 || !writeAll(fd, ch.data, ch.used))
+        writeStats.errors.addShared();
+      else {
+        // index the chunk's records
+        for (size_t pos = 0; pos < ch.used; ){
+          const layout::recordHeader* r = reinterpret_cast<const layout::recordHeader*>(ch.data + pos);
+          index.push_back({fileSize + pos, r->minTimestamp, r->maxTimestamp, r->firstEvent, r->nevents, r->board, r->type});
+          pos += r->size;
+        }
+        fileSize += ch.used;
+        bytesWritten += ch.used;
+        uint64_t written = latencyMetrics::now();
+        if (complete)
+          complete->record(written - ch.firstCommit);
+        if (endToEnd && ch.oldestRead)
+          endToEnd->record(written - ch.oldestRead);
+        if (tracer)
+          tracer->record(traceRecorder::span::WRITE, thread, traceRecorder::noBoard, 0, start, written, ch.used);
+      }
+    }
+    if (ch.endsFile && fd >= 0)
+      finishFile();
+    writeStats.items.add();
+    writeStats.busyNanoseconds.add(latencyMetrics::now() - start);
+    writeStats.cpuNanoseconds.set(readoutScheduler::threadCpuTime() - cpuStart);
+
+    lock.lock();
+    freeChunks.push_back(c);
+    chunkFree.notify_one();
+  }
+  lock.unlock();
+  if (fd >= 0)
+    finishFile();
+}
+
+void cadidaq::fileWriter::runFinaliser(){
+  // (next to the writer, whose placement is reported)
+  affinity::pin(cpus);
+  uint64_t cpuStart = readoutScheduler::threadCpuTime();
+  while (true){
+    finishedFile f;
+    {
+      std::unique_lock<std::mutex> lock(finaliseMutex);
+      fileFinished.wait(lock, [this]{return !finished.empty() || finaliseDone;});
+      if (finished.empty())
+        break;
+      f = finished.front();
+      finished.pop_front();
+    }
+    clock::time_point start = clock::now();
+    finalise(f);
+    finaliseStats.items.add();
+    finaliseStats.busyNanoseconds.add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+    finaliseStats.cpuNanoseconds.set(readoutScheduler::threadCpuTime() - cpuStart);
+  }
+}
+
+void cadidaq::fileWriter::finalise(const finishedFile& f){
+  auto& lg = finaliseLg;
+  bool ok = true;
+  if (fsync(f.fd) != 0){
+    WRT_LOG_ERROR << "Could not flush data file '" << f.path << "' to disk: " << strerror(errno);
+    ok = false;
+  }
+  // the checksum of the file as written, read back (from the page cache): of the uncompressed data, so that it checks
+  // the file once decompressed (the compressors keep checksums of their own)
+  boost::crc_32_type crc;
+  std::unique_ptr<char[]> buffer(new char[chunkSize]);
+  uint64_t size = 0;
+  ssize_t n;
+  while ((n = pread(f.fd, buffer.get(), chunkSize, size)) > 0){
+    crc.process_bytes(buffer.get(), n);
+    size += n;
+  }
+  if (n < 0){
+    WRT_LOG_ERROR << "Could not read back data file '" << f.path << "': " << strerror(errno);
+    ok = false;
+  }
+  ::close(f.fd);
+  if (ok){
+    std::ofstream sum(f.path + ".crc32");
+    sum << std::hex << std::setw(8) << std::setfill('0') << crc.checksum() << std::dec << "  " << size << "  "
+        << f.path.substr(f.path.find_last_of('/') + 1) << "\n";
+    if (!sum){
+      WRT_LOG_ERROR << "Could not write the checksum of data file '" << f.path << "'.";
+      ok = false;
+    }
+  }
+  if (ok && !compressCommand.empty()){
+    int status = runCommand(compressCommand, f.path);
+    if (status != 0){
+      WRT_LOG_ERROR << "Compressing data file '" << f.path << "' failed ('" << compressCommand << "' returned " << status << ").";
+      ok = false;
+    }
+  }
+  if (ok)
+    WRT_LOG_INFO << "Closed data file '" << f.path << "' (" << size << " bytes, CRC-32 " << std::hex << crc.checksum() << std::dec << ").";
+  else
+    finaliseStats.errors.add();
+}
+
+void cadidaq::fileWriter::close(){
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (closing)
+      return;
+    if (current != noChunk && chunks[current].used)
+      handOver(lock, true);
+    closing = true;
+  }
+  chunkQueued.notify_all();
+  writer.join();
+  {
+    std::lock_guard<std::mutex> lock(finaliseMutex);
+    finaliseDone = true;
+  }
+  fileFinished.notify_all();
+  finaliser.join();
+  WRT_LOG_INFO << "Wrote " << fileNumber << " data file(s) " << prefix << "*.cdaq (" << bytesWritten << " bytes, " << records << " records)"
+               << (blockedNanoseconds ? ", the acquisition waited " + std::to_string(blockedNanoseconds / 1000000) + " ms for the disk" : "") << ".";
+  if (writeStats.errors.get() || finaliseStats.errors.get())
+    WRT_LOG_ERROR << writeStats.errors.get() << " chunk(s) or record(s) could not be written, " << finaliseStats.errors.get() << " data file(s) could not be finalised.";
+}
@@ -0,0 +1,179 @@
+#include <healthMonitor.hpp>
+
+#include <algorithm> // min, max
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define HEALTH_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define HEALTH_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+#define HEALTH_LOG_ERROR BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::error)
+
+using std::chrono::nanoseconds;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+namespace {
+  /// assumed time of a register read until one has been measured
+  const nanoseconds initialCost = microseconds(50);
+  /// weight of the latest read in the moving average of the time of a register read
+  const double costSmoothing = 0.2;
+  /// time between two checks of the snapshots by the monitor
+  const milliseconds checkInterval = milliseconds(100);
+}
+
+//
+// poller
+//
+
+cadidaq::healthPoller::healthPoller(const std::vector<digitizer*>& boards, const std::vector<healthSnapshot*>& snapshots, const std::vector<boardMetrics*>& stats)
+  : boards(boards), snapshots(snapshots), stats(stats), cursor(0), cost(initialCost) {
+  clock::time_point now = clock::now();
+  for (auto board : boards){
+    boardState s = {};
+    s.interval  = milliseconds(board->getHealthInterval());
+    s.registers = s.interval.count() ? board->healthRegisters() : 0;
+    s.next      = 0;
+    s.due       = now;
+    state.push_back(s);
+  }
+  plan();
+}
+
+bool cadidaq::healthPoller::poll(clock::time_point now, clock::time_point until){
+  if (until - now < 2 * cost)
+    return false;
+  for (size_t k = 0; k < state.size(); k++){
+    size_t i = (cursor + k) % state.size();
+    if (state[i].registers && state[i].due <= now){
+      read(i, now);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool cadidaq::healthPoller::pollOverdue(clock::time_point now){
+  if (now < overdue)
+    return false;
+  for (size_t k = 0; k < state.size(); k++){
+    size_t i = (cursor + k) % state.size();
+    if (state[i].registers && state[i].due + state[i].interval <= now){
+      if (stats[i])
+        stats[i]->healthForcedReads.add();
+      read(i, now);
+      return true;
+    }
+  }
+  return false;
+}
+
+void cadidaq::healthPoller::read(size_t i, clock::time_point now){
+  boardState& s = state[i];
+  bool ok = boards[i]->readHealth(s.next, s.health);
+  clock::time_point end = clock::now();
+  nanoseconds elapsed = duration_cast<nanoseconds>(end - now);
+  cost += duration_cast<nanoseconds>((elapsed - cost) * costSmoothing);
+  if (stats[i]){
+    stats[i]->healthReads.add();
+    stats[i]->healthNanoseconds.add(elapsed.count());
+  }
+  if (ok){
+    s.health.time = latencyMetrics::now();
+    if (snapshots[i])
+      snapshots[i]->publish(s.health);
+  }
+  // the next board gets the next gap
+  if (++s.next >= s.registers){
+    s.next = 0;
+    // on schedule, unless behind by more than an interval
+    s.due += s.interval;
+    if (s.due + s.interval <= end)
+      s.due = end;
+    cursor = (i + 1) % state.size();
+    plan();
+  }
+}
+
+void cadidaq::healthPoller::plan(){
+  overdue = clock::time_point::max();
+  for (auto& s : state)
+    if (s.registers)
+      overdue = std::min(overdue, s.due + s.interval);
+}
+
+//
+// monitor
+//
+
+cadidaq::healthMonitor::healthMonitor(const std::vector<digitizer*>& boards, const std::vector<boardMetrics*>& stats)
+  : stats(stats), snapshots(new healthSnapshot[boards.size()]), raised(boards.size()), stop(false) {
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("health"));
+  for (auto board : boards)
+    names.push_back(board->getName());
+  thread = std::thread(&healthMonitor::run, this);
+}
+
+cadidaq::healthMonitor::~healthMonitor(){
+  stop = true;
+  if (thread.joinable())
+    thread.join();
+}
+
+void cadidaq::healthMonitor::run(){
+  while (!stop){
+    std::this_thread::sleep_for(checkInterval);
+    for (size_t i = 0; i < names.size(); i++)
+      check(i);
+  }
+}
+
+void cadidaq::healthMonitor::check(size_t i){
+  boardHealth health = snapshots[i].read();
+  if (health.time == 0)
+    return;
+  boardMetrics* s = stats[i];
+  if (s){
+    s->temperature.set(health.maxTemperature());
+    s->memoryFull.set(health.memoryFull());
+    s->pllLocked.set(health.pllLocked());
+  }
+  alarms& a = raised[i];
+  if (health.memoryFull() != a.memoryFull){
+    a.memoryFull = health.memoryFull();
+    if (a.memoryFull)
+      HEALTH_LOG_WARN << names[i] << ": event memory full, triggers are lost (read out too slowly?)";
+    else
+      HEALTH_LOG_INFO << names[i] << ": event memory no longer full";
+    if (a.memoryFull && s)
+      s->healthAlarms.add();
+  }
+  if (!health.pllLocked() != a.pllUnlocked){
+    a.pllUnlocked = !health.pllLocked();
+    if (a.pllUnlocked)
+      HEALTH_LOG_ERROR << names[i] << ": PLL lost the lock on its clock reference, time stamps are unreliable";
+    else
+      HEALTH_LOG_INFO << names[i] << ": PLL locked again";
+    if (a.pllUnlocked && s)
+      s->healthAlarms.add();
+  }
+  if (health.temperatureFailure() != a.overheated){
+    a.overheated = health.temperatureFailure();
+    if (a.overheated)
+      HEALTH_LOG_ERROR << names[i] << ": ADC over temperature (" << health.maxTemperature() << " C at most)";
+    else
+      HEALTH_LOG_INFO << names[i] << ": ADC temperature back to normal (" << health.maxTemperature() << " C at most)";
+    if (a.overheated && s)
+      s->healthAlarms.add();
+  }
+  if (health.adcPowerDown() != a.powerDown){
+    a.powerDown = health.adcPowerDown();
+    if (a.powerDown)
+      HEALTH_LOG_ERROR << names[i] << ": ADCs powered down (over temperature)";
+    else
+      HEALTH_LOG_INFO << names[i] << ": ADCs powered up again";
+    if (a.powerDown && s)
+      s->healthAlarms.add();
+  }
+}
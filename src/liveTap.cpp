@@ -0,0 +1,130 @@
+#include <liveTap.hpp>
+
+#include <cstring>   // memcpy, strncpy
+#include <new>       // placement new
+#include <stdexcept> // exceptions
+
+// POSIX shared memory
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define TAP_LOG_DEBUG BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::debug)
+#define TAP_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define TAP_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+#define TAP_LOG_ERROR BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::error)
+
+namespace layout = cadidaq::liveTapLayout;
+
+cadidaq::liveTap::liveTap(std::string name, uint64_t capacity, uint32_t prescale)
+  : name(name), fd(-1), header(nullptr), ring(nullptr), capacity(layout::align(capacity)), prescale(prescale ? prescale : 1), nevents(0), sequence(0) {
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("tap"));
+  // the ring starts on the page following the header
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t headerSize = ((sizeof(layout::ringHeader) + pageSize - 1) / pageSize) * pageSize;
+  segmentSize = headerSize + this->capacity;
+
+  // remove any stale segment left behind by a previous run before creating a fresh one
+  shm_unlink(name.c_str());
+  fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0)
+    throw std::runtime_error("Could not create shared memory segment '" + name + "': " + strerror(errno));
+  if (ftruncate(fd, segmentSize) != 0){
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error("Could not resize shared memory segment '" + name + "': " + strerror(errno));
+  }
+  void* segment = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (segment == MAP_FAILED){
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error("Could not map shared memory segment '" + name + "': " + strerror(errno));
+  }
+  header = new (segment) layout::ringHeader();
+  ring = static_cast<char*>(segment) + headerSize;
+  header->version  = layout::version;
+  header->capacity = this->capacity;
+  header->prescale = this->prescale;
+  header->nboards  = 0;
+  header->head.store(0);
+  header->committed.store(0);
+  header->published.store(0);
+  header->skipped.store(0);
+  // readers check the magic number last, so it is only set once everything else is in place
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic    = layout::magic;
+  TAP_LOG_INFO << "Publishing every " << this->prescale << ". event to live data tap '" << name << "' (" << this->capacity/(1024*1024) << " MB)";
+}
+
+cadidaq::liveTap::~liveTap(){
+  TAP_LOG_INFO << "Closing live data tap '" << name << "' after publishing " << sequence << " events ("
+               << header->skipped.load() << " events too large to publish)";
+  munmap(header, segmentSize);
+  close(fd);
+  // attached readers keep their mapping until they detach
+  shm_unlink(name.c_str());
+}
+
+uint16_t cadidaq::liveTap::addBoard(std::string boardName){
+  if (header->nboards >= layout::maxBoards){
+    TAP_LOG_WARN << "Cannot register more than " << layout::maxBoards << " boards with the live data tap, events of '" << boardName << "' will be tagged with the last board index";
+    return layout::maxBoards - 1;
+  }
+  uint16_t index = header->nboards;
+  std::strncpy(header->boardNames[index], boardName.c_str(), layout::nameLength - 1);
+  header->nboards = index + 1;
+  return index;
+}
+
+void cadidaq::liveTap::publish(uint16_t board, const eventHeader& event, bool headerOnly){
+  // apply the prescaler
+  if (nevents++ % prescale != 0)
+    return;
+  uint32_t payloadSize = (headerOnly ? eventHeaderWords : event.size) * sizeof(uint32_t);
+  uint64_t size = layout::align(sizeof(layout::recordHeader) + payloadSize);
+  if (size > capacity/2){
+    // would overwrite most of the ring at once
+    header->skipped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // only the writer modifies 'committed', so it can be read without synchronization
+  uint64_t pos = header->committed.load(std::memory_order_relaxed);
+  uint64_t offset = pos % capacity;
+  uint64_t start = pos;
+  // records never wrap: if there is not enough room left before the end of the ring, start over at its beginning
+  if (capacity - offset < size)
+    start = pos + (capacity - offset);
+  uint64_t end = start + size;
+
+  // announce the region about to be overwritten before touching it
+  header->head.store(end, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  if (start != pos && capacity - offset >= sizeof(layout::recordHeader)){
+    // mark the unused space at the end of the ring (readers skip smaller gaps implicitly)
+    layout::recordHeader padding = {};
+    padding.size  = capacity - offset;
+    padding.flags = layout::PADDING;
+    std::memcpy(ring + offset, &padding, sizeof(padding));
+  }
+  layout::recordHeader record = {};
+  record.size           = size;
+  record.board          = board;
+  record.flags          = layout::NONE;
+  record.sequence       = sequence++;
+  record.eventCounter   = event.eventCounter;
+  record.triggerTimeTag = event.triggerTimeTag;
+  record.channelMask    = event.channelMask;
+  record.payloadSize    = payloadSize;
+  char* dest = ring + (start % capacity);
+  std::memcpy(dest, &record, sizeof(record));
+  std::memcpy(dest + sizeof(record), event.data, payloadSize);
+
+  // make the record available to readers
+  header->committed.store(end, std::memory_order_release);
+  header->published.store(sequence, std::memory_order_relaxed);
+}
@@ -0,0 +1,119 @@
+#include <liveTapReader.hpp>
+
+#include <cstring>   // memcpy, strerror
+#include <cerrno>
+#include <limits>
+#include <stdexcept> // exceptions
+
+// POSIX shared memory
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace layout = cadidaq::liveTapLayout;
+
+namespace {
+  /// marks that no record has been read yet, i.e. the next sequence number is not known
+  const uint64_t unknownSequence = std::numeric_limits<uint64_t>::max();
+}
+
+cadidaq::liveTapReader::liveTapReader(std::string name)
+  : name(name), fd(-1), header(nullptr), ring(nullptr), readPos(0), expectedSequence(unknownSequence), lost(0) {
+  fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    throw std::runtime_error("Could not open live data tap '" + name + "': " + strerror(errno));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(layout::ringHeader)){
+    close(fd);
+    throw std::runtime_error("Live data tap '" + name + "' has an invalid size");
+  }
+  segmentSize = st.st_size;
+  void* segment = mmap(nullptr, segmentSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (segment == MAP_FAILED){
+    close(fd);
+    throw std::runtime_error("Could not map live data tap '" + name + "': " + strerror(errno));
+  }
+  header = static_cast<const layout::ringHeader*>(segment);
+  if (header->magic != layout::magic || header->version != layout::version){
+    munmap(segment, segmentSize);
+    close(fd);
+    throw std::runtime_error("Live data tap '" + name + "' is not initialized or has an incompatible version");
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  capacity = header->capacity;
+  if (capacity == 0 || capacity > segmentSize){
+    munmap(segment, segmentSize);
+    close(fd);
+    throw std::runtime_error("Live data tap '" + name + "' has an inconsistent ring size");
+  }
+  // the ring occupies the end of the segment
+  ring = static_cast<const char*>(segment) + (segmentSize - capacity);
+  // start with the most recent data
+  resync();
+}
+
+cadidaq::liveTapReader::~liveTapReader(){
+  munmap(const_cast<layout::ringHeader*>(header), segmentSize);
+  close(fd);
+}
+
+std::string cadidaq::liveTapReader::getBoardName(uint16_t board){
+  if (board >= header->nboards)
+    return std::string();
+  char boardName[layout::nameLength];
+  std::memcpy(boardName, header->boardNames[board], layout::nameLength);
+  boardName[layout::nameLength - 1] = '\0';
+  return std::string(boardName);
+}
+
+void cadidaq::liveTapReader::resync(){
+  // skip everything up to the latest complete record; lost records are accounted for by the sequence gap
+  readPos = header->committed.load(std::memory_order_acquire);
+}
+
+bool cadidaq::liveTapReader::next(liveTapEvent& event){
+  while (true){
+    uint64_t committed = header->committed.load(std::memory_order_acquire);
+    if (readPos == committed)
+      return false; // nothing new
+    if (committed - readPos > capacity){
+      // fell behind by more than the ring size
+      resync();
+      continue;
+    }
+    uint64_t offset = readPos % capacity;
+    if (capacity - offset < sizeof(layout::recordHeader)){
+      // gap at the end of the ring too small for a record
+      readPos += capacity - offset;
+      continue;
+    }
+    layout::recordHeader record;
+    std::memcpy(&record, ring + offset, sizeof(record));
+    bool valid = record.size >= sizeof(record) && record.size <= capacity - offset && record.size % 8 == 0
+      && (record.flags == layout::PADDING || record.payloadSize <= record.size - sizeof(record));
+    if (valid && record.flags != layout::PADDING){
+      event.board          = record.board;
+      event.sequence       = record.sequence;
+      event.eventCounter   = record.eventCounter;
+      event.triggerTimeTag = record.triggerTimeTag;
+      event.channelMask    = record.channelMask;
+      event.data.resize(record.payloadSize / sizeof(uint32_t));
+      std::memcpy(event.data.data(), ring + offset + sizeof(record), event.data.size() * sizeof(uint32_t));
+    }
+    // verify that the writer did not overwrite the record while we were copying it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    if (!valid || head - readPos > capacity){
+      resync();
+      continue;
+    }
+    readPos += record.size;
+    if (record.flags == layout::PADDING)
+      continue;
+    if (expectedSequence != unknownSequence && event.sequence > expectedSequence)
+      lost += event.sequence - expectedSequence;
+    expectedSequence = event.sequence + 1;
+    return true;
+  }
+}
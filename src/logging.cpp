@@ -75,6 +75,7 @@ void init_console_logging(){
   min_severity["cfg"] = boost::log::trivial::debug;
   min_severity["main"] = boost::log::trivial::debug;
   min_severity["dig"] = boost::log::trivial::debug;
+  min_severity["daq"] = boost::log::trivial::debug;
 
   auto consoleLog = boost::log::add_console_log(
                   std::clog,
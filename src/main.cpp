@@ -4,8 +4,23 @@
 
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <iterator>  // istreambuf_iterator
 #include <iostream>
 #include <stdexcept> // exceptions
+#include <memory>    // unique_ptr, shared_ptr
+#include <map>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <exception> // exception_ptr
+#include <cstring>   // memcpy
+#include <csignal>
+#include <algorithm> // max, sort, any_of, count
+
+#include <sys/resource.h> // getrusage
+#include <fcntl.h>        // posix_fadvise
+#include <unistd.h>
 
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/program_options.hpp>
@@ -15,8 +30,32 @@
 #include <logging.hpp>
 #include <settings.hpp>
 #include <digitizer.hpp>
+#include <event.hpp>
+#include <dppEvents.hpp>
+#include <liveTap.hpp>
+#include <metrics.hpp>
+#include <traceRecorder.hpp>
+#include <healthMonitor.hpp>
+#include <channelScan.hpp>
+#include <snapshot.hpp>
+#include <bufferPool.hpp>
+#include <allocationCounter.hpp>
+#include <readoutScheduler.hpp>
+#include <readoutQueue.hpp>
+#include <affinity.hpp>
+#include <processingPool.hpp>
+#include <overflowControl.hpp>
+#include <fileWriter.hpp>
+#include <streamSink.hpp>
+#include <streamReceiver.hpp>
+#include <dataFileReader.hpp>
+#include <replaySource.hpp>
+#include <eventFilter.hpp>
 
 #include <helper.hpp>       // CadiDAQ helper functions
+#include <caenEnumTranslatorImpl.hpp> // CAEN enum lookup tables
+
+#include <boost/bimap.hpp>
 
 namespace po = boost::program_options;
 namespace pt = boost::property_tree;
@@ -33,20 +72,1870 @@ namespace pt = boost::property_tree;
   BOOST_LOG_CHANNEL_SEV(lg, "main", boost::log::trivial::fatal)
 
 
+//
+// run control
+//
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int){
+  stopRequested = 1;
+}
+
+/** /struct readoutThread
+    A thread reading out a group of boards: those sharing a link (which cannot be read concurrently anyway)
+    or given the same 'ReadoutThread' name, possibly merged to stay within the configured number of threads.
+    Its readout buffers are allocated on the NUMA node of the CPUs it is pinned to.
+*/
+struct readoutThread {
+  std::string            name;
+  std::vector<uint32_t>  boards;            ///< indices of the boards read by the thread
+  cadidaq::affinity::cpuList cpus;          ///< CPUs to run on (empty: any)
+  std::unique_ptr<cadidaq::bufferPool> pool;
+  cadidaq::stageMetrics* stage = nullptr;
+  cadidaq::latencyMetrics* latency = nullptr; ///< of the read calls returning data
+  cadidaq::traceRecorder* trace = nullptr;
+  uint32_t               traceThread = 0;
+  bool                   steady = false;    ///< whether the thread has handled data (and initialized all it uses) once
+  uint64_t               steadyAllocations = 0;
+  uint64_t               steadyIterations = 0;
+  std::thread            thread;
+};
+
+/** /struct replayedBoards
+    How the data of the replayed boards is handled, per board: from the digitizer section of the .ini file named like
+    it, as for a board read out (unfiltered and never discarded if there is none).
+*/
+struct replayedBoards {
+  std::vector<cadidaq::overflowPolicy> policies;
+  std::vector<uint32_t>  prescales;
+  std::vector<std::unique_ptr<cadidaq::eventFilter>> filters;
+};
+
+/// groups the boards by their readout thread name and merges groups (largest first onto the least busy thread) to stay within 'maxThreads' (0: no limit)
+std::vector<std::unique_ptr<readoutThread>> group_readout_threads(std::vector<cadidaq::digitizer*>& vecDigi, uint32_t maxThreads)
+{
+    std::vector<std::unique_ptr<readoutThread>> groups;
+    std::map<std::string, size_t> byName;
+    for (uint32_t i = 0; i < vecDigi.size(); i++){
+      std::string name = vecDigi[i]->getReadoutThread();
+      auto it = byName.find(name);
+      if (it == byName.end()){
+        it = byName.insert(std::make_pair(name, groups.size())).first;
+        groups.emplace_back(new readoutThread);
+        groups.back()->name = name;
+      }
+      groups[it->second]->boards.push_back(i);
+    }
+    if (maxThreads == 0 || groups.size() <= maxThreads)
+      return groups;
+    std::stable_sort(groups.begin(), groups.end(), [](const std::unique_ptr<readoutThread>& a, const std::unique_ptr<readoutThread>& b){
+        return a->boards.size() > b->boards.size();
+      });
+    std::vector<std::unique_ptr<readoutThread>> threads;
+    for (auto& group : groups){
+      if (threads.size() < maxThreads){
+        threads.push_back(std::move(group));
+        continue;
+      }
+      auto least = std::min_element(threads.begin(), threads.end(), [](const std::unique_ptr<readoutThread>& a, const std::unique_ptr<readoutThread>& b){
+          return a->boards.size() < b->boards.size();
+        });
+      (*least)->name += " + " + group->name;
+      (*least)->boards.insert((*least)->boards.end(), group->boards.begin(), group->boards.end());
+    }
+    for (auto& t : threads)
+      std::sort(t->boards.begin(), t->boards.end());
+    return threads;
+}
+
+/** allocates the thread's readout buffers, pre-faulted from the thread's CPUs so that their pages are allocated on its
+    NUMA node, and logs where the thread serves the given boards.
+    throws std::runtime_error if the buffers cannot be allocated */
+void allocate_readout_buffers(readoutThread& t, uint32_t bufferSize, uint32_t count, const std::vector<std::string>& boardNames)
+{
+    cadidaq::affinity::cpuList effective;
+    std::exception_ptr error;
+    std::thread([&]{
+        if (!cadidaq::affinity::pin(t.cpus))
+          return;
+        effective = cadidaq::affinity::current();
+        try {
+          t.pool.reset(new cadidaq::bufferPool(bufferSize, count));
+        }
+        catch (...){
+          error = std::current_exception();
+        }
+      }).join();
+    if (error)
+      std::rethrow_exception(error);
+    if (!t.pool)
+      throw std::runtime_error("Could not pin readout thread '" + t.name + "' to CPUs " + cadidaq::affinity::describe(t.cpus));
+    std::string memory = cadidaq::affinity::memoryNodes(t.pool->getMemory());
+    MAIN_LOG_INFO << "Readout thread '" << t.name << "' serves " << boardNames.size() << " digitizer(s) (" << boost::algorithm::join(boardNames, ", ") << ") on "
+                  << (t.cpus.empty() ? "any CPU" : "CPUs " + cadidaq::affinity::describe(effective))
+                  << ", readout buffers on " << (memory.empty() ? "unknown NUMA node(s)" : "NUMA node(s) " + memory + " (pages per node)");
+}
+
+/** assigns the boards to readout threads, places the threads on the CPUs configured for their boards (or
+    for all readout threads) and allocates their readout buffers local to those CPUs.
+    throws std::runtime_error if the buffers cannot be allocated */
+std::vector<std::unique_ptr<readoutThread>> assign_readout_threads(cadidaq::daqSettings& daq, std::vector<cadidaq::digitizer*>& vecDigi)
+{
+    std::vector<std::unique_ptr<readoutThread>> threads = group_readout_threads(vecDigi, daq.readoutThreads.first ? *daq.readoutThreads.first : 0);
+    cadidaq::affinity::cpuList defaultCpus;
+    if (daq.readoutCPUs.first)
+      defaultCpus = cadidaq::affinity::parse(*daq.readoutCPUs.first);
+    for (auto& t : threads){
+      // the first board with CPUs of its own places the thread
+      t->cpus = defaultCpus;
+      int placedBy = -1;
+      for (auto b : t->boards){
+        cadidaq::affinity::cpuList cpus = vecDigi[b]->getReadoutCPUs();
+        if (cpus.empty())
+          continue;
+        if (placedBy < 0){
+          t->cpus = cpus;
+          placedBy = b;
+        } else if (cpus != t->cpus)
+          MAIN_LOG_WARN << "'" << vecDigi[b]->getName() << "' is read out by thread '" << t->name << "' together with '" << vecDigi[placedBy]->getName()
+                        << "' but configured for other CPUs: using those of '" << vecDigi[placedBy]->getName() << "'.";
+      }
+
+      // the buffers are sized for the programmed settings of the thread's boards and reused for every run
+      uint32_t bufferSize = 0;
+      for (auto b : t->boards)
+        bufferSize = std::max(bufferSize, vecDigi[b]->readoutBufferSize());
+      std::vector<std::string> names;
+      for (auto b : t->boards)
+        names.push_back(vecDigi[b]->getName());
+      allocate_readout_buffers(*t, bufferSize, *daq.readoutBuffers.first * t->boards.size(), names);
+    }
+    return threads;
+}
+
+/// reads out the thread's boards as scheduled and hands the data on to the processing stage until 'stop' is set
+void readout_loop(readoutThread& self, std::vector<cadidaq::digitizer*>& vecDigi, std::vector<cadidaq::boardMetrics*>& boardStats,
+                  cadidaq::healthMonitor* health, cadidaq::readoutQueue& queue, const std::atomic<bool>& stop)
+{
+    // placed as when allocating the buffers (which has been checked to work)
+    cadidaq::affinity::pin(self.cpus);
+    cadidaq::bufferPool& pool = *self.pool;
+    std::vector<cadidaq::digitizer*> boards;
+    std::vector<cadidaq::boardMetrics*> stats;
+    std::vector<cadidaq::healthSnapshot*> snapshots;
+    for (auto b : self.boards){
+      boards.push_back(vecDigi[b]);
+      stats.push_back(boardStats[b]);
+      snapshots.push_back(health ? health->getSnapshot(b) : nullptr);
+    }
+    std::unique_ptr<cadidaq::healthPoller> poller;
+    if (health)
+      poller.reset(new cadidaq::healthPoller(boards, snapshots, stats));
+    cadidaq::readoutScheduler scheduler(boards, stats, poller.get());
+    cadidaq::stageMetrics& stage = *self.stage;
+    uint64_t cpuStart = cadidaq::readoutScheduler::threadCpuTime();
+    uint64_t iterations = 0;
+    while (!stop.load(std::memory_order_relaxed)){
+      // return from waiting regularly to check for the end of the run
+      int i = scheduler.next(std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+      if (i < 0)
+        continue;
+      auto pollStart = std::chrono::steady_clock::now();
+      // all buffers queued for processing: block until one is released (the board keeps filling up meanwhile)
+      cadidaq::bufferPool::handle buffer = pool.acquire();
+      if (buffer == cadidaq::bufferPool::none){
+        buffer = pool.acquire(std::chrono::milliseconds(100));
+        if (stats[i])
+          stats[i]->blockedNanoseconds.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pollStart).count());
+        if (buffer == cadidaq::bufferPool::none){
+          // still none (e.g. the processing is stuck): the board stays due, the next attempt blocks again
+          scheduler.stalled(i);
+          stage.errors.add();
+          continue;
+        }
+      }
+      uint64_t readStart = cadidaq::latencyMetrics::now();
+      uint32_t bytes = boards[i]->readData(pool.get(buffer));
+      uint64_t readEnd = cadidaq::latencyMetrics::now();
+      scheduler.record(i, bytes, pool.get(buffer).size);
+      if (bytes == 0)
+        pool.release(buffer);
+      else {
+        if (self.latency)
+          self.latency->record(readEnd - readStart);
+        if (self.trace)
+          self.trace->record(cadidaq::traceRecorder::span::READ, self.traceThread, self.boards[i], 0, readStart, readEnd, bytes);
+        queue.push({self.boards[i], &pool, buffer, bytes, readEnd});
+      }
+      stage.items.add();
+      stage.busyNanoseconds.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pollStart).count());
+      if (++iterations % 256 == 0)
+        stage.cpuNanoseconds.set(cadidaq::readoutScheduler::threadCpuTime() - cpuStart);
+      if (self.steady)
+        self.steadyIterations++;
+      else if (bytes){
+        self.steady = true;
+        self.steadyAllocations = cadidaq::allocations::thisThread();
+      }
+    }
+    stage.cpuNanoseconds.set(cadidaq::readoutScheduler::threadCpuTime() - cpuStart);
+    self.steadyAllocations = cadidaq::allocations::thisThread() - self.steadyAllocations;
+}
+
+/// feeds the recorded data to the processing stage in place of the readout until the data ends or 'stop' is set
+void replay_loop(readoutThread& self, cadidaq::replaySource& replay, std::vector<cadidaq::boardMetrics*>& boardStats,
+                 cadidaq::readoutQueue& queue, const std::atomic<bool>& stop)
+{
+    cadidaq::affinity::pin(self.cpus);
+    cadidaq::stageMetrics& stage = *self.stage;
+    uint64_t cpuStart = cadidaq::readoutScheduler::threadCpuTime();
+    uint64_t iterations = 0;
+    while (replay.next(*self.pool, queue, boardStats, stop)){
+      stage.items.add();
+      if (++iterations % 256 == 0)
+        stage.cpuNanoseconds.set(cadidaq::readoutScheduler::threadCpuTime() - cpuStart);
+      if (self.steady)
+        self.steadyIterations++;
+      else {
+        self.steady = true;
+        self.steadyAllocations = cadidaq::allocations::thisThread();
+      }
+    }
+    stage.cpuNanoseconds.set(cadidaq::readoutScheduler::threadCpuTime() - cpuStart);
+    self.steadyAllocations = cadidaq::allocations::thisThread() - self.steadyAllocations;
+}
+
+/** starts the acquisition on all digitizers, reads them out from one thread per link (or configured group) and
+    distributes their data until stopped. With a replay source, the recorded data is fed in by the (single) thread
+    instead of the digitizers' readout until it ends, handled as given by 'replayed'. returns false if allocations are
+    counted and the readout or processing loops allocated after their first iteration with data */
+bool run_acquisition(cadidaq::daqSettings& daq, std::vector<cadidaq::digitizer*>& vecDigi, std::vector<std::unique_ptr<readoutThread>>& threads,
+                     cadidaq::replaySource* replay = nullptr, const replayedBoards* replayed = nullptr)
+{
+    // the boards read out or replayed; the list-mode events of those with DPP firmware are decoded by the workers into
+    // event batches (reduced by the boards' event filters)
+    std::vector<std::string> names;
+    std::vector<cadidaq::dppFormat> dppFormats;
+    std::vector<cadidaq::overflowPolicy> policies;
+    std::vector<uint32_t> prescales;
+    std::vector<const cadidaq::eventFilter*> filters;
+    if (replay){
+      names = replay->getBoardNames();
+      dppFormats = replay->getDPPFormats();
+      policies = replayed->policies;
+      prescales = replayed->prescales;
+      for (auto& filter : replayed->filters)
+        filters.push_back(filter.get());
+    } else
+      for (auto digi : vecDigi){
+        names.push_back(digi->getName());
+        dppFormats.push_back(digi->getDPPFormat());
+        policies.push_back(digi->getOverflowPolicy());
+        prescales.push_back(digi->getOverflowPrescale());
+        filters.push_back(digi->getEventFilter());
+      }
+    // DPP boards hand on their decoded events instead of the raw aggregates under FeaturesOnly, and always if filtered
+    // (their raw data holds the events not selected as well)
+    auto decodedOnly = [&](uint32_t board, const cadidaq::processingPool::result& r){
+      return dppFormats[board] != cadidaq::dppFormat::NONE && (r.featuresOnly || filters[board]);
+    };
+
+    // set up the live data tap for online monitors
+    std::unique_ptr<cadidaq::liveTap> tap;
+    if (daq.liveTapName.first){
+      try {
+        tap.reset(new cadidaq::liveTap(*daq.liveTapName.first, static_cast<uint64_t>(*daq.liveTapSize.first)*1024*1024, *daq.liveTapPrescale.first));
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_ERROR << e.what() << " -- continuing without live data tap.";
+      }
+    }
+    std::vector<uint16_t> tapIndex;
+    for (auto& name : names)
+      tapIndex.push_back(tap ? tap->addBoard(name) : 0);
+
+    // set up the run-time metrics for each board and pipeline stage
+    cadidaq::metrics registry;
+    std::vector<cadidaq::boardMetrics*> boardStats;
+    for (auto& name : names)
+      boardStats.push_back(&registry.addBoard(name));
+    for (size_t i = 0; i < vecDigi.size(); i++)
+      vecDigi[i]->setMetrics(boardStats[i]);
+    for (auto& t : threads)
+      t->stage = &registry.addStage("readout:" + t->name);
+    std::vector<cadidaq::stageMetrics*> workerStats;
+    for (uint32_t w = 0; w < *daq.processingThreads.first; w++)
+      workerStats.push_back(&registry.addStage("decode:" + std::to_string(w)));
+    cadidaq::stageMetrics& deliverStage = registry.addStage("deliver");
+
+    // the latencies of the buffers along the pipeline, and (served with the metrics) traces of it on request, in room
+    // for a few seconds of spans at high rates
+    const uint32_t traceSpans = 1 << 18;
+    std::unique_ptr<cadidaq::traceRecorder> trace;
+    if (daq.metricsPort.first)
+      trace.reset(new cadidaq::traceRecorder(names, traceSpans));
+    for (auto& t : threads){
+      t->latency = &registry.addLatency("read");
+      t->trace = trace.get();
+      t->traceThread = trace ? trace->addThread("readout:" + t->name) : 0;
+    }
+    cadidaq::latencyMetrics& queueLatency = registry.addLatency("queue");
+    std::vector<cadidaq::latencyMetrics*> decodeLatency;
+    std::vector<uint32_t> decodeThreads;
+    for (uint32_t w = 0; w < workerStats.size(); w++){
+      decodeLatency.push_back(&registry.addLatency("decode"));
+      decodeThreads.push_back(trace ? trace->addThread("decode:" + std::to_string(w)) : 0);
+    }
+    cadidaq::latencyMetrics& processLatency = registry.addLatency("process");
+    cadidaq::latencyMetrics& mergeLatency = registry.addLatency("merge");
+    cadidaq::latencyMetrics& deliveryLatency = registry.addLatency("readout_to_delivery");
+    // (the deliveries run on the workers, one at a time)
+    uint32_t deliverThread = trace ? trace->addThread("deliver") : 0;
+    uint32_t maxBufferSize = 0;
+    for (auto& t : threads)
+      maxBufferSize = std::max(maxBufferSize, t->pool->getBufferSize());
+
+    // the data files and streams start with the configuration read back from the boards (or that of the data replayed)
+    std::string configuration;
+    if (daq.outputFile.first || daq.streamTarget.first){
+      if (replay)
+        configuration = replay->getConfiguration();
+      else {
+        pt::iptree config;
+        for (auto digi : vecDigi)
+          digi->retrieveConfig(config.put_child(digi->getName(), pt::iptree()));
+        std::ostringstream ini;
+        pt::ini_parser::write_ini(ini, config);
+        configuration = ini.str();
+      }
+    }
+
+    // set up the data files and the stream, their threads placed apart from the readout and processing
+    cadidaq::affinity::cpuList writerCpus;
+    if (daq.writerCPUs.first)
+      writerCpus = cadidaq::affinity::parse(*daq.writerCPUs.first);
+    std::unique_ptr<cadidaq::fileWriter> writer;
+    cadidaq::latencyMetrics* writeSubmitLatency = nullptr;
+    if (daq.outputFile.first){
+      // decoded DPP events take up to four times the room of their raw data (16 bytes for events of a single word)
+      uint32_t maxRecordBytes = maxBufferSize;
+      for (auto format : dppFormats)
+        if (format != cadidaq::dppFormat::NONE)
+          maxRecordBytes = 4 * maxBufferSize;
+      cadidaq::fileWriter::rotation rotate = {static_cast<uint64_t>(daq.outputRotateSize.first ? *daq.outputRotateSize.first : 0)*1024*1024,
+                                              daq.outputRotateEvents.first ? *daq.outputRotateEvents.first : 0,
+                                              daq.outputRotateTime.first ? *daq.outputRotateTime.first : 0};
+      try {
+        writer.reset(new cadidaq::fileWriter(*daq.outputFile.first, rotate, names, dppFormats, configuration, maxRecordBytes,
+                                             daq.outputCompress.first ? *daq.outputCompress.first : std::string(),
+                                             registry.addStage("write"), registry.addStage("finalise"), writerCpus));
+        writeSubmitLatency = &registry.addLatency("write_submit");
+        cadidaq::latencyMetrics& completeLatency = registry.addLatency("write_complete");
+        writer->traceLatency(completeLatency, registry.addLatency("readout_to_disk"), trace.get(), trace ? trace->addThread("write") : 0);
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_FATAL << e.what() << " -- not starting the acquisition.";
+        for (auto digi : vecDigi)
+          digi->setMetrics(nullptr);
+        return false;
+      }
+    }
+    // set up the data stream: it holds on to the buffers delivered until sent, which are counted for the buffers in use
+    uint32_t nbuffers = 0;
+    for (auto& t : threads)
+      nbuffers += t->pool->getCount();
+    // (and DPP event batches are swapped for spares, decoding waits for one to be sent once all are in use)
+    const uint32_t streamSpareBatches = 64;
+    std::unique_ptr<cadidaq::streamSink> sink;
+    if (daq.streamTarget.first)
+      sink.reset(new cadidaq::streamSink(*daq.streamTarget.first, names, dppFormats, configuration, *daq.streamBatchSize.first * 1024,
+                                         std::chrono::milliseconds(*daq.streamMaxDelay.first), nbuffers, streamSpareBatches,
+                                         *daq.processingBatchSize.first * 1024 / (2 * sizeof(uint32_t)), registry.addStage("stream"), writerCpus));
+    std::unique_ptr<cadidaq::metricsExporter> exporter;
+    if (daq.metricsPort.first || daq.metricsFile.first)
+      exporter.reset(new cadidaq::metricsExporter(registry, daq.metricsPort.first ? *daq.metricsPort.first : 0,
+                                                  daq.metricsFile.first ? *daq.metricsFile.first : std::string(), *daq.metricsInterval.first,
+                                                  trace.get()));
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    for (auto digi : vecDigi)
+      digi->startAcquisition();
+    if (daq.runDuration.first)
+      MAIN_LOG_INFO << (replay ? "Replay" : "Acquisition") << " running for " << *daq.runDuration.first << " s (press Ctrl-C to stop earlier).";
+    else
+      MAIN_LOG_INFO << (replay ? "Replay running until the end of the data" : "Acquisition running") << ", press Ctrl-C to stop.";
+
+    // the processing workers and this thread (dispatching the buffers to them) are placed for the run only
+    cadidaq::affinity::cpuList mainCpus = cadidaq::affinity::current();
+    cadidaq::affinity::cpuList processingCpus;
+    if (daq.processingCPUs.first){
+      processingCpus = cadidaq::affinity::parse(*daq.processingCPUs.first);
+      if (cadidaq::affinity::pin(processingCpus))
+        MAIN_LOG_INFO << "Processing with " << workerStats.size() << " thread(s) on CPUs " << cadidaq::affinity::describe(cadidaq::affinity::current());
+      else {
+        MAIN_LOG_ERROR << "Could not pin the processing to CPUs " << cadidaq::affinity::describe(processingCpus) << ", running it on any CPU.";
+        processingCpus.clear();
+      }
+    } else
+      MAIN_LOG_INFO << "Processing with " << workerStats.size() << " thread(s).";
+
+    struct rusage usageStart;
+    getrusage(RUSAGE_SELF, &usageStart);
+    uint64_t acquiredStart = 0;
+    for (auto& t : threads)
+      acquiredStart += t->pool->getAcquired();
+
+    bool anyDPP = false;
+    for (size_t i = 0; i < names.size(); i++)
+      if (dppFormats[i] != cadidaq::dppFormat::NONE){
+        MAIN_LOG_INFO << "Decoding the " << cadidaq::toString(dppFormats[i]) << " list-mode events of '" << names[i] << "'.";
+        anyDPP = true;
+      }
+
+    // processing: the workers decode the buffers in batches of events, which are then delivered (one buffer at a
+    // time, in the order read from each board) to publish their events and release them
+    uint64_t nevents = 0;
+    uint64_t nbytes = 0;
+    // handing a record to the data files: copying it into a chunk (waiting for a free one if the disk falls behind)
+    auto submitted = [&](uint32_t board, uint64_t sequence, uint64_t start, uint32_t bytes){
+      uint64_t end = cadidaq::latencyMetrics::now();
+      writeSubmitLatency->record(end - start);
+      if (trace)
+        trace->record(cadidaq::traceRecorder::span::WRITE_SUBMIT, deliverThread, board, sequence, start, end, bytes);
+    };
+    cadidaq::processingPool processing(workerStats.size(), names.size(), nbuffers, maxBufferSize, *daq.processingBatchSize.first * 1024, processingCpus, workerStats,
+      [&](const cadidaq::readoutQueue::item& item, const cadidaq::processingPool::result& r){
+        // the events kept by the prescaler, with their waveforms unless only the features are handed on (no raw data for DPP)
+        if (tap && !decodedOnly(item.board, r)){
+          uint64_t index = r.firstEvent;
+          cadidaq::forEachEvent(item.pool->get(item.buffer).data, item.nbytes, [&](const cadidaq::eventHeader& event){
+              if (index++ % r.prescale == 0)
+                tap->publish(tapIndex[item.board], event, r.featuresOnly);
+            });
+        }
+        // the same events to the data files (for DPP boards under FeaturesOnly or filtered: their decoded event batches only)
+        if (writer && !decodedOnly(item.board, r)){
+          uint64_t submitStart = cadidaq::latencyMetrics::now();
+          writer->writeEvents(item.board, r.sequence, r.firstEvent, item.pool->get(item.buffer).data, item.nbytes, r.prescale, r.featuresOnly, item.readTime);
+          submitted(item.board, r.sequence, submitStart, item.nbytes);
+        }
+        // and to the stream, which releases the buffer once sent
+        if (sink && !decodedOnly(item.board, r))
+          sink->sendEvents(item, r.sequence, r.firstEvent, r.prescale, r.featuresOnly);
+        else
+          item.pool->release(item.buffer);
+        nbytes += item.nbytes;
+        nevents += r.nevents;
+        boardStats[item.board]->events.add(r.nevents);
+        if (r.discarded)
+          boardStats[item.board]->prescaledEvents.add(r.discarded);
+        if (r.filtered)
+          boardStats[item.board]->filteredEvents.add(r.filtered);
+        if (r.strippedBytes)
+          boardStats[item.board]->strippedBytes.add(r.strippedBytes);
+        // where the buffer spent its time since it was read: waiting for the dispatcher, in the workers, waiting for the
+        // board's earlier buffers and being delivered
+        uint64_t deliverEnd = cadidaq::latencyMetrics::now();
+        if (item.readTime){
+          queueLatency.record(r.submitted - item.readTime);
+          deliveryLatency.record(deliverEnd - item.readTime);
+        }
+        processLatency.record(r.processed - r.submitted);
+        mergeLatency.record(r.delivering - r.processed);
+        if (trace){
+          if (item.readTime)
+            trace->record(cadidaq::traceRecorder::span::QUEUE, deliverThread, item.board, r.sequence, item.readTime, r.submitted);
+          trace->record(cadidaq::traceRecorder::span::PROCESS, deliverThread, item.board, r.sequence, r.submitted, r.processed);
+          trace->record(cadidaq::traceRecorder::span::MERGE, deliverThread, item.board, r.sequence, r.processed, r.delivering);
+          trace->record(cadidaq::traceRecorder::span::DELIVER, deliverThread, item.board, r.sequence, r.delivering, deliverEnd, r.nevents);
+        }
+        deliverStage.items.add();
+        deliverStage.busyNanoseconds.add(deliverEnd - r.delivering);
+      });
+    if (anyDPP)
+      processing.decodeDPP(dppFormats, [&](cadidaq::dppEventBatch& batch, const cadidaq::processingPool::result& r){
+          uint64_t pileups = 0;
+          const uint16_t* flags = batch.flags.data();
+          for (size_t i = 0; i < batch.size(); i++)
+            pileups += flags[i] & cadidaq::DPP_PILEUP;
+          boardStats[batch.board]->pileups.add(pileups);
+          // the waveform-less events stand in for the raw data in the files
+          if (writer && decodedOnly(batch.board, r)){
+            uint64_t submitStart = cadidaq::latencyMetrics::now();
+            writer->writeDPP(batch, r.firstEvent, r.prescale, r.readTime);
+            submitted(batch.board, batch.sequence, submitStart, batch.size() * (sizeof(uint64_t) + 4 * sizeof(uint16_t)));
+          }
+          if (sink && decodedOnly(batch.board, r))
+            sink->sendDPP(batch, r.firstEvent, r.prescale);
+        });
+    if (anyDPP)
+      processing.filterDPP(filters);
+    processing.traceLatency(decodeLatency, trace.get(), decodeThreads);
+
+    // the boards' health registers, read by the readout threads in their idle time
+    std::unique_ptr<cadidaq::healthMonitor> health;
+    if (!replay && std::any_of(vecDigi.begin(), vecDigi.end(), [](cadidaq::digitizer* d){return d->getHealthInterval() > 0;}))
+      health.reset(new cadidaq::healthMonitor(vecDigi, boardStats));
+
+    auto start = std::chrono::steady_clock::now();
+    cadidaq::readoutQueue queue(nbuffers);
+    std::atomic<bool> stop(false);
+    for (auto& t : threads)
+      if (replay)
+        t->thread = std::thread(replay_loop, std::ref(*t), std::ref(*replay), std::ref(boardStats), std::ref(queue), std::cref(stop));
+      else
+        t->thread = std::thread(readout_loop, std::ref(*t), std::ref(vecDigi), std::ref(boardStats), health.get(), std::ref(queue), std::cref(stop));
+
+    // dispatch the buffers read to the processing workers, reducing the data under back-pressure as configured per board
+    cadidaq::overflowControl overflow(policies, prescales, dppFormats, boardStats, *daq.overflowHighWatermark.first / 100., *daq.overflowLowWatermark.first / 100.);
+    bool steady = false;
+    uint64_t steadyAllocations = 0;
+    uint64_t steadyIterations = 0;
+    while (true){
+      auto now = std::chrono::steady_clock::now();
+      auto timeout = std::chrono::microseconds(std::chrono::milliseconds(100));
+      if (!stop){
+        bool ending = stopRequested || (replay && replay->isFinished());
+        if (daq.runDuration.first){
+          auto end = start + std::chrono::seconds(*daq.runDuration.first);
+          ending = ending || now >= end;
+          timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::microseconds>(end - now));
+        }
+        if (ending){
+          // stop reading, then process what has been read
+          stop = true;
+          for (auto& t : threads)
+            t->thread.join();
+        }
+      }
+      if (stop)
+        timeout = std::chrono::microseconds(0);
+      cadidaq::readoutQueue::item item;
+      if (!queue.pop(item, timeout)){
+        if (stop)
+          break;
+        continue;
+      }
+      cadidaq::overflowControl::decision decision = overflow.decide(item);
+      if (decision.drop)
+        overflow.drop(item);
+      else
+        processing.submit(item, decision.prescale, decision.featuresOnly);
+      if (steady)
+        steadyIterations++;
+      else {
+        steady = true;
+        steadyAllocations = cadidaq::allocations::thisThread();
+      }
+    }
+    steadyAllocations = cadidaq::allocations::thisThread() - steadyAllocations;
+    processing.stop();
+    cadidaq::affinity::pin(mainCpus);
+    if (sink)
+      sink->close();
+    if (writer)
+      writer->close();
+
+    for (auto digi : vecDigi){
+      digi->stopAcquisition();
+      digi->setMetrics(nullptr);
+    }
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    MAIN_LOG_INFO << "Acquisition stopped after " << seconds << " s: read " << nevents << " events (" << nbytes << " bytes) from " << names.size() << " digitizer(s).";
+    // end-to-end throughput of the pipeline for the same data every time
+    if (replay)
+      MAIN_LOG_INFO << "Replayed " << replay->getRecords() << " records (" << replay->getBytes()/(1024*1024) << " MB"
+                    << (replay->isFinished() ? ", all of the data" : ", stopped before the end of the data") << "): "
+                    << (seconds > 0 ? replay->getBytes() / seconds / (1024*1024) : 0) << " MB/s, "
+                    << (seconds > 0 ? nevents / seconds : 0) << " events/s through the processing"
+                    << (replay->getSkipped() ? ", " + std::to_string(replay->getSkipped()) + " records of decoded DPP events skipped" : "")
+                    << (replay->getDroppedBoards() ? ", " + std::to_string(replay->getDroppedBoards()) + " records of unknown boards dropped" : "");
+    struct rusage usageStop;
+    getrusage(RUSAGE_SELF, &usageStop);
+    size_t mapped = 0;
+    uint64_t acquired = 0;
+    bool hugePages = true, locked = true;
+    for (auto& t : threads){
+      mapped += t->pool->getMappedSize();
+      acquired += t->pool->getAcquired();
+      hugePages = hugePages && t->pool->usesHugePages();
+      locked = locked && t->pool->isLocked();
+    }
+    MAIN_LOG_INFO << "Readout buffer pools: " << nbuffers << " buffers in " << threads.size() << " pool(s) (" << mapped/(1024*1024) << " MB"
+                  << (hugePages ? ", huge pages" : "") << (locked ? ", locked" : "") << "), buffers reused "
+                  << acquired - acquiredStart << " times; page faults during the run: "
+                  << usageStop.ru_minflt - usageStart.ru_minflt << " minor, " << usageStop.ru_majflt - usageStart.ru_majflt << " major.";
+    // readout scheduling trade-off: CPU usage vs. latency and empty reads
+    for (auto& t : threads)
+      MAIN_LOG_INFO << "Readout thread '" << t->name << "' CPU usage: " << (seconds > 0 ? t->stage->cpuNanoseconds.get() * 1e-7 / seconds : 0) << " %"
+                    << (t->stage->errors.get() ? ", waited for a free readout buffer " + std::to_string(t->stage->errors.get()) + " time(s)" : "");
+    // balance of the processing workers
+    for (uint32_t w = 0; w < workerStats.size(); w++)
+      MAIN_LOG_INFO << "Processing thread " << w << ": busy " << (seconds > 0 ? workerStats[w]->busyNanoseconds.get() * 1e-7 / seconds : 0) << " % of the run, "
+                    << workerStats[w]->items.get() << " batches (" << workerStats[w]->stolen.get() << " taken over from other threads), CPU usage "
+                    << (seconds > 0 ? workerStats[w]->cpuNanoseconds.get() * 1e-7 / seconds : 0) << " %";
+    // where the time went between reading the buffers and delivering (and writing) them
+    std::ostringstream latencies;
+    for (auto& stage : registry.getLatencyStages()){
+      cadidaq::latencyDistribution d = registry.getLatency(stage);
+      if (d.total)
+        latencies << (latencies.tellp() ? ", " : "") << stage << " " << d.mean() * 1e-3 << " (" << d.quantile(0.99) * 1e-3 << ")";
+    }
+    if (latencies.tellp())
+      MAIN_LOG_INFO << "Latency per buffer in us, mean (99 % below): " << latencies.str();
+    for (size_t i = 0; i < names.size(); i++){
+      uint64_t reads = boardStats[i]->readCalls.get();
+      uint64_t empty = boardStats[i]->emptyReads.get();
+      MAIN_LOG_INFO << "'" << names[i] << "' (" << (replay ? std::string("replayed") : cadidaq::toString(vecDigi[i]->getReadoutMode()) + std::string(" readout")) << "): "
+                    << reads << " reads, " << empty << " empty (" << (reads ? 100. * empty / reads : 0) << " %), "
+                    << boardStats[i]->skippedReads.get() << " skipped as empty, latency "
+                    << (reads > empty ? boardStats[i]->latencyNanoseconds.get() * 1e-3 / (reads - empty) : 0) << " us on average, "
+                    << boardStats[i]->maxLatencyNanoseconds.get() * 1e-3 << " us at most"
+                    << (dppFormats[i] != cadidaq::dppFormat::NONE ? ", " + std::to_string(boardStats[i]->pileups.get()) + " events piled up" : "")
+                    << (filters[i] ? ", " + std::to_string(boardStats[i]->filteredEvents.get()) + " events not selected by the filter" : "");
+      // what the overflow policy discarded, for correcting the losses offline
+      if (boardStats[i]->overflowBuffers.get() || boardStats[i]->blockedNanoseconds.get())
+        MAIN_LOG_WARN << "'" << names[i] << "' overflow (" << cadidaq::toString(policies[i]) << "): "
+                      << boardStats[i]->overflowBuffers.get() << " buffers above the high watermark, "
+                      << boardStats[i]->droppedEvents.get() << " events (" << boardStats[i]->droppedBytes.get() << " bytes) dropped, "
+                      << boardStats[i]->prescaledEvents.get() << " events prescaled away, "
+                      << boardStats[i]->strippedBytes.get() << " bytes of waveforms discarded, readout blocked for "
+                      << boardStats[i]->blockedNanoseconds.get() * 1e-6 << " ms";
+      // what watching the board's health cost the readout
+      uint64_t healthReads = boardStats[i]->healthReads.get();
+      if (health && healthReads)
+        MAIN_LOG_INFO << "'" << names[i] << "' health: " << healthReads << " registers read, "
+                      << boardStats[i]->healthNanoseconds.get() * 1e-3 / healthReads << " us each ("
+                      << (seconds > 0 ? boardStats[i]->healthNanoseconds.get() * 1e-7 / seconds : 0) << " % of the run), "
+                      << boardStats[i]->healthForcedReads.get() << " while the board was due, "
+                      << "hottest ADC at " << health->get(i).maxTemperature() << " C, " << boardStats[i]->healthAlarms.get() << " alarm(s)";
+    }
+    if (cadidaq::allocations::counting()){
+      bool allocated = steady && steadyAllocations;
+      if (allocated)
+        MAIN_LOG_ERROR << "The dispatching loop made " << steadyAllocations << " heap allocation(s) in " << steadyIterations << " iterations in steady state!";
+      else
+        MAIN_LOG_INFO << "The dispatching loop made no heap allocations in " << steadyIterations << " iterations in steady state.";
+      for (uint32_t w = 0; w < processing.getWorkers(); w++){
+        if (processing.getSteadyAllocations(w)){
+          MAIN_LOG_ERROR << "Processing thread " << w << " made " << processing.getSteadyAllocations(w) << " heap allocation(s) in " << processing.getSteadyIterations(w) << " batches in steady state!";
+          allocated = true;
+        } else
+          MAIN_LOG_INFO << "Processing thread " << w << " made no heap allocations in " << processing.getSteadyIterations(w) << " batches in steady state.";
+      }
+      for (auto& t : threads){
+        if (t->steady && t->steadyAllocations){
+          MAIN_LOG_ERROR << "Readout thread '" << t->name << "' made " << t->steadyAllocations << " heap allocation(s) in " << t->steadyIterations << " iterations in steady state!";
+          allocated = true;
+        } else
+          MAIN_LOG_INFO << "Readout thread '" << t->name << "' made no heap allocations in " << t->steadyIterations << " iterations in steady state.";
+      }
+      if (allocated)
+        return false;
+    }
+    return true;
+}
+
+//
+// configuration snapshots
+//
+
+/** configures the DAQ and all digitizers from a snapshot compiled from the given ini file content.
+    returns false, leaving nothing configured, if the snapshot is missing, damaged, outdated or does not match the boards found */
+bool load_snapshot(const std::string& snapshotFile, const std::string* iniContent, std::unique_ptr<cadidaq::daqSettings>& daq, std::vector<cadidaq::digitizer*>& vecDigi)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<cadidaq::snapshotReader> snapshot;
+    try {
+      snapshot.reset(new cadidaq::snapshotReader(snapshotFile));
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_INFO << e.what() << " -- reading the ini file instead.";
+      return false;
+    }
+    if (!iniContent)
+      MAIN_LOG_WARN << "Ini file not found, using configuration snapshot '" << snapshotFile << "' without checking whether it is up to date.";
+    else if (!snapshot->matchesSource(iniContent->size(), cadidaq::checksum(iniContent->data(), iniContent->size()))){
+      MAIN_LOG_INFO << "Configuration snapshot '" << snapshotFile << "' was compiled from a different version of the ini file -- reading the ini file instead.";
+      return false;
+    }
+    try {
+      daq->load(*snapshot);
+      uint32_t NDigitizer;
+      snapshot->get(NDigitizer);
+      for (uint32_t i = 0; i < NDigitizer; i++){
+        std::string digName;
+        snapshot->get(digName);
+        cadidaq::digitizer* digi = new cadidaq::digitizer(digName);
+        vecDigi.push_back(digi);
+        digi->configure(*snapshot);
+      }
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_WARN << e.what() << " -- reading the ini file instead.";
+      for (auto digi : vecDigi)
+        delete digi;
+      vecDigi.clear();
+      daq.reset(new cadidaq::daqSettings("cadidaq"));
+      return false;
+    }
+    MAIN_LOG_INFO << "Configured " << vecDigi.size() << " digitizer(s) from snapshot '" << snapshotFile << "' in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms.";
+    return true;
+}
+
+/// compiles the verified configuration of the DAQ and all digitizers into a snapshot
+void save_snapshot(const std::string& snapshotFile, const std::string& iniContent, cadidaq::daqSettings& daq, std::vector<cadidaq::digitizer*>& vecDigi)
+{
+    cadidaq::snapshotWriter snapshot;
+    daq.store(snapshot);
+    snapshot.put(static_cast<uint32_t>(vecDigi.size()));
+    for (auto digi : vecDigi){
+      snapshot.put(digi->getName());
+      digi->storeConfig(snapshot);
+    }
+    try {
+      snapshot.save(snapshotFile, iniContent.size(), cadidaq::checksum(iniContent.data(), iniContent.size()));
+      MAIN_LOG_INFO << "Wrote configuration snapshot '" << snapshotFile << "' (" << snapshot.size() << " bytes).";
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_ERROR << e.what();
+    }
+}
+
+/// prints the configuration stored in a snapshot in ini format
+int dump_snapshot(const std::string& snapshotFile)
+{
+    try {
+      cadidaq::snapshotReader snapshot(snapshotFile);
+      pt::iptree tree;
+      cadidaq::daqSettings daq("cadidaq");
+      daq.load(snapshot);
+      std::unique_ptr<pt::iptree> node(daq.createPTree());
+      tree.put_child("CADIDAQ", *node);
+      uint32_t NDigitizer;
+      snapshot.get(NDigitizer);
+      for (uint32_t i = 0; i < NDigitizer; i++){
+        std::string digName;
+        snapshot.get(digName);
+        node.reset(cadidaq::digitizer::describeSnapshot(digName, snapshot));
+        tree.put_child(digName, *node);
+      }
+      pt::ini_parser::write_ini(std::cout, tree);
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_ERROR << e.what();
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+//
+// data streams
+//
+
+/** /struct streamStatistics
+    What was received over a connection of a data stream: the amount of data and the latency of each record from
+    its delivery to the stream (its write time) until received.
+*/
+struct streamStatistics {
+  uint64_t            records = 0;
+  uint64_t            events = 0;
+  uint64_t            bytes = 0;
+  std::vector<double> latencies;   ///< in seconds
+
+  void add(const cadidaq::dataFileLayout::fileHeader& header, const cadidaq::dataFileLayout::recordHeader& r){
+    // (the run start is the sender's time of day, for latencies over the network the clocks have to be in sync)
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    latencies.push_back((now - static_cast<int64_t>(header.runStart + r.writeTime)) * 1e-9);
+    records++;
+    events += r.nevents;
+    bytes += r.size;
+  }
+  /// the latency below which the fraction 'q' of the records arrived (reorders the latencies)
+  double latency(double q){
+    if (latencies.empty())
+      return 0;
+    size_t k = std::min<size_t>(latencies.size() * q, latencies.size() - 1);
+    std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+    return latencies[k];
+  }
+  std::string describe(double seconds){
+    std::ostringstream s;
+    s << records << " records, " << events << " events (" << bytes/(1024*1024) << " MB) in " << seconds << " s: "
+      << (seconds > 0 ? bytes / seconds / (1024*1024) : 0) << " MB/s, latency median " << latency(0.5) * 1e3 << " ms, 99 % "
+      << latency(0.99) * 1e3 << " ms, max " << latency(1) * 1e3 << " ms";
+    return s.str();
+  }
+};
+
+/// receives the records of the data streams sent to 'address' one connection after the other until interrupted, reporting their throughput and latency
+int receive_stream(const std::string& address)
+{
+    std::unique_ptr<cadidaq::streamReceiver> receiver;
+    try {
+      receiver.reset(new cadidaq::streamReceiver(address));
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_FATAL << e.what();
+      return EXIT_FAILURE;
+    }
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    MAIN_LOG_INFO << "Receiving data streams at " << receiver->getAddress() << ", press Ctrl-C to stop.";
+    while (!stopRequested){
+      if (!receiver->accept(std::chrono::milliseconds(200)))
+        continue;
+      const cadidaq::dataFileLayout::fileHeader& header = receiver->getHeader();
+      std::ostringstream boards;
+      for (uint16_t b = 0; b < header.nboards; b++)
+        boards << (b ? ", " : "") << receiver->getBoardName(b);
+      MAIN_LOG_INFO << "Receiving connection " << header.fileNumber << " of a run with " << header.nboards << " board(s): " << boards.str();
+      streamStatistics received;
+      auto start = std::chrono::steady_clock::now();
+      while (!stopRequested && receiver->isConnected())
+        if (const cadidaq::dataFileLayout::recordHeader* r = receiver->next(std::chrono::milliseconds(200)))
+          received.add(header, *r);
+      MAIN_LOG_INFO << (receiver->isConnected() ? "Stopped receiving: " : "Sender disconnected: ")
+                    << received.describe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    return EXIT_SUCCESS;
+}
+
+//
+// benchmarks
+//
+
+/** measures the simulated readout path (block transfer into a readout buffer, decoding and touching all samples)
+    for readout buffers allocated on each NUMA node and processed from the CPUs of each node */
+int numa_benchmark()
+{
+    const uint32_t bufferSize = 4*1024*1024;
+    const uint32_t nbuffers = 16;    // 64 MB in total: larger than the caches
+    const uint32_t eventWords = cadidaq::eventHeaderWords + 16*512;
+    const auto duration = std::chrono::seconds(1);
+    int nodes = cadidaq::affinity::nodes();
+    MAIN_LOG_INFO << "NUMA benchmark: " << nodes << " node(s), " << nbuffers << " readout buffers of " << bufferSize/(1024*1024) << " MB, "
+                  << std::chrono::duration_cast<std::chrono::seconds>(duration).count() << " s per combination.";
+    if (nodes == 1)
+      MAIN_LOG_WARN << "Only one NUMA node: there is no cross-node traffic to measure, the result is the local throughput only.";
+    std::vector<double> local(nodes, 0);
+    for (int memoryNode = 0; memoryNode < nodes; memoryNode++){
+      for (int cpuNode = 0; cpuNode < nodes; cpuNode++){
+        std::unique_ptr<cadidaq::bufferPool> pool;
+        double rate = 0;
+        std::string memory;
+        std::exception_ptr error;
+        // allocate (first touch) from the memory node, then run the readout path from the CPU node
+        std::thread([&]{
+            cadidaq::affinity::pin(cadidaq::affinity::cpusOf(memoryNode));
+            try {
+              pool.reset(new cadidaq::bufferPool(bufferSize, nbuffers));
+            }
+            catch (...){
+              error = std::current_exception();
+            }
+          }).join();
+        if (error){
+          try {
+            std::rethrow_exception(error);
+          }
+          catch (const std::runtime_error& e){
+            MAIN_LOG_ERROR << e.what();
+            return EXIT_FAILURE;
+          }
+        }
+        memory = cadidaq::affinity::memoryNodes(pool->getMemory());
+        std::thread([&]{
+            cadidaq::affinity::pin(cadidaq::affinity::cpusOf(cpuNode));
+            // the data as sent by a board: events of 16 channels with 512 samples each
+            uint32_t nevents = bufferSize / (eventWords * sizeof(uint32_t));
+            std::vector<uint32_t> block(nevents * eventWords);
+            for (uint32_t e = 0; e < nevents; e++){
+              uint32_t* w = &block[e * eventWords];
+              w[0] = 0xA0000000 | eventWords;
+              w[1] = 0xFF;
+              w[2] = e;
+              w[3] = e * 100;
+              for (uint32_t i = cadidaq::eventHeaderWords; i < eventWords; i++)
+                w[i] = (8000 + i) | ((8000 + i) << 16);
+            }
+            uint64_t bytes = 0;
+            uint64_t sum = 0;
+            auto start = std::chrono::steady_clock::now();
+            auto end = start + duration;
+            while (std::chrono::steady_clock::now() < end){
+              for (uint32_t b = 0; b < nbuffers; b++){
+                cadidaq::bufferPool::handle h = pool->acquire();
+                caen::ReadoutBuffer& buffer = pool->get(h);
+                std::memcpy(buffer.data, block.data(), block.size() * sizeof(uint32_t));
+                buffer.dataSize = block.size() * sizeof(uint32_t);
+                cadidaq::forEachEvent(buffer.data, buffer.dataSize, [&](const cadidaq::eventHeader& event){
+                    for (uint32_t i = cadidaq::eventHeaderWords; i < event.size; i++)
+                      sum += event.data[i];
+                  });
+                bytes += buffer.dataSize;
+                pool->release(h);
+              }
+            }
+            rate = bytes / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            // keep the decoding from being optimized away
+            if (sum == 0)
+              rate = 0;
+          }).join();
+        if (cpuNode == memoryNode)
+          local[memoryNode] = rate;
+        MAIN_LOG_INFO << "Buffers on node " << memoryNode << " (" << (memory.empty() ? "placement unknown" : memory) << "), processed on node " << cpuNode
+                      << " (CPUs " << cadidaq::affinity::describe(cadidaq::affinity::cpusOf(cpuNode)) << "): " << rate / (1024*1024) << " MB/s"
+                      << (cpuNode != memoryNode && local[memoryNode] > 0 ? " (" + std::to_string(static_cast<int>(100 * rate / local[memoryNode])) + " % of local)" : "");
+      }
+    }
+    return EXIT_SUCCESS;
+}
+
+/** measures the throughput of the processing workers for 1, 2, 4, ... threads up to the number of CPUs available, for
+    boards with very different data rates and a feature extraction reading every sample (peak search) */
+int processing_benchmark()
+{
+    const uint32_t nboards = 8;
+    const uint32_t buffersPerBoard = 4;
+    const uint32_t bufferSize = 1024*1024;
+    const uint32_t eventWords = cadidaq::eventHeaderWords + 16*256/2;  // 16 channels of 256 samples, two per word
+    const auto duration = std::chrono::seconds(1);
+    uint32_t ncpus = std::max<size_t>(cadidaq::affinity::current().size(), 1);
+
+    // board b fills (b+1)/nboards of each of its buffers: the loads are uneven
+    cadidaq::bufferPool pool(bufferSize, nboards * buffersPerBoard);
+    std::vector<cadidaq::readoutQueue::item> items;
+    for (uint32_t i = 0; i < nboards * buffersPerBoard; i++){
+      cadidaq::bufferPool::handle h = pool.acquire();
+      uint32_t board = i % nboards;
+      uint32_t nevents = (bufferSize / (eventWords * sizeof(uint32_t))) * (board + 1) / nboards;
+      uint32_t* w = reinterpret_cast<uint32_t*>(pool.get(h).data);
+      for (uint32_t e = 0; e < nevents; e++, w += eventWords){
+        w[0] = 0xA0000000 | eventWords;
+        w[1] = 0xFF;
+        w[2] = 0xFF000000 | e;
+        w[3] = e * 100;
+        for (uint32_t s = cadidaq::eventHeaderWords; s < eventWords; s++)
+          w[s] = ((8000 + (s * 7 + e) % 200) << 16) | (8000 + (s * 13 + e) % 200);
+      }
+      // (submitted again and again: read at no time in particular)
+      items.push_back({board, &pool, h, nevents * eventWords * static_cast<uint32_t>(sizeof(uint32_t)), 0});
+    }
+    MAIN_LOG_INFO << "Processing benchmark: " << nboards << " boards filling 1/" << nboards << " to all of their " << bufferSize/1024 << " kB buffers, "
+                  << "peak search over all samples, up to " << ncpus << " thread(s).";
+
+    double single = 0;
+    for (uint32_t nthreads = 1; ; nthreads = std::min(nthreads * 2, ncpus)){
+      cadidaq::metrics registry;
+      std::vector<cadidaq::stageMetrics*> stats;
+      for (uint32_t w = 0; w < nthreads; w++)
+        stats.push_back(&registry.addStage("decode:" + std::to_string(w)));
+      std::atomic<uint32_t> peaks(0);
+      uint64_t bytes = 0;
+      uint64_t events = 0;
+      // delivered buffers are handed back to be submitted again
+      cadidaq::readoutQueue returned(items.size());
+      {
+        cadidaq::processingPool processing(nthreads, nboards, items.size(), bufferSize, 64*1024, cadidaq::affinity::cpuList(), stats,
+          [&](const cadidaq::readoutQueue::item& item, const cadidaq::processingPool::result& r){
+            bytes += item.nbytes;
+            events += r.nevents;
+            returned.push(item);
+          },
+          [&](const cadidaq::eventHeader& event){
+            const uint16_t* samples = reinterpret_cast<const uint16_t*>(event.data + cadidaq::eventHeaderWords);
+            uint32_t nsamples = (event.size - cadidaq::eventHeaderWords) * 2;
+            uint16_t peak = 0;
+            for (uint32_t s = 0; s < nsamples; s++)
+              peak = std::max(peak, samples[s]);
+            if (peak > 8190)
+              peaks.fetch_add(1, std::memory_order_relaxed);
+          });
+        auto start = std::chrono::steady_clock::now();
+        for (auto& item : items)
+          processing.submit(item);
+        cadidaq::readoutQueue::item item;
+        while (std::chrono::steady_clock::now() - start < duration)
+          if (returned.pop(item, std::chrono::milliseconds(10)))
+            processing.submit(item);
+        processing.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = bytes / seconds;
+        if (nthreads == 1)
+          single = rate;
+        std::ostringstream busy;
+        for (uint32_t w = 0; w < nthreads; w++)
+          busy << (w ? "/" : "") << static_cast<int>(stats[w]->busyNanoseconds.get() * 1e-7 / seconds);
+        MAIN_LOG_INFO << nthreads << " thread(s): " << rate / (1024*1024) << " MB/s, " << events / seconds << " events/s, speed-up "
+                      << (single > 0 ? rate / single : 0) << " (" << (single > 0 ? static_cast<int>(100 * rate / single / nthreads) : 0) << " % efficiency), "
+                      << "threads busy " << busy.str() << " % of the time";
+      }
+      if (nthreads >= ncpus)
+        break;
+    }
+    if (ncpus == 1)
+      MAIN_LOG_WARN << "Only one CPU available: the scaling cannot be measured on this host.";
+    return EXIT_SUCCESS;
+}
+
+/** compares decoding DPP-PSD list-mode data into one structure per event (AoS) and into event batches (SoA),
+    each followed by a selection (long charge window, no pile-up) and a histogram of the selected events' charge */
+int dpp_benchmark()
+{
+    const uint32_t bufferSize = 1024*1024;
+    const uint32_t eventsPerPair = 16;
+    const uint32_t eventWords = 3;  // time tag, extras, charges (no waveform)
+    const uint32_t pairWords = 2 + eventsPerPair * eventWords;
+    const uint32_t aggregateWords = cadidaq::eventHeaderWords + 8 * pairWords;
+    const uint16_t low = 2000, high = 12000;
+    const auto duration = std::chrono::seconds(1);
+
+    // board aggregates of all 8 channel pairs with random charges and 1/16 of the events piled up
+    std::vector<uint32_t> buffer((bufferSize / sizeof(uint32_t)) / aggregateWords * aggregateWords);
+    uint32_t random = 1;
+    uint64_t time = 0;
+    for (size_t a = 0; a < buffer.size(); a += aggregateWords){
+      uint32_t* w = &buffer[a];
+      w[0] = 0xA0000000 | aggregateWords;
+      w[1] = 0xFF;
+      w[2] = a / aggregateWords;
+      w[3] = static_cast<uint32_t>(time);
+      for (uint32_t p = 0; p < 8; p++){
+        uint32_t* c = w + cadidaq::eventHeaderWords + p * pairWords;
+        c[0] = 0x80000000 | pairWords;
+        c[1] = (1u << 28) | (1u << 30);  // extras and charges, no samples
+        for (uint32_t e = 0; e < eventsPerPair; e++, time += 100){
+          random = random * 1664525 + 1013904223;
+          uint32_t chargeLong = (random >> 18) & 0x3FFF;
+          uint32_t pileup = ((random >> 4) & 0xF) == 0;
+          c[2 + e * eventWords]     = ((random >> 8) & 1) << 31 | static_cast<uint32_t>(time & 0x7FFFFFFF);
+          c[2 + e * eventWords + 1] = static_cast<uint32_t>(time >> 31) << 16;
+          c[2 + e * eventWords + 2] = chargeLong << 16 | pileup << 15 | (chargeLong / 4);
+        }
+      }
+    }
+    const char* data = reinterpret_cast<const char*>(buffer.data());
+    uint32_t nbytes = buffer.size() * sizeof(uint32_t);
+    MAIN_LOG_INFO << "DPP event layout benchmark: " << nbytes/1024 << " kB of DPP-PSD data ("
+                  << buffer.size() / aggregateWords * 8 * eventsPerPair << " events) decoded, selected and histogrammed repeatedly for "
+                  << std::chrono::duration_cast<std::chrono::seconds>(duration).count() << " s per layout.";
+
+    std::vector<uint32_t> histogram(1024);
+    uint64_t selectedAoS = 0, selectedSoA = 0;
+    for (int layout = 0; layout < 2; layout++){
+      std::vector<cadidaq::dppEvent> events;
+      cadidaq::dppEventBatch batch;
+      uint64_t iterations = 0, nevents = 0, selected = 0;
+      std::chrono::nanoseconds decoding(0), analysing(0);
+      auto start = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - start < duration){
+        auto t0 = std::chrono::steady_clock::now();
+        if (layout == 0){
+          events.clear();
+          cadidaq::forEachEvent(data, nbytes, [&](const cadidaq::eventHeader& aggregate){
+              cadidaq::forEachDPPEvent(aggregate, cadidaq::dppFormat::PSD, [&](const cadidaq::dppEvent& e){events.push_back(e);});
+            });
+        } else {
+          batch.clear();
+          cadidaq::forEachEvent(data, nbytes, [&](const cadidaq::eventHeader& aggregate){
+              cadidaq::decodeDPPEvents(aggregate, cadidaq::dppFormat::PSD, batch);
+            });
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        // handed on to the analysis by moving, as between the stages of the acquisition
+        if (layout == 0){
+          std::vector<cadidaq::dppEvent> analysed(std::move(events));
+          for (const auto& e : analysed){
+            uint32_t pass = static_cast<uint16_t>(e.energy - low) < high - low && !(e.flags & cadidaq::DPP_PILEUP);
+            histogram[e.energy >> 4] += pass;
+            selected += pass;
+          }
+          nevents += analysed.size();
+          events = std::move(analysed);
+        } else {
+          cadidaq::dppEventBatch analysed(std::move(batch));
+          const uint16_t* energy = analysed.energy.data();
+          const uint16_t* flags = analysed.flags.data();
+          size_t n = analysed.size();
+          for (size_t i = 0; i < n; i++){
+            uint32_t pass = static_cast<uint16_t>(energy[i] - low) < high - low && !(flags[i] & cadidaq::DPP_PILEUP);
+            histogram[energy[i] >> 4] += pass;
+            selected += pass;
+          }
+          nevents += n;
+          batch = std::move(analysed);
+        }
+        decoding += t1 - t0;
+        analysing += std::chrono::steady_clock::now() - t1;
+        iterations++;
+      }
+      double seconds = std::chrono::duration<double>(decoding + analysing).count();
+      MAIN_LOG_INFO << (layout == 0 ? "Array of structures:  " : "Structure of arrays:  ")
+                    << iterations * nbytes / seconds / (1024*1024) << " MB/s, " << nevents / seconds * 1e-6 << " M events/s end to end; decoding "
+                    << nevents / (decoding.count() * 1e-9) * 1e-6 << " M events/s, selection and histogram "
+                    << nevents / (analysing.count() * 1e-9) * 1e-6 << " M events/s";
+      (layout == 0 ? selectedAoS : selectedSoA) = iterations ? selected / iterations : 0;
+    }
+    if (selectedAoS != selectedSoA){
+      MAIN_LOG_ERROR << "The layouts selected different numbers of events: " << selectedAoS << " vs. " << selectedSoA;
+      return EXIT_FAILURE;
+    }
+
+    // truncated board aggregates (the last channel aggregate cut short) and channel aggregates announcing more words than
+    // the board aggregate holds: the counting must stop where the decoding does, at the first one not fitting
+    struct {uint32_t boardWords, corruptPair, expected;} truncations[] = {
+      {aggregateWords - pairWords / 2, 8, 7 * eventsPerPair}, {aggregateWords - pairWords, 8, 7 * eventsPerPair},
+      {aggregateWords, 3, 3 * eventsPerPair}, {aggregateWords, 0, 0}};
+    for (const auto& t : truncations){
+      std::vector<uint32_t> words(buffer.begin(), buffer.begin() + aggregateWords);
+      words[0] = 0xA0000000 | t.boardWords;
+      if (t.corruptPair < 8)
+        words[cadidaq::eventHeaderWords + t.corruptPair * pairWords] = 0x80000000 | 0x3FFFFF;
+      cadidaq::eventHeader aggregate;
+      cadidaq::dppEventBatch batch;
+      if (!cadidaq::decodeEventHeader(words.data(), t.boardWords, aggregate)){
+        MAIN_LOG_ERROR << "Truncated board aggregate of " << t.boardWords << " words not decoded";
+        return EXIT_FAILURE;
+      }
+      uint32_t counted = cadidaq::countDPPEvents(aggregate);
+      uint32_t decoded = cadidaq::decodeDPPEvents(aggregate, cadidaq::dppFormat::PSD, batch);
+      if (counted != t.expected || decoded != t.expected){
+        MAIN_LOG_ERROR << "Board aggregate of " << t.boardWords << " words" << (t.corruptPair < 8 ? " with a corrupt channel aggregate" : "")
+                       << ": " << counted << " events counted and " << decoded << " decoded, " << t.expected << " expected";
+        return EXIT_FAILURE;
+      }
+    }
+    MAIN_LOG_INFO << "Truncated and corrupt board aggregates: events counted as decoded.";
+    return EXIT_SUCCESS;
+}
+
+/** compares looking up the constants of CAEN enum E by name in its perfect-hash table with the boost::bimap lookup the
+    tables replaced (a case-insensitive walk through all names); returns false if the two disagree */
+template <typename E>
+bool enum_lookup_benchmark(const std::string& enumName, std::chrono::milliseconds duration)
+{
+    typedef cadidaq::CaenEnum2str<E> table;
+    // names as given in config files, without the root and in any case, and a few unknown ones
+    std::vector<std::string> names;
+    for (size_t i = 0; i < table::size; i++){
+      std::string name(table::entries[i].name + table::rootLength);
+      names.push_back(name);
+      names.push_back(boost::algorithm::to_lower_copy(name));
+    }
+    names.push_back("NotAConstant");
+    names.push_back("X");
+
+    // the bimap as it was generated, filled by its converter's constructor
+    typedef boost::bimap<std::string, E> bimap;
+    auto start = std::chrono::steady_clock::now();
+    bimap map;
+    for (size_t i = 0; i < table::size; i++)
+      map.insert(typename bimap::value_type(table::entries[i].name, table::entries[i].value));
+    double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::string root(table::root);
+
+    double rate[2] = {0, 0};
+    uint64_t found[2] = {0, 0};
+    for (int method = 0; method < 2; method++){
+      uint64_t iterations = 0;
+      uint64_t n = 0;
+      start = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - start < duration){
+        n = 0;
+        for (auto& name : names)
+          if (method == 0)
+            n += cadidaq::fromStr<E>(name.c_str(), name.size()) != nullptr;
+          else {
+            std::string search = boost::algorithm::to_lower_copy(root + name);
+            for (auto i = map.left.begin(); i != map.left.end(); ++i)
+              if (boost::iequals(boost::algorithm::to_lower_copy(i->first), search)){
+                n++;
+                break;
+              }
+          }
+        iterations++;
+      }
+      rate[method] = iterations * names.size() / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      found[method] = n;
+    }
+    MAIN_LOG_INFO << enumName << " (" << table::size << " constants): perfect hash " << rate[0] * 1e-6 << " M lookups/s, bimap "
+                  << rate[1] * 1e-6 << " M lookups/s (" << (rate[1] > 0 ? rate[0] / rate[1] : 0) << " times faster); building the bimap took "
+                  << build * 1e6 << " us";
+    if (found[0] != found[1]){
+      MAIN_LOG_ERROR << "The lookups of " << enumName << " found different numbers of names: " << found[0] << " vs. " << found[1];
+      return false;
+    }
+    return true;
+}
+
+/** compares the lookups of CAEN enum constants by name (as in the settings) in the generated perfect-hash tables with
+    those in the boost::bimaps formerly generated */
+int enum_benchmark()
+{
+    const auto duration = std::chrono::milliseconds(300);
+    MAIN_LOG_INFO << "CAEN enum lookup benchmark: all names of each enum (as given and in lower case) and two unknown names, "
+                  << duration.count() << " ms per method.";
+    bool ok = enum_lookup_benchmark<CAEN_DGTZ_TriggerMode_t>("CAEN_DGTZ_TriggerMode_t", duration)
+      && enum_lookup_benchmark<CAEN_DGTZ_AcqMode_t>("CAEN_DGTZ_AcqMode_t", duration)
+      && enum_lookup_benchmark<CAEN_DGTZ_DPP_AcqMode_t>("CAEN_DGTZ_DPP_AcqMode_t", duration)
+      && enum_lookup_benchmark<CAEN_DGTZ_BoardModel_t>("CAEN_DGTZ_BoardModel_t", duration);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+namespace {
+  // the element-wise helpers on std::vector<boost::optional<T>> that channelValues and channelSet replaced (as they
+  // were in helper.hpp, the masks widened to 64 bits and the group size passed as channels per group)
+  typedef std::vector<boost::optional<bool>> optionalBools;
+
+  uint64_t vec2Mask(const optionalBools& vec, unsigned perGroup){
+    uint64_t mask = 0;
+    for (size_t i = 0; i < vec.size(); i++)
+      if (vec[i] && *vec[i])
+        mask |= uint64_t(1) << (i / perGroup);
+    return mask;
+  }
+
+  void mask2Vec(boost::optional<uint64_t> mask, optionalBools& vec, unsigned perGroup){
+    for (size_t i = 0; i < vec.size(); i++)
+      vec[i] = mask ? boost::optional<bool>((*mask >> (i / perGroup) & 1) != 0) : boost::optional<bool>(boost::none);
+  }
+
+  int countTrue(const optionalBools& vec, size_t start, size_t stop){
+    int n = 0;
+    for (size_t i = start; i < stop && i < vec.size(); i++)
+      n += vec[i] && *vec[i];
+    return n;
+  }
+
+  template <typename T>
+  int countSet(const std::vector<boost::optional<T>>& vec, size_t start, size_t stop){
+    int n = 0;
+    for (size_t i = start; i < stop && i < vec.size(); i++)
+      n += static_cast<bool>(vec[i]);
+    return n;
+  }
+
+  template <typename T>
+  boost::optional<T> getFirstSetValue(const std::vector<boost::optional<T>>& vec, size_t start, size_t stop){
+    for (size_t i = start; i < stop && i < vec.size(); i++)
+      if (vec[i])
+        return vec[i];
+    return boost::none;
+  }
+
+  template <typename T>
+  bool allValuesSame(const std::vector<boost::optional<T>>& vec, size_t start, size_t stop){
+    boost::optional<T> value = getFirstSetValue(vec, start, stop);
+    for (size_t i = start; i < stop && i < vec.size(); i++)
+      if (vec[i] && vec[i] != value)
+        return false;
+    return true;
+  }
+}
+
+/** checks channelValues and channelSet against the element-wise helpers on vectors of optional values they replaced, on
+    random settings of boards with 8, 16, 32 and 64 channels (the latter in groups of 8 as on the x740), and compares how
+    long both take for what configuring a board asks of them: the channels enabled, the group mask and a first value */
+int channelset_benchmark()
+{
+    const auto duration = std::chrono::milliseconds(200);
+    const size_t nsets = 256;
+    MAIN_LOG_INFO << "Channel set benchmark: " << nsets << " random settings per board size, " << duration.count() << " ms per method.";
+    uint32_t random = 1;
+    auto next = [&random](){random = random * 1664525 + 1013904223; return random >> 8;};
+    for (unsigned nchannels : {8u, 16u, 32u, 64u}){
+      unsigned groupSizes[] = {1, 2, nchannels == 64 ? 8u : 4u};
+      // channels undefined, false or true (and values) at random
+      std::vector<optionalBools> vectors(nsets, optionalBools(nchannels));
+      std::vector<std::vector<boost::optional<uint32_t>>> valueVectors(nsets, std::vector<boost::optional<uint32_t>>(nchannels));
+      std::vector<cadidaq::channelSet> sets(nsets, cadidaq::channelSet(nchannels));
+      std::vector<cadidaq::channelValues<uint32_t>> values(nsets, cadidaq::channelValues<uint32_t>(nchannels));
+      for (size_t k = 0; k < nsets; k++)
+        for (unsigned ch = 0; ch < nchannels; ch++){
+          uint32_t r = next();
+          if (r % 3){
+            vectors[k][ch] = r % 3 == 2;
+            sets[k].set(ch, r % 3 == 2);
+          }
+          if ((r >> 2) % 4){
+            // few distinct values, so that some ranges hold the same everywhere
+            valueVectors[k][ch] = (r >> 4) % 3;
+            values[k].set(ch, (r >> 4) % 3);
+          }
+        }
+
+      // the results in random ranges and for each group size
+      for (size_t k = 0; k < nsets; k++){
+        unsigned start = next() % (nchannels + 1), stop = next() % (nchannels + 2);
+        const optionalBools& vec = vectors[k];
+        const cadidaq::channelSet& set = sets[k];
+        bool ok = countTrue(vec, start, stop) == static_cast<int>(set.countTrue(start, stop))
+          && countSet(vec, start, stop) == static_cast<int>(set.countSet(start, stop))
+          && getFirstSetValue(vec, start, stop) == set.firstValue(start, stop)
+          && allValuesSame(vec, start, stop) == set.allSame(start, stop)
+          && countSet(valueVectors[k], start, stop) == static_cast<int>(values[k].countSet(start, stop))
+          && getFirstSetValue(valueVectors[k], start, stop) == values[k].firstValue(start, stop)
+          && allValuesSame(valueVectors[k], start, stop) == values[k].allSame(start, stop);
+        for (unsigned perGroup : groupSizes){
+          uint64_t mask = vec2Mask(vec, perGroup);
+          optionalBools expanded(nchannels);
+          cadidaq::channelSet fromMask(nchannels);
+          mask2Vec(mask, expanded, perGroup);
+          fromMask.fromGroupMask(mask, perGroup);
+          for (unsigned ch = 0; ch < nchannels; ch++)
+            ok = ok && expanded[ch] == fromMask.get(ch);
+          ok = ok && set.groupMask(perGroup) == mask;
+          mask2Vec(boost::none, expanded, perGroup);
+          fromMask.fromGroupMask(boost::none, perGroup);
+          ok = ok && fromMask.countSet() == 0 && countSet(expanded, 0, nchannels) == 0;
+        }
+        if (!ok){
+          MAIN_LOG_ERROR << "Channel set of " << nchannels << " channels (setting " << k << ", channels " << start << " to " << stop
+                         << ") differs from the element-wise helpers";
+          return EXIT_FAILURE;
+        }
+      }
+
+      // channels enabled, group mask and first value of each setting
+      double nanoseconds[2] = {0, 0};
+      uint64_t sums[2] = {0, 0};
+      unsigned perGroup = groupSizes[2];
+      for (int method = 0; method < 2; method++){
+        uint64_t iterations = 0, sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < duration){
+          sum = 0;
+          for (size_t k = 0; k < nsets; k++)
+            if (method == 0)
+              sum += countTrue(vectors[k], 0, nchannels) + vec2Mask(vectors[k], perGroup) + getFirstSetValue(valueVectors[k], 0, nchannels).value_or(7);
+            else
+              sum += sets[k].countTrue() + sets[k].groupMask(perGroup) + values[k].firstValue().value_or(7);
+          iterations++;
+        }
+        nanoseconds[method] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (iterations * nsets);
+        sums[method] = sum;
+      }
+      MAIN_LOG_INFO << nchannels << " channels (groups of " << perGroup << "): element-wise " << nanoseconds[0] << " ns, channel set "
+                    << nanoseconds[1] << " ns per setting (" << (nanoseconds[1] > 0 ? nanoseconds[0] / nanoseconds[1] : 0) << " times faster)";
+      if (sums[0] != sums[1]){
+        MAIN_LOG_ERROR << "The methods gave different results for " << nchannels << " channels: " << sums[0] << " vs. " << sums[1];
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+}
+
+/** compares evaluating event filter expressions over the columns of an event batch, as the processing does, with
+    interpreting their expression tree event by event, for expressions of increasing complexity */
+int filter_benchmark()
+{
+    const size_t nevents = 64*1024;
+    const auto duration = std::chrono::milliseconds(500);
+    const std::vector<std::string> expressions = {
+      "energy > 200",
+      "energy > 200 && channel in [0-15]",
+      "energy in [2000-12000] && !pileup && channel in [0-3,8-11]",
+      "(energy > 8000 || chargeShort < 500) && !(channel in [4-7] || pileup) && timestamp >= 100000"};
+
+    // events of 16 channels with random charges, 1/16 of them piled up
+    cadidaq::dppEventBatch batch;
+    uint32_t random = 1;
+    for (size_t i = 0; i < nevents; i++){
+      random = random * 1664525 + 1013904223;
+      cadidaq::dppEvent e;
+      e.timestamp = i * 100;
+      e.channel = (random >> 8) & 0xF;
+      e.energy = (random >> 18) & 0x3FFF;
+      e.chargeShort = e.energy / 4;
+      e.flags = ((random >> 4) & 0xF) == 0 ? cadidaq::DPP_PILEUP : 0;
+      batch.push_back(e);
+    }
+    MAIN_LOG_INFO << "Event filter benchmark: batches of " << nevents << " decoded events, each filter evaluated repeatedly for "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() << " ms per method.";
+
+    std::vector<uint8_t> mask(nevents);
+    cadidaq::eventFilter::workspace ws;
+    for (auto& expression : expressions){
+      std::unique_ptr<cadidaq::eventFilter> filter;
+      try {
+        filter.reset(new cadidaq::eventFilter(expression));
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_ERROR << e.what();
+        return EXIT_FAILURE;
+      }
+      double rate[2] = {0, 0};
+      uint64_t selected[2] = {0, 0};
+      for (int method = 0; method < 2; method++){
+        uint64_t iterations = 0;
+        uint64_t n = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < duration){
+          n = 0;
+          if (method == 0){
+            filter->evaluate(batch, mask.data(), ws);
+            for (size_t i = 0; i < nevents; i++)
+              n += mask[i];
+          } else
+            for (size_t i = 0; i < nevents; i++){
+              cadidaq::dppEvent e = {batch.timestamp[i], batch.channel[i], batch.energy[i], batch.chargeShort[i], batch.flags[i]};
+              n += filter->matches(e);
+            }
+          iterations++;
+        }
+        rate[method] = iterations * nevents / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        selected[method] = n;
+      }
+      MAIN_LOG_INFO << filter->describe() << ": " << 100. * selected[0] / nevents << " % selected, columns "
+                    << rate[0] * 1e-6 << " M events/s, per event " << rate[1] * 1e-6 << " M events/s ("
+                    << (rate[1] > 0 ? rate[0] / rate[1] : 0) << " times faster)";
+      if (selected[0] != selected[1]){
+        MAIN_LOG_ERROR << "The methods selected different numbers of events: " << selected[0] << " vs. " << selected[1];
+        return EXIT_FAILURE;
+      }
+    }
+
+    // ranges are compared as intervals (whatever their width), merged, and their bounds must fit the column
+    struct {std::string expression; const char* compiled; size_t selected;} ranges[] = {
+      {"energy in [0-65535]", "energy in [0-65535]", nevents},
+      {"timestamp in [0-18446744073709551615]", "timestamp in [0-18446744073709551615]", nevents},
+      {"channel in [8-15, 0-3, 2-9]", "channel in [0-15]", nevents},
+      {"!(chargeShort in [0-65535]) || channel in [16-65535]", "(!(chargeShort in [0-65535]) || channel in [16-65535])", 0}};
+    for (auto& r : ranges){
+      try {
+        cadidaq::eventFilter filter(r.expression);
+        filter.evaluate(batch, mask.data(), ws);
+        size_t n = std::count(mask.begin(), mask.end(), 1);
+        if (filter.describe() != r.compiled || n != r.selected){
+          MAIN_LOG_ERROR << "'" << r.expression << "' compiled to '" << filter.describe() << "' selecting " << n << " events, '"
+                         << r.compiled << "' selecting " << r.selected << " expected";
+          return EXIT_FAILURE;
+        }
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_ERROR << e.what();
+        return EXIT_FAILURE;
+      }
+    }
+    for (const char* invalid : {"channel in [0-2000000000]", "energy in [65536]", "timestamp in [18446744073709551616]",
+                                "channel in [3-1]", "channel in []", "channel in [1,]", "channel in [0-3",
+                                "energy > 99999999999999999999", "timestamp < 18446744073709551616", "flags == 0x10000000000000000"}){
+      try {
+        cadidaq::eventFilter filter(invalid);
+        MAIN_LOG_ERROR << "'" << invalid << "' accepted as '" << filter.describe() << "'";
+        return EXIT_FAILURE;
+      }
+      catch (const std::runtime_error&){}
+    }
+    // the largest numbers still taken
+    for (const char* valid : {"timestamp <= 18446744073709551615", "timestamp != 0xFFFFFFFFFFFFFFFF"}){
+      try {
+        cadidaq::eventFilter filter(valid);
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_ERROR << e.what();
+        return EXIT_FAILURE;
+      }
+    }
+    MAIN_LOG_INFO << "Ranges compared as intervals, bounds beyond their column and numbers beyond 64 bits rejected.";
+    return EXIT_SUCCESS;
+}
+
+/** writes a synthetic data file of several GB to 'directory' and compares finding the events of a board in short time
+    windows through the file's index (with one and with all CPUs) with scanning the whole file; the file is dropped from
+    the page cache before every query, so that it is read from disk as a file much larger than the memory would be */
+int index_benchmark(const std::string& directory)
+{
+    const uint32_t nboards = 8;
+    const uint64_t fileSize = static_cast<uint64_t>(4)*1024*1024*1024;
+    const uint32_t bufferSize = 1024*1024;
+    const uint32_t eventWords = cadidaq::eventHeaderWords + 252;  // 1 kB events
+    const uint32_t ticksPerEvent = 5000;  // the trigger time tags of a board roll over every ~430000 events
+    const uint32_t nqueries = 8;
+    const double window = 0.01;           // of the run per query
+    uint32_t ncpus = std::max<size_t>(cadidaq::affinity::current().size(), 1);
+
+    // the boards' buffers in turn, the events of a board 'ticksPerEvent' apart
+    std::string file;
+    std::vector<uint64_t> timestamps(nboards, 0);
+    {
+      cadidaq::metrics registry;
+      std::vector<std::string> names;
+      for (uint32_t b = 0; b < nboards; b++)
+        names.push_back("board" + std::to_string(b));
+      std::unique_ptr<cadidaq::fileWriter> writer;
+      try {
+        writer.reset(new cadidaq::fileWriter(directory + "/index-benchmark", {0, 0, 0}, names, std::vector<cadidaq::dppFormat>(nboards, cadidaq::dppFormat::NONE),
+                                             std::string(), bufferSize, std::string(),
+                                             registry.addStage("write"), registry.addStage("finalise")));
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_FATAL << e.what();
+        return EXIT_FAILURE;
+      }
+      file = writer->getPrefix() + "0000.cdaq";
+      MAIN_LOG_INFO << "Index benchmark: writing " << fileSize/(1024*1024*1024) << " GB of " << nboards << " boards' " << eventWords * sizeof(uint32_t) << " byte events to " << file;
+      uint32_t perBuffer = bufferSize / (eventWords * sizeof(uint32_t));
+      std::vector<uint32_t> buffer(perBuffer * eventWords, 0x1F401F40);
+      std::vector<uint64_t> nevents(nboards, 0);
+      for (uint64_t written = 0, sequence = 0; written < fileSize; written += buffer.size() * sizeof(uint32_t), sequence++){
+        uint32_t board = sequence % nboards;
+        for (uint32_t e = 0; e < perBuffer; e++){
+          uint32_t* w = &buffer[e * eventWords];
+          w[0] = 0xA0000000 | eventWords;
+          w[1] = 0xFF;
+          w[2] = (nevents[board] + e) & 0xFFFFFF;
+          w[3] = static_cast<uint32_t>(timestamps[board]);
+          timestamps[board] += ticksPerEvent;
+        }
+        writer->writeEvents(board, sequence / nboards, nevents[board], reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(uint32_t), 1, false);
+        nevents[board] += perBuffer;
+      }
+      writer->close();
+    }
+
+    int fd = open(file.c_str(), O_RDONLY);
+    std::vector<std::string> methods = {"sequential scan", "index, 1 thread"};
+    if (ncpus > 1)
+      methods.push_back("index, " + std::to_string(ncpus) + " threads");
+    std::vector<double> seconds(methods.size(), 0);
+    std::vector<uint64_t> found(methods.size(), 0);
+    uint32_t random = 1;
+    for (uint32_t q = 0; q < nqueries; q++){
+      uint32_t board = q % nboards;
+      random = random * 1103515245 + 12345;
+      uint64_t span = timestamps[board];
+      uint64_t from = static_cast<uint64_t>(span * (1 - window) * ((random >> 8) % 1000) / 1000.);
+      uint64_t to = from + static_cast<uint64_t>(span * window);
+      for (size_t m = 0; m < methods.size(); m++){
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        cadidaq::dataFileReader reader(file);
+        std::atomic<uint64_t> sum(0);
+        auto count = [&](uint32_t, const cadidaq::eventHeader& event, uint64_t){sum.fetch_add(event.data[event.size - 1], std::memory_order_relaxed);};
+        auto start = std::chrono::steady_clock::now();
+        uint64_t n = m == 0 ? reader.scanEvents(board, from, to, count) : reader.forEachEvent(board, from, to, count, m == 1 ? 1 : ncpus);
+        seconds[m] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        found[m] += n;
+      }
+    }
+    close(fd);
+    std::remove(file.c_str());
+    std::remove((file + ".crc32").c_str());
+    for (size_t m = 0; m < methods.size(); m++)
+      MAIN_LOG_INFO << "Events of one board in " << window * 100 << " % of the run, " << methods[m] << ": " << seconds[m] / nqueries * 1e3 << " ms per query"
+                    << (m ? " (" + std::to_string(static_cast<int>(seconds[0] / seconds[m])) + " times faster)" : "") << ", " << found[m] / nqueries << " events";
+    for (size_t m = 1; m < methods.size(); m++)
+      if (found[m] != found[0]){
+        MAIN_LOG_ERROR << "The " << methods[m] << " found " << found[m] << " events, the sequential scan " << found[0];
+        return EXIT_FAILURE;
+      }
+    if (ncpus == 1)
+      MAIN_LOG_WARN << "Only one CPU available: parallel queries cannot be measured on this host.";
+    return EXIT_SUCCESS;
+}
+
+/** streams synthetic readout buffers to a receiver in this process over TCP (loopback) and a Unix domain socket and
+    measures the throughput and latency for several batch sizes at full rate, and the latency of single events at a low
+    rate for several maximum delays */
+int stream_benchmark()
+{
+    const uint32_t nbuffers = 64;
+    const uint32_t bufferSize = 1024*1024;
+    const uint32_t eventWords = cadidaq::eventHeaderWords + 252;  // 1 kB events
+    const auto duration = std::chrono::seconds(2);
+    const auto lowRateInterval = std::chrono::milliseconds(1);
+    const uint32_t lowRateBuffers = 500;
+
+    cadidaq::bufferPool pool(bufferSize, nbuffers);
+    uint32_t perBuffer = bufferSize / (eventWords * sizeof(uint32_t));
+    {
+      // the buffers keep their data when released, the sink sends all events of a buffer as they are
+      std::vector<cadidaq::bufferPool::handle> handles;
+      for (uint32_t i = 0; i < nbuffers; i++){
+        handles.push_back(pool.acquire());
+        uint32_t* w = reinterpret_cast<uint32_t*>(pool.get(handles.back()).data);
+        for (uint32_t e = 0; e < perBuffer; e++, w += eventWords){
+          w[0] = 0xA0000000 | eventWords;
+          w[1] = 0xFF;
+          w[2] = e;
+          w[3] = e * 100;
+          for (uint32_t k = cadidaq::eventHeaderWords; k < eventWords; k++)
+            w[k] = 0x1F401F40;
+        }
+      }
+      for (auto h : handles)
+        pool.release(h);
+    }
+    std::vector<std::string> names(1, "board0");
+    std::vector<cadidaq::dppFormat> formats(1, cadidaq::dppFormat::NONE);
+    std::string socketPath = "/tmp/cadidaq-stream-benchmark-" + std::to_string(getpid());
+    MAIN_LOG_INFO << "Stream benchmark: " << bufferSize/1024 << " kB buffers of " << eventWords * sizeof(uint32_t) << " byte events to a receiver in this process.";
+
+    // streams buffers of 'nevents' events every 'interval' (none: as fast as possible) for 'duration' or 'count' buffers; returns what was received
+    auto run = [&](cadidaq::streamReceiver& receiver, uint32_t batchKB, std::chrono::milliseconds maxDelay, uint32_t nevents,
+                   std::chrono::microseconds interval, uint32_t count, double& seconds){
+      streamStatistics received;
+      std::thread receiving([&]{
+          if (!receiver.accept(std::chrono::seconds(5)))
+            return;
+          while (receiver.isConnected())
+            if (const cadidaq::dataFileLayout::recordHeader* r = receiver.next(std::chrono::seconds(5)))
+              received.add(receiver.getHeader(), *r);
+        });
+      cadidaq::metrics registry;
+      auto start = std::chrono::steady_clock::now();
+      {
+        cadidaq::streamSink sink(receiver.getAddress(), names, formats, std::string(), batchKB * 1024, maxDelay, nbuffers, 0, 0,
+                                 registry.addStage("stream"));
+        auto next = start;
+        for (uint64_t sequence = 0; count ? sequence < count : std::chrono::steady_clock::now() - start < duration; sequence++){
+          if (interval.count()){
+            next += interval;
+            std::this_thread::sleep_until(next);
+          }
+          cadidaq::bufferPool::handle h = pool.acquire(std::chrono::seconds(1));
+          if (h == cadidaq::bufferPool::none)
+            break;
+          sink.sendEvents({0, &pool, h, nevents * eventWords * static_cast<uint32_t>(sizeof(uint32_t)), cadidaq::latencyMetrics::now()}, sequence, sequence * nevents, 1, false);
+        }
+        sink.close();
+      }
+      receiving.join();
+      seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      return received;
+    };
+
+    for (std::string address : {std::string("127.0.0.1:0"), "unix:" + socketPath}){
+      std::unique_ptr<cadidaq::streamReceiver> receiver;
+      try {
+        receiver.reset(new cadidaq::streamReceiver(address));
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_ERROR << e.what();
+        continue;
+      }
+      std::string transport = address.compare(0, 5, "unix:") ? "TCP" : "Unix socket";
+      for (uint32_t batchKB : {64, 256, 1024, 4096}){
+        double seconds = 0;
+        streamStatistics received = run(*receiver, batchKB, std::chrono::milliseconds(10), perBuffer, std::chrono::microseconds(0), 0, seconds);
+        MAIN_LOG_INFO << transport << ", batches of " << batchKB << " kB at full rate: " << received.describe(seconds);
+      }
+      for (uint32_t maxDelay : {0, 1, 10}){
+        double seconds = 0;
+        streamStatistics received = run(*receiver, 256, std::chrono::milliseconds(maxDelay), 1, lowRateInterval, lowRateBuffers, seconds);
+        MAIN_LOG_INFO << transport << ", one event every " << std::chrono::duration_cast<std::chrono::microseconds>(lowRateInterval).count()
+                      << " us, sent after " << maxDelay << " ms at the latest: " << received.describe(seconds);
+      }
+    }
+    unlink(socketPath.c_str());
+    return EXIT_SUCCESS;
+}
+
 //
 // reading config file
 //
 
-void read_ini_file(const char *filename)
+namespace {
+  const std::string templatePrefix = "template:";
+
+  bool isTemplateSection(const std::string& sectionName){
+    return boost::istarts_with(sectionName, templatePrefix);
+  }
+
+  /** indexes the general section and the [template:NAME] sections of the config file, each only once however many
+      boards inherit from them. A template (or board) section selects the template it inherits from with the key
+      'Template = NAME', templates without this key (and boards without one) inherit from the general section. */
+  class templateResolver {
+  public:
+    templateResolver(pt::iptree& iniPTree) : iniPTree(iniPTree) {
+      boost::optional<pt::iptree&> nodeGeneral = iniPTree.get_child_optional("GENERAL");
+      if (nodeGeneral)
+        general = std::make_shared<const cadidaq::settingsSection>(*nodeGeneral);
+    }
+    /// returns the shared section a section with the given 'Template' key inherits from (nullptr if there is none)
+    std::shared_ptr<const cadidaq::settingsSection> resolve(boost::optional<std::string> templateName){
+      if (!templateName)
+        return general;
+      std::string name = boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(*templateName));
+      auto it = templates.find(name);
+      if (it != templates.end()){
+        if (!it->second)
+          throw std::runtime_error("Template '" + name + "' inherits from itself");
+        return it->second;
+      }
+      boost::optional<pt::iptree&> node = iniPTree.get_child_optional(pt::iptree::path_type(templatePrefix + name, '\0'));
+      if (!node)
+        throw std::runtime_error("Template '" + name + "' not found: no section [" + templatePrefix + name + "] in config file");
+      templates[name] = nullptr; // marks the template as being resolved to detect cycles
+      std::shared_ptr<const cadidaq::settingsSection> parent;
+      try {
+        parent = resolve(node->get_optional<std::string>("Template"));
+      }
+      catch (const std::runtime_error&){
+        // sections using the template later on get the same error, not a cycle
+        templates.erase(name);
+        throw;
+      }
+      templates[name] = std::make_shared<const cadidaq::settingsSection>(*node, parent);
+      return templates[name];
+    }
+    size_t size() const {
+      size_t n = 0;
+      for (auto& t : templates)
+        if (t.second) n++;
+      return n;
+    }
+  private:
+    pt::iptree& iniPTree;
+    std::shared_ptr<const cadidaq::settingsSection> general;
+    std::map<std::string, std::shared_ptr<const cadidaq::settingsSection>> templates;
+  };
+}
+
+/** checks that malformed channel ranges are rejected, then measures indexing and parsing synthetic configurations of
+    increasing numbers of board sections with per-channel overrides as configure_from_ini does (without connecting to
+    the boards) */
+int settings_benchmark()
 {
+    // lists and the number of values they expand to, 0 for malformed lists that must be rejected
+    const std::vector<std::pair<std::string, size_t>> ranges = {
+      {"0-3, 8", 5}, {"7", 1}, {" 2 - 2 ,4 ", 2}, {"2147483647", 1},
+      {"", 0}, {" ", 0}, {"1,", 0}, {",1", 0}, {"1,,2", 0}, {"3-1", 0}, {"1-", 0}, {"1 2", 0}, {"x", 0},
+      {"2147483648", 0}, {"99999999999", 0}, {"0-4294967296", 0}};
+    for (auto& r : ranges){
+      std::vector<int> values;
+      std::string error;
+      try {
+        expandRange(r.first, values);
+      }
+      catch (const std::invalid_argument& e){
+        error = e.what();
+      }
+      if (r.second ? !error.empty() || values.size() != r.second : error.empty()){
+        MAIN_LOG_ERROR << "Range '" << r.first << "' expanded to " << (error.empty() ? std::to_string(values.size()) + " value(s)" : "an error (" + error + ")")
+                       << ", expected " << (r.second ? std::to_string(r.second) + " value(s)" : "an error");
+        return EXIT_FAILURE;
+      }
+      MAIN_LOG_DEBUG << "Range '" << r.first << "': " << (error.empty() ? std::to_string(values.size()) + " value(s)" : error);
+    }
+    MAIN_LOG_INFO << "Settings benchmark: " << ranges.size() << " valid and malformed channel ranges handled as expected.";
+
+    // templates: the error of a template that cannot be resolved, each time it is used
+    {
+      std::istringstream stream("[template:a]\nTemplate = b\n[template:b]\nTemplate = a\n"
+                                "[template:c]\nTemplate = missing\n[template:d]\nTemplate = c\n");
+      pt::iptree iniPTree;
+      pt::ini_parser::read_ini(stream, iniPTree);
+      templateResolver templates(iniPTree);
+      // template, expected part of the error message
+      const std::vector<std::pair<std::string, std::string>> failures = {
+        {"a", "inherits from itself"}, {"a", "inherits from itself"},
+        {"c", "'missing' not found"}, {"c", "'missing' not found"}, {"d", "'missing' not found"}};
+      for (auto& f : failures){
+        std::string error;
+        try {
+          templates.resolve(f.first);
+        }
+        catch (const std::runtime_error& e){
+          error = e.what();
+        }
+        if (error.find(f.second) == std::string::npos){
+          MAIN_LOG_ERROR << "Resolving template '" << f.first << "' gave " << (error.empty() ? "no error" : "'" + error + "'")
+                         << ", expected an error with '" << f.second << "'";
+          return EXIT_FAILURE;
+        }
+      }
+      MAIN_LOG_INFO << "Templates: inheritance cycles and missing parents reported as expected, also on repeated use.";
+    }
 
-    /* Open the UTF8 .ini file */
-    std::ifstream iniStream(filename);
+    const uint32_t nchannels = 16;
+    for (size_t sections : {100, 1000, 4000}){
+      // a general section, a template per crate of 64 boards and boards overriding the DC offset and threshold of each channel
+      std::ostringstream ini;
+      ini << "[general]\nRecordLength = 1024\nPostTriggerSize = 50\nEnableChannel[*] = true\nChannelDCOffset[*] = 0x8000\nChannelTriggerTreshold[0-15] = 100\n";
+      for (size_t c = 0; c < (sections + 63) / 64; c++)
+        ini << "[template:crate" << c << "]\nPostTriggerSize = " << 40 + c % 20 << "\nReadoutThread = crate" << c << "\n";
+      for (size_t s = 0; s < sections; s++){
+        ini << "[board" << s << "]\nTemplate = crate" << s / 64 << "\nLinkNum = " << s / 8 << "\nConetNode = " << s % 8 << "\n";
+        for (uint32_t ch = 0; ch < nchannels; ch++)
+          ini << "ChannelDCOffset[" << ch << "] = " << 0x4000 + s + ch << "\nChannelTriggerTreshold[" << ch << "] = " << 100 + ch << "\n";
+        ini << "EnableChannel[" << s % nchannels << "-" << nchannels - 1 << "] = false\n";
+      }
+      std::string content = ini.str();
+
+      // the settings' debug output would dominate the time measured
+      boost::log::core::get()->set_logging_enabled(false);
+      auto start = std::chrono::steady_clock::now();
+      std::istringstream stream(content);
+      pt::iptree iniPTree;
+      pt::ini_parser::read_ini(stream, iniPTree);
+      auto read = std::chrono::steady_clock::now();
+      templateResolver templates(iniPTree);
+      size_t keys = 0, unknown = 0;
+      for (auto& section : iniPTree){
+        if (boost::iequals(section.first, "general") || isTemplateSection(section.first))
+          continue;
+        cadidaq::settingsIndex index;
+        index.add(templates.resolve(section.second.get_optional<std::string>("Template")));
+        index.add(section.second);
+        for (auto key : index.find("Template"))
+          index.markUsed(key);
+        cadidaq::connectionSettings lnk(section.first);
+        lnk.parse(index);
+        cadidaq::registerSettings reg(section.first, nchannels);
+        reg.parse(index);
+        keys += index.size();
+        unknown += index.unused().size();
+      }
+      auto end = std::chrono::steady_clock::now();
+      boost::log::core::get()->set_logging_enabled(true);
+      double readTime = std::chrono::duration<double>(read - start).count();
+      double parseTime = std::chrono::duration<double>(end - read).count();
+      MAIN_LOG_INFO << sections << " board sections, " << templates.size() << " templates (" << content.size() / 1024 << " kB, " << keys << " effective keys): read in "
+                    << readTime * 1e3 << " ms, indexed and parsed in " << parseTime * 1e3 << " ms ("
+                    << parseTime / sections * 1e6 << " us per board, " << keys / parseTime * 1e-6 << " M keys/s)";
+      if (unknown){
+        MAIN_LOG_ERROR << unknown << " key(s) of the synthetic configuration were not recognised by any setting";
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+
+/// parses and verifies the settings of the DAQ application itself
+void configure_daq(pt::iptree& iniPTree, cadidaq::daqSettings& daq)
+{
+    try {
+      cadidaq::settingsIndex index(iniPTree.get_child("CADIDAQ"));
+      daq.parse(index);
+      /* Loop over all keys that have not been used by any setting */
+      for (auto key : index.unused()){
+        MAIN_LOG_WARN << "Unknown setting in section CADIDAQ ignored: \t" << key->key << " = " << key->value;
+      }
+    }
+    catch (const pt::ptree_bad_path& e){
+      MAIN_LOG_DEBUG << "No 'CADIDAQ' section (with options for the DAQ application) could be found in config file.";
+    }
+    daq.verify();
+}
 
+/// parses the ini file content, then connects to and configures all digitizers found in it
+void configure_from_ini(const std::string& iniContent, cadidaq::daqSettings& daq, std::vector<cadidaq::digitizer*>& vecDigi)
+{
     /* Parse the .ini file via boost::property_tree::ini_parser */
+    std::istringstream iniStream(iniContent);
     pt::iptree iniPTree; // ptree w/ case-insensitive comparisons
     pt::ini_parser::read_ini(iniStream, iniPTree);
-
     // parse the config file to determine number of digitizers
     int NDigitizer = 0;
     for (auto& section : iniPTree){
@@ -54,62 +1943,280 @@ void read_ini_file(const char *filename)
         continue;
       if(boost::iequals(boost::algorithm::to_lower_copy(section.first), std::string("general")))
         continue;
+      if(isTemplateSection(section.first))
+        continue;
       NDigitizer++;
     }
     MAIN_LOG_INFO << "Configuration for " << NDigitizer << " digitizer(s) found in config file.";
+    configure_daq(iniPTree, daq);
+
+    // retrieve the "general" section of the config file to initialize defaults
+    if (iniPTree.get_child_optional("GENERAL"))
+      MAIN_LOG_INFO << "Found 'General' section in config file and applying its values as default.";
+    else
+      MAIN_LOG_DEBUG << "No 'General' section (with options valid for all digitizers) could be found in config file.";
+    templateResolver templates(iniPTree);
 
-    std::vector<cadidaq::digitizer*> vecDigi;
     // get the connection details for each digitizer section
     for (auto& section : iniPTree){
       // ignoring "daq" settings for main application
       if(boost::iequals(boost::algorithm::to_lower_copy(section.first), std::string("cadidaq")))
         continue;
-      // ignoring "general" section for common digitizer settings (for now)
+      // ignoring "general" section and templates for common digitizer settings (only used through inheritance)
       if(boost::iequals(boost::algorithm::to_lower_copy(section.first), std::string("general")))
         continue;
+      if(isTemplateSection(section.first))
+        continue;
       // retrieve this section's settings
       std::string digName = section.first;
-      pt::iptree &nodeDigi = iniPTree.get_child(digName);
+      pt::iptree &nodeDigi = section.second;
       MAIN_LOG_INFO << "Found '" << digName << "' section in config file.";
-      // join the section with any setting in the general section (overwriting the latter where appropriate)
-      pt::iptree *node = new pt::iptree(); // need new pttree as not to modify the one read from the ini file
+      // index the settings inherited from the general section and template(s) followed by the section's own (overwriting the former where appropriate)
+      cadidaq::settingsIndex index;
       try {
-        // retrieve the "general" section of the config file to initialize defaults
-        pt::iptree &nodeGeneral = iniPTree.get_child("GENERAL");
-        MAIN_LOG_INFO << "Found 'General' section in config file and applying its values as default.";
-        // update the fresh node with settings from the general section
-        BOOST_FOREACH( auto& leaf, nodeGeneral ){
-            node->put_child( leaf.first, leaf.second );
-        }
-        // update the node with settings from the digitizer section, possibly overwriting values
-        BOOST_FOREACH( auto& leaf, nodeDigi ){
-          node->put_child( leaf.first, leaf.second );
-        }
+        index.add(templates.resolve(nodeDigi.get_optional<std::string>("Template")));
       }
-      catch (const pt::ptree_bad_path& e){
-        MAIN_LOG_DEBUG << "No 'General' section (with options valid for all digitizers) could be found in config file.";
-        // just use what is in the digitizer section
-        node = &nodeDigi;
+      catch (const std::runtime_error& e){
+        MAIN_LOG_ERROR << e.what() << " -- ignoring section '" << digName << "'.";
+        continue;
       }
+      index.add(nodeDigi);
+      for (auto key : index.find("Template"))
+        index.markUsed(key);
 
       // parse, establish connection and configure digitizer
       cadidaq::digitizer* digi = new cadidaq::digitizer(digName);
-      digi->configure(node);
+      digi->configure(index);
       vecDigi.push_back(digi);
 
     }
+    if (templates.size())
+      MAIN_LOG_INFO << templates.size() << " template section(s) shared by the digitizers.";
+}
+
+/** configures the DAQ and all digitizers from the snapshot if it was compiled from the current content of the .ini file,
+    otherwise from the .ini file (and (re-)writes the snapshot) */
+void configure_digitizers(const char *filename, const std::string& snapshotFile, std::unique_ptr<cadidaq::daqSettings>& daq, std::vector<cadidaq::digitizer*>& vecDigi)
+{
+    /* Read the UTF8 .ini file; its content identifies the configuration a snapshot was compiled from */
+    std::ifstream iniFileStream(filename, std::ios::binary);
+    bool iniFound = iniFileStream.good();
+    std::string iniContent((std::istreambuf_iterator<char>(iniFileStream)), std::istreambuf_iterator<char>());
+
+    daq.reset(new cadidaq::daqSettings("cadidaq"));
+    if (snapshotFile.empty() || !load_snapshot(snapshotFile, iniFound ? &iniContent : nullptr, daq, vecDigi)){
+      configure_from_ini(iniContent, *daq, vecDigi);
+      if (!snapshotFile.empty())
+        save_snapshot(snapshotFile, iniContent, *daq, vecDigi);
+    }
+}
 
-    // TODO: init and run the actual "DAQ" part of the application here
+int read_ini_file(const char *filename, const std::string& snapshotFile)
+{
+    std::unique_ptr<cadidaq::daqSettings> daq;
+    std::vector<cadidaq::digitizer*> vecDigi;
+    configure_digitizers(filename, snapshotFile, daq, vecDigi);
+
+    // the readout threads and their buffers, placed once and reused for every run
+    std::vector<std::unique_ptr<readoutThread>> threads;
+    try {
+      threads = assign_readout_threads(*daq, vecDigi);
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_FATAL << e.what();
+      exit(EXIT_FAILURE);
+    }
+
+    bool allocationFree = run_acquisition(*daq, vecDigi, threads);
 
     // write the config back to another file
     std::string outIniFileName = "output.ini";
     MAIN_LOG_INFO << "Reading back configuration from digitizer and writing to output file: " << outIniFileName;
     pt::iptree ptwrite; // create a new tree
     BOOST_FOREACH(cadidaq::digitizer *digi, vecDigi){
-      pt::iptree *node = digi->retrieveConfig();
-      ptwrite.put_child(digi->getName(), *node);
+      digi->retrieveConfig(ptwrite.put_child(digi->getName(), pt::iptree()));
     }
     pt::ini_parser::write_ini(outIniFileName, ptwrite);
+
+    for (auto digi : vecDigi)
+      delete digi;
+    return allocationFree ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/// parses the values of a scan: 'first:last:step' or a comma-separated list (decimal or hexadecimal)
+std::vector<uint32_t> parse_scan_values(const std::string& spec)
+{
+    std::vector<uint32_t> values;
+    auto number = [&spec](const std::string& s){
+      std::string t = boost::algorithm::trim_copy(s);
+      char* end = nullptr;
+      unsigned long v = strtoul(t.c_str(), &end, 0);
+      if (t.empty() || *end != '\0' || v > UINT32_MAX)
+        throw std::runtime_error("Invalid value '" + t + "' in scan '" + spec + "'");
+      return static_cast<uint32_t>(v);
+    };
+    std::vector<std::string> parts;
+    if (spec.find(':') != std::string::npos){
+      boost::split(parts, spec, boost::is_any_of(":"));
+      if (parts.size() != 3)
+        throw std::runtime_error("Scan '" + spec + "' is neither 'first:last:step' nor a list");
+      uint32_t first = number(parts[0]), last = number(parts[1]), step = number(parts[2]);
+      if (step == 0 || last < first)
+        throw std::runtime_error("Scan '" + spec + "' needs a positive step from first to last");
+      for (uint64_t v = first; v <= last; v += step)
+        values.push_back(v);
+    } else {
+      boost::split(parts, spec, boost::is_any_of(","));
+      for (auto& p : parts)
+        values.push_back(number(p));
+    }
+    return values;
+}
+
+/** steps the trigger thresholds and DC offsets of all channels through the given values with short acquisitions on all
+    digitizers configured by the .ini file (or snapshot) and writes the rates and baselines measured to 'output' */
+int scan_channels(const char *filename, const std::string& snapshotFile, const std::string& output,
+                  const std::string& thresholdSpec, const std::string& dcOffsetSpec, uint32_t pointTime)
+{
+    std::vector<uint32_t> thresholds, dcOffsets;
+    try {
+      if (!thresholdSpec.empty())
+        thresholds = parse_scan_values(thresholdSpec);
+      if (!dcOffsetSpec.empty())
+        dcOffsets = parse_scan_values(dcOffsetSpec);
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_FATAL << e.what();
+      return EXIT_FAILURE;
+    }
+    std::ofstream table(output);
+    if (!table){
+      MAIN_LOG_FATAL << "Could not open the scan output file '" << output << "'";
+      return EXIT_FAILURE;
+    }
+    std::unique_ptr<cadidaq::daqSettings> daq;
+    std::vector<cadidaq::digitizer*> vecDigi;
+    configure_digitizers(filename, snapshotFile, daq, vecDigi);
+    bool scanned;
+    {
+      cadidaq::channelScan scanner(vecDigi);
+      scanned = scanner.scan(thresholds, dcOffsets, std::chrono::milliseconds(pointTime), table);
+    }
+    if (scanned)
+      MAIN_LOG_INFO << "Wrote the scan results to '" << output << "'";
+    for (auto digi : vecDigi)
+      delete digi;
+    return scanned && table ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** calibrates the DC offsets of all digitizers configured by the .ini file (or snapshot) for baselines at 'target' and
+    writes the offsets found to 'output' as .ini sections */
+int calibrate_baselines(const char *filename, const std::string& snapshotFile, const std::string& output,
+                        double target, double tolerance, uint32_t iterationTime)
+{
+    std::ofstream ini(output);
+    if (!ini){
+      MAIN_LOG_FATAL << "Could not open the calibration output file '" << output << "'";
+      return EXIT_FAILURE;
+    }
+    std::unique_ptr<cadidaq::daqSettings> daq;
+    std::vector<cadidaq::digitizer*> vecDigi;
+    configure_digitizers(filename, snapshotFile, daq, vecDigi);
+    {
+      cadidaq::channelScan scanner(vecDigi);
+      scanner.calibrateBaselines(target, tolerance, std::chrono::milliseconds(iterationTime), ini);
+    }
+    MAIN_LOG_INFO << "Wrote the calibrated DC offsets to '" << output << "'";
+    for (auto digi : vecDigi)
+      delete digi;
+    return ini ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** takes the overflow policy, prescale and event filter of each replayed board from the digitizer section of the .ini
+    file named like it (with the general and template sections it inherits from); boards without a section are
+    replayed unfiltered, blocking the replay under back-pressure rather than discarding data */
+void configure_replay(pt::iptree& iniPTree, const std::vector<std::string>& names, const std::vector<cadidaq::dppFormat>& dppFormats,
+                      replayedBoards& replayed)
+{
+    // (the model is not recorded: room for the channels of any board)
+    const uint32_t maxChannels = 64;
+    templateResolver templates(iniPTree);
+    for (size_t b = 0; b < names.size(); b++){
+      replayed.policies.push_back(cadidaq::overflowPolicy::BLOCK);
+      replayed.prescales.push_back(1);
+      replayed.filters.emplace_back();
+      boost::optional<pt::iptree&> nodeDigi = iniPTree.get_child_optional(pt::iptree::path_type(names[b], '\0'));
+      if (!nodeDigi || boost::iequals(names[b], "cadidaq") || boost::iequals(names[b], "general") || isTemplateSection(names[b])){
+        MAIN_LOG_DEBUG << "No section for the replayed board '" << names[b] << "', replaying it unfiltered and without discarding data.";
+        continue;
+      }
+      // (only the settings of the data's handling apply, those of the link and the board itself are not used)
+      cadidaq::settingsIndex index;
+      try {
+        index.add(templates.resolve(nodeDigi->get_optional<std::string>("Template")));
+      }
+      catch (const std::runtime_error& e){
+        MAIN_LOG_ERROR << e.what() << " -- ignoring section '" << names[b] << "'.";
+        continue;
+      }
+      index.add(*nodeDigi);
+      cadidaq::registerSettings settings(names[b], maxChannels);
+      settings.parse(index);
+      settings.verify();
+      replayed.policies[b] = cadidaq::toOverflowPolicy(*settings.overflowPolicy.first);
+      replayed.prescales[b] = *settings.overflowPrescale.first;
+      if (settings.eventFilter.first && !settings.eventFilter.first->empty()){
+        if (dppFormats[b] == cadidaq::dppFormat::NONE)
+          MAIN_LOG_WARN << "'" << settings.eventFilter.second << "' of '" << names[b] << "' only applies to the decoded events of DPP-PSD and DPP-PHA firmware, all events are kept.";
+        else {
+          try {
+            replayed.filters[b].reset(new cadidaq::eventFilter(*settings.eventFilter.first));
+          }
+          catch (const std::runtime_error& e){
+            MAIN_LOG_ERROR << e.what() << " -- all events of '" << names[b] << "' are kept.";
+          }
+        }
+      }
+      MAIN_LOG_INFO << "Replaying '" << names[b] << "' with overflow policy " << cadidaq::toString(replayed.policies[b])
+                    << (replayed.policies[b] == cadidaq::overflowPolicy::PRESCALE ? " (one in " + std::to_string(replayed.prescales[b]) + ")" : "")
+                    << (replayed.filters[b] ? ", keeping the events selected by " + replayed.filters[b]->describe() : "");
+    }
+}
+
+/** replays the raw events of the given data files through the processing configured by the 'CADIDAQ' section of the
+    .ini file, handling the data of each board as configured by its digitizer section (no digitizer is connected to) */
+int replay_files(const char *filename, const std::vector<std::string>& dataFiles, double speed)
+{
+    std::unique_ptr<cadidaq::daqSettings> daq(new cadidaq::daqSettings("cadidaq"));
+    pt::iptree iniPTree;
+    try {
+      pt::ini_parser::read_ini(filename, iniPTree);
+    }
+    catch (const pt::ini_parser_error& e){
+      MAIN_LOG_WARN << "Could not read '" << filename << "' (" << e.message() << "), replaying with the default settings.";
+    }
+    configure_daq(iniPTree, *daq);
+
+    std::unique_ptr<cadidaq::replaySource> replay;
+    std::vector<std::unique_ptr<readoutThread>> threads;
+    replayedBoards replayed;
+    try {
+      replay.reset(new cadidaq::replaySource(dataFiles, speed));
+      configure_replay(iniPTree, replay->getBoardNames(), replay->getDPPFormats(), replayed);
+      // a single thread takes the place of the readout threads, with as many buffers as they would have
+      threads.emplace_back(new readoutThread);
+      threads.back()->name = "replay";
+      if (daq->readoutCPUs.first)
+        threads.back()->cpus = cadidaq::affinity::parse(*daq->readoutCPUs.first);
+      allocate_readout_buffers(*threads.back(), replay->getMaxRecordBytes(), *daq->readoutBuffers.first * replay->getBoardNames().size(),
+                               replay->getBoardNames());
+    }
+    catch (const std::runtime_error& e){
+      MAIN_LOG_FATAL << e.what();
+      return EXIT_FAILURE;
+    }
+    std::vector<cadidaq::digitizer*> vecDigi;
+    return run_acquisition(*daq, vecDigi, threads, replay.get(), &replayed) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 
@@ -120,7 +2227,62 @@ int main(int argc, char **argv)
         ("help,h", "Print help message")
         ("file,f", 
             po::value<std::string>()->default_value("test.ini"),
-            "The test .ini file");
+            "The test .ini file")
+        ("snapshot,s",
+            po::value<std::string>(),
+            "Configuration snapshot: used instead of the .ini file if compiled from its current content, (re-)written otherwise")
+        ("dump-snapshot",
+            po::value<std::string>(),
+            "Print the configuration stored in the given snapshot in .ini format and exit")
+        ("numa-benchmark",
+            "Measure the simulated readout path for readout buffers on each NUMA node processed from each node and exit")
+        ("processing-benchmark",
+            "Measure the throughput of the processing threads for increasing numbers of threads and exit")
+        ("dpp-benchmark",
+            "Compare decoding and analysing DPP list-mode events in array-of-structures and structure-of-arrays layout, check counting events in truncated aggregates and exit")
+        ("settings-benchmark",
+            "Check the parsing of channel ranges and templates, measure indexing and parsing configurations of thousands of board sections and exit")
+        ("enum-benchmark",
+            "Compare looking up CAEN enum constants by name in the generated perfect-hash tables with the boost::bimaps they replaced and exit")
+        ("channelset-benchmark",
+            "Check the per-channel setting containers against the element-wise helpers they replaced on boards of 8 to 64 channels, compare their speed and exit")
+        ("filter-benchmark",
+            "Compare evaluating event filter expressions over event batches column by column with interpreting them event by event, check the parsing of value ranges and exit")
+        ("index-benchmark",
+            po::value<std::string>(),
+            "Write a data file of 4 GB to the given directory, compare indexed and sequential time range queries on it and exit")
+        ("stream-benchmark",
+            "Measure the throughput and latency of streaming the data to a receiver over TCP and a Unix socket and exit")
+        ("stream-receive",
+            po::value<std::string>(),
+            "Receive the data streams sent to the given address (host:port or unix:/path) and report their throughput and latency until interrupted")
+        ("replay",
+            po::value<std::vector<std::string>>()->multitoken(),
+            "Replay the raw events of the given data files through the processing configured by the .ini file instead of reading out the digitizers")
+        ("replay-speed",
+            po::value<double>()->default_value(0),
+            "Pace of the replay relative to the recording (1: as recorded), 0 for as fast as possible")
+        ("scan",
+            po::value<std::string>(),
+            "Step the channels' trigger thresholds and DC offsets through --scan-thresholds and --scan-dc-offsets with short acquisitions on all digitizers, write the rates and baselines measured to the given file and exit")
+        ("scan-thresholds",
+            po::value<std::string>(),
+            "Trigger thresholds of the scan: 'first:last:step' or a comma-separated list (default: as configured)")
+        ("scan-dc-offsets",
+            po::value<std::string>(),
+            "DC offsets of the scan: 'first:last:step' or a comma-separated list (default: as configured)")
+        ("scan-time",
+            po::value<uint32_t>()->default_value(200),
+            "Acquisition time per scan point or baseline calibration iteration in milliseconds")
+        ("calibrate-baselines",
+            po::value<std::string>(),
+            "Calibrate the DC offsets of all channels of all digitizers so that their baselines come within --baseline-tolerance of --baseline-target, write the offsets found to the given file (.ini sections) and exit")
+        ("baseline-target",
+            po::value<double>()->default_value(0.1),
+            "Target baseline of the calibration in ADC counts, or as a fraction of the ADC range if at most 1")
+        ("baseline-tolerance",
+            po::value<double>()->default_value(2),
+            "Largest deviation of a calibrated baseline from the target in ADC counts");
 
     po::variables_map vm;
     try
@@ -146,10 +2308,54 @@ int main(int argc, char **argv)
 
     init_console_logging();
 
+    if (vm.count("dump-snapshot"))
+        return dump_snapshot(vm["dump-snapshot"].as<std::string>());
+    if (vm.count("numa-benchmark"))
+        return numa_benchmark();
+    if (vm.count("processing-benchmark"))
+        return processing_benchmark();
+    if (vm.count("dpp-benchmark"))
+        return dpp_benchmark();
+    if (vm.count("settings-benchmark"))
+        return settings_benchmark();
+    if (vm.count("enum-benchmark"))
+        return enum_benchmark();
+    if (vm.count("channelset-benchmark"))
+        return channelset_benchmark();
+    if (vm.count("filter-benchmark"))
+        return filter_benchmark();
+    if (vm.count("index-benchmark"))
+        return index_benchmark(vm["index-benchmark"].as<std::string>());
+    if (vm.count("stream-benchmark"))
+        return stream_benchmark();
+    if (vm.count("stream-receive"))
+        return receive_stream(vm["stream-receive"].as<std::string>());
+
     std::string iniFile = vm["file"].as<std::string>().c_str();
+    if (vm.count("replay")){
+        int status = replay_files(iniFile.c_str(), vm["replay"].as<std::vector<std::string>>(), vm["replay-speed"].as<double>());
+        MAIN_LOG_INFO << "Program loop terminated. Have a nice day :)";
+        return status;
+    }
+    std::string snapshotFile = vm.count("snapshot") ? vm["snapshot"].as<std::string>() : std::string();
+    if (vm.count("scan")){
+        int status = scan_channels(iniFile.c_str(), snapshotFile, vm["scan"].as<std::string>(),
+                                   vm.count("scan-thresholds") ? vm["scan-thresholds"].as<std::string>() : std::string(),
+                                   vm.count("scan-dc-offsets") ? vm["scan-dc-offsets"].as<std::string>() : std::string(),
+                                   vm["scan-time"].as<uint32_t>());
+        MAIN_LOG_INFO << "Program loop terminated. Have a nice day :)";
+        return status;
+    }
+    if (vm.count("calibrate-baselines")){
+        int status = calibrate_baselines(iniFile.c_str(), snapshotFile, vm["calibrate-baselines"].as<std::string>(),
+                                         vm["baseline-target"].as<double>(), vm["baseline-tolerance"].as<double>(),
+                                         vm["scan-time"].as<uint32_t>());
+        MAIN_LOG_INFO << "Program loop terminated. Have a nice day :)";
+        return status;
+    }
     std::cout << "Read ini file: " << iniFile << std::endl;
-    read_ini_file(iniFile.c_str());
+    int status = read_ini_file(iniFile.c_str(), snapshotFile);
     MAIN_LOG_INFO << "Program loop terminated. Have a nice day :)";
-    return 0;
+    return status;
 }
 
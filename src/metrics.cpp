@@ -0,0 +1,407 @@
+#include <metrics.hpp>
+#include <traceRecorder.hpp>
+
+#include <sstream>
+#include <fstream>
+#include <cstdio>    // rename
+#include <cstring>   // strerror
+#include <cerrno>
+#include <cstdlib>   // strtoul
+#include <algorithm> // find, min, max
+
+// sockets
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define MET_LOG_DEBUG BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::debug)
+#define MET_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define MET_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+#define MET_LOG_ERROR BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::error)
+
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+//
+// counters
+//
+
+void cadidaq::boardMetrics::recordRead(uint32_t nbytes, uint32_t bufferSize, steady_clock::time_point start, steady_clock::time_point end){
+  // the time since a read that filled the buffer is counted as (potential) dead time, as the board might have run full in the meantime
+  if (lastReadSaturated)
+    deadNanoseconds.add(duration_cast<nanoseconds>(start - lastRead).count());
+  lastRead = end;
+  uint64_t ns = duration_cast<nanoseconds>(end - start).count();
+  readCalls.add();
+  readNanoseconds.add(ns);
+  maxReadNanoseconds.max(ns);
+  if (nbytes == 0){
+    emptyReads.add();
+    lastReadSaturated = false;
+    return;
+  }
+  bytes.add(nbytes);
+  uint64_t occupancy = bufferSize ? static_cast<uint64_t>(nbytes) * 1000 / bufferSize : 0;
+  bufferOccupancy.set(occupancy);
+  lastReadSaturated = occupancy >= 900;
+  if (lastReadSaturated)
+    saturatedReads.add();
+}
+
+void cadidaq::latencyDistribution::add(const latencyMetrics& m){
+  for (uint32_t b = 0; b < latencyMetrics::buckets; b++)
+    counts[b] += m.counts[b].get();
+  total += m.total.get();
+  sum += m.sum.get();
+}
+
+uint64_t cadidaq::latencyDistribution::quantile(double q) const {
+  // (the counts are taken one after the other while being updated, so their sum can differ from the total)
+  uint64_t n = 0;
+  for (uint32_t b = 0; b < latencyMetrics::buckets; b++)
+    n += counts[b];
+  uint64_t below = 0;
+  for (uint32_t b = 0; b < latencyMetrics::buckets; b++){
+    below += counts[b];
+    if (below && below >= q * n)
+      return latencyMetrics::bound(b);
+  }
+  return 0;
+}
+
+//
+// registry
+//
+
+cadidaq::boardMetrics& cadidaq::metrics::addBoard(std::string name){
+  boards.emplace_back(name);
+  boardRates.emplace_back();
+  return boards.back();
+}
+
+cadidaq::stageMetrics& cadidaq::metrics::addStage(std::string name){
+  stages.emplace_back(name);
+  return stages.back();
+}
+
+cadidaq::latencyMetrics& cadidaq::metrics::addLatency(std::string stage){
+  latencies.emplace_back(stage);
+  return latencies.back();
+}
+
+std::vector<std::string> cadidaq::metrics::getLatencyStages() const {
+  std::vector<std::string> names;
+  for (auto& l : latencies)
+    if (std::find(names.begin(), names.end(), l.stage) == names.end())
+      names.push_back(l.stage);
+  return names;
+}
+
+cadidaq::latencyDistribution cadidaq::metrics::getLatency(const std::string& stage) const {
+  latencyDistribution d;
+  for (auto& l : latencies)
+    if (l.stage == stage)
+      d.add(l);
+  return d;
+}
+
+void cadidaq::metrics::sample(){
+  auto now = steady_clock::now();
+  double seconds = std::chrono::duration<double>(now - lastSample).count();
+  bool first = lastSample == steady_clock::time_point();
+  lastSample = now;
+  for (size_t i = 0; i < boards.size(); i++){
+    rates& r = boardRates[i];
+    uint64_t events = boards[i].events.get();
+    uint64_t bytes = boards[i].bytes.get();
+    uint64_t empty = boards[i].emptyReads.get();
+    uint64_t dead = boards[i].deadNanoseconds.get();
+    if (!first && seconds > 0){
+      r.events       = (events - r.lastEvents) / seconds;
+      r.bytes        = (bytes - r.lastBytes) / seconds;
+      r.emptyReads   = (empty - r.lastEmpty) / seconds;
+      r.deadFraction = (dead - r.lastDead) * 1e-9 / seconds;
+    }
+    r.lastEvents = events;
+    r.lastBytes  = bytes;
+    r.lastEmpty  = empty;
+    r.lastDead   = dead;
+  }
+}
+
+namespace {
+  void describe(std::ostringstream& out, const char* name, const char* type, const char* help){
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n";
+  }
+}
+
+std::string cadidaq::metrics::prometheus(){
+  std::ostringstream out;
+  // board counters with their unit conversion to the Prometheus base units
+  struct boardCounter {
+    const char* name;
+    const char* type;
+    const char* help;
+    counter boardMetrics::* value;
+    double scale;
+  };
+  static const boardCounter boardCounters[] = {
+    {"cadidaq_board_events_total",               "counter", "Events read from the board.",                       &boardMetrics::events,             1},
+    {"cadidaq_board_bytes_total",                "counter", "Bytes read from the board.",                        &boardMetrics::bytes,              1},
+    {"cadidaq_board_read_calls_total",           "counter", "Read calls to the board.",                          &boardMetrics::readCalls,          1},
+    {"cadidaq_board_empty_reads_total",          "counter", "Read calls returning no data.",                     &boardMetrics::emptyReads,         1},
+    {"cadidaq_board_skipped_reads_total",        "counter", "Reads saved because the board reported no stored events.", &boardMetrics::skippedReads, 1},
+    {"cadidaq_board_read_seconds_total",         "counter", "Time spent in read calls.",                         &boardMetrics::readNanoseconds,    1e-9},
+    {"cadidaq_board_read_max_seconds",           "gauge",   "Longest read call.",                                &boardMetrics::maxReadNanoseconds, 1e-9},
+    {"cadidaq_board_saturated_reads_total",      "counter", "Read calls filling the readout buffer.",            &boardMetrics::saturatedReads,     1},
+    {"cadidaq_board_dead_seconds_total",         "counter", "Estimated dead time following saturated reads.",    &boardMetrics::deadNanoseconds,    1e-9},
+    {"cadidaq_board_buffer_occupancy_ratio",     "gauge",   "Readout buffer occupancy of the last non-empty read.", &boardMetrics::bufferOccupancy, 1e-3},
+    {"cadidaq_board_latency_seconds_total",      "counter", "Time since the previous read summed over reads returning data.", &boardMetrics::latencyNanoseconds, 1e-9},
+    {"cadidaq_board_latency_max_seconds",        "gauge",   "Longest time since the previous read for a read returning data.", &boardMetrics::maxLatencyNanoseconds, 1e-9},
+    {"cadidaq_board_errors_total",               "counter", "Errors when communicating with the board.",         &boardMetrics::errors,             1},
+    {"cadidaq_board_pileups_total",              "counter", "Decoded DPP events flagged as pile-up.",            &boardMetrics::pileups,            1},
+    {"cadidaq_board_filtered_events_total",      "counter", "Decoded DPP events not selected by the event filter.", &boardMetrics::filteredEvents, 1},
+    {"cadidaq_board_overflow_buffers_total",     "counter", "Buffers dispatched above the high watermark.",      &boardMetrics::overflowBuffers,    1},
+    {"cadidaq_board_dropped_events_total",       "counter", "Events discarded in whole buffers (DropOldest).",   &boardMetrics::droppedEvents,      1},
+    {"cadidaq_board_dropped_bytes_total",        "counter", "Bytes discarded in whole buffers (DropOldest).",    &boardMetrics::droppedBytes,       1},
+    {"cadidaq_board_prescaled_events_total",     "counter", "Events discarded by the overflow prescaler.",       &boardMetrics::prescaledEvents,    1},
+    {"cadidaq_board_stripped_bytes_total",       "counter", "Waveform bytes discarded keeping features only.",   &boardMetrics::strippedBytes,      1},
+    {"cadidaq_board_blocked_seconds_total",      "counter", "Time the readout waited for a free buffer.",        &boardMetrics::blockedNanoseconds, 1e-9},
+    {"cadidaq_board_health_reads_total",         "counter", "Health registers read.",                            &boardMetrics::healthReads,        1},
+    {"cadidaq_board_health_forced_reads_total",  "counter", "Health registers read while the board was due to be read out.", &boardMetrics::healthForcedReads, 1},
+    {"cadidaq_board_health_read_seconds_total",  "counter", "Time spent reading health registers.",              &boardMetrics::healthNanoseconds,  1e-9},
+    {"cadidaq_board_health_alarms_total",        "counter", "Alarms raised on the board's health.",              &boardMetrics::healthAlarms,       1},
+    {"cadidaq_board_temperature_celsius",        "gauge",   "Highest ADC temperature.",                          &boardMetrics::temperature,        1},
+    {"cadidaq_board_memory_full",                "gauge",   "Whether the event memory is full (triggers lost).", &boardMetrics::memoryFull,         1},
+    {"cadidaq_board_pll_locked",                 "gauge",   "Whether the PLL is locked on its clock reference.", &boardMetrics::pllLocked,          1},
+  };
+  for (const auto& c : boardCounters){
+    describe(out, c.name, c.type, c.help);
+    for (auto& b : boards){
+      out << c.name << "{board=\"" << b.name << "\"} ";
+      if (c.scale == 1)
+        out << (b.*c.value).get() << "\n";
+      else
+        out << (b.*c.value).get() * c.scale << "\n";
+    }
+  }
+  // rates derived from the last two samples
+  describe(out, "cadidaq_board_event_rate", "gauge", "Events per second read from the board.");
+  for (size_t i = 0; i < boards.size(); i++)
+    out << "cadidaq_board_event_rate{board=\"" << boards[i].name << "\"} " << boardRates[i].events << "\n";
+  describe(out, "cadidaq_board_data_rate_bytes", "gauge", "Bytes per second read from the board.");
+  for (size_t i = 0; i < boards.size(); i++)
+    out << "cadidaq_board_data_rate_bytes{board=\"" << boards[i].name << "\"} " << boardRates[i].bytes << "\n";
+  describe(out, "cadidaq_board_empty_read_rate", "gauge", "Empty read calls per second.");
+  for (size_t i = 0; i < boards.size(); i++)
+    out << "cadidaq_board_empty_read_rate{board=\"" << boards[i].name << "\"} " << boardRates[i].emptyReads << "\n";
+  describe(out, "cadidaq_board_dead_time_ratio", "gauge", "Estimated fraction of time the board was dead.");
+  for (size_t i = 0; i < boards.size(); i++)
+    out << "cadidaq_board_dead_time_ratio{board=\"" << boards[i].name << "\"} " << boardRates[i].deadFraction << "\n";
+  // pipeline stages
+  describe(out, "cadidaq_stage_items_total", "counter", "Items processed by the pipeline stage.");
+  for (auto& s : stages)
+    out << "cadidaq_stage_items_total{stage=\"" << s.name << "\"} " << s.items.get() << "\n";
+  describe(out, "cadidaq_stage_busy_seconds_total", "counter", "Time the pipeline stage spent processing.");
+  for (auto& s : stages)
+    out << "cadidaq_stage_busy_seconds_total{stage=\"" << s.name << "\"} " << s.busyNanoseconds.get() * 1e-9 << "\n";
+  describe(out, "cadidaq_stage_cpu_seconds_total", "counter", "CPU time used by the pipeline stage.");
+  for (auto& s : stages)
+    out << "cadidaq_stage_cpu_seconds_total{stage=\"" << s.name << "\"} " << s.cpuNanoseconds.get() * 1e-9 << "\n";
+  describe(out, "cadidaq_stage_stolen_total", "counter", "Items the pipeline stage took over from other threads.");
+  for (auto& s : stages)
+    out << "cadidaq_stage_stolen_total{stage=\"" << s.name << "\"} " << s.stolen.get() << "\n";
+  describe(out, "cadidaq_stage_errors_total", "counter", "Errors in the pipeline stage.");
+  for (auto& s : stages)
+    out << "cadidaq_stage_errors_total{stage=\"" << s.name << "\"} " << s.errors.get() << "\n";
+  // latencies along the pipeline (cumulative buckets)
+  describe(out, "cadidaq_stage_latency_seconds", "histogram", "Latency of the buffers in (or up to) the pipeline stage.");
+  for (auto& stage : getLatencyStages()){
+    latencyDistribution d = getLatency(stage);
+    uint64_t below = 0;
+    for (uint32_t b = 0; b + 1 < latencyMetrics::buckets; b++){
+      below += d.counts[b];
+      out << "cadidaq_stage_latency_seconds_bucket{stage=\"" << stage << "\",le=\"" << latencyMetrics::bound(b) * 1e-9 << "\"} " << below << "\n";
+    }
+    below += d.counts[latencyMetrics::buckets - 1];
+    out << "cadidaq_stage_latency_seconds_bucket{stage=\"" << stage << "\",le=\"+Inf\"} " << below << "\n"
+        << "cadidaq_stage_latency_seconds_sum{stage=\"" << stage << "\"} " << d.sum * 1e-9 << "\n"
+        << "cadidaq_stage_latency_seconds_count{stage=\"" << stage << "\"} " << below << "\n";
+  }
+  describe(out, "cadidaq_metrics_overhead_seconds", "gauge", "Measured cost of the bookkeeping per read call.");
+  out << "cadidaq_metrics_overhead_seconds " << overhead * 1e-9 << "\n";
+  return out.str();
+}
+
+double cadidaq::metrics::measureOverhead(){
+  // mimics the bookkeeping done around each read call: two clock readings and the counter updates
+  boardMetrics m("calibration");
+  const int n = 1000000;
+  auto start = steady_clock::now();
+  for (int i = 0; i < n; i++){
+    auto t0 = steady_clock::now();
+    auto t1 = steady_clock::now();
+    m.recordRead(i & 0xFFF, 0x1000, t0, t1);
+  }
+  return std::chrono::duration<double, std::nano>(steady_clock::now() - start).count() / n;
+}
+
+//
+// exporter
+//
+
+cadidaq::metricsExporter::metricsExporter(metrics& registry, uint16_t port, std::string file, uint32_t interval, traceRecorder* trace)
+  : registry(registry), port(port), file(file), interval(interval ? interval : 1), listenSocket(-1), trace(trace), traceConnection(-1), stop(false) {
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("metrics"));
+  double overhead = metrics::measureOverhead();
+  registry.setOverhead(overhead);
+  MET_LOG_INFO << "Metrics bookkeeping adds " << overhead << " ns per read call.";
+  if (port){
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    // only serve local clients
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listenSocket < 0 || bind(listenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenSocket, 4) != 0){
+      MET_LOG_ERROR << "Could not serve metrics on localhost port " << port << ": " << strerror(errno);
+      if (listenSocket >= 0)
+        close(listenSocket);
+      listenSocket = -1;
+    } else {
+      MET_LOG_INFO << "Serving metrics at http://localhost:" << port << "/metrics"
+                   << (trace ? " and traces of the pipeline at http://localhost:" + std::to_string(port) + "/trace?seconds=N" : "");
+    }
+  }
+  if (!file.empty())
+    MET_LOG_INFO << "Writing metrics every " << this->interval << " s to file " << file;
+  registry.sample();
+  thread = std::thread(&metricsExporter::run, this);
+}
+
+cadidaq::metricsExporter::~metricsExporter(){
+  stop = true;
+  if (thread.joinable())
+    thread.join();
+  // (what has been recorded of a trace when the run ends)
+  if (traceConnection >= 0)
+    finishTrace();
+  if (listenSocket >= 0)
+    close(listenSocket);
+  // final state of the counters at the end of the run
+  if (!file.empty())
+    writeFile();
+}
+
+void cadidaq::metricsExporter::run(){
+  auto nextSample = steady_clock::now() + std::chrono::seconds(interval);
+  while (!stop){
+    // wake up regularly to check for the stop request
+    int timeout = 100;
+    if (listenSocket >= 0){
+      pollfd p = {listenSocket, POLLIN, 0};
+      if (poll(&p, 1, timeout) > 0 && (p.revents & POLLIN)){
+        int connection = accept(listenSocket, nullptr, nullptr);
+        if (connection >= 0)
+          serve(connection);
+      }
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+    }
+    if (traceConnection >= 0 && steady_clock::now() >= traceEnd)
+      finishTrace();
+    if (steady_clock::now() >= nextSample){
+      nextSample += std::chrono::seconds(interval);
+      registry.sample();
+      if (!file.empty())
+        writeFile();
+    }
+  }
+}
+
+void cadidaq::metricsExporter::serve(int connection){
+  // do not let a stalled client hold up the exporter
+  timeval timeout = {1, 0};
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  char request[1024];
+  ssize_t n = recv(connection, request, sizeof(request) - 1, 0);
+  std::string response;
+  if (n > 0){
+    request[n] = '\0';
+    std::string line(request, strcspn(request, "\r\n"));
+    if (line.compare(0, 4, "GET ") != 0){
+      response = "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n";
+    } else if (trace && (line.compare(4, 7, "/trace ") == 0 || line.compare(4, 7, "/trace?") == 0)){
+      if (traceConnection >= 0 || !trace->start())
+        response = "HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\n\r\nA trace is being recorded already.\n";
+      else {
+        // answered once recorded (see run)
+        size_t query = line.find("seconds=");
+        unsigned long seconds = query != std::string::npos && query < line.find(' ', 4) ? strtoul(line.c_str() + query + 8, nullptr, 10) : 1;
+        seconds = std::min<unsigned long>(std::max<unsigned long>(seconds, 1), 60);
+        traceConnection = connection;
+        traceEnd = steady_clock::now() + std::chrono::seconds(seconds);
+        MET_LOG_INFO << "Recording a trace of the pipeline for " << seconds << " s.";
+        return;
+      }
+    } else if (line.compare(4, 9, "/metrics ") != 0 && line.compare(4, 2, "/ ") != 0){
+      response = "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n";
+    } else {
+      std::string body = registry.prometheus();
+      response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+        + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    }
+    size_t sent = 0;
+    while (sent < response.size()){
+      ssize_t s = send(connection, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (s <= 0)
+        break;
+      sent += s;
+    }
+  }
+  close(connection);
+}
+
+void cadidaq::metricsExporter::finishTrace(){
+  std::string body = trace->stop();
+  std::string response = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+    + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+  // (a large trace takes a while on a slow client)
+  timeval timeout = {10, 0};
+  setsockopt(traceConnection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  size_t sent = 0;
+  while (sent < response.size()){
+    ssize_t s = send(traceConnection, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (s <= 0)
+      break;
+    sent += s;
+  }
+  close(traceConnection);
+  traceConnection = -1;
+  MET_LOG_INFO << "Sent a trace of the pipeline (" << body.size() / 1024 << " kB).";
+}
+
+void cadidaq::metricsExporter::writeFile(){
+  // write to a temporary file first so that readers never see a partially written file
+  std::string tmp = file + ".tmp";
+  {
+    std::ofstream out(tmp);
+    out << registry.prometheus();
+    if (!out){
+      MET_LOG_WARN << "Could not write metrics to file " << tmp;
+      return;
+    }
+  }
+  if (std::rename(tmp.c_str(), file.c_str()) != 0)
+    MET_LOG_WARN << "Could not rename metrics file " << tmp << " to " << file << ": " << strerror(errno);
+}
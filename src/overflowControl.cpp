@@ -0,0 +1,65 @@
+#include <overflowControl.hpp>
+
+#include <event.hpp>
+
+cadidaq::overflowControl::overflowControl(const std::vector<overflowPolicy>& policies, const std::vector<uint32_t>& prescales, const std::vector<dppFormat>& formats,
+                                          const std::vector<boardMetrics*>& stats, double highWatermark, double lowWatermark)
+  : policies(policies), prescales(prescales), formats(formats), stats(stats), highWatermark(highWatermark), lowWatermark(lowWatermark) {
+  // at most one pool per board
+  pools.reserve(policies.size());
+}
+
+cadidaq::overflowControl::decision cadidaq::overflowControl::decide(const readoutQueue::item& item){
+  decision d = {false, 1, false};
+  poolState* state = nullptr;
+  for (auto& p : pools)
+    if (p.pool == item.pool){
+      state = &p;
+      break;
+    }
+  if (state == nullptr){
+    pools.push_back({item.pool, false});
+    state = &pools.back();
+  }
+  // with hysteresis, so that the policy applies to a stretch of data rather than flickering at the watermark
+  double level = static_cast<double>(item.pool->getInUse()) / item.pool->getCount();
+  if (level >= highWatermark)
+    state->overflowing = true;
+  else if (level <= lowWatermark)
+    state->overflowing = false;
+  if (!state->overflowing)
+    return d;
+  if (stats[item.board])
+    stats[item.board]->overflowBuffers.add();
+  switch (policies[item.board]){
+  case overflowPolicy::DROP_OLDEST:
+    // (the buffers are dispatched in the order they were read)
+    d.drop = true;
+    break;
+  case overflowPolicy::PRESCALE:
+    d.prescale = prescales[item.board];
+    break;
+  case overflowPolicy::FEATURES_ONLY:
+    d.featuresOnly = true;
+    break;
+  default:
+    break;
+  }
+  return d;
+}
+
+void cadidaq::overflowControl::drop(const readoutQueue::item& item){
+  dppFormat format = formats[item.board];
+  uint64_t nevents = 0;
+  uint32_t aggregates = forEachEvent(item.pool->get(item.buffer).data, item.nbytes, [&](const eventHeader& aggregate){
+      if (format != dppFormat::NONE)
+        nevents += countDPPEvents(aggregate);
+    });
+  if (format == dppFormat::NONE)
+    nevents = aggregates;
+  if (stats[item.board]){
+    stats[item.board]->droppedEvents.add(nevents);
+    stats[item.board]->droppedBytes.add(item.nbytes);
+  }
+  item.pool->release(item.buffer);
+}
@@ -0,0 +1,346 @@
+#include <processingPool.hpp>
+
+#include <stdexcept> // exceptions
+
+#include <readoutScheduler.hpp>  // threadCpuTime
+#include <allocationCounter.hpp>
+
+cadidaq::processingPool::processingPool(uint32_t nworkers, uint32_t nboards, uint32_t maxBuffers, uint32_t maxBufferSize, uint32_t batchBytes,
+                                        const affinity::cpuList& cpus, const std::vector<stageMetrics*>& workerStats,
+                                        deliverFunction deliver, eventFunction process)
+  : workers(nworkers ? nworkers : 1), jobs(maxBuffers ? maxBuffers : 1), order(nboards * jobs.size()), orderHead(nboards, 0), orderCount(nboards, 0), readyHead(nboards, 0), readyCount(nboards, 0),
+    nextSequence(nboards, 0), nextEvent(nboards, 0), maxBuffers(jobs.size()), batchBytes(batchBytes ? batchBytes : 1), nextWorker(0), cpus(cpus),
+    deliver(deliver), process(process), trace(nullptr), queued(0), stopping(false), inFlight(0), delivering(false), redeliver(false) {
+  // each batch but the last of a buffer holds at least 'batchBytes': this bounds the number of tasks in flight
+  maxParts = maxBufferSize / this->batchBytes + 1;
+  size_t maxTasks = static_cast<size_t>(maxBuffers) * maxParts;
+  freeJobs.reserve(jobs.size());
+  for (uint32_t j = 0; j < jobs.size(); j++)
+    freeJobs.push_back(jobs.size() - 1 - j);
+  for (uint32_t w = 0; w < workers.size(); w++){
+    workers[w].tasks.resize(maxTasks);
+    workers[w].stats = w < workerStats.size() ? workerStats[w] : nullptr;
+  }
+  for (uint32_t w = 0; w < workers.size(); w++)
+    workers[w].thread = std::thread(&processingPool::run, this, w);
+}
+
+cadidaq::processingPool::~processingPool(){
+  stop();
+}
+
+void cadidaq::processingPool::decodeDPP(const std::vector<dppFormat>& formats, batchFunction onBatch){
+  std::lock_guard<std::mutex> lock(deliverMutex);
+  if (inFlight)
+    throw std::logic_error("Processing pool: DPP decoding set up while buffers are being processed");
+  this->formats = formats;
+  this->onBatch = onBatch;
+  // room for a batch of the shortest events (time tag and energy), so that decoding does not allocate
+  size_t events = batchBytes / (2 * sizeof(uint32_t));
+  for (auto& jb : jobs){
+    jb.batches.resize(maxParts);
+    for (auto& batch : jb.batches)
+      batch.reserve(events);
+  }
+}
+
+void cadidaq::processingPool::filterDPP(const std::vector<const eventFilter*>& filters){
+  std::lock_guard<std::mutex> lock(deliverMutex);
+  if (inFlight)
+    throw std::logic_error("Processing pool: event filters set up while buffers are being processed");
+  this->filters = filters;
+  // room for the masks of the largest batch decoded without allocating (see decodeDPP)
+  size_t events = batchBytes / (2 * sizeof(uint32_t));
+  for (auto filter : filters)
+    if (filter)
+      for (auto& w : workers)
+        filter->reserve(w.filterSpace, events);
+}
+
+void cadidaq::processingPool::traceLatency(const std::vector<latencyMetrics*>& latency, traceRecorder* trace, const std::vector<uint32_t>& traceThreads){
+  std::lock_guard<std::mutex> lock(deliverMutex);
+  if (inFlight)
+    throw std::logic_error("Processing pool: latency tracing set up while buffers are being processed");
+  this->trace = trace;
+  for (uint32_t w = 0; w < workers.size(); w++){
+    workers[w].latency = w < latency.size() ? latency[w] : nullptr;
+    workers[w].traceThread = w < traceThreads.size() ? traceThreads[w] : 0;
+  }
+}
+
+void cadidaq::processingPool::submit(const readoutQueue::item& item, uint32_t prescale, bool featuresOnly){
+  uint32_t j;
+  {
+    std::lock_guard<std::mutex> lock(deliverMutex);
+    // there are as many jobs as buffers, and each submitted buffer holds one
+    if (freeJobs.empty())
+      throw std::logic_error("Processing pool overflow: more buffers submitted than allocated");
+    j = freeJobs.back();
+    freeJobs.pop_back();
+    // held until all batches are queued, so that the job is not delivered before
+    job& jb = jobs[j];
+    jb.item = item;
+    jb.sequence = nextSequence[item.board]++;
+    jb.nevents.store(0, std::memory_order_relaxed);
+    jb.discarded.store(0, std::memory_order_relaxed);
+    jb.filtered.store(0, std::memory_order_relaxed);
+    jb.strippedBytes.store(0, std::memory_order_relaxed);
+    jb.firstEvent = nextEvent[item.board];
+    jb.prescale = prescale ? prescale : 1;
+    jb.featuresOnly = featuresOnly;
+    jb.submitted = latencyMetrics::now();
+    jb.processed.store(jb.submitted, std::memory_order_relaxed);
+    jb.remaining.store(1);
+    uint32_t board = item.board;
+    order[board * maxBuffers + (orderHead[board] + orderCount[board]) % maxBuffers] = j;
+    orderCount[board]++;
+    inFlight++;
+  }
+  job& jb = jobs[j];
+  uint32_t ntasks = 0;
+  uint64_t& event = nextEvent[item.board];
+  uint64_t firstEvent = event;
+  auto queueBatch = [&](uint32_t start, uint32_t end){
+    jb.remaining.fetch_add(1);
+    worker& w = workers[nextWorker];
+    {
+      std::lock_guard<std::mutex> lock(w.mutex);
+      w.tasks[(w.head + w.count) % w.tasks.size()] = {j, ntasks, firstEvent, static_cast<uint32_t>(start * sizeof(uint32_t)), static_cast<uint32_t>((end - start) * sizeof(uint32_t))};
+      w.count++;
+    }
+    nextWorker = (nextWorker + 1) % workers.size();
+    ntasks++;
+  };
+
+  // split at event boundaries, only reading the size of each event (decoding stops at the first invalid word as in forEachEvent)
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(item.pool->get(item.buffer).data);
+  uint32_t nwords = item.nbytes / sizeof(uint32_t);
+  uint32_t pos = 0;
+  uint32_t start = 0;
+  while (pos + eventHeaderWords <= nwords && (words[pos] >> 28) == 0xA){
+    uint32_t size = words[pos] & 0x0FFFFFFF;
+    if (size < eventHeaderWords || size > nwords - pos)
+      break;
+    pos += size;
+    event++;
+    if ((pos - start) * sizeof(uint32_t) >= batchBytes){
+      queueBatch(start, pos);
+      start = pos;
+      firstEvent = event;
+    }
+  }
+  if (pos > start)
+    queueBatch(start, pos);
+  if (ntasks){
+    {
+      std::lock_guard<std::mutex> lock(idleMutex);
+      queued.fetch_add(ntasks);
+    }
+    if (ntasks == 1)
+      workAvailable.notify_one();
+    else
+      workAvailable.notify_all();
+  }
+  jb.nparts = ntasks;
+  // drop the hold (delivering right away if there was nothing to process)
+  if (jb.remaining.fetch_sub(1) == 1)
+    finish();
+}
+
+bool cadidaq::processingPool::take(uint32_t w, task& t){
+  // oldest task of the own queue first
+  {
+    worker& own = workers[w];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.count){
+      t = own.tasks[own.head];
+      own.head = (own.head + 1) % own.tasks.size();
+      own.count--;
+      return true;
+    }
+  }
+  // then the newest task of another worker
+  for (uint32_t k = 1; k < workers.size(); k++){
+    worker& victim = workers[(w + k) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.count){
+      victim.count--;
+      t = victim.tasks[(victim.head + victim.count) % victim.tasks.size()];
+      if (workers[w].stats)
+        workers[w].stats->stolen.add();
+      return true;
+    }
+  }
+  return false;
+}
+
+void cadidaq::processingPool::run(uint32_t w){
+  affinity::pin(cpus);
+  worker& self = workers[w];
+  uint64_t cpuStart = readoutScheduler::threadCpuTime();
+  uint64_t batches = 0;
+  uint64_t allocationsStart = 0;
+  while (true){
+    task t;
+    if (!take(w, t)){
+      std::unique_lock<std::mutex> lock(idleMutex);
+      if (stopping)
+        break;
+      workAvailable.wait(lock, [this]{return queued.load() > 0 || stopping;});
+      continue;
+    }
+    queued.fetch_sub(1);
+    uint64_t start = latencyMetrics::now();
+    job& jb = jobs[t.job];
+    const char* data = jb.item.pool->get(jb.item.buffer).data + t.offset;
+    dppFormat format = formats.empty() ? dppFormat::NONE : formats[jb.item.board];
+    uint64_t index = t.firstEvent;
+    uint32_t n = 0;
+    uint32_t discarded = 0;
+    uint32_t filtered = 0;
+    uint64_t stripped = 0;
+    if (format == dppFormat::NONE)
+      forEachEvent(data, t.nbytes, [&](const eventHeader& event){
+          if (index++ % jb.prescale){
+            discarded++;
+            return;
+          }
+          if (jb.featuresOnly)
+            stripped += (event.size - eventHeaderWords) * sizeof(uint32_t);
+          if (process)
+            process(event);
+          n++;
+        });
+    else {
+      // list-mode data: the 'events' are board aggregates holding the events of several channels (prescaled as a whole)
+      dppEventBatch& batch = jb.batches[t.part];
+      batch.clear();
+      batch.board = jb.item.board;
+      batch.sequence = jb.sequence;
+      forEachEvent(data, t.nbytes, [&](const eventHeader& aggregate){
+          if (index++ % jb.prescale){
+            discarded += countDPPEvents(aggregate);
+            return;
+          }
+          // the features are in the batch, none of the raw data is handed on
+          if (jb.featuresOnly)
+            stripped += aggregate.size * sizeof(uint32_t);
+          if (process)
+            process(aggregate);
+          decodeDPPEvents(aggregate, format, batch);
+        });
+      const eventFilter* filter = filters.empty() ? nullptr : filters[jb.item.board];
+      if (filter)
+        filtered = filter->select(batch, self.filterSpace);
+      n = batch.size();
+    }
+    jb.nevents.fetch_add(n, std::memory_order_relaxed);
+    if (discarded)
+      jb.discarded.fetch_add(discarded, std::memory_order_relaxed);
+    if (filtered)
+      jb.filtered.fetch_add(filtered, std::memory_order_relaxed);
+    if (stripped)
+      jb.strippedBytes.fetch_add(stripped, std::memory_order_relaxed);
+    uint64_t end = latencyMetrics::now();
+    if (self.stats){
+      self.stats->items.add();
+      self.stats->busyNanoseconds.add(end - start);
+      if (++batches % 256 == 0)
+        self.stats->cpuNanoseconds.set(readoutScheduler::threadCpuTime() - cpuStart);
+    }
+    if (self.latency)
+      self.latency->record(end - start);
+    if (trace)
+      trace->record(traceRecorder::span::DECODE, self.traceThread, jb.item.board, jb.sequence, start, end, n);
+    // (the batches can finish in any order)
+    uint64_t processed = jb.processed.load(std::memory_order_relaxed);
+    while (processed < end && !jb.processed.compare_exchange_weak(processed, end, std::memory_order_relaxed))
+      ;
+    if (jb.remaining.fetch_sub(1) == 1)
+      finish();
+    if (self.steady)
+      self.steadyIterations++;
+    else {
+      self.steady = true;
+      allocationsStart = allocations::thisThread();
+    }
+  }
+  if (self.stats)
+    self.stats->cpuNanoseconds.set(readoutScheduler::threadCpuTime() - cpuStart);
+  self.steadyAllocations = self.steady ? allocations::thisThread() - allocationsStart : 0;
+}
+
+void cadidaq::processingPool::finish(){
+  std::unique_lock<std::mutex> lock(deliverMutex);
+  // another thread is delivering: it looks for buffers that are done again before it stops
+  if (delivering){
+    redeliver = true;
+    return;
+  }
+  delivering = true;
+  do {
+    redeliver = false;
+    // take the buffers of each board that are done, up to the first one still being processed
+    uint32_t total = 0;
+    for (uint32_t board = 0; board < orderCount.size(); board++){
+      uint32_t* ring = &order[board * maxBuffers];
+      uint32_t first = orderHead[board];
+      uint32_t n = 0;
+      while (n < orderCount[board] && jobs[ring[(first + n) % maxBuffers]].remaining.load() == 0)
+        n++;
+      // the slots of the ring stay valid until their jobs are freed (the jobs in flight never exceed the ring)
+      readyHead[board] = first;
+      readyCount[board] = n;
+      orderHead[board] = (first + n) % maxBuffers;
+      orderCount[board] -= n;
+      total += n;
+    }
+    if (total == 0)
+      continue;
+    // deliver them without the lock, so that a slow consumer does not hold up the workers finishing their batches
+    lock.unlock();
+    for (uint32_t board = 0; board < orderCount.size(); board++)
+      for (uint32_t k = 0; k < readyCount[board]; k++){
+        uint32_t index = order[board * maxBuffers + (readyHead[board] + k) % maxBuffers];
+        job& next = jobs[index];
+        result r = {next.sequence, next.nevents.load(std::memory_order_relaxed), next.discarded.load(std::memory_order_relaxed), next.filtered.load(std::memory_order_relaxed),
+                    next.strippedBytes.load(std::memory_order_relaxed), next.firstEvent, next.prescale, next.featuresOnly,
+                    next.item.readTime, next.submitted, next.processed.load(std::memory_order_relaxed), latencyMetrics::now()};
+        if (!formats.empty() && formats[board] != dppFormat::NONE && onBatch)
+          for (uint32_t p = 0; p < next.nparts; p++)
+            onBatch(next.batches[p], r);
+        // the job is free before the consumer can release the buffer and submit it again
+        readoutQueue::item item = next.item;
+        {
+          std::lock_guard<std::mutex> freeLock(deliverMutex);
+          freeJobs.push_back(index);
+        }
+        deliver(item, r);
+      }
+    lock.lock();
+    inFlight -= total;
+    redeliver = true;
+  } while (redeliver);
+  delivering = false;
+  if (inFlight == 0)
+    delivered.notify_all();
+}
+
+void cadidaq::processingPool::drain(){
+  std::unique_lock<std::mutex> lock(deliverMutex);
+  delivered.wait(lock, [this]{return inFlight == 0;});
+}
+
+void cadidaq::processingPool::stop(){
+  drain();
+  {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    if (stopping)
+      return;
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (auto& w : workers)
+    if (w.thread.joinable())
+      w.thread.join();
+}
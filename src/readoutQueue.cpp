@@ -0,0 +1,27 @@
+#include <readoutQueue.hpp>
+
+#include <stdexcept> // exceptions
+
+cadidaq::readoutQueue::readoutQueue(uint32_t capacity) : ring(capacity ? capacity : 1), head(0), count(0) {
+}
+
+void cadidaq::readoutQueue::push(const item& i){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count == ring.size())
+      throw std::logic_error("Readout queue overflow: more buffers queued than allocated");
+    ring[(head + count) % ring.size()] = i;
+    count++;
+  }
+  pushed.notify_one();
+}
+
+bool cadidaq::readoutQueue::pop(item& i, std::chrono::microseconds timeout){
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!pushed.wait_for(lock, timeout, [this]{return count > 0;}))
+    return false;
+  i = ring[head];
+  head = (head + 1) % ring.size();
+  count--;
+  return true;
+}
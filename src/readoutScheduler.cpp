@@ -0,0 +1,179 @@
+#include <readoutScheduler.hpp>
+
+#include <thread>    // sleep_until
+#include <algorithm> // min, max, sort
+#include <ctime>     // clock_gettime
+
+using std::chrono::nanoseconds;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+namespace {
+  /// shortest interval between reads in the adaptive mode (unless the buffer was filled beyond 'drainOccupancy')
+  const nanoseconds minInterval = microseconds(20);
+  /// readout buffer occupancy aimed at by the adaptive mode
+  const double targetOccupancy = 0.25;
+  /// occupancy above which the board is read again immediately
+  const double drainOccupancy = 0.5;
+  /// weight of the latest read in the moving average of the data rate
+  const double rateSmoothing = 0.2;
+}
+
+cadidaq::readoutScheduler::readoutScheduler(const std::vector<digitizer*>& boards, const std::vector<boardMetrics*>& stats, healthPoller* health)
+  : boards(boards), stats(stats), health(health), position(0), anyIRQ(false) {
+  clock::time_point now = clock::now();
+  for (auto board : boards){
+    boardState s;
+    s.mode        = board->getReadoutMode();
+    s.maxInterval = microseconds(board->getReadoutMaxInterval());
+    s.interval    = minInterval;
+    s.due         = now;
+    s.lastRead    = now;
+    s.rate        = 0;
+    state.push_back(s);
+    if (s.mode == readoutMode::IRQ)
+      anyIRQ = true;
+  }
+  // no allocations while scheduling
+  round.reserve(boards.size());
+  priority.resize(boards.size());
+}
+
+int cadidaq::readoutScheduler::next(clock::time_point deadline){
+  int n = state.size();
+  if (n == 0)
+    return -1;
+  if (position < round.size())
+    return round[position++];
+  while (true){
+    clock::time_point now = clock::now();
+    // start a new round with the boards that are due, otherwise find the one due first
+    round.clear();
+    position = 0;
+    // (health registers left unread for too long go first, a single one per round)
+    if (health && health->pollOverdue(now))
+      now = clock::now();
+    int first = -1;
+    for (int i = 0; i < n; i++){
+      if (state[i].due <= now)
+        round.push_back(i);
+      else if (first < 0 || state[i].due < state[first].due)
+        first = i;
+    }
+    if (round.size() == 1)
+      return round[position++];
+    if (round.size() > 1){
+      if (prioritise(now))
+        return round[position++];
+      // the boards found empty were rescheduled, possibly before the one found due first
+      for (int i = 0; i < n; i++)
+        if (first < 0 || state[i].due < state[first].due)
+          first = i;
+      if (state[first].due <= now)
+        first = -1;
+    }
+    if (first < 0)
+      continue; // all boards were found without data and are due again right away (polling)
+    clock::time_point until = std::min(state[first].due, deadline);
+    if (until <= now)
+      return -1;
+    // use the gap for the health registers
+    if (health && health->poll(now, until))
+      continue;
+    // wait for an interrupt if a board waits for one (and there is enough time), otherwise sleep
+    int irqBoard = -1;
+    if (anyIRQ && until - now >= milliseconds(1)){
+      for (int i = 0; i < n; i++)
+        if (state[i].mode == readoutMode::IRQ && state[i].due > now){
+          irqBoard = i;
+          break;
+        }
+    }
+    if (irqBoard >= 0){
+      uint32_t timeout = duration_cast<milliseconds>(until - now).count();
+      if (boards[irqBoard]->waitForInterrupt(timeout)){
+        // the interrupts of all boards on a link are delivered together: check all waiting boards
+        now = clock::now();
+        for (auto& s : state)
+          if (s.mode == readoutMode::IRQ)
+            s.due = now;
+      }
+    } else
+      std::this_thread::sleep_until(until);
+  }
+}
+
+bool cadidaq::readoutScheduler::prioritise(clock::time_point now){
+  size_t kept = 0;
+  for (size_t k = 0; k < round.size(); k++){
+    int i = round[k];
+    double occupancy = boards[i]->occupancy();
+    if (occupancy == 0){
+      // nothing to read: plan the next read as after an empty one, but save the block transfer
+      record(i, 0, 0);
+      if (stats[i])
+        stats[i]->skippedReads.add();
+      continue;
+    }
+    // the fill level (unknown counts as empty) plus how long the board is overdue relative to its longest interval:
+    // a board overdue by its longest interval comes before any board however full
+    priority[i] = std::max(occupancy, 0.) + static_cast<double>((now - state[i].due).count()) / state[i].maxInterval.count();
+    round[kept++] = i;
+  }
+  round.resize(kept);
+  // (not stable_sort, which allocates)
+  std::sort(round.begin(), round.end(), [this](int a, int b){return priority[a] > priority[b] || (priority[a] == priority[b] && a < b);});
+  return !round.empty();
+}
+
+void cadidaq::readoutScheduler::record(int i, uint32_t nbytes, uint32_t bufferSize){
+  boardState& s = state[i];
+  clock::time_point now = clock::now();
+  nanoseconds elapsed = duration_cast<nanoseconds>(now - s.lastRead);
+  s.lastRead = now;
+  if (nbytes && stats[i]){
+    // the data could have been waiting on the board since the previous read
+    stats[i]->latencyNanoseconds.add(elapsed.count());
+    stats[i]->maxLatencyNanoseconds.max(elapsed.count());
+  }
+  switch (s.mode){
+  case readoutMode::POLL:
+    s.due = now;
+    break;
+  case readoutMode::IRQ:
+    // drain the board, then wait for the next interrupt (or poll after the longest interval)
+    s.due = nbytes ? now : now + s.maxInterval;
+    break;
+  case readoutMode::ADAPTIVE:
+    if (nbytes == 0){
+      s.interval = std::min<nanoseconds>(std::max<nanoseconds>(s.interval * 2, minInterval), s.maxInterval);
+    } else {
+      double occupancy = bufferSize ? static_cast<double>(nbytes) / bufferSize : 1;
+      double rate = static_cast<double>(nbytes) / std::max<int64_t>(elapsed.count(), 1);
+      s.rate = s.rate > 0 ? s.rate + rateSmoothing * (rate - s.rate) : rate;
+      if (occupancy >= drainOccupancy)
+        s.interval = nanoseconds(0);
+      else {
+        double target = targetOccupancy * bufferSize / s.rate;
+        s.interval = target >= s.maxInterval.count() ? s.maxInterval : std::max(nanoseconds(static_cast<int64_t>(target)), minInterval);
+      }
+    }
+    s.due = now + s.interval;
+    break;
+  }
+}
+
+void cadidaq::readoutScheduler::stalled(int i){
+  boardState& s = state[i];
+  if (s.mode == readoutMode::ADAPTIVE)
+    s.interval = nanoseconds(0);
+  s.due = clock::now();
+}
+
+uint64_t cadidaq::readoutScheduler::threadCpuTime(){
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
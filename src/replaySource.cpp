@@ -0,0 +1,133 @@
+#include <replaySource.hpp>
+
+#include <cstring>   // memcpy
+#include <algorithm> // sort, max, min
+#include <stdexcept> // exceptions
+#include <thread>    // sleep_until
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define RPL_LOG_DEBUG BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::debug)
+#define RPL_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define RPL_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+#define RPL_LOG_ERROR BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::error)
+
+namespace layout = cadidaq::dataFileLayout;
+
+namespace {
+  /// longest time spent waiting (for a record's time or a free buffer) before checking for the end of the run
+  const std::chrono::milliseconds waitSlice(100);
+}
+
+cadidaq::replaySource::replaySource(const std::vector<std::string>& paths, double speed)
+  : speed(speed), maxRecordBytes(0), currentFile(0), currentEntry(0), paced(false), records(0), bytes(0), skipped(0), droppedBoards(0), finished(false) {
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("replay"));
+  for (auto& path : paths){
+    replayFile f;
+    f.reader.reset(new dataFileReader(path));
+    files.push_back(std::move(f));
+  }
+  // the runs in the order they were taken, each with its files in turn
+  std::sort(files.begin(), files.end(), [](const replayFile& a, const replayFile& b){
+      const layout::fileHeader& ha = a.reader->getHeader();
+      const layout::fileHeader& hb = b.reader->getHeader();
+      return ha.runStart < hb.runStart || (ha.runStart == hb.runStart && ha.fileNumber < hb.fileNumber);
+    });
+
+  uint64_t total = 0;
+  uint64_t nrecords = 0;
+  for (auto& f : files){
+    for (uint16_t b = 0; b < f.reader->getNBoards() && b < layout::maxBoards; b++){
+      std::string name = f.reader->getBoardName(b);
+      auto known = std::find(boardNames.begin(), boardNames.end(), name);
+      if (known == boardNames.end()){
+        boardNames.push_back(name);
+        formats.push_back(f.reader->getDPPFormat(b));
+        known = boardNames.end() - 1;
+      } else if (formats[known - boardNames.begin()] != f.reader->getDPPFormat(b))
+        RPL_LOG_WARN << "'" << name << "' was recorded with another DPP firmware in a later run, decoding all of its events as "
+                     << toString(formats[known - boardNames.begin()]) << ".";
+      f.boards.push_back(known - boardNames.begin());
+    }
+    for (auto& e : f.reader->getIndex()){
+      if (e.type != layout::EVENTS || e.board >= f.boards.size())
+        continue;
+      uint32_t payloadSize = f.reader->getRecord(e).payloadSize;
+      maxRecordBytes = std::max(maxRecordBytes, payloadSize);
+      total += payloadSize;
+      nrecords++;
+    }
+  }
+  if (nrecords == 0)
+    throw std::runtime_error("The data files hold no raw events to replay");
+  RPL_LOG_INFO << "Replaying " << nrecords << " records (" << total/(1024*1024) << " MB) of " << boardNames.size() << " board(s) from "
+               << files.size() << " file(s) " << (speed > 0 ? "at " + std::to_string(speed) + " times the recorded pace" : "as fast as possible");
+}
+
+std::string cadidaq::replaySource::getConfiguration() const {
+  return files.front().reader->getConfiguration();
+}
+
+bool cadidaq::replaySource::next(bufferPool& pool, readoutQueue& queue, const std::vector<boardMetrics*>& stats, const std::atomic<bool>& stop){
+  while (currentFile < files.size()){
+    replayFile& f = files[currentFile];
+    const std::vector<dataFileReader::entry>& index = f.reader->getIndex();
+    if (currentEntry >= index.size()){
+      currentFile++;
+      currentEntry = 0;
+      // the pace of another run is kept from its own start
+      if (currentFile < files.size() && files[currentFile].reader->getHeader().runStart != f.reader->getHeader().runStart)
+        paced = false;
+      continue;
+    }
+    const dataFileReader::entry& e = index[currentEntry];
+    if (e.type != layout::EVENTS){
+      currentEntry++;
+      skipped++;
+      continue;
+    }
+    if (e.board >= f.boards.size()){
+      currentEntry++;
+      droppedBoards++;
+      continue;
+    }
+    const layout::recordHeader& r = f.reader->getRecord(e);
+
+    // at the recorded pace: the first record right away, the others as long after it as they were written
+    if (speed > 0){
+      auto offset = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::nano>(r.writeTime / speed));
+      if (!paced){
+        start = clock::now() - offset;
+        paced = true;
+      }
+      auto due = start + offset;
+      for (auto now = clock::now(); now < due; now = clock::now()){
+        if (stop.load(std::memory_order_relaxed))
+          return false;
+        std::this_thread::sleep_until(std::min(due, now + std::chrono::duration_cast<clock::duration>(waitSlice)));
+      }
+    }
+    // all buffers queued for processing: wait for one to be released, as the readout does
+    bufferPool::handle buffer = pool.acquire();
+    while (buffer == bufferPool::none){
+      if (stop.load(std::memory_order_relaxed))
+        return false;
+      buffer = pool.acquire(waitSlice);
+    }
+    auto readStart = clock::now();
+    caen::ReadoutBuffer& b = pool.get(buffer);
+    std::memcpy(b.data, reinterpret_cast<const char*>(&r + 1), r.payloadSize);
+    b.dataSize = r.payloadSize;
+    uint32_t board = f.boards[e.board];
+    if (stats[board])
+      stats[board]->recordRead(r.payloadSize, b.size, readStart, clock::now());
+    queue.push({board, &pool, buffer, r.payloadSize, latencyMetrics::now()});
+    currentEntry++;
+    records++;
+    bytes += r.payloadSize;
+    return true;
+  }
+  finished.store(true, std::memory_order_release);
+  return false;
+}
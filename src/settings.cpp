@@ -6,6 +6,7 @@
 #include <iomanip>   // std::hex
 #include <stdexcept> // exceptions
 #include <iterator>  // distance
+#include <cctype>    // tolower, isspace
 
 // BOOST
 #include <boost/property_tree/ptree.hpp>
@@ -24,6 +25,7 @@
 
 #include <CaenEnum2str.hpp> // generated by CMake in build directory
 #include <helper.hpp>       // helper functions
+#include <affinity.hpp>     // CPU lists
 
 #define CFG_LOG_DEBUG                                           \
   BOOST_LOG_CHANNEL_SEV(lg, "cfg", boost::log::trivial::debug)
@@ -44,17 +46,12 @@
     uses template specialization to cover CAEN enums, ints, bools */
 template <typename CAEN_ENUM>
 std::string describeValidValues(){
-  // get a converter for this CAEN enum type
-  cadidaq::CaenEnum2str enumConverter;
-  CAEN_ENUM e;
-  auto* map = enumConverter.getBimap(e);
-  // generate a string of known options from the CAEN enum map
+  typedef cadidaq::CaenEnum2str<CAEN_ENUM> table;
+  // generate a string of known options from the CAEN enum table
   std::stringstream knownOptions;
-  std::string enumRoot = findEnumRoot(*map);
-  typedef typename boost::bimap< std::string, CAEN_ENUM >::left_const_iterator const_iterator;
-  for( const_iterator i = map->left.begin(), iend = map->left.end(); i != iend; ++i ){
-    knownOptions << boost::erase_head_copy(i->first, enumRoot.length());
-    if (!is_last(i, map->left)) knownOptions << ", ";
+  for (size_t i = 0; i < table::size; ++i){
+    knownOptions << table::entries[i].name + table::rootLength;
+    if (i + 1 < table::size) knownOptions << ", ";
   }
   return knownOptions.str();
 }
@@ -70,12 +67,137 @@ template <>
 std::string describeValidValues<bool>(){
   return std::string("boolean value noted as either 0/1 or true/false");
 }
+template <>
+std::string describeValidValues<std::string>(){
+  return std::string("any string");
+}
+
+//
+// Config key index
+//
+
+namespace {
+  /// lower-cases a string and removes all whitespace
+  std::string normalize(const std::string& str){
+    std::string norm;
+    norm.reserve(str.size());
+    for (char c : str)
+      if (!std::isspace(static_cast<unsigned char>(c)))
+        norm.push_back(std::tolower(static_cast<unsigned char>(c)));
+    return norm;
+  }
+}
+
+cadidaq::settingsSection::settingsSection(const pt::iptree& node, std::shared_ptr<const settingsSection> parent) : parent(parent){
+  for (auto& key : node){
+    entry e;
+    e.key = key.first;
+    e.value = key.second.data();
+    // split "SettingName[range]" (or "SettingName(range)") into name and range
+    std::string name = key.first;
+    size_t open = key.first.find_first_of("[(");
+    e.hasRange = open != std::string::npos;
+    if (e.hasRange){
+      name = key.first.substr(0, open);
+      size_t close = key.first.find_last_of("])");
+      if (close == std::string::npos || close < open)
+        close = key.first.length();
+      e.range = key.first.substr(open + 1, close - open - 1);
+    }
+    name = normalize(name);
+    e.normKey = e.hasRange ? name + "[" + normalize(e.range) + "]" : name;
+    // keys given again within the section replace the earlier value
+    auto it = entries.find(name);
+    if (it == entries.end()){
+      names.push_back(name);
+      entries[name].push_back(e);
+      continue;
+    }
+    bool replaced = false;
+    for (auto& existing : it->second){
+      if (existing.normKey == e.normKey){
+        existing = e;
+        replaced = true;
+        break;
+      }
+    }
+    if (!replaced)
+      it->second.push_back(e);
+  }
+}
+
+const std::vector<cadidaq::settingsSection::entry>* cadidaq::settingsSection::find(const std::string& normName) const{
+  auto it = entries.find(normName);
+  if (it == entries.end())
+    return nullptr;
+  return &it->second;
+}
+
+void cadidaq::settingsIndex::add(const pt::iptree& node){
+  layers.push_back(std::make_shared<const settingsSection>(node));
+}
+
+void cadidaq::settingsIndex::add(std::shared_ptr<const settingsSection> section){
+  // add the inherited sections first so that the more specific ones override them
+  size_t pos = layers.size();
+  for (; section; section = section->getParent())
+    layers.insert(layers.begin() + pos, section);
+}
+
+std::vector<const cadidaq::settingsIndex::entry*> cadidaq::settingsIndex::lookup(const std::string& normName) const{
+  std::vector<const entry*> result;
+  for (auto& layer : layers){
+    const std::vector<entry>* entries = layer->find(normName);
+    if (!entries)
+      continue;
+    for (auto& e : *entries){
+      // keys given again in a more specific section replace the earlier value (keeping its position)
+      bool replaced = false;
+      for (auto& existing : result){
+        if (existing->normKey == e.normKey){
+          existing = &e;
+          replaced = true;
+          break;
+        }
+      }
+      if (!replaced)
+        result.push_back(&e);
+    }
+  }
+  return result;
+}
+
+std::vector<const cadidaq::settingsIndex::entry*> cadidaq::settingsIndex::find(const std::string& settingName) const{
+  return lookup(normalize(settingName));
+}
+
+std::vector<const cadidaq::settingsIndex::entry*> cadidaq::settingsIndex::unused() const{
+  std::vector<const entry*> result;
+  std::unordered_set<std::string> seen;
+  for (auto& layer : layers)
+    for (auto& name : layer->getNames())
+      if (seen.insert(name).second)
+        for (auto e : lookup(name))
+          if (!used.count(e))
+            result.push_back(e);
+  return result;
+}
+
+size_t cadidaq::settingsIndex::size() const{
+  size_t nkeys = 0;
+  std::unordered_set<std::string> seen;
+  for (auto& layer : layers)
+    for (auto& name : layer->getNames())
+      if (seen.insert(name).second)
+        nkeys += lookup(name).size();
+  return nkeys;
+}
 
 //
 // Class implementation
 //
 
-cadidaq::settingsBase::settingsBase(std::string name) : name(name)
+cadidaq::settingsBase::settingsBase(std::string name) : name(name), index(nullptr), snapshotOut(nullptr), snapshotIn(nullptr)
 {
   // Register a constant attribute that identifies our digitizer in the logs
   lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>(name));
@@ -91,8 +213,28 @@ void cadidaq::settingsBase::print(){
   delete node;
 };
 
-void cadidaq::settingsBase::parse(pt::iptree *node){
-  processPTree(node, parseDirection::READING);
+void cadidaq::settingsBase::parse(settingsIndex& idx){
+  index = &idx;
+  processPTree(nullptr, parseDirection::READING);
+  index = nullptr;
+}
+
+void cadidaq::settingsBase::store(snapshotWriter& out){
+  snapshotOut = &out;
+  processPTree(nullptr, parseDirection::STORING);
+  snapshotOut = nullptr;
+}
+
+void cadidaq::settingsBase::load(snapshotReader& in){
+  snapshotIn = &in;
+  try {
+    processPTree(nullptr, parseDirection::LOADING);
+  }
+  catch (...){
+    snapshotIn = nullptr;
+    throw;
+  }
+  snapshotIn = nullptr;
 }
 
 pt::iptree* cadidaq::settingsBase::createPTree(){
@@ -105,27 +247,85 @@ void cadidaq::settingsBase::fillPTree(pt::iptree *node){
   processPTree(node, parseDirection::WRITING);
 }
 
+/// converts a config value using the same translators as the property trees (bool, hex, CAEN enums)
+template <class VALUE> boost::optional<VALUE> convertValue(const std::string& str){
+  typename pt::translator_between<std::string, VALUE>::type translator;
+  return translator.get_value(str);
+}
+
+template <class VALUE> void cadidaq::settingsBase::snapshotSetting(const std::string& settingName, boost::optional<VALUE>& settingValue, parseDirection direction){
+  if (direction == parseDirection::STORING){
+    snapshotOut->put(settingName);
+    snapshotOut->put(static_cast<uint8_t>(settingValue ? 1 : 0));
+    if (settingValue)
+      snapshotOut->put(*settingValue);
+  } else {
+    snapshotIn->expect(settingName);
+    uint8_t defined;
+    snapshotIn->get(defined);
+    settingValue = boost::none;
+    if (defined){
+      VALUE value;
+      snapshotIn->get(value);
+      settingValue = value;
+    }
+  }
+}
+
+template <class VALUE> void cadidaq::settingsBase::snapshotSetting(const std::string& settingName, channelValues<VALUE>& settingValue, parseDirection direction){
+  if (direction == parseDirection::STORING){
+    snapshotOut->put(settingName);
+    snapshotOut->put(static_cast<uint32_t>(settingValue.size()));
+    snapshotOut->put(settingValue.setMask());
+    // only the defined values are stored
+    for (uint64_t m = settingValue.setMask(); m; m &= m - 1)
+      snapshotOut->put(*settingValue.get(__builtin_ctzll(m)));
+  } else {
+    snapshotIn->expect(settingName);
+    uint32_t nchannels;
+    uint64_t defined;
+    snapshotIn->get(nchannels);
+    snapshotIn->get(defined);
+    if (nchannels != settingValue.size())
+      throw std::runtime_error("Snapshot has " + std::to_string(nchannels) + " channels for '" + settingName + "' but the board has " + std::to_string(settingValue.size()));
+    settingValue.fill(boost::none);
+    for (uint64_t m = defined; m; m &= m - 1){
+      VALUE value;
+      snapshotIn->get(value);
+      settingValue.set(__builtin_ctzll(m), value);
+    }
+  }
+}
+
 template <class VALUE> void cadidaq::settingsBase::parseSetting(std::string settingName, pt::iptree *node, boost::optional<VALUE>& settingValue, parseDirection direction, parseFormat format){
+  if (direction == parseDirection::STORING || direction == parseDirection::LOADING){
+    snapshotSetting(settingName, settingValue, direction);
+    return;
+  }
   if (direction == parseDirection::READING){
-    // get the setting's value from the ptree
-    try{
-      settingValue = node->get<VALUE>(settingName);
-    }
-    catch (const pt::ptree_bad_data& e){
-      CFG_LOG_ERROR << "Parsing '" << settingName << "' yielded Bad_Data exception (" << e.what() << ") for value: " << node->get<std::string>(settingName);
-      CFG_LOG_ERROR << "\t Allowed values are: " << describeValidValues<VALUE>();
-      return;
+    // look up the setting's key in the index
+    const settingsIndex::entry* match = nullptr;
+    for (auto e : index->find(settingName)){
+      if (e->hasRange){
+        CFG_LOG_ERROR << "Setting '" << settingName << "' does not support a channel range but was given as '" << e->key << "'. Ignored.";
+        index->markUsed(e);
+        continue;
+      }
+      match = e;
     }
-    catch (const pt::ptree_bad_path& e){
+    if (!match){
       CFG_LOG_DEBUG << "Could not find key '" << settingName << "'";
       return;
     }
-    if (settingValue) {
-      CFG_LOG_DEBUG << "found key " << settingName << " with value '" << *settingValue << "' converted from string '" << node->get<std::string>(settingName) << "'";
+    index->markUsed(match);
+    boost::optional<VALUE> value = convertValue<VALUE>(match->value);
+    if (!value){
+      CFG_LOG_ERROR << "Could not parse value '" << match->value << "' given for '" << match->key << "'";
+      CFG_LOG_ERROR << "\t Allowed values are: " << describeValidValues<VALUE>();
+      return;
     }
-    // erase value from ptree as it has been successfully parsed
-    // NOTE: this will only erase a single instance of the key; if the key exists several times, the other entries remain!
-    node->erase(settingName);
+    settingValue = value;
+    CFG_LOG_DEBUG << "found key " << match->key << " with value '" << *settingValue << "' converted from string '" << match->value << "'";
   } else {
     // direction: WRITING
     // add key to ptree if the setting's value has been set
@@ -144,76 +344,78 @@ template <class VALUE> void cadidaq::settingsBase::parseSetting(std::string sett
 }
 
 
-template <typename VALUE> void cadidaq::settingsBase::parseSetting(std::string settingName, pt::iptree *node, std::vector<boost::optional<VALUE>>& settingValue, parseDirection direction, parseFormat format){
+template <typename VALUE> void cadidaq::settingsBase::parseSetting(std::string settingName, pt::iptree *node, channelValues<VALUE>& settingValue, parseDirection direction, parseFormat format){
+  if (direction == parseDirection::STORING || direction == parseDirection::LOADING){
+    snapshotSetting(settingName, settingValue, direction);
+    return;
+  }
   if (direction == parseDirection::READING){
-    std::vector<std::string> matchingKeys;
-    // get the setting's value from the ptree by looping over all entries of "settingName[RANGE]"
-    for (auto&& key : *node)
-      if (boost::istarts_with(key.first, settingName))
-        matchingKeys.push_back(key.first);
-
-    if (matchingKeys.empty()){
+    // get the setting's values from all entries of "settingName[RANGE]" in the index
+    std::vector<const settingsIndex::entry*> entries = index->find(settingName);
+    if (entries.empty()){
       CFG_LOG_DEBUG << "Found no matching keys for setting " << settingName;
       return;
     } else
-      CFG_LOG_DEBUG << "Found " << matchingKeys.size() << " matching keys for setting '" << settingName << "'";
-
-    for (auto&& it : matchingKeys){
-      // extract the range
-      std::string range = boost::erase_head_copy(it, settingName.length());
-      // remove the brackets or parenthesis and any remaining whitespace
-      boost::trim_left_if(range,boost::is_any_of("[("));
-      boost::trim_right_if(range,boost::is_any_of(")]"));
-      // make sure that there are no characters present that we can't parse
-      if (!boost::all(range,boost::is_any_of(",-*")||boost::is_digit() || boost::is_space())){
-        CFG_LOG_ERROR << "Could not parse range '" << range << "' specified in setting '" << it << "'. Only allowed characters are '*', '-', ',' and digits.";
+      CFG_LOG_DEBUG << "Found " << entries.size() << " matching keys for setting '" << settingName << "'";
+
+    std::vector<int> v;
+    for (auto entry : entries){
+      index->markUsed(entry);
+      const settingsIndex::entry& e = *entry;
+      if (!e.hasRange){
+        CFG_LOG_ERROR << "Setting '" << settingName << "' requires a channel range (e.g. '" << settingName << "[0-3]' or '" << settingName << "[*]') but was given as '" << e.key << "'. Ignored.";
         continue;
       }
-      // now split the range into individual channel numbers
-      std::vector<int> v;
-      // special treatment if the remaining character is an asterix
-      if (boost::find_first(range,"*")){
-        // use setting for all channels
-        for (int i = 0; i < settingValue.size(); i++) v.push_back(i);
+      // split the range into individual channel numbers
+      v.clear();
+      if (e.range.find('*') != std::string::npos){
+        // special treatment if the range contains an asterisk: use setting for all channels
+        for (int i = 0; i < static_cast<int>(settingValue.size()); i++) v.push_back(i);
         CFG_LOG_DEBUG << "   Found '*' in range -> using settings's value for all channels";
       } else {
-        // parse the range
-        v = expandRange(range);
+        try{
+          expandRange(e.range, v);
+        }
+        catch (std::invalid_argument& err){
+          CFG_LOG_ERROR << "Could not parse range '" << e.range << "' specified in setting '" << e.key << "' (" << err.what() << "). Only allowed characters are '*', '-', ',' and digits.";
+          continue;
+        }
       }
 
       // output the parsed range for debugging purposes
       std::stringstream expandedrange;
       for(auto x:v)
         expandedrange << std::to_string(x) << " ";
-      CFG_LOG_DEBUG << "   Expanded range '" << range << "' into " << expandedrange.str();
+      CFG_LOG_DEBUG << "   Expanded range '" << e.range << "' into " << expandedrange.str();
 
       // loop over parsed range and set the values in the settings vector
-      boost::optional<VALUE> value;
-      parseSetting(it, node, value, direction);
-      if (!value) continue; // value not valid, try next key
+      boost::optional<VALUE> value = convertValue<VALUE>(e.value);
+      if (!value){
+        CFG_LOG_ERROR << "Could not parse value '" << e.value << "' given for '" << e.key << "'";
+        CFG_LOG_ERROR << "\t Allowed values are: " << describeValidValues<VALUE>();
+        continue; // value not valid, try next key
+      }
       for(auto x:v){
-        try{
-          settingValue.at(x) = *value;
-        }
-        catch (const std::out_of_range& e) {
+        if (x < 0 || x >= static_cast<int>(settingValue.size())){
           CFG_LOG_ERROR << "Channel number '" << std::to_string(x) << "' in setting '" << settingName << "' is out of range!";
           continue;
         }
+        settingValue.set(x, *value);
       }
-    } // matchingKeys
+    } // entries
   } else {
     // direction: WRITING
     // TODO: write range compression to get setting string as in "settingName[RANGE]"
     // add key to ptree if the setting's value has been set
-    for (auto it = settingValue.begin(); it != settingValue.end(); ++it) {
-      auto index = std::distance(settingValue.begin(), it);
-      if (*it) {
+    for (unsigned index = 0; index < settingValue.size(); ++index) {
+      boost::optional<VALUE> value = settingValue.get(index);
+      if (value) {
         if (format == parseFormat::HEX){
           std::stringstream ss;
-          ss << std::hex << std::showbase << **it; // might need e.g. std::setfill ('0') and std::setw(sizeof(your_type)*2)
+          ss << std::hex << std::showbase << *value; // might need e.g. std::setfill ('0') and std::setw(sizeof(your_type)*2)
           node->put(settingName + "[" + std::to_string(index) + "]", ss.str());
         } else {
-          node->put(settingName + "[" + std::to_string(index) + "]", **it);
+          node->put(settingName + "[" + std::to_string(index) + "]", *value);
         }
       } else {
         // TODO: this log messages should be degraded to 'debug' at a later
@@ -228,50 +430,62 @@ template <typename VALUE> void cadidaq::settingsBase::parseSetting(std::string s
 
 void cadidaq::settingsBase::parseRegisters(pt::iptree *node, std::vector< std::pair< uint32_t, uint32_t >>& registers, parseDirection direction){
   std::string settingName = "SetRegister";
-  if (direction == parseDirection::READING){
-    std::vector<std::string> matchingKeys;
-    // get the setting's value from the ptree by looping over all entries of "settingName[RANGE]"
-    for (auto&& key : *node)
-      if (boost::istarts_with(key.first, settingName))
-        matchingKeys.push_back(key.first);
-
-    if (matchingKeys.empty()){
+  if (direction == parseDirection::STORING){
+    // the resolved list of address-value pairs in the order they are programmed
+    snapshotOut->put(settingName);
+    snapshotOut->put(static_cast<uint32_t>(registers.size()));
+    for (auto& r : registers){
+      snapshotOut->put(r.first);
+      snapshotOut->put(r.second);
+    }
+  } else if (direction == parseDirection::LOADING){
+    snapshotIn->expect(settingName);
+    uint32_t n;
+    snapshotIn->get(n);
+    registers.clear();
+    for (uint32_t i = 0; i < n; i++){
+      std::pair<uint32_t, uint32_t> r;
+      snapshotIn->get(r.first);
+      snapshotIn->get(r.second);
+      registers.push_back(r);
+    }
+  } else if (direction == parseDirection::READING){
+    // get the register values from all entries of "settingName[ADDRESSES]" in the index
+    std::vector<const settingsIndex::entry*> entries = index->find(settingName);
+    if (entries.empty()){
       CFG_LOG_DEBUG << "Found no matching keys for setting " << settingName;
       return;
     } else
-      CFG_LOG_DEBUG << "Found " << matchingKeys.size() << " matching keys for setting '" << settingName << "'";
-
-    for (auto&& it : matchingKeys){
-      // extract the range
-      std::string address = boost::erase_head_copy(it, settingName.length());
-      // remove the brackets or parenthesis and any remaining whitespace
-      boost::trim_left_if(address,boost::is_any_of("[("));
-      boost::trim_right_if(address,boost::is_any_of(")]"));
-      // make sure that there are no characters present that we can't parse
-      if (!boost::all(address,boost::is_any_of("x,")||boost::is_digit() || boost::is_space())){
-        CFG_LOG_ERROR << "Could not parse register address '" << address << "' specified in setting '" << it << "'. Only allowed characters are comma-separated hex values.";
-        continue;
-      }
-      // retrieve the key's value
-      boost::optional<uint32_t> value;
-      parseSetting(it, node, value, direction);
-      if (!value) continue; // value not valid, try next key
+      CFG_LOG_DEBUG << "Found " << entries.size() << " matching keys for setting '" << settingName << "'";
 
+    for (auto entry : entries){
+      index->markUsed(entry);
+      const settingsIndex::entry& e = *entry;
+      // retrieve the key's value
+      boost::optional<uint32_t> value = convertValue<uint32_t>(e.value);
+      if (!value){
+        CFG_LOG_ERROR << "Could not parse value '" << e.value << "' given for '" << e.key << "'";
+        CFG_LOG_ERROR << "\t Allowed values are: " << describeValidValues<uint32_t>();
+        continue; // value not valid, try next key
+      }
       // now split the potentially comma-separated address(es) into individual
       // addresses and keep the address-value pair in the given vector
-      std::vector<std::string> strs;
-      boost::split(strs,address,boost::is_any_of(","));
-      // expand values
-      for (auto it:strs){
-        boost::optional<uint32_t> adr = str2hex(it);
+      size_t start = 0;
+      while (start <= e.range.length()){
+        size_t end = e.range.find(',', start);
+        if (end == std::string::npos)
+          end = e.range.length();
+        std::string address = e.range.substr(start, end - start);
+        start = end + 1;
+        boost::optional<uint32_t> adr = str2hex(address);
         if (!adr){
-          CFG_LOG_ERROR << "Could not convert register address '" << it << "' to a number. Only allowed characters are comma-separated hex values.";
+          CFG_LOG_ERROR << "Could not convert register address '" << address << "' in setting '" << e.key << "' to a number. Only allowed characters are comma-separated hex values.";
           continue;
         }
         registers.push_back(std::make_pair(*adr, *value));
         CFG_LOG_DEBUG << "   Parsed config value '" << std::hex << std::showbase << *value <<  "' for register address " << *adr;
       }
-    } // matchingKeys
+    } // entries
   } else {
     // direction: WRITING
     for (auto it = registers.begin(); it != registers.end(); ++it) {
@@ -285,6 +499,18 @@ void cadidaq::settingsBase::parseRegisters(pt::iptree *node, std::vector< std::p
 }
 
 
+void cadidaq::settingsBase::verifyCPUs(option<std::string>& setting){
+  if (!setting.first)
+    return;
+  try {
+    affinity::parse(*setting.first);
+  }
+  catch (const std::invalid_argument& e){
+    CFG_LOG_ERROR << e.what() << " for '" << setting.second << "', the threads will not be pinned.";
+    setting.first = boost::none;
+  }
+}
+
 template <class VALUE> void cadidaq::settingsBase::parseSetting(option<VALUE>& setting, pt::iptree *node, parseDirection direction, parseFormat format){
   parseSetting(setting.second, node, setting.first, direction, format);
 }
@@ -293,6 +519,176 @@ template <typename VALUE> void cadidaq::settingsBase::parseSetting(optionVector<
 }
 
 
+cadidaq::daqSettings::daqSettings(std::string name) : cadidaq::settingsBase(name) {
+  // run control
+  runDuration         = std::make_pair(boost::none, "RunDuration");
+
+  // live data tap
+  liveTapName         = std::make_pair(boost::none, "LiveTapName");
+  liveTapSize         = std::make_pair(boost::none, "LiveTapSizeMB");
+  liveTapPrescale     = std::make_pair(boost::none, "LiveTapPrescale");
+
+  // readout buffer pool
+  readoutBuffers      = std::make_pair(boost::none, "ReadoutBuffers");
+  readoutThreads      = std::make_pair(boost::none, "ReadoutThreads");
+
+  // thread placement
+  readoutCPUs         = std::make_pair(boost::none, "ReadoutCPUs");
+  processingCPUs      = std::make_pair(boost::none, "ProcessingCPUs");
+  writerCPUs          = std::make_pair(boost::none, "WriterCPUs");
+
+  // processing
+  processingThreads   = std::make_pair(boost::none, "ProcessingThreads");
+  processingBatchSize = std::make_pair(boost::none, "ProcessingBatchKB");
+
+  // overflow control
+  overflowHighWatermark = std::make_pair(boost::none, "OverflowHighWatermarkPct");
+  overflowLowWatermark  = std::make_pair(boost::none, "OverflowLowWatermarkPct");
+
+  // data files
+  outputFile          = std::make_pair(boost::none, "OutputFile");
+  outputRotateSize    = std::make_pair(boost::none, "OutputRotateMB");
+  outputRotateEvents  = std::make_pair(boost::none, "OutputRotateEvents");
+  outputRotateTime    = std::make_pair(boost::none, "OutputRotateSeconds");
+  outputCompress      = std::make_pair(boost::none, "OutputCompressCommand");
+
+  // streaming
+  streamTarget        = std::make_pair(boost::none, "StreamTarget");
+  streamBatchSize     = std::make_pair(boost::none, "StreamBatchKB");
+  streamMaxDelay      = std::make_pair(boost::none, "StreamMaxDelayMs");
+
+  // metrics
+  metricsPort         = std::make_pair(boost::none, "MetricsPort");
+  metricsFile         = std::make_pair(boost::none, "MetricsFile");
+  metricsInterval     = std::make_pair(boost::none, "MetricsInterval");
+}
+
+void cadidaq::daqSettings::verify(){
+  if (runDuration.first && *runDuration.first == 0){
+    CFG_LOG_DEBUG << "'" << runDuration.second << "' set to '0': acquisition will run until interrupted.";
+    runDuration.first = boost::none;
+  }
+  if (liveTapName.first){
+    // POSIX shared memory object names have to start with a slash
+    if (!boost::starts_with(*liveTapName.first, "/"))
+      liveTapName.first = "/" + *liveTapName.first;
+    if (!liveTapSize.first){
+      CFG_LOG_DEBUG << "'" << liveTapSize.second << "' not set, assuming 64 MB.";
+      liveTapSize.first = 64;
+    }
+    if (!liveTapPrescale.first || *liveTapPrescale.first == 0){
+      CFG_LOG_DEBUG << "'" << liveTapPrescale.second << "' not set (or zero), publishing every event.";
+      liveTapPrescale.first = 1;
+    }
+  }
+  if (!readoutBuffers.first || *readoutBuffers.first == 0){
+    CFG_LOG_DEBUG << "'" << readoutBuffers.second << "' not set (or zero), using 2 readout buffers per board.";
+    readoutBuffers.first = 2;
+  }
+  if (readoutThreads.first && *readoutThreads.first == 0)
+    readoutThreads.first = boost::none;
+  verifyCPUs(readoutCPUs);
+  verifyCPUs(processingCPUs);
+  verifyCPUs(writerCPUs);
+  if (!processingThreads.first || *processingThreads.first == 0){
+    // one worker per CPU the processing is placed on
+    processingThreads.first = processingCPUs.first ? affinity::parse(*processingCPUs.first).size() : 1;
+    CFG_LOG_DEBUG << "'" << processingThreads.second << "' not set (or zero), using " << *processingThreads.first << " processing thread(s).";
+  }
+  if (!processingBatchSize.first || *processingBatchSize.first == 0){
+    CFG_LOG_DEBUG << "'" << processingBatchSize.second << "' not set (or zero), splitting the readout buffers into batches of 64 kB.";
+    processingBatchSize.first = 64;
+  }
+  if (!overflowHighWatermark.first || *overflowHighWatermark.first == 0 || *overflowHighWatermark.first > 100){
+    CFG_LOG_DEBUG << "'" << overflowHighWatermark.second << "' not set (or not within 1 to 100), applying the overflow policies from 75 % of the readout buffers in use.";
+    overflowHighWatermark.first = 75;
+  }
+  if (!overflowLowWatermark.first || *overflowLowWatermark.first > *overflowHighWatermark.first){
+    if (overflowLowWatermark.first)
+      CFG_LOG_WARN << "'" << overflowLowWatermark.second << "' above '" << overflowHighWatermark.second << "', using " << *overflowHighWatermark.first * 2 / 3 << " %.";
+    overflowLowWatermark.first = *overflowHighWatermark.first * 2 / 3;
+  }
+  if (outputFile.first){
+    // zero for no limit
+    for (auto limit : {&outputRotateSize, &outputRotateEvents, &outputRotateTime})
+      if (limit->first && *limit->first == 0)
+        limit->first = boost::none;
+    if (!outputRotateSize.first && !outputRotateEvents.first && !outputRotateTime.first){
+      CFG_LOG_DEBUG << "None of '" << outputRotateSize.second << "', '" << outputRotateEvents.second << "' and '" << outputRotateTime.second
+                    << "' set, starting a new data file every 1024 MB.";
+      outputRotateSize.first = 1024;
+    }
+  }
+  if (streamTarget.first){
+    if (!streamBatchSize.first || *streamBatchSize.first == 0){
+      CFG_LOG_DEBUG << "'" << streamBatchSize.second << "' not set (or zero), streaming in batches of 256 kB.";
+      streamBatchSize.first = 256;
+    }
+    if (!streamMaxDelay.first){
+      CFG_LOG_DEBUG << "'" << streamMaxDelay.second << "' not set, sending what has waited for 10 ms.";
+      streamMaxDelay.first = 10;
+    }
+  }
+  if (metricsPort.first && (*metricsPort.first == 0 || *metricsPort.first > 65535)){
+    CFG_LOG_ERROR << "'" << metricsPort.second << "' has to be a TCP port number between 1 and 65535, metrics will not be served.";
+    metricsPort.first = boost::none;
+  }
+  if ((metricsPort.first || metricsFile.first) && (!metricsInterval.first || *metricsInterval.first == 0)){
+    CFG_LOG_DEBUG << "'" << metricsInterval.second << "' not set (or zero), sampling metrics every 5 s.";
+    metricsInterval.first = 5;
+  }
+  CFG_LOG_DEBUG << "Done with verifying DAQ settings.";
+}
+
+void cadidaq::daqSettings::processPTree(pt::iptree *node, parseDirection direction){
+  // this routine implements the calls to ParseSetting for individual settings read from config or stored internally
+
+  // run control
+  parseSetting(runDuration, node, direction);
+
+  // live data tap
+  parseSetting(liveTapName, node, direction);
+  parseSetting(liveTapSize, node, direction);
+  parseSetting(liveTapPrescale, node, direction);
+
+  // readout buffer pool
+  parseSetting(readoutBuffers, node, direction);
+  parseSetting(readoutThreads, node, direction);
+
+  // thread placement
+  parseSetting(readoutCPUs, node, direction);
+  parseSetting(processingCPUs, node, direction);
+  parseSetting(writerCPUs, node, direction);
+
+  // processing
+  parseSetting(processingThreads, node, direction);
+  parseSetting(processingBatchSize, node, direction);
+
+  // overflow control
+  parseSetting(overflowHighWatermark, node, direction);
+  parseSetting(overflowLowWatermark, node, direction);
+
+  // data files
+  parseSetting(outputFile, node, direction);
+  parseSetting(outputRotateSize, node, direction);
+  parseSetting(outputRotateEvents, node, direction);
+  parseSetting(outputRotateTime, node, direction);
+  parseSetting(outputCompress, node, direction);
+
+  // streaming
+  parseSetting(streamTarget, node, direction);
+  parseSetting(streamBatchSize, node, direction);
+  parseSetting(streamMaxDelay, node, direction);
+
+  // metrics
+  parseSetting(metricsPort, node, direction);
+  parseSetting(metricsFile, node, direction);
+  parseSetting(metricsInterval, node, direction);
+
+  CFG_LOG_DEBUG << "Done with processing DAQ settings property tree";
+}
+
+
 void cadidaq::connectionSettings::verify(){
 
   if (!linkType){
@@ -332,6 +728,16 @@ void cadidaq::connectionSettings::processPTree(pt::iptree *node, parseDirection
 cadidaq::registerSettings::registerSettings(std::string name, uint nchannels) : cadidaq::settingsBase(name) {
   // data readout
   maxNumEventsBLT     = std::make_pair(boost::none, "Expert_MaxNumEventsBLT");
+  readoutSizing       = std::make_pair(boost::none, "ReadoutSizing");
+  readoutMode         = std::make_pair(boost::none, "ReadoutMode");
+  readoutMaxInterval  = std::make_pair(boost::none, "ReadoutMaxIntervalUs");
+  readoutIRQEvents    = std::make_pair(boost::none, "ReadoutIRQEvents");
+  readoutThread       = std::make_pair(boost::none, "ReadoutThread");
+  readoutCPUs         = std::make_pair(boost::none, "ReadoutCPUs");
+  overflowPolicy      = std::make_pair(boost::none, "OverflowPolicy");
+  overflowPrescale    = std::make_pair(boost::none, "OverflowPrescale");
+  eventFilter         = std::make_pair(boost::none, "EventFilter");
+  healthInterval      = std::make_pair(boost::none, "HealthIntervalMs");
 
   // trigger settings
   swTriggerMode       = std::make_pair(boost::none, "SWTriggerMode");
@@ -356,6 +762,7 @@ cadidaq::registerSettings::registerSettings(std::string name, uint nchannels) :
   dppChPulsePolarity  = std::make_pair(Vec<CAEN_DGTZ_PulsePolarity_t>(nchannels), "DPPChannelPulsePolarity");
   dppAcqMode = std::make_pair(boost::none, "DPPAcquisitionMode");
   dppTriggermode      = std::make_pair(boost::none, "DPPTriggerMode");
+  dppEventAggregation = std::make_pair(boost::none, "DPPEventAggregation");
 
 }
 
@@ -366,6 +773,16 @@ void cadidaq::registerSettings::processPTree(pt::iptree *node, parseDirection di
 
   // data readout
   parseSetting(maxNumEventsBLT, node, direction);
+  parseSetting(readoutSizing, node, direction);
+  parseSetting(readoutMode, node, direction);
+  parseSetting(readoutMaxInterval, node, direction);
+  parseSetting(readoutIRQEvents, node, direction);
+  parseSetting(readoutThread, node, direction);
+  parseSetting(readoutCPUs, node, direction);
+  parseSetting(overflowPolicy, node, direction);
+  parseSetting(overflowPrescale, node, direction);
+  parseSetting(eventFilter, node, direction);
+  parseSetting(healthInterval, node, direction);
 
   // trigger
   parseSetting(swTriggerMode, node, direction);
@@ -390,6 +807,7 @@ void cadidaq::registerSettings::processPTree(pt::iptree *node, parseDirection di
   parseSetting(dppChPulsePolarity, node, direction);
   //parseSetting(dppAcqMode, node, direction);
   parseSetting(dppTriggermode, node, direction);
+  parseSetting(dppEventAggregation, node, direction);
 
   // register address-value settings
   parseRegisters(node, registerValues, direction);
@@ -403,10 +821,56 @@ void cadidaq::registerSettings::verify(){
   // TODO: implement "light" checks on e.g. critical options that are valid for all supported digitizer types/families (nothing model-dependent)
 
   // check that at least one channel is set to enable
-  if (countTrue(chEnable.first) == 0)
+  if (chEnable.first.countTrue() == 0)
     CFG_LOG_WARN << "No channel has been set to be enabled using setting '" << chEnable.second << "'!";
   else
-    CFG_LOG_DEBUG << "Setting '" << chEnable.second << "' enables " << countTrue(chEnable.first) << " channels.";
+    CFG_LOG_DEBUG << "Setting '" << chEnable.second << "' enables " << chEnable.first.countTrue() << " channels.";
+
+  // readout sizing
+  if (!readoutSizing.first){
+    readoutSizing.first = std::string("Manual");
+  } else if (!boost::iequals(*readoutSizing.first, "Manual") && !boost::iequals(*readoutSizing.first, "Auto") && !boost::iequals(*readoutSizing.first, "Calibrate")){
+    CFG_LOG_ERROR << "Unknown value '" << *readoutSizing.first << "' for '" << readoutSizing.second << "', allowed values are: Manual, Auto, Calibrate. Using 'Manual'.";
+    readoutSizing.first = std::string("Manual");
+  }
+
+  // readout scheduling
+  if (!readoutMode.first){
+    readoutMode.first = std::string("Adaptive");
+  } else if (!boost::iequals(*readoutMode.first, "Adaptive") && !boost::iequals(*readoutMode.first, "Poll") && !boost::iequals(*readoutMode.first, "IRQ")){
+    CFG_LOG_ERROR << "Unknown value '" << *readoutMode.first << "' for '" << readoutMode.second << "', allowed values are: Adaptive, Poll, IRQ. Using 'Adaptive'.";
+    readoutMode.first = std::string("Adaptive");
+  }
+  if (!readoutMaxInterval.first || *readoutMaxInterval.first == 0){
+    CFG_LOG_DEBUG << "'" << readoutMaxInterval.second << "' not set (or zero), reading the board at least every 10 ms.";
+    readoutMaxInterval.first = 10000;
+  }
+  if (!readoutIRQEvents.first || *readoutIRQEvents.first == 0)
+    readoutIRQEvents.first = 1;
+  if (readoutThread.first){
+    boost::algorithm::trim(*readoutThread.first);
+    if (readoutThread.first->empty())
+      readoutThread.first = boost::none;
+  }
+  verifyCPUs(readoutCPUs);
+
+  // overflow control
+  if (!overflowPolicy.first){
+    overflowPolicy.first = std::string("Block");
+  } else if (!boost::iequals(*overflowPolicy.first, "Block") && !boost::iequals(*overflowPolicy.first, "DropOldest")
+             && !boost::iequals(*overflowPolicy.first, "Prescale") && !boost::iequals(*overflowPolicy.first, "FeaturesOnly")){
+    CFG_LOG_ERROR << "Unknown value '" << *overflowPolicy.first << "' for '" << overflowPolicy.second << "', allowed values are: Block, DropOldest, Prescale, FeaturesOnly. Using 'Block'.";
+    overflowPolicy.first = std::string("Block");
+  }
+  if (!overflowPrescale.first || *overflowPrescale.first < 2){
+    if (boost::iequals(*overflowPolicy.first, "Prescale"))
+      CFG_LOG_DEBUG << "'" << overflowPrescale.second << "' not set (or below 2), keeping every 10th event while overflowing.";
+    overflowPrescale.first = 10;
+  }
+
+  // health polling
+  if (!healthInterval.first)
+    healthInterval.first = 1000;
 
   // DPPAcquisitionMode requires two parameters to be set
 /*  if ((dppAcqMode.first && !dppAcqModeParam.first) || (!dppAcqMode.first && dppAcqModeParam.first)){
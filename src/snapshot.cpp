@@ -0,0 +1,101 @@
+#include <snapshot.hpp>
+
+#include <cerrno>
+#include <cstdio>    // rename, remove
+#include <ctime>
+#include <fstream>
+
+#include <boost/crc.hpp>
+
+// memory mapping
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace layout = cadidaq::snapshotLayout;
+
+uint32_t cadidaq::checksum(const char* data, size_t size){
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+void cadidaq::snapshotWriter::save(const std::string& file, uint64_t sourceSize, uint32_t sourceChecksum){
+  layout::fileHeader header = {};
+  std::memcpy(header.magic, layout::magic, sizeof(header.magic));
+  header.version         = layout::version;
+  header.payloadChecksum = checksum(data.data(), data.size());
+  header.payloadSize     = data.size();
+  header.sourceSize      = sourceSize;
+  header.sourceChecksum  = sourceChecksum;
+  header.created         = std::time(nullptr);
+
+  // write to a temporary file first so that an interrupted write never leaves a damaged snapshot behind
+  std::string tmpFile = file + ".tmp";
+  {
+    std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(data.data(), data.size());
+    out.close();
+    if (!out){
+      std::remove(tmpFile.c_str());
+      throw std::runtime_error("Could not write configuration snapshot '" + tmpFile + "'");
+    }
+  }
+  if (std::rename(tmpFile.c_str(), file.c_str()) != 0){
+    std::remove(tmpFile.c_str());
+    throw std::runtime_error("Could not replace configuration snapshot '" + file + "': " + strerror(errno));
+  }
+}
+
+cadidaq::snapshotReader::snapshotReader(const std::string& file)
+  : file(file), mapping(nullptr), mappingSize(0), header(nullptr), pos(nullptr), end(nullptr) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Could not open configuration snapshot '" + file + "': " + strerror(errno));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(layout::fileHeader)){
+    close(fd);
+    throw std::runtime_error("Configuration snapshot '" + file + "' is too small");
+  }
+  mappingSize = st.st_size;
+  mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED){
+    mapping = nullptr;
+    throw std::runtime_error("Could not map configuration snapshot '" + file + "': " + strerror(errno));
+  }
+  header = static_cast<const layout::fileHeader*>(mapping);
+  std::string problem;
+  if (std::memcmp(header->magic, layout::magic, sizeof(header->magic)) != 0)
+    problem = "is not a configuration snapshot";
+  else if (header->version != layout::version)
+    problem = "was written by an incompatible version (" + std::to_string(header->version) + ")";
+  else if (header->payloadSize != mappingSize - sizeof(layout::fileHeader))
+    problem = "has an inconsistent size";
+  else if (checksum(static_cast<const char*>(mapping) + sizeof(layout::fileHeader), header->payloadSize) != header->payloadChecksum)
+    problem = "is damaged (checksum mismatch)";
+  if (!problem.empty()){
+    munmap(mapping, mappingSize);
+    throw std::runtime_error("Configuration snapshot '" + file + "' " + problem);
+  }
+  pos = static_cast<const char*>(mapping) + sizeof(layout::fileHeader);
+  end = pos + header->payloadSize;
+}
+
+cadidaq::snapshotReader::~snapshotReader(){
+  if (mapping)
+    munmap(mapping, mappingSize);
+}
+
+bool cadidaq::snapshotReader::matchesSource(uint64_t size, uint32_t checksum) const{
+  return header->sourceSize == size && header->sourceChecksum == checksum;
+}
+
+void cadidaq::snapshotReader::expect(const std::string& name){
+  std::string stored;
+  get(stored);
+  if (stored != name)
+    throw std::runtime_error("Configuration snapshot '" + file + "' has '" + stored + "' where '" + name + "' was expected");
+}
@@ -0,0 +1,131 @@
+#include <streamReceiver.hpp>
+#include <streamSocket.hpp>
+
+#include <cstring>   // memcpy, memmove, memset, strnlen
+#include <cerrno>
+#include <stdexcept> // exceptions
+#include <algorithm> // max
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace layout = cadidaq::dataFileLayout;
+
+namespace {
+  /// initial size of the receive buffer (grown for larger records)
+  const size_t bufferSize = 4*1024*1024;
+  /// largest record accepted (anything larger is taken for a corrupt stream)
+  const size_t maxRecordSize = 1024*1024*1024;
+  /// longest time a sender may take to send the header of its stream once connected
+  const std::chrono::seconds headerTimeout(5);
+}
+
+cadidaq::streamReceiver::streamReceiver(const std::string& address)
+  : listener(-1), fd(-1), buffer(bufferSize), begin(0), end(0), pending(0), bytes(0) {
+  std::memset(&header, 0, sizeof(header));
+  std::string error;
+  listener = streamSocket::listen(address, error);
+  if (listener < 0)
+    throw std::runtime_error("Could not listen for a data stream at '" + address + "': " + error);
+  this->address = streamSocket::localAddress(listener);
+}
+
+cadidaq::streamReceiver::~streamReceiver(){
+  disconnect();
+  close(listener);
+}
+
+void cadidaq::streamReceiver::disconnect(){
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+  begin = end = pending = 0;
+}
+
+bool cadidaq::streamReceiver::accept(std::chrono::milliseconds timeout){
+  struct pollfd p = {listener, POLLIN, 0};
+  if (poll(&p, 1, timeout.count()) <= 0)
+    return false;
+  int s = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+  if (s < 0)
+    return false;
+  disconnect();
+  fd = s;
+  bytes = 0;
+  auto deadline = clock::now() + headerTimeout;
+  if (!fill(sizeof(layout::fileHeader), deadline)){
+    disconnect();
+    return false;
+  }
+  std::memcpy(&header, buffer.data(), sizeof(header));
+  begin = sizeof(header);
+  if (header.magic != layout::magic || header.version != layout::version || !fill(layout::align(header.configurationSize), deadline)){
+    disconnect();
+    return false;
+  }
+  configuration.assign(buffer.data() + begin, header.configurationSize);
+  begin += layout::align(header.configurationSize);
+  return true;
+}
+
+std::string cadidaq::streamReceiver::getBoardName(uint16_t board) const {
+  if (board >= header.nboards || board >= layout::maxBoards)
+    return std::string();
+  return std::string(header.boardNames[board], strnlen(header.boardNames[board], layout::nameLength));
+}
+
+bool cadidaq::streamReceiver::fill(size_t size, clock::time_point deadline){
+  if (begin + size > buffer.size()){
+    // keep the data not handed out yet at the front (records stay aligned, 'begin' is a multiple of 8)
+    std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    if (size > buffer.size())
+      buffer.resize(size);
+  }
+  while (end - begin < size){
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+    struct pollfd p = {fd, POLLIN, 0};
+    int ready = poll(&p, 1, std::max<int64_t>(left, 0));
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready == 0)
+      return false;
+    ssize_t n = recv(fd, buffer.data() + end, buffer.size() - end, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+    if (n <= 0){
+      disconnect();
+      return false;
+    }
+    end += n;
+    bytes += n;
+  }
+  return true;
+}
+
+const cadidaq::dataFileLayout::recordHeader* cadidaq::streamReceiver::next(std::chrono::milliseconds timeout){
+  if (fd < 0)
+    return nullptr;
+  begin += pending;
+  pending = 0;
+  // (a record arriving in part stays buffered for the next call)
+  auto deadline = clock::now() + timeout;
+  if (!fill(sizeof(layout::recordHeader), deadline))
+    return nullptr;
+  uint32_t size = reinterpret_cast<const layout::recordHeader*>(buffer.data() + begin)->size;
+  if (size < sizeof(layout::recordHeader) || size > maxRecordSize){
+    disconnect();
+    return nullptr;
+  }
+  if (!fill(size, deadline))
+    return nullptr;
+  const layout::recordHeader* r = reinterpret_cast<const layout::recordHeader*>(buffer.data() + begin);
+  if (!layout::validRecord(*r, 0, size)){
+    disconnect();
+    return nullptr;
+  }
+  pending = size;
+  return r;
+}
@@ -0,0 +1,357 @@
+#include <streamSink.hpp>
+#include <streamSocket.hpp>
+#include <event.hpp>
+
+#include <cassert>
+#include <cstring>   // memcpy, memmove, memset, strncpy, strerror
+#include <cerrno>
+#include <climits>   // IOV_MAX
+#include <algorithm> // min, max, min_element, max_element
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// logging
+#include <boost/log/attributes/constant.hpp>
+
+#define STR_LOG_DEBUG BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::debug)
+#define STR_LOG_INFO  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::info)
+#define STR_LOG_WARN  BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::warning)
+#define STR_LOG_ERROR BOOST_LOG_CHANNEL_SEV(lg, "daq", boost::log::trivial::error)
+
+#define SND_LOG_INFO  BOOST_LOG_CHANNEL_SEV(senderLg, "daq", boost::log::trivial::info)
+#define SND_LOG_WARN  BOOST_LOG_CHANNEL_SEV(senderLg, "daq", boost::log::trivial::warning)
+#define SND_LOG_ERROR BOOST_LOG_CHANNEL_SEV(senderLg, "daq", boost::log::trivial::error)
+
+namespace layout = cadidaq::dataFileLayout;
+
+namespace {
+  /// time between attempts to connect to the receiver
+  const std::chrono::seconds reconnectInterval(1);
+  /// longest time a send may block before the receiver is taken for stalled and the connection is dropped
+  const struct timeval sendTimeout = {5, 0};
+  /// scatter-gather entries of a record: header, payload and padding, or header and the five columns of an event batch
+  const size_t iovPerRecord = 6;
+  const char padding[8] = {};
+
+  /// sends all of 'size' bytes, returns false on error
+  bool sendAll(int fd, const char* data, size_t size){
+    while (size){
+      ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+}
+
+cadidaq::streamSink::streamSink(const std::string& address, const std::vector<std::string>& boardNames, const std::vector<dppFormat>& formats,
+                                const std::string& configuration, uint32_t batchBytes, std::chrono::milliseconds maxDelay,
+                                uint32_t maxBuffers, uint32_t spareBatches, size_t batchEvents, stageMetrics& stats, const affinity::cpuList& cpus)
+  : address(address), batchBytes(batchBytes), maxDelay(std::chrono::duration_cast<clock::duration>(maxDelay)), stats(stats), cpus(cpus),
+    head(0), count(0), queuedBytes(0), closing(false), fd(-1), sentBytes(0), sentRecords(0), droppedBytes(0), droppedRecords(0),
+    droppedSinceConnected(0), connections(0), unreachableReported(false) {
+  lg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("stream"));
+  senderLg.add_attribute("Digitizer", boost::log::attributes::constant<std::string>("stream"));
+  auto now = std::chrono::system_clock::now();
+  started = clock::now();
+
+  // every connection starts like a data file
+  layout::fileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic             = layout::magic;
+  header.version           = layout::version;
+  header.nboards           = std::min<size_t>(boardNames.size(), layout::maxBoards);
+  header.runStart          = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+  header.fileStart         = header.runStart;
+  header.configurationSize = configuration.size();
+  for (uint32_t b = 0; b < header.nboards; b++){
+    std::strncpy(header.boardNames[b], boardNames[b].c_str(), layout::nameLength - 1);
+    header.dppFormats[b] = b < formats.size() ? static_cast<uint8_t>(formats[b]) : 0;
+  }
+  preamble.resize(sizeof(header) + layout::align(configuration.size()), 0);
+  std::memcpy(preamble.data(), &header, sizeof(header));
+  std::memcpy(preamble.data() + sizeof(header), configuration.data(), configuration.size());
+
+  // all memory is allocated up front: each buffer and spare batch is queued at most once
+  lastTimestamp.resize(boardNames.size(), 0);
+  records.resize(maxBuffers + spareBatches);
+  batches.resize(spareBatches);
+  for (uint32_t b = 0; b < spareBatches; b++){
+    batches[b].reserve(batchEvents);
+    freeBatches.push_back(b);
+  }
+
+  STR_LOG_INFO << "Streaming the data to " << address << " in batches of " << batchBytes/1024 << " kB, sending what has waited "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(maxDelay).count() << " ms at the latest";
+  sender = std::thread(&streamSink::runSender, this);
+}
+
+cadidaq::streamSink::~streamSink(){
+  close();
+}
+
+void cadidaq::streamSink::sendEvents(const readoutQueue::item& item, uint64_t sequence, uint64_t firstEvent, uint32_t prescale, bool featuresOnly){
+  if (prescale == 0)
+    prescale = 1;
+  char* data = item.pool->get(item.buffer).data;
+  // the events kept are moved to the front of the buffer (their data is only ever moved towards it, so the events
+  // still to be looked at are not overwritten)
+  bool reduce = prescale > 1 || featuresOnly;
+  uint32_t payloadSize = 0;
+  uint32_t nevents = 0;
+  uint64_t index = firstEvent;
+  uint64_t& timestamp = lastTimestamp[item.board];
+  uint64_t minTimestamp = ~static_cast<uint64_t>(0);
+  uint64_t maxTimestamp = 0;
+  forEachEvent(data, item.nbytes, [&](const eventHeader& event){
+      // (the roll-overs are counted over all events of the board)
+      timestamp = layout::extendTimeTag(timestamp, event.triggerTimeTag);
+      if (index++ % prescale != 0)
+        return;
+      minTimestamp = std::min(minTimestamp, timestamp);
+      maxTimestamp = std::max(maxTimestamp, timestamp);
+      uint32_t words = featuresOnly ? eventHeaderWords : event.size;
+      if (reduce){
+        uint32_t* out = reinterpret_cast<uint32_t*>(data + payloadSize);
+        std::memmove(out, event.data, words * sizeof(uint32_t));
+        // the header alone is a complete event
+        if (featuresOnly)
+          out[0] = (out[0] & 0xF0000000) | eventHeaderWords;
+      }
+      payloadSize += words * sizeof(uint32_t);
+      nevents++;
+    });
+  if (nevents == 0){
+    item.pool->release(item.buffer);
+    return;
+  }
+  record r;
+  std::memset(&r.header, 0, sizeof(r.header));
+  r.header.size         = sizeof(layout::recordHeader) + layout::align(payloadSize);
+  r.header.board        = item.board;
+  r.header.type         = layout::EVENTS;
+  r.header.sequence     = sequence;
+  r.header.firstEvent   = firstEvent;
+  r.header.nevents      = nevents;
+  r.header.prescale     = prescale;
+  r.header.flags        = (featuresOnly ? layout::FEATURES_ONLY : layout::NONE) | (prescale > 1 ? layout::PRESCALED : layout::NONE);
+  r.header.payloadSize  = payloadSize;
+  r.header.minTimestamp = minTimestamp;
+  r.header.maxTimestamp = maxTimestamp;
+  r.payload = data;
+  r.pool    = item.pool;
+  r.buffer  = item.buffer;
+  r.batch   = noBatch;
+  std::unique_lock<std::mutex> lock(mutex);
+  queue(lock, r);
+}
+
+void cadidaq::streamSink::sendDPP(dppEventBatch& batch, uint64_t firstEvent, uint32_t prescale){
+  size_t n = batch.size();
+  if (n == 0)
+    return;
+  uint32_t spare;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    batchFree.wait(lock, [this]{return !freeBatches.empty();});
+    spare = freeBatches.back();
+    freeBatches.pop_back();
+  }
+  // the batch is sent from where it was decoded, the processing decodes into the spare's storage from now on
+  std::swap(batches[spare], batch);
+  const dppEventBatch& events = batches[spare];
+  record r;
+  std::memset(&r.header, 0, sizeof(r.header));
+  r.header.size         = sizeof(layout::recordHeader) + n * (sizeof(uint64_t) + 4 * sizeof(uint16_t));
+  r.header.board        = events.board;
+  r.header.type         = layout::DPP_EVENTS;
+  r.header.sequence     = events.sequence;
+  r.header.firstEvent   = firstEvent;
+  r.header.nevents      = n;
+  r.header.prescale     = prescale ? prescale : 1;
+  r.header.flags        = layout::FEATURES_ONLY | (prescale > 1 ? layout::PRESCALED : layout::NONE);
+  r.header.payloadSize  = r.header.size - sizeof(layout::recordHeader);
+  // (the events of the channels are not in time order)
+  r.header.minTimestamp = *std::min_element(events.timestamp.begin(), events.timestamp.end());
+  r.header.maxTimestamp = *std::max_element(events.timestamp.begin(), events.timestamp.end());
+  r.payload = nullptr;
+  r.pool    = nullptr;
+  r.buffer  = bufferPool::none;
+  r.batch   = spare;
+  std::unique_lock<std::mutex> lock(mutex);
+  queue(lock, r);
+}
+
+void cadidaq::streamSink::queue(std::unique_lock<std::mutex>& lock, record& r){
+  assert(lock.owns_lock() && lock.mutex() == &mutex);
+  r.queued = clock::now();
+  r.header.writeTime = std::chrono::duration_cast<std::chrono::nanoseconds>(r.queued - started).count();
+  records[(head + count) % records.size()] = r;
+  count++;
+  queuedBytes += r.header.size;
+  // the sender waits for the first record's deadline or a full batch
+  if (count == 1 || queuedBytes >= batchBytes)
+    queued.notify_one();
+}
+
+void cadidaq::streamSink::close(){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closing)
+      return;
+    closing = true;
+  }
+  queued.notify_one();
+  if (sender.joinable())
+    sender.join();
+  STR_LOG_INFO << "Streamed " << sentRecords << " records (" << sentBytes/(1024*1024) << " MB) to " << address << " over "
+               << connections << " connection(s)";
+  if (droppedRecords)
+    STR_LOG_WARN << "Discarded " << droppedRecords << " records (" << droppedBytes/(1024*1024) << " MB) while not connected to " << address;
+}
+
+bool cadidaq::streamSink::connect(){
+  auto now = clock::now();
+  if (now < nextAttempt)
+    return false;
+  nextAttempt = now + reconnectInterval;
+  std::string error;
+  int s = streamSocket::connect(address, error);
+  if (s >= 0){
+    // a receiver not taking the data is given up on rather than blocking the sender (and the buffers) for good
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+    layout::fileHeader* header = reinterpret_cast<layout::fileHeader*>(preamble.data());
+    header->fileNumber = connections;
+    header->fileStart = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!sendAll(s, preamble.data(), preamble.size())){
+      error = strerror(errno);
+      ::close(s);
+      s = -1;
+    }
+  }
+  if (s < 0){
+    if (!unreachableReported)
+      SND_LOG_WARN << "Could not connect to " << address << " (" << error << "), trying again every "
+                   << reconnectInterval.count() << " s and discarding the data meanwhile";
+    unreachableReported = true;
+    return false;
+  }
+  fd = s;
+  connections++;
+  unreachableReported = false;
+  SND_LOG_INFO << "Connected to " << address
+               << (droppedSinceConnected ? ", " + std::to_string(droppedSinceConnected) + " records discarded while not connected" : "");
+  droppedSinceConnected = 0;
+  return true;
+}
+
+bool cadidaq::streamSink::sendRecords(size_t first, size_t n){
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++){
+    record& r = records[(first + i) % records.size()];
+    iov[k++] = {&r.header, sizeof(layout::recordHeader)};
+    if (r.payload){
+      iov[k++] = {const_cast<char*>(r.payload), r.header.payloadSize};
+      size_t pad = r.header.size - sizeof(layout::recordHeader) - r.header.payloadSize;
+      if (pad)
+        iov[k++] = {const_cast<char*>(padding), pad};
+    } else {
+      dppEventBatch& b = batches[r.batch];
+      iov[k++] = {b.timestamp.data(), b.size() * sizeof(uint64_t)};
+      for (std::vector<uint16_t>* column : {&b.channel, &b.energy, &b.chargeShort, &b.flags})
+        iov[k++] = {column->data(), b.size() * sizeof(uint16_t)};
+    }
+  }
+  struct iovec* v = iov.data();
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  while (k){
+    msg.msg_iov = v;
+    msg.msg_iovlen = k;
+    ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0){
+      SND_LOG_WARN << "Lost the connection to " << address << " (" << (sent < 0 ? strerror(errno) : "closed") << "), reconnecting";
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+    // skip what went out (possibly part of an entry)
+    while (k && static_cast<size_t>(sent) >= v->iov_len){
+      sent -= v->iov_len;
+      v++;
+      k--;
+    }
+    if (k){
+      v->iov_base = static_cast<char*>(v->iov_base) + sent;
+      v->iov_len -= sent;
+    }
+  }
+  return true;
+}
+
+void cadidaq::streamSink::runSender(){
+  if (!affinity::pin(cpus))
+    SND_LOG_ERROR << "Could not pin the sender to CPUs " << affinity::describe(cpus) << ", running it on any CPU.";
+  else if (!cpus.empty())
+    SND_LOG_INFO << "Sender on CPUs " << affinity::describe(affinity::current());
+  iov.resize(std::max<size_t>(iovPerRecord, std::min<size_t>(IOV_MAX, records.size() * iovPerRecord)));
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true){
+    // a full batch, the oldest record's deadline or the end
+    while (!closing && (count == 0 || (queuedBytes < batchBytes && clock::now() < records[head].queued + maxDelay))){
+      if (count == 0)
+        queued.wait(lock);
+      else
+        queued.wait_until(lock, records[head].queued + maxDelay);
+    }
+    if (count == 0)
+      break;
+    size_t first = head;
+    size_t n = std::min(count, iov.size() / iovPerRecord);
+    lock.unlock();
+
+    auto sendStart = clock::now();
+    bool sent = (fd >= 0 || connect()) && sendRecords(first, n);
+    uint64_t nbytes = 0;
+    for (size_t i = 0; i < n; i++)
+      nbytes += records[(first + i) % records.size()].header.size;
+    if (sent){
+      sentBytes += nbytes;
+      sentRecords += n;
+      stats.items.add(n);
+    } else {
+      droppedBytes += nbytes;
+      droppedRecords += n;
+      droppedSinceConnected += n;
+      stats.errors.add(n);
+    }
+    stats.busyNanoseconds.add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - sendStart).count());
+
+    lock.lock();
+    for (size_t i = 0; i < n; i++){
+      record& r = records[(first + i) % records.size()];
+      if (r.pool)
+        r.pool->release(r.buffer);
+      else {
+        batches[r.batch].clear();
+        freeBatches.push_back(r.batch);
+      }
+    }
+    if (!freeBatches.empty())
+      batchFree.notify_one();
+    head = (head + n) % records.size();
+    count -= n;
+    queuedBytes -= nbytes;
+  }
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
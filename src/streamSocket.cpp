@@ -0,0 +1,161 @@
+#include <streamSocket.hpp>
+
+#include <cstring>   // memset, strncpy, strerror
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+namespace {
+  const std::string unixPrefix = "unix:";
+
+  /// splits "host:port" (the host possibly in brackets for IPv6); returns false if there is no port
+  bool splitHostPort(const std::string& address, std::string& host, std::string& port){
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size())
+      return false;
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+      host = host.substr(1, host.size() - 2);
+    return true;
+  }
+
+  /// fills in the address of a Unix domain socket; returns false if the path is too long
+  bool unixAddress(const std::string& path, struct sockaddr_un& sa){
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(sa.sun_path))
+      return false;
+    std::strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+    return true;
+  }
+
+  /// calls f(addrinfo*) for the addresses 'host:port' resolves to until it returns a socket; returns it or -1
+  template <typename F>
+  int forEachAddress(const std::string& address, bool passive, std::string& error, F f){
+    std::string host, port;
+    if (!splitHostPort(address, host, port)){
+      error = "'" + address + "' is neither host:port nor unix:/path";
+      return -1;
+    }
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    struct addrinfo* found = nullptr;
+    int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+    if (status != 0){
+      error = "could not resolve '" + address + "': " + gai_strerror(status);
+      return -1;
+    }
+    int s = -1;
+    for (struct addrinfo* ai = found; ai && s < 0; ai = ai->ai_next){
+      s = f(ai);
+      if (s < 0)
+        error = std::string(strerror(errno));
+    }
+    freeaddrinfo(found);
+    return s;
+  }
+}
+
+int cadidaq::streamSocket::connect(const std::string& address, std::string& error){
+  if (address.compare(0, unixPrefix.size(), unixPrefix) == 0){
+    struct sockaddr_un sa;
+    if (!unixAddress(address.substr(unixPrefix.size()), sa)){
+      error = "invalid Unix socket path in '" + address + "'";
+      return -1;
+    }
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s >= 0 && ::connect(s, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0){
+      int e = errno;
+      ::close(s);
+      errno = e;
+      s = -1;
+    }
+    if (s < 0)
+      error = strerror(errno);
+    return s;
+  }
+  return forEachAddress(address, false, error, [](struct addrinfo* ai){
+      int s = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+      if (s < 0)
+        return -1;
+      if (::connect(s, ai->ai_addr, ai->ai_addrlen) != 0){
+        int e = errno;
+        ::close(s);
+        errno = e;
+        return -1;
+      }
+      // the data is batched before sending, the last part of a batch is not to wait for more
+      int on = 1;
+      setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      return s;
+    });
+}
+
+int cadidaq::streamSocket::listen(const std::string& address, std::string& error){
+  if (address.compare(0, unixPrefix.size(), unixPrefix) == 0){
+    struct sockaddr_un sa;
+    if (!unixAddress(address.substr(unixPrefix.size()), sa)){
+      error = "invalid Unix socket path in '" + address + "'";
+      return -1;
+    }
+    unlink(sa.sun_path);
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s >= 0 && (bind(s, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0 || ::listen(s, 4) != 0)){
+      int e = errno;
+      ::close(s);
+      errno = e;
+      s = -1;
+    }
+    if (s < 0)
+      error = strerror(errno);
+    return s;
+  }
+  return forEachAddress(address, true, error, [](struct addrinfo* ai){
+      int s = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+      if (s < 0)
+        return -1;
+      int on = 1;
+      setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (bind(s, ai->ai_addr, ai->ai_addrlen) != 0 || ::listen(s, 4) != 0){
+        int e = errno;
+        ::close(s);
+        errno = e;
+        return -1;
+      }
+      return s;
+    });
+}
+
+std::string cadidaq::streamSocket::localAddress(int socket){
+  struct sockaddr_storage sa;
+  socklen_t length = sizeof(sa);
+  if (getsockname(socket, reinterpret_cast<struct sockaddr*>(&sa), &length) != 0)
+    return std::string();
+  char host[INET6_ADDRSTRLEN] = {};
+  switch (sa.ss_family){
+  case AF_UNIX:
+    return unixPrefix + reinterpret_cast<struct sockaddr_un*>(&sa)->sun_path;
+  case AF_INET: {
+    struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(&sa);
+    inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+    return std::string(host) + ":" + std::to_string(ntohs(in->sin_port));
+  }
+  case AF_INET6: {
+    struct sockaddr_in6* in6 = reinterpret_cast<struct sockaddr_in6*>(&sa);
+    inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+    return "[" + std::string(host) + "]:" + std::to_string(ntohs(in6->sin6_port));
+  }
+  default:
+    return std::string();
+  }
+}
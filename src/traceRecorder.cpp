@@ -0,0 +1,93 @@
+#include <traceRecorder.hpp>
+#include <metrics.hpp>  // latencyMetrics::now
+
+#include <sstream>
+#include <iomanip>   // fixed, setprecision
+#include <thread>    // yield
+#include <algorithm> // min
+
+namespace {
+  const char* spanNames[] = {"read", "decode", "deliver", "write_submit", "write", "queue", "process", "merge"};
+  /// what the amount of the spans counts (none for the phases of the buffers)
+  const char* amountNames[] = {"bytes", "events", "events", "bytes", "bytes", nullptr, nullptr, nullptr};
+
+  /// the names are chosen in the settings, but quote them anyway
+  std::string quote(const std::string& s){
+    std::string q = "\"";
+    for (char c : s){
+      if (c == '"' || c == '\\')
+        q += '\\';
+      if (static_cast<unsigned char>(c) >= 0x20)
+        q += c;
+    }
+    return q + "\"";
+  }
+}
+
+cadidaq::traceRecorder::traceRecorder(const std::vector<std::string>& boardNames, uint32_t capacity)
+  : boardNames(boardNames), spans(capacity), next(closed), written(0), started(0) {
+}
+
+uint32_t cadidaq::traceRecorder::addThread(const std::string& name){
+  threadNames.push_back(name);
+  return threadNames.size() - 1;
+}
+
+bool cadidaq::traceRecorder::start(){
+  if (next.load() < closed)
+    return false;
+  written.store(0, std::memory_order_relaxed);
+  started = latencyMetrics::now();
+  next.store(0, std::memory_order_release);
+  return true;
+}
+
+std::string cadidaq::traceRecorder::stop(){
+  uint64_t claimed = next.exchange(closed);
+  if (claimed >= closed)
+    return std::string();
+  uint64_t stopped = latencyMetrics::now();
+  uint64_t n = std::min<uint64_t>(claimed, spans.size());
+  // the spans being written as the recording stopped are only a few stores away
+  while (written.load(std::memory_order_acquire) < n)
+    std::this_thread::yield();
+
+  // the phases of buffers read before the start reach back further
+  uint64_t origin = started;
+  for (uint64_t i = 0; i < n; i++)
+    origin = std::min(origin, spans[i].begin);
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"spans\":\"" << n << "\",\"dropped\":\"" << claimed - n
+      << "\",\"window_seconds\":\"" << (stopped - started) * 1e-9 << "\"},\"traceEvents\":[\n"
+      << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"cadidaq\"}}";
+  for (size_t t = 0; t < threadNames.size(); t++)
+    out << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"name\":\"thread_name\",\"args\":{\"name\":" << quote(threadNames[t]) << "}}"
+        << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":" << t << "}}";
+  for (uint64_t i = 0; i < n; i++){
+    const entry& e = spans[i];
+    uint32_t what = static_cast<uint32_t>(e.what);
+    std::ostringstream args;
+    if (e.board != noBoard)
+      args << "\"board\":" << quote(e.board < boardNames.size() ? boardNames[e.board] : std::to_string(e.board));
+    if (e.what != span::READ && e.board != noBoard)
+      args << ",\"buffer\":" << e.sequence;
+    if (amountNames[what])
+      args << (e.board != noBoard ? "," : "") << "\"" << amountNames[what] << "\":" << e.amount;
+    double ts = (e.begin - origin) * 1e-3;
+    double dur = (e.end > e.begin ? e.end - e.begin : 0) * 1e-3;
+    if (e.what < span::QUEUE)
+      // work of a thread
+      out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread << ",\"name\":\"" << spanNames[what] << "\",\"ts\":" << ts << ",\"dur\":" << dur
+          << ",\"args\":{" << args.str() << "}}";
+    else {
+      // phase of a buffer, grouped by the buffer
+      out << ",\n{\"ph\":\"b\",\"pid\":1,\"tid\":" << e.thread << ",\"cat\":\"buffer\",\"id\":\"" << e.board << "." << e.sequence
+          << "\",\"name\":\"" << spanNames[what] << "\",\"ts\":" << ts << ",\"args\":{" << args.str() << "}}"
+          << ",\n{\"ph\":\"e\",\"pid\":1,\"tid\":" << e.thread << ",\"cat\":\"buffer\",\"id\":\"" << e.board << "." << e.sequence
+          << "\",\"name\":\"" << spanNames[what] << "\",\"ts\":" << ts + dur << "}";
+    }
+  }
+  out << "\n]}\n";
+  return out.str();
+}